@@ -0,0 +1,170 @@
+//QuickList (the list encoding) against the std::vector<std::string> lists
+//used to be: head push/pop, tail push/pop, LINDEX and a full LRANGE scan on
+//lists of growing length. a randomised run against std::deque checks every
+//list operation along the way.
+//
+//usage: list_encoding [--max N] [--value-size BYTES] [--ops N]
+#include "../include/QuickList.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static double secondsSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+//ns per operation of fn run ops times
+template<typename F>
+static double timeOps(size_t ops,F fn){
+    auto start=std::chrono::steady_clock::now();
+    for(size_t i=0;i<ops;i++)fn(i);
+    return secondsSince(start)*1e9/ops;
+}
+
+static void benchLength(size_t len,size_t valueSize,size_t ops){
+    std::string value(valueSize,'x');
+    QuickList ql;
+    std::vector<std::string> vec;
+    for(size_t i=0;i<len;i++){
+        ql.pushBack(value);
+        vec.push_back(value);
+    }
+    //the vector's head operations are O(n); cap their repetitions
+    size_t headOps=std::max<size_t>(1,std::min(ops,20000000/(len+1)));
+    double qlHead=timeOps(ops,[&](size_t){ ql.pushFront(value); ql.popFront(); });
+    double vecHead=timeOps(headOps,[&](size_t){ vec.insert(vec.begin(),value); vec.erase(vec.begin()); });
+    double qlTail=timeOps(ops,[&](size_t){ ql.pushBack(value); ql.popBack(); });
+    double vecTail=timeOps(ops,[&](size_t){ vec.push_back(value); vec.pop_back(); });
+    std::mt19937_64 rng(7);
+    std::string out;
+    double qlIndex=timeOps(ops,[&](size_t){ ql.index(rng()%len,out); });
+    double vecIndex=timeOps(ops,[&](size_t){ out=vec[rng()%len]; });
+    std::vector<std::string> items;
+    auto start=std::chrono::steady_clock::now();
+    ql.range(0,-1,items);
+    double qlScan=secondsSince(start)*1e9/len;
+    items.clear();
+    start=std::chrono::steady_clock::now();
+    items.assign(vec.begin(),vec.end());
+    double vecScan=secondsSince(start)*1e9/len;
+
+    std::cout<<std::setw(10)<<len
+             <<std::setw(12)<<qlHead<<std::setw(12)<<vecHead
+             <<std::setw(12)<<qlTail<<std::setw(12)<<vecTail
+             <<std::setw(12)<<qlIndex<<std::setw(12)<<vecIndex
+             <<std::setw(12)<<qlScan<<std::setw(12)<<vecScan
+             <<std::setw(8)<<ql.nodeCount()<<"\n";
+}
+
+//random mix of every list operation, mirrored on a std::deque
+static bool checkAgainstDeque(size_t ops){
+    std::mt19937_64 rng(1);
+    QuickList ql;
+    std::deque<std::string> ref;
+    auto randomValue=[&](){
+        //mostly short values from a small alphabet so LREM/LINSERT find matches;
+        //now and then one big enough to get a node of its own
+        if(rng()%500==0)return std::string(QuickList::NODE_MAX_BYTES+rng()%100,'b');
+        return std::string(1+rng()%3,static_cast<char>('a'+rng()%4));
+    };
+    for(size_t i=0;i<ops;i++){
+        long len=static_cast<long>(ref.size());
+        switch(rng()%10){
+            case 0: case 1:{ std::string v=randomValue(); ql.pushFront(v); ref.push_front(v); break; }
+            case 2: case 3:{ std::string v=randomValue(); ql.pushBack(v); ref.push_back(v); break; }
+            case 4:
+                if(len>0 && ql.popFront()!=ref.front())return false;
+                if(len>0)ref.pop_front();
+                break;
+            case 5:
+                if(len>0 && ql.popBack()!=ref.back())return false;
+                if(len>0)ref.pop_back();
+                break;
+            case 6:{
+                long idx=len>0?static_cast<long>(rng()%(2*len))-len:0;
+                std::string v=randomValue();
+                bool ok=ql.set(idx,v);
+                if(ok!=(len>0)){ return false; }
+                if(ok)ref[idx<0?idx+len:idx]=v;
+                break;
+            }
+            case 7:{
+                long limit=static_cast<long>(rng()%5)-2;
+                std::string v=randomValue();
+                size_t removed=ql.remove(limit,v);
+                size_t want=limit==0?ref.size():static_cast<size_t>(std::labs(limit)),done=0;
+                if(limit>=0){
+                    for(auto it=ref.begin();it!=ref.end() && done<want;){
+                        if(*it==v){ it=ref.erase(it); done++; }else ++it;
+                    }
+                }else{
+                    for(size_t j=ref.size();j-->0 && done<want;){
+                        if(ref[j]==v){ ref.erase(ref.begin()+j); done++; }
+                    }
+                }
+                if(removed!=done)return false;
+                break;
+            }
+            case 8:{
+                std::string pivot=randomValue(),v=randomValue();
+                bool before=rng()%2;
+                long got=ql.insert(pivot,v,before);
+                auto it=std::find(ref.begin(),ref.end(),pivot);
+                if(it==ref.end()){
+                    if(got!=-1)return false;
+                }else{
+                    ref.insert(before?it:it+1,v);
+                    if(got!=static_cast<long>(ref.size()))return false;
+                }
+                break;
+            }
+            case 9:{
+                if(rng()%20!=0)break;   //keep the lists long
+                long start=static_cast<long>(rng()%(len+3))-2,stop=len-static_cast<long>(rng()%3);
+                ql.trim(start,stop);
+                long s=start<0?start+len:start,e=stop<0?stop+len:stop;
+                if(s<0)s=0;
+                if(e>=len)e=len-1;
+                if(s>e || s>=len)ref.clear();
+                else ref=std::deque<std::string>(ref.begin()+s,ref.begin()+e+1);
+                break;
+            }
+        }
+        if(ql.size()!=ref.size())return false;
+        if(i%1000==0){
+            std::vector<std::string> items;
+            ql.range(0,-1,items);
+            if(!std::equal(items.begin(),items.end(),ref.begin(),ref.end()))return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc,char* argv[]){
+    size_t maxLen=1000000;
+    size_t valueSize=16;
+    size_t ops=200000;
+    for(int i=1;i+1<argc;i+=2){
+        if(std::strcmp(argv[i],"--max")==0)maxLen=std::stoul(argv[i+1]);
+        else if(std::strcmp(argv[i],"--value-size")==0)valueSize=std::stoul(argv[i+1]);
+        else if(std::strcmp(argv[i],"--ops")==0)ops=std::stoul(argv[i+1]);
+    }
+    std::cout<<"value-size="<<valueSize<<" node-max-bytes="<<QuickList::NODE_MAX_BYTES<<"  (ns per op, scan ns per element)\n";
+    std::cout<<std::fixed<<std::setprecision(1);
+    std::cout<<std::setw(10)<<"length"
+             <<std::setw(12)<<"ql head"<<std::setw(12)<<"vec head"
+             <<std::setw(12)<<"ql tail"<<std::setw(12)<<"vec tail"
+             <<std::setw(12)<<"ql index"<<std::setw(12)<<"vec index"
+             <<std::setw(12)<<"ql scan"<<std::setw(12)<<"vec scan"
+             <<std::setw(8)<<"nodes"<<"\n";
+    for(size_t len=1000;len<=maxLen;len*=10)benchLength(len,valueSize,ops);
+    bool ok=checkAgainstDeque(ops);
+    std::cout<<"randomised check against std::deque: "<<(ok?"ok":"FAILED")<<"\n";
+    return ok?0:1;
+}
@@ -0,0 +1,305 @@
+//in-process micro-benchmarks of the request hot paths, without the network:
+//RESP parsing, the RedisDatabase commands and snapshot dump/load. every
+//benchmark runs one untimed warmup repetition, then --reps timed ones; the
+//median, min and max ns/op and the heap allocations per op are reported, as
+//a table and optionally as JSON.
+//
+//usage: microbench [--ops N] [--reps N] [--keys N] [--filter SUBSTRING] [--json FILE]
+#include "../../include/RedisDatabase.h"
+#include "../../include/RespParser.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+//every heap allocation of the process goes through here so a benchmark can
+//tell how many it caused
+static std::atomic<uint64_t> allocCount{0};
+static std::atomic<uint64_t> allocBytes{0};
+
+void* operator new(size_t n){
+    allocCount.fetch_add(1,std::memory_order_relaxed);
+    allocBytes.fetch_add(n,std::memory_order_relaxed);
+    if(void* p=std::malloc(n?n:1))return p;
+    throw std::bad_alloc();
+}
+//gcc pairs the inlined malloc in new with free here and wrongly reports a mismatch
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept{ std::free(p); }
+void operator delete(void* p,size_t) noexcept{ std::free(p); }
+#pragma GCC diagnostic pop
+
+struct Result{
+    std::string name;
+    uint64_t opsPerRep;
+    int reps;
+    double medianNs,minNs,maxNs;
+    double allocsPerOp,bytesPerOp;
+};
+
+struct Options{
+    uint64_t ops=200000;
+    int reps=5;
+    size_t keys=200000;
+    std::string filter;
+    std::string json;
+};
+
+static std::vector<Result> results;
+//results of benchmarked calls go here so the compiler cannot drop the calls
+volatile size_t sink=0;
+
+//fn(ops) performs ops operations; setup runs before each repetition, untimed
+static void bench(const Options& opt,const std::string& name,uint64_t ops,
+                  const std::function<void()>& setup,const std::function<void(uint64_t)>& fn){
+    if(!opt.filter.empty() && name.find(opt.filter)==std::string::npos)return;
+    setup();
+    fn(ops);    //warmup
+    std::vector<double> perOp;
+    uint64_t allocs=0,bytes=0;
+    for(int r=0;r<opt.reps;r++){
+        setup();
+        uint64_t a0=allocCount.load(),b0=allocBytes.load();
+        auto start=std::chrono::steady_clock::now();
+        fn(ops);
+        double ns=std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-start).count();
+        allocs+=allocCount.load()-a0;
+        bytes+=allocBytes.load()-b0;
+        perOp.push_back(ns/ops);
+    }
+    std::sort(perOp.begin(),perOp.end());
+    double total=double(ops)*opt.reps;
+    results.push_back({name,ops,opt.reps,perOp[perOp.size()/2],perOp.front(),perOp.back(),allocs/total,bytes/total});
+    const Result& r=results.back();
+    std::cout<<std::left<<std::setw(26)<<r.name<<std::right<<std::fixed
+             <<std::setprecision(1)<<std::setw(12)<<r.medianNs<<std::setw(12)<<r.minNs<<std::setw(12)<<r.maxNs
+             <<std::setprecision(2)<<std::setw(10)<<r.allocsPerOp<<std::setprecision(1)<<std::setw(12)<<r.bytesPerOp<<"\n";
+    std::cout.flush();
+}
+
+static std::string respCommand(const std::vector<std::string>& argv){
+    std::string out="*"+std::to_string(argv.size())+"\r\n";
+    for(const auto& a:argv)out+="$"+std::to_string(a.size())+"\r\n"+a+"\r\n";
+    return out;
+}
+
+static std::string keyName(const char* prefix,uint64_t i,size_t keys){
+    char buf[48];
+    snprintf(buf,sizeof(buf),"%s%llu",prefix,(unsigned long long)(i%keys));
+    return buf;
+}
+
+static void parserBenchmarks(const Options& opt){
+    auto noSetup=[](){};
+    const size_t sizes[]={16,1024,64*1024};
+    for(size_t size:sizes){
+        std::string value(size,'v');
+        std::string resp=respCommand({"SET","key:000001",value});
+        std::string inlineCmd="SET key:000001 "+value+"\r\n";
+        uint64_t ops=size>=64*1024?opt.ops/100:opt.ops;
+        std::string tag=size>=1024?std::to_string(size/1024)+"KB":std::to_string(size)+"B";
+        bench(opt,"parse_resp_"+tag,ops,noSetup,[&](uint64_t n){
+            for(uint64_t i=0;i<n;i++)sink=ParseRespCommand(resp).size();
+        });
+        bench(opt,"parse_inline_"+tag,ops,noSetup,[&](uint64_t n){
+            for(uint64_t i=0;i<n;i++)sink=ParseRespCommand(inlineCmd).size();
+        });
+        //the event loop's path: one parser and argv reused for a pipelined buffer
+        std::string pipeline;
+        for(int i=0;i<16;i++)pipeline+=resp;
+        bench(opt,"parse_pipelined16_"+tag,ops,noSetup,[&](uint64_t n){
+            RespParser parser;
+            std::vector<std::string> argv;
+            for(uint64_t i=0;i<n;i+=16){
+                size_t pos=0;
+                while(parser.parse(pipeline,pos,argv)==RespParser::Status::Complete)sink=argv.size();
+            }
+        });
+    }
+}
+
+static void databaseBenchmarks(const Options& opt){
+    RedisDatabase& db=RedisDatabase::getInstance();
+    std::string value(32,'v');
+    std::vector<std::string> keys,lists,hashes;
+    for(size_t i=0;i<opt.keys;i++){
+        keys.push_back(keyName("key:",i,opt.keys));
+        hashes.push_back(keyName("hash:",i,opt.keys));
+    }
+    //a few long lists, so pushes and pops hit lists of realistic length
+    for(size_t i=0;i<64;i++)lists.push_back(keyName("list:",i,64));
+    auto flush=[&db](){ db.flushAll(); };
+    auto fillStrings=[&](){
+        db.flushAll();
+        for(const auto& k:keys)db.set(k,value);
+    };
+    auto fillHashes=[&](){
+        db.flushAll();
+        for(const auto& h:hashes){
+            for(int f=0;f<10;f++)db.hset(h,"field:"+std::to_string(f),value);
+        }
+    };
+    auto fillLists=[&](){
+        db.flushAll();
+        for(uint64_t i=0;i<opt.ops*2;i++)db.rpush(lists[i%lists.size()],value);
+    };
+    //one leaderboard of every player, big enough to be a skiplist
+    std::vector<std::string> players;
+    for(size_t i=0;i<opt.keys;i++)players.push_back(keyName("player:",i,opt.keys));
+    auto fillBoard=[&](){
+        db.flushAll();
+        for(size_t i=0;i<players.size();i++)db.zadd("board",{{double(i*7919%players.size()),players[i]}},0);
+    };
+    //two tag sets of 100k ids below 1M that share a seventh of them, once as
+    //intsets (the limit raised to fit) and once as hashtables of "t:<id>"
+    std::vector<std::string> tagsA,tagsB,namesA,namesB;
+    for(uint64_t i=0;i<100000;i++){
+        tagsA.push_back(std::to_string(i*10));
+        tagsB.push_back(std::to_string(i*7));
+        namesA.push_back("t:"+tagsA.back());
+        namesB.push_back("t:"+tagsB.back());
+    }
+    auto fillTags=[&](){
+        db.flushAll();
+        EncodingLimits limits;
+        limits.setMaxIntsetEntries=tagsA.size();
+        db.setEncodingLimits(limits);
+        db.sadd("tags:a",tagsA);
+        db.sadd("tags:b",tagsB);
+        db.sadd("names:a",namesA);
+        db.sadd("names:b",namesB);
+        db.setEncodingLimits(EncodingLimits());
+    };
+
+    bench(opt,"db_set",opt.ops,flush,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)db.set(keys[i%keys.size()],value);
+    });
+    bench(opt,"db_get",opt.ops,fillStrings,[&](uint64_t n){
+        std::string out;
+        for(uint64_t i=0;i<n;i++)sink=db.get(keys[i%keys.size()],out);
+    });
+    bench(opt,"db_lpush",opt.ops,flush,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)db.lpush(lists[i%lists.size()],value);
+    });
+    bench(opt,"db_lpop",opt.ops,fillLists,[&](uint64_t n){
+        std::string out;
+        for(uint64_t i=0;i<n;i++)sink=db.lpop(lists[i%lists.size()],out);
+    });
+    bench(opt,"db_hset",opt.ops,flush,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)db.hset(hashes[i%hashes.size()],"field:"+std::to_string(i%10),value);
+    });
+    bench(opt,"db_hgetall",opt.ops,fillHashes,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)sink=db.hgetall(hashes[i%hashes.size()]).size();
+    });
+    bench(opt,"db_zadd",opt.ops,fillBoard,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)sink=db.zadd("board",{{double(i%1000),players[i%players.size()]}},0).updated;
+    });
+    bench(opt,"db_zrank",opt.ops,fillBoard,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)sink=db.zrank("board",players[i%players.size()],false);
+    });
+    bench(opt,"db_sismember_intset",opt.ops,fillTags,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)sink=db.sismember("tags:a",tagsB[i%tagsB.size()]);
+    });
+    const std::vector<std::string> intsets={"tags:a","tags:b"},hashtables={"names:a","names:b"};
+    bench(opt,"db_sinter_intset_100k",opt.ops/1000,fillTags,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)sink=db.sinter(intsets).size();
+    });
+    bench(opt,"db_sinter_hashtable_100k",opt.ops/1000,fillTags,[&](uint64_t n){
+        for(uint64_t i=0;i<n;i++)sink=db.sinter(hashtables).size();
+    });
+}
+
+static void snapshotBenchmarks(const Options& opt){
+    RedisDatabase& db=RedisDatabase::getInstance();
+    const std::string file="microbench.my_rdb";
+    std::string value(32,'v');
+    //a mixed dataset: strings, small hashes and lists, a tenth with a ttl
+    auto fill=[&](){
+        db.flushAll();
+        int64_t later=RedisDatabase::nowMs()+3600*1000;
+        for(size_t i=0;i<opt.keys;i++){
+            std::string k=keyName("key:",i,opt.keys);
+            switch(i%4){
+            case 0:
+            case 1:
+                db.set(k,value,i%10==0?later:-1,SetCondition::Always);
+                break;
+            case 2:
+                for(int f=0;f<5;f++)db.hset(k,"field:"+std::to_string(f),value);
+                break;
+            default:
+                for(int e=0;e<5;e++)db.rpush(k,value);
+            }
+        }
+    };
+    //per-op figures are per key
+    bench(opt,"dump",opt.keys,fill,[&](uint64_t){
+        if(!db.dump(file))std::cerr<<"dump failed\n";
+    });
+    bench(opt,"load",opt.keys,[&](){ db.flushAll(); },[&](uint64_t){
+        if(!db.load(file))std::cerr<<"load failed\n";
+    });
+    std::remove(file.c_str());
+    db.flushAll();
+}
+
+static std::string jsonEscape(const std::string& s){
+    std::string out;
+    for(char c:s){
+        if(c=='"' || c=='\\')out+='\\';
+        out+=c;
+    }
+    return out;
+}
+
+static bool writeJson(const Options& opt){
+    std::ofstream out(opt.json);
+    if(!out)return false;
+    out<<std::fixed<<std::setprecision(3);
+    out<<"{\n  \"ops_per_rep\": "<<opt.ops<<",\n  \"reps\": "<<opt.reps<<",\n  \"keys\": "<<opt.keys<<",\n  \"benchmarks\": [\n";
+    for(size_t i=0;i<results.size();i++){
+        const Result& r=results[i];
+        out<<"    {\"name\": \""<<jsonEscape(r.name)<<"\", \"ops\": "<<r.opsPerRep<<", \"reps\": "<<r.reps
+           <<", \"ns_per_op\": "<<r.medianNs<<", \"min_ns_per_op\": "<<r.minNs<<", \"max_ns_per_op\": "<<r.maxNs
+           <<", \"allocs_per_op\": "<<r.allocsPerOp<<", \"alloc_bytes_per_op\": "<<r.bytesPerOp<<"}"
+           <<(i+1<results.size()?",":"")<<"\n";
+    }
+    out<<"  ]\n}\n";
+    return bool(out);
+}
+
+int main(int argc,char* argv[]){
+    Options opt;
+    for(int i=1;i+1<argc;i+=2){
+        if(std::strcmp(argv[i],"--ops")==0)opt.ops=std::stoull(argv[i+1]);
+        else if(std::strcmp(argv[i],"--reps")==0)opt.reps=std::max(1,std::stoi(argv[i+1]));
+        else if(std::strcmp(argv[i],"--keys")==0)opt.keys=std::stoul(argv[i+1]);
+        else if(std::strcmp(argv[i],"--filter")==0)opt.filter=argv[i+1];
+        else if(std::strcmp(argv[i],"--json")==0)opt.json=argv[i+1];
+    }
+    if(opt.ops<16)opt.ops=16;
+    if(opt.keys==0)opt.keys=1;
+    std::cout<<std::left<<std::setw(26)<<"benchmark"<<std::right<<std::setw(12)<<"ns/op"<<std::setw(12)<<"min"
+             <<std::setw(12)<<"max"<<std::setw(10)<<"allocs/op"<<std::setw(12)<<"bytes/op"<<"\n";
+    parserBenchmarks(opt);
+    databaseBenchmarks(opt);
+    snapshotBenchmarks(opt);
+    if(!opt.json.empty()){
+        if(!writeJson(opt)){
+            std::cerr<<"Could not write "<<opt.json<<"\n";
+            return 1;
+        }
+        std::cout<<"Results written to "<<opt.json<<"\n";
+    }
+    return 0;
+}
@@ -0,0 +1,435 @@
+//redis-benchmark style load generator: N connections spread over a few
+//epoll threads send pipelined batches of P commands and time every reply
+//from the moment its batch was written. reports ops/sec and latency
+//percentiles per test, so server changes can be compared over loopback.
+//
+//usage: redis_benchmark [-h HOST] [-p PORT] [-c CLIENTS] [-n REQUESTS] [-P PIPELINE]
+//                       [-d VALUE_BYTES] [-r KEYSPACE] [--threads N]
+//                       [-t set,get,lpush,lpop,hset,hgetall] [--mix get:80,set:20] [--csv]
+#include "../include/LatencyHistogram.h"
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+typedef std::chrono::steady_clock Clock;
+
+enum class Op{ Set, Get, Lpush, Lpop, Hset, Hgetall };
+
+struct OpName{
+    const char* name;
+    Op op;
+};
+static const OpName OPS[]={
+    {"set",Op::Set},{"get",Op::Get},{"lpush",Op::Lpush},
+    {"lpop",Op::Lpop},{"hset",Op::Hset},{"hgetall",Op::Hgetall},
+};
+
+struct Config{
+    std::string host="127.0.0.1";
+    std::string port="6379";
+    size_t clients=50;
+    size_t requests=100000;
+    size_t pipeline=1;
+    size_t valueSize=3;
+    size_t keyspace=100000;
+    size_t threads=1;
+    bool csv=false;
+};
+
+//a test is one op, or a weighted mix of them
+struct Test{
+    std::string name;
+    std::vector<std::pair<Op,unsigned>> weights;
+};
+
+struct Result{
+    double opsPerSec;
+    uint64_t errors;
+    std::vector<uint64_t> latency;  //LatencyHistogram buckets, ns
+};
+
+static void appendArg(std::string& out,const char* s,size_t n){
+    out+='$';
+    out+=std::to_string(n);
+    out+="\r\n";
+    out.append(s,n);
+    out+="\r\n";
+}
+
+static void appendCommand(std::string& out,Op op,std::mt19937_64& rng,const Config& cfg,const std::string& value){
+    char key[32],field[32];
+    unsigned long long k=rng()%cfg.keyspace;
+    switch(op){
+    case Op::Set:
+    case Op::Get:
+        snprintf(key,sizeof(key),"key:%012llu",k);
+        break;
+    case Op::Lpush:
+    case Op::Lpop:
+        snprintf(key,sizeof(key),"list:%012llu",k);
+        break;
+    default:
+        snprintf(key,sizeof(key),"hash:%012llu",k);
+    }
+    switch(op){
+    case Op::Set:
+        out+="*3\r\n$3\r\nSET\r\n";
+        appendArg(out,key,strlen(key));
+        appendArg(out,value.data(),value.size());
+        break;
+    case Op::Get:
+        out+="*2\r\n$3\r\nGET\r\n";
+        appendArg(out,key,strlen(key));
+        break;
+    case Op::Lpush:
+        out+="*3\r\n$5\r\nLPUSH\r\n";
+        appendArg(out,key,strlen(key));
+        appendArg(out,value.data(),value.size());
+        break;
+    case Op::Lpop:
+        out+="*2\r\n$4\r\nLPOP\r\n";
+        appendArg(out,key,strlen(key));
+        break;
+    case Op::Hset:
+        //ten fields per hash keeps HGETALL replies a fixed size
+        snprintf(field,sizeof(field),"field:%llu",(unsigned long long)(rng()%10));
+        out+="*4\r\n$4\r\nHSET\r\n";
+        appendArg(out,key,strlen(key));
+        appendArg(out,field,strlen(field));
+        appendArg(out,value.data(),value.size());
+        break;
+    case Op::Hgetall:
+        out+="*2\r\n$7\r\nHGETALL\r\n";
+        appendArg(out,key,strlen(key));
+        break;
+    }
+}
+
+//length of the complete reply at p, 0 when more bytes are needed
+static size_t replyLength(const char* p,size_t n,bool& error){
+    const char* eol=static_cast<const char*>(memchr(p,'\n',n));
+    if(!eol)return 0;
+    size_t line=eol-p+1;
+    switch(p[0]){
+    case '-':
+        error=true;
+        return line;
+    case '+':
+    case ':':
+        return line;
+    case '$':{
+        long len=strtol(p+1,nullptr,10);
+        if(len<0)return line;
+        size_t total=line+len+2;
+        return total<=n?total:0;
+    }
+    case '*':{
+        long count=strtol(p+1,nullptr,10);
+        size_t total=line;
+        for(long i=0;i<count;i++){
+            size_t sub=replyLength(p+total,n-total,error);
+            if(sub==0)return 0;
+            total+=sub;
+        }
+        return total;
+    }
+    }
+    error=true;     //not RESP; skip the line
+    return line;
+}
+
+struct Conn{
+    int fd=-1;
+    std::string out;
+    size_t outpos=0;
+    std::string in;
+    size_t outstanding=0;
+    bool done=false;        //no requests left for this connection
+    Clock::time_point batchStart;
+};
+
+static int connectTo(const Config& cfg){
+    addrinfo hints{},*res=nullptr;
+    hints.ai_family=AF_UNSPEC;
+    hints.ai_socktype=SOCK_STREAM;
+    if(getaddrinfo(cfg.host.c_str(),cfg.port.c_str(),&hints,&res)!=0)return -1;
+    int fd=-1;
+    for(addrinfo* a=res;a;a=a->ai_next){
+        fd=socket(a->ai_family,a->ai_socktype|SOCK_CLOEXEC,a->ai_protocol);
+        if(fd<0)continue;
+        if(connect(fd,a->ai_addr,a->ai_addrlen)==0)break;
+        close(fd);
+        fd=-1;
+    }
+    freeaddrinfo(res);
+    if(fd<0)return -1;
+    int opt=1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+    fcntl(fd,F_SETFL,fcntl(fd,F_GETFL,0)|O_NONBLOCK);
+    return fd;
+}
+
+//one thread driving its share of the connections until the shared request
+//budget is used up
+class Worker{
+public:
+    Worker(const Config& cfg,const Test& test,std::atomic<size_t>& issued,size_t seed)
+        :cfg(cfg),test(test),issued(issued),rng(seed),value(cfg.valueSize,'x'){
+        for(const auto& w:test.weights)totalWeight+=w.second;
+    }
+    bool connectAll(size_t count){
+        for(size_t i=0;i<count;i++){
+            Conn c;
+            c.fd=connectTo(cfg);
+            if(c.fd<0)return false;
+            conns.push_back(std::move(c));
+        }
+        return true;
+    }
+    void run(){
+        int ep=epoll_create1(EPOLL_CLOEXEC);
+        for(size_t i=0;i<conns.size();i++){
+            epoll_event ev{};
+            ev.events=EPOLLIN|EPOLLOUT|EPOLLET;
+            ev.data.u64=i;
+            epoll_ctl(ep,EPOLL_CTL_ADD,conns[i].fd,&ev);
+        }
+        size_t active=0;
+        for(auto& c:conns){
+            if(startBatch(c))active++;
+            else c.done=true;
+        }
+        epoll_event events[256];
+        while(active>0){
+            int n=epoll_wait(ep,events,256,1000);
+            if(n<0 && errno!=EINTR)break;
+            for(int i=0;i<n;i++){
+                Conn& c=conns[events[i].data.u64];
+                if(c.fd<0 || c.done)continue;
+                if(!writeOut(c) || !readIn(c)){
+                    std::cerr<<"connection lost\n";
+                    close(c.fd);
+                    c.fd=-1;
+                    active--;
+                    continue;
+                }
+                if(c.outstanding==0 && !startBatch(c)){
+                    c.done=true;
+                    active--;
+                }
+            }
+        }
+        close(ep);
+        for(auto& c:conns){
+            if(c.fd>=0)close(c.fd);
+        }
+    }
+    LatencyHistogram latency;
+    uint64_t errors=0;
+
+private:
+    const Config& cfg;
+    const Test& test;
+    std::atomic<size_t>& issued;
+    std::mt19937_64 rng;
+    std::string value;
+    unsigned totalWeight=0;
+    std::vector<Conn> conns;
+
+    Op pickOp(){
+        if(test.weights.size()==1)return test.weights[0].first;
+        unsigned r=rng()%totalWeight;
+        for(const auto& w:test.weights){
+            if(r<w.second)return w.first;
+            r-=w.second;
+        }
+        return test.weights.back().first;
+    }
+    //claim up to a pipeline's worth of requests and send them; false when
+    //the budget is exhausted
+    bool startBatch(Conn& c){
+        size_t first=issued.fetch_add(cfg.pipeline);
+        if(first>=cfg.requests)return false;
+        size_t count=std::min(cfg.pipeline,cfg.requests-first);
+        c.out.clear();
+        c.outpos=0;
+        for(size_t i=0;i<count;i++)appendCommand(c.out,pickOp(),rng,cfg,value);
+        c.outstanding=count;
+        c.batchStart=Clock::now();
+        return writeOut(c);
+    }
+    bool writeOut(Conn& c){
+        while(c.outpos<c.out.size()){
+            ssize_t n=send(c.fd,c.out.data()+c.outpos,c.out.size()-c.outpos,MSG_NOSIGNAL);
+            if(n>0){
+                c.outpos+=n;
+                continue;
+            }
+            if(n<0 && errno==EINTR)continue;
+            return n<0 && (errno==EAGAIN || errno==EWOULDBLOCK);
+        }
+        return true;
+    }
+    bool readIn(Conn& c){
+        char buf[16*1024];
+        while(true){
+            ssize_t n=recv(c.fd,buf,sizeof(buf),0);
+            if(n>0){
+                c.in.append(buf,n);
+                continue;
+            }
+            if(n==0)return false;
+            if(errno==EINTR)continue;
+            if(errno==EAGAIN || errno==EWOULDBLOCK)break;
+            return false;
+        }
+        size_t pos=0;
+        Clock::time_point now=Clock::now();
+        while(c.outstanding>0 && pos<c.in.size()){
+            bool error=false;
+            size_t len=replyLength(c.in.data()+pos,c.in.size()-pos,error);
+            if(len==0)break;
+            pos+=len;
+            if(error)errors++;
+            c.outstanding--;
+            latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now-c.batchStart).count());
+        }
+        c.in.erase(0,pos);
+        return true;
+    }
+};
+
+static bool runTest(const Config& cfg,const Test& test,Result& result){
+    std::atomic<size_t> issued{0};
+    size_t threads=std::max<size_t>(1,std::min(cfg.threads,cfg.clients));
+    std::vector<std::unique_ptr<Worker>> workers;
+    for(size_t t=0;t<threads;t++){
+        workers.emplace_back(new Worker(cfg,test,issued,t*7919+1));
+        size_t share=cfg.clients/threads+(t<cfg.clients%threads?1:0);
+        if(!workers.back()->connectAll(share)){
+            std::cerr<<"Could not connect to "<<cfg.host<<":"<<cfg.port<<"\n";
+            return false;
+        }
+    }
+    auto begin=Clock::now();
+    std::vector<std::thread> running;
+    for(auto& w:workers)running.emplace_back([&w](){ w->run(); });
+    for(auto& t:running)t.join();
+    double secs=std::chrono::duration<double>(Clock::now()-begin).count();
+    result.opsPerSec=cfg.requests/secs;
+    result.errors=0;
+    result.latency.assign(LatencyHistogram::BUCKETS,0);
+    for(auto& w:workers){
+        result.errors+=w->errors;
+        w->latency.addTo(result.latency);
+    }
+    return true;
+}
+
+static bool parseOp(const std::string& name,Op& op){
+    std::string lower=name;
+    std::transform(lower.begin(),lower.end(),lower.begin(),::tolower);
+    for(const auto& o:OPS){
+        if(lower==o.name){
+            op=o.op;
+            return true;
+        }
+    }
+    std::cerr<<"Unknown test "<<name<<"\n";
+    return false;
+}
+
+int main(int argc,char* argv[]){
+    Config cfg;
+    std::string tests="set,get,lpush,lpop,hset,hgetall";
+    std::string mix;
+    for(int i=1;i<argc;i++){
+        std::string a=argv[i];
+        bool hasValue=i+1<argc;
+        if(a=="--csv")cfg.csv=true;
+        else if(a=="-h" && hasValue)cfg.host=argv[++i];
+        else if(a=="-p" && hasValue)cfg.port=argv[++i];
+        else if(a=="-c" && hasValue)cfg.clients=std::stoul(argv[++i]);
+        else if(a=="-n" && hasValue)cfg.requests=std::stoul(argv[++i]);
+        else if(a=="-P" && hasValue)cfg.pipeline=std::stoul(argv[++i]);
+        else if(a=="-d" && hasValue)cfg.valueSize=std::stoul(argv[++i]);
+        else if(a=="-r" && hasValue)cfg.keyspace=std::stoul(argv[++i]);
+        else if(a=="--threads" && hasValue)cfg.threads=std::stoul(argv[++i]);
+        else if(a=="-t" && hasValue)tests=argv[++i];
+        else if(a=="--mix" && hasValue)mix=argv[++i];
+        else{
+            std::cerr<<"Unknown option "<<a<<"\n";
+            return 1;
+        }
+    }
+    if(cfg.clients==0 || cfg.pipeline==0 || cfg.keyspace==0){
+        std::cerr<<"-c, -P and -r must be at least 1\n";
+        return 1;
+    }
+
+    std::vector<Test> plan;
+    std::string item;
+    if(!mix.empty()){
+        //--mix get:80,set:20 runs one test drawing each command by weight
+        Test t{"mix "+mix,{}};
+        std::istringstream in(mix);
+        while(std::getline(in,item,',')){
+            size_t colon=item.find(':');
+            Op op;
+            if(!parseOp(item.substr(0,colon),op))return 1;
+            unsigned weight=colon==std::string::npos?1:std::stoul(item.substr(colon+1));
+            if(weight>0)t.weights.emplace_back(op,weight);
+        }
+        if(t.weights.empty())return 1;
+        plan.push_back(t);
+    }else{
+        std::istringstream in(tests);
+        while(std::getline(in,item,',')){
+            Op op;
+            if(!parseOp(item,op))return 1;
+            std::string upper=item;
+            std::transform(upper.begin(),upper.end(),upper.begin(),::toupper);
+            plan.push_back({upper,{{op,1}}});
+        }
+    }
+
+    if(cfg.csv)std::cout<<"test,requests_per_sec,p50_ms,p99_ms,p999_ms,errors\n";
+    std::cout<<std::fixed;
+    for(const auto& test:plan){
+        Result r;
+        if(!runTest(cfg,test,r))return 1;
+        double p50=LatencyHistogram::percentile(r.latency,0.50)/1e6;
+        double p99=LatencyHistogram::percentile(r.latency,0.99)/1e6;
+        double p999=LatencyHistogram::percentile(r.latency,0.999)/1e6;
+        if(cfg.csv){
+            std::cout<<std::setprecision(2)<<"\""<<test.name<<"\","<<r.opsPerSec<<","
+                     <<std::setprecision(3)<<p50<<","<<p99<<","<<p999<<","<<r.errors<<"\n";
+            continue;
+        }
+        std::cout<<"====== "<<test.name<<" ======\n"
+                 <<"  "<<cfg.requests<<" requests, "<<cfg.clients<<" clients, pipeline "<<cfg.pipeline
+                 <<", "<<cfg.valueSize<<" byte values, keyspace "<<cfg.keyspace<<"\n"
+                 <<std::setprecision(2)<<"  throughput: "<<r.opsPerSec<<" requests per second\n"
+                 <<std::setprecision(3)<<"  latency (ms): p50="<<p50<<" p99="<<p99<<" p99.9="<<p999<<"\n";
+        if(r.errors)std::cout<<"  error replies: "<<r.errors<<"\n";
+        std::cout<<"\n";
+    }
+    return 0;
+}
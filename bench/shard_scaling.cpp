@@ -0,0 +1,88 @@
+//GET/SET throughput of RedisDatabase as the number of worker threads grows.
+//every thread count is measured twice: once against the sharded keyspace and
+//once with all calls funnelled through one extra global mutex, which is what
+//the keyspace looked like before it was split into shards.
+//
+//usage: shard_scaling [--threads MAX] [--keys N] [--ms DURATION] [--reads PERCENT]
+#include "../include/RedisDatabase.h"
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+static std::mutex globalMutex;
+
+static double runOnce(int threads,size_t keyCount,int durationMs,int readPercent,bool globalLock){
+    RedisDatabase& db=RedisDatabase::getInstance();
+    std::atomic<bool> start{false},stop{false};
+    std::atomic<uint64_t> total{0};
+    std::vector<std::thread> workers;
+    for(int t=0;t<threads;t++){
+        workers.emplace_back([&,t](){
+            std::mt19937_64 rng(t*7919+1);
+            std::string key,value;
+            uint64_t ops=0;
+            while(!start.load(std::memory_order_acquire)){}
+            while(!stop.load(std::memory_order_relaxed)){
+                //batch between checks of the stop flag
+                for(int i=0;i<64;i++){
+                    key="key:"+std::to_string(rng()%keyCount);
+                    bool read=static_cast<int>(rng()%100)<readPercent;
+                    if(globalLock){
+                        std::lock_guard<std::mutex> lock(globalMutex);
+                        if(read)db.get(key,value);
+                        else db.set(key,key);
+                    }else{
+                        if(read)db.get(key,value);
+                        else db.set(key,key);
+                    }
+                }
+                ops+=64;
+            }
+            total+=ops;
+        });
+    }
+    auto begin=std::chrono::steady_clock::now();
+    start.store(true,std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+    stop=true;
+    for(auto& w:workers)w.join();
+    double secs=std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+    return total/secs;
+}
+
+int main(int argc,char* argv[]){
+    int maxThreads=std::max(4u,std::thread::hardware_concurrency());
+    size_t keyCount=100000;
+    int durationMs=1000;
+    int readPercent=80;
+    for(int i=1;i+1<argc;i+=2){
+        if(std::strcmp(argv[i],"--threads")==0)maxThreads=std::stoi(argv[i+1]);
+        else if(std::strcmp(argv[i],"--keys")==0)keyCount=std::stoul(argv[i+1]);
+        else if(std::strcmp(argv[i],"--ms")==0)durationMs=std::stoi(argv[i+1]);
+        else if(std::strcmp(argv[i],"--reads")==0)readPercent=std::stoi(argv[i+1]);
+    }
+
+    RedisDatabase& db=RedisDatabase::getInstance();
+    for(size_t i=0;i<keyCount;i++){
+        std::string key="key:"+std::to_string(i);
+        db.set(key,key);
+    }
+    std::cout<<"keys="<<keyCount<<" reads="<<readPercent<<"% cores="<<std::thread::hardware_concurrency()<<"\n";
+    std::cout<<std::setw(8)<<"threads"<<std::setw(16)<<"sharded ops/s"<<std::setw(16)<<"global ops/s"<<std::setw(10)<<"speedup"<<"\n";
+    for(int threads=1;threads<=maxThreads;threads*=2){
+        double sharded=runOnce(threads,keyCount,durationMs,readPercent,false);
+        double global=runOnce(threads,keyCount,durationMs,readPercent,true);
+        std::cout<<std::setw(8)<<threads
+                 <<std::setw(16)<<static_cast<uint64_t>(sharded)
+                 <<std::setw(16)<<static_cast<uint64_t>(global)
+                 <<std::setw(9)<<std::fixed<<std::setprecision(2)<<sharded/global<<"x\n";
+    }
+    return 0;
+}
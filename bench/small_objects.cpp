@@ -0,0 +1,104 @@
+//memory and HGETALL/LRANGE cost of many small hashes and lists, with the
+//listpack encoding against the hashtable/quicklist encodings (forced by
+//setting the listpack limits to zero). each configuration runs in its own
+//forked process so resident memory is measured from a clean heap.
+//
+//usage: small_objects [--keys N] [--fields N] [--value-size BYTES]
+#include "../include/RedisDatabase.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static size_t residentBytes(){
+    long pages=0,resident=0;
+    FILE* f=fopen("/proc/self/statm","r");
+    if(!f)return 0;
+    if(fscanf(f,"%ld %ld",&pages,&resident)!=2)resident=0;
+    fclose(f);
+    return static_cast<size_t>(resident)*sysconf(_SC_PAGESIZE);
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+static void run(const char* label,const EncodingLimits& limits,size_t keys,size_t fields,size_t valueSize){
+    RedisDatabase& db=RedisDatabase::getInstance();
+    db.setEncodingLimits(limits);
+    std::string value(valueSize,'v');
+    std::vector<std::string> fieldNames;
+    for(size_t f=0;f<fields;f++)fieldNames.push_back("field:"+std::to_string(f));
+
+    size_t before=residentBytes();
+    for(size_t i=0;i<keys;i++){
+        std::string key="user:"+std::to_string(i);
+        for(const auto& f:fieldNames)db.hset(key,f,value);
+    }
+    size_t hashBytes=residentBytes()-before;
+    before=residentBytes();
+    for(size_t i=0;i<keys;i++){
+        std::string key="queue:"+std::to_string(i);
+        for(size_t f=0;f<fields;f++)db.rpush(key,value);
+    }
+    size_t listBytes=residentBytes()-before;
+
+    size_t sink=0;
+    auto start=std::chrono::steady_clock::now();
+    for(size_t i=0;i<keys;i++)sink+=db.hgetall("user:"+std::to_string(i)).size();
+    double hgetallNs=secondsSince(start)*1e9/keys;
+    std::vector<std::string> items;
+    start=std::chrono::steady_clock::now();
+    for(size_t i=0;i<keys;i++){
+        items.clear();
+        db.lrange("queue:"+std::to_string(i),0,-1,items);
+        sink+=items.size();
+    }
+    double lrangeNs=secondsSince(start)*1e9/keys;
+
+    std::cout<<std::setw(22)<<label
+             <<std::setw(14)<<db.encoding("user:0")
+             <<std::setw(12)<<hashBytes/keys
+             <<std::setw(14)<<db.encoding("queue:0")
+             <<std::setw(12)<<listBytes/keys
+             <<std::setw(12)<<hgetallNs
+             <<std::setw(12)<<lrangeNs
+             <<(sink==2*keys*fields?"":"  (count mismatch)")<<"\n";
+}
+
+int main(int argc,char* argv[]){
+    size_t keys=200000;
+    size_t fields=5;
+    size_t valueSize=16;
+    for(int i=1;i+1<argc;i+=2){
+        if(std::strcmp(argv[i],"--keys")==0)keys=std::stoul(argv[i+1]);
+        else if(std::strcmp(argv[i],"--fields")==0)fields=std::stoul(argv[i+1]);
+        else if(std::strcmp(argv[i],"--value-size")==0)valueSize=std::stoul(argv[i+1]);
+    }
+    std::cout<<"keys="<<keys<<" fields/elements="<<fields<<" value-size="<<valueSize<<"\n";
+    std::cout<<std::fixed<<std::setprecision(1);
+    std::cout<<std::setw(22)<<"config"<<std::setw(14)<<"hash enc"<<std::setw(12)<<"B/hash"
+             <<std::setw(14)<<"list enc"<<std::setw(12)<<"B/list"
+             <<std::setw(12)<<"hgetall ns"<<std::setw(12)<<"lrange ns"<<"\n";
+    std::cout.flush();
+
+    EncodingLimits packed;
+    EncodingLimits full;
+    full.hashMaxListpackEntries=0;
+    full.listMaxListpackBytes=0;
+    const std::pair<const char*,EncodingLimits> configs[]={{"listpack (default)",packed},{"hashtable/quicklist",full}};
+    for(const auto& config:configs){
+        pid_t pid=fork();
+        if(pid==0){
+            run(config.first,config.second,keys,fields,valueSize);
+            std::cout.flush();
+            _exit(0);
+        }
+        waitpid(pid,nullptr,0);
+    }
+    return 0;
+}
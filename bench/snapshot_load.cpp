@@ -0,0 +1,85 @@
+//dump/load timing for the binary snapshot format on a synthetic dataset, plus a
+//round-trip check that binary values (spaces, newlines, NULs, ':') survive.
+//
+//usage: snapshot_load [--keys N] [--value-size BYTES] [--file PATH]
+#include "../include/RedisDatabase.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+
+static std::string randomValue(std::mt19937_64& rng,size_t size){
+    std::string v(size,'\0');
+    for(auto& c:v)c=static_cast<char>(rng()&0xFF);
+    return v;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+int main(int argc,char* argv[]){
+    size_t keyCount=1000000;
+    size_t valueSize=64;
+    std::string file="/tmp/snapshot_load_bench.my_rdb";
+    for(int i=1;i+1<argc;i+=2){
+        if(std::strcmp(argv[i],"--keys")==0)keyCount=std::stoul(argv[i+1]);
+        else if(std::strcmp(argv[i],"--value-size")==0)valueSize=std::stoul(argv[i+1]);
+        else if(std::strcmp(argv[i],"--file")==0)file=argv[i+1];
+    }
+
+    RedisDatabase& db=RedisDatabase::getInstance();
+    db.flushAll();
+    std::mt19937_64 rng(42);
+    //80% strings, 10% lists of 8 items, 10% hashes of 8 fields
+    for(size_t i=0;i<keyCount;i++){
+        std::string key="key:"+std::to_string(i);
+        switch(i%10){
+            case 8:
+                for(int j=0;j<8;j++)db.rpush(key,randomValue(rng,valueSize/8+1));
+                break;
+            case 9:
+                for(int j=0;j<8;j++)db.hset(key,"field:"+std::to_string(j),randomValue(rng,valueSize/8+1));
+                break;
+            default:
+                db.set(key,randomValue(rng,valueSize));
+        }
+    }
+    const std::string probeKey="probe key";
+    const std::string probeValue=std::string("a b\r\nc:d\0e",10);
+    db.set(probeKey,probeValue);
+    db.expire(probeKey,3600);
+
+    auto start=std::chrono::steady_clock::now();
+    if(!db.dump(file)){
+        std::cerr<<"dump failed\n";
+        return 1;
+    }
+    double dumpSecs=secondsSince(start);
+    struct stat st{};
+    stat(file.c_str(),&st);
+    double mb=st.st_size/(1024.0*1024.0);
+
+    db.flushAll();
+    start=std::chrono::steady_clock::now();
+    if(!db.load(file)){
+        std::cerr<<"load failed\n";
+        return 1;
+    }
+    double loadSecs=secondsSince(start);
+
+    std::string value;
+    bool roundTrip=db.get(probeKey,value) && value==probeValue && db.pttl(probeKey)>0 &&
+                   db.keys().size()==keyCount+1;
+
+    std::cout<<std::fixed<<std::setprecision(3);
+    std::cout<<"keys="<<keyCount<<" value-size="<<valueSize<<" file="<<mb<<" MB\n";
+    std::cout<<"dump: "<<dumpSecs<<" s  "<<mb/dumpSecs<<" MB/s  "<<static_cast<uint64_t>(keyCount/dumpSecs)<<" keys/s\n";
+    std::cout<<"load: "<<loadSecs<<" s  "<<mb/loadSecs<<" MB/s  "<<static_cast<uint64_t>(keyCount/loadSecs)<<" keys/s\n";
+    std::cout<<"round trip: "<<(roundTrip?"ok":"FAILED")<<"\n";
+    std::remove(file.c_str());
+    return roundTrip?0:1;
+}
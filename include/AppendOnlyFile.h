@@ -0,0 +1,121 @@
+#ifndef APPEND_ONLY_FILE_H
+#define APPEND_ONLY_FILE_H
+
+#include<string>
+#include<vector>
+#include<array>
+#include<mutex>
+#include<condition_variable>
+#include<thread>
+#include<atomic>
+#include<cstdint>
+#include<sys/types.h>
+
+class RedisCommandHandler;
+
+//when appended commands reach the disk
+enum class FsyncPolicy{
+    Always,     //fsync before the reply goes out; concurrent writers share one fsync
+    EverySec,   //a background thread fsyncs once a second
+    No          //write() only, the kernel flushes when it likes
+};
+
+/*
+Append only file. Every successful write command is appended as RESP to an
+incr file. A rewrite compacts the log in the background. It forks a child
+that writes the keyspace as a binary snapshot (the new base). Meanwhile the
+parent already appends to the next generation's incr file. Files in the
+working directory:
+    appendonly.aof.<gen>.base.rdb   snapshot, renamed into place when complete
+    appendonly.aof.<gen>.incr.aof   commands applied after that snapshot
+Startup loads the newest base and replays every incr file of that generation
+or later, in order. Older generations are deleted once a rewrite succeeds.
+*/
+class AppendOnlyFile{
+public:
+    static AppendOnlyFile& getInstance();
+    bool enabled() const { return on; }
+    //load the dataset from the aof (seeding it from the rdb dump the first
+    //time) and start appending; call once before clients are served
+    bool open(FsyncPolicy policy,RedisCommandHandler& handler);
+    //write and fsync what is pending, stop any rewrite child
+    void close();
+
+    //lock the stripes of every step-th token in tokens[first..last) so that,
+    //per key, commands are logged in the order they were executed
+    std::vector<std::unique_lock<std::mutex>> lockKeys(const std::vector<std::string>& tokens,size_t first,size_t last,size_t step=1);
+    //every stripe, for commands touching the whole keyspace
+    std::vector<std::unique_lock<std::mutex>> lockAllKeys();
+    //queue one command; nothing reaches the file before commit()
+    void feed(const std::vector<std::string>& argv);
+    //queue several commands back to back, with no other writer's in between
+    void feedAll(const std::vector<std::vector<std::string>>& cmds);
+    //group commit: write everything fed so far and, under appendfsync always,
+    //fsync it. the first caller does the i/o for everyone queued behind it.
+    //false under appendfsync always when that did not reach the disk: the
+    //writes must not be acknowledged
+    bool commit();
+    //the last write or fsync failed; write commands are refused until a
+    //flush (retried every second) succeeds
+    bool writeFailed() const { return writeError.load(std::memory_order_acquire); }
+    int lastWriteErrno() const { return writeErrno.load(std::memory_order_relaxed); }
+    //bytes the calling thread has fed so far; two readings tell whether the
+    //commands run in between were logged
+    static uint64_t fedOnThisThread();
+
+    //start a background rewrite; false if one is already running
+    bool rewrite();
+    bool rewriteInProgress();
+    //reap a finished rewrite child and start an automatic rewrite once the
+    //incr file has outgrown the base; called from the server cron
+    void cron();
+
+private:
+    AppendOnlyFile() =default;
+    ~AppendOnlyFile()=default;
+    AppendOnlyFile(const AppendOnlyFile&)=delete;
+    AppendOnlyFile& operator=(const AppendOnlyFile&)=delete;
+
+    static const size_t KEY_STRIPES=64;
+    std::array<std::mutex,KEY_STRIPES> stripes;
+
+    std::atomic<bool> on{false};
+    FsyncPolicy policy=FsyncPolicy::EverySec;
+
+    std::mutex mutex;                       //guards everything below
+    std::condition_variable flushed;        //signalled when a flush ends
+    std::string buf;                        //fed but not yet written
+    std::string spare;                      //swapped with buf by the flusher
+    bool flushing=false;                    //one thread does i/o at a time
+    int fd=-1;
+    uint64_t gen=0;                         //generation of the open incr file
+    uint64_t baseSize=0;                    //bytes of the newest base
+    uint64_t incrSize=0;                    //bytes written to the current incr
+    std::atomic<uint64_t> fedBytes{0};      //running totals, compared to skip
+    std::atomic<uint64_t> writtenBytes{0};  //commit() without taking mutex
+    std::atomic<uint64_t> syncedBytes{0};
+    pid_t childPid=-1;
+    uint64_t childGen=0;
+    std::atomic<bool> writeError{false};    //set by a failed flush, cleared by a good one
+    std::atomic<int> writeErrno{0};
+
+    std::thread syncThread;
+    bool stopSync=false;
+    std::condition_variable syncWake;
+
+    bool replay(const std::string& filename,RedisCommandHandler& handler);
+    //caller holds mutex
+    void appendLocked(const std::vector<std::string>& argv);
+    bool openIncr(uint64_t generation);
+    //caller holds mutex and has set flushing; drops mutex around the i/o.
+    //on failure the file is cut back to its last good size and the bytes
+    //stay queued; returns false then
+    bool flushLocked(std::unique_lock<std::mutex>& lock,bool sync);
+    //wait until no flush runs and claim the flusher role
+    void acquireFlusher(std::unique_lock<std::mutex>& lock);
+    void releaseFlusher();
+    void syncLoop();
+    void removeOlderThan(uint64_t generation);
+};
+
+#endif
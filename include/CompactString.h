@@ -0,0 +1,105 @@
+#ifndef COMPACT_STRING_H
+#define COMPACT_STRING_H
+
+#include "SlabAllocator.h"
+#include<string>
+#include<string_view>
+#include<cstring>
+#include<cstdint>
+#include<utility>
+
+/*
+Immutable byte string of 16 bytes for keys and small values. Up to
+INLINE_MAX bytes are kept in place, the last byte holding the length; longer
+ones live in one slab block laid out as [uint32 length][bytes], the last
+byte set to HEAP and the first eight holding the block. A std::string costs
+32 bytes and, past 15 characters, a separate malloc'd buffer with its own
+header and rounding; this costs 16 bytes and a block that is rounded to 8.
+Not null terminated.
+*/
+class CompactString{
+public:
+    static const size_t INLINE_MAX=15;
+
+    CompactString(){ bytes[INLINE_MAX]=0; }
+    CompactString(std::string_view s){ assign(s); }
+    CompactString(const std::string& s):CompactString(std::string_view(s)){}
+    CompactString(const char* s):CompactString(std::string_view(s)){}
+    CompactString(const CompactString& o){ assign(o.view()); }
+    CompactString(CompactString&& o) noexcept{
+        std::memcpy(bytes,o.bytes,sizeof(bytes));
+        o.bytes[INLINE_MAX]=0;
+    }
+    CompactString& operator=(const CompactString& o){
+        if(this!=&o){
+            release();
+            assign(o.view());
+        }
+        return *this;
+    }
+    CompactString& operator=(CompactString&& o) noexcept{
+        if(this!=&o){
+            release();
+            std::memcpy(bytes,o.bytes,sizeof(bytes));
+            o.bytes[INLINE_MAX]=0;
+        }
+        return *this;
+    }
+    ~CompactString(){ release(); }
+
+    std::string_view view() const{
+        if(!onHeap())return std::string_view(bytes,static_cast<uint8_t>(bytes[INLINE_MAX]));
+        const char* block=heapBlock();
+        uint32_t len;
+        std::memcpy(&len,block,sizeof(len));
+        return std::string_view(block+sizeof(len),len);
+    }
+    operator std::string_view() const { return view(); }
+    std::string str() const { return std::string(view()); }
+    size_t size() const { return view().size(); }
+    bool empty() const { return size()==0; }
+    const char* data() const { return view().data(); }
+
+    //bytes held outside the object, for MEMORY USAGE
+    size_t heapBytes() const { return onHeap()?blockSize(size()):0; }
+
+    bool operator==(std::string_view s) const { return view()==s; }
+    bool operator!=(std::string_view s) const { return view()!=s; }
+    bool operator==(const CompactString& o) const { return view()==o.view(); }
+    bool operator!=(const CompactString& o) const { return view()!=o.view(); }
+    bool operator<(const CompactString& o) const { return view()<o.view(); }
+
+private:
+    static const uint8_t HEAP=0xFF;
+    alignas(8) char bytes[16];
+
+    bool onHeap() const { return static_cast<uint8_t>(bytes[INLINE_MAX])==HEAP; }
+    char* heapBlock() const{
+        char* block;
+        std::memcpy(&block,bytes,sizeof(block));
+        return block;
+    }
+    static size_t blockSize(size_t len){ return sizeof(uint32_t)+len; }
+    void assign(std::string_view s){
+        if(s.size()<=INLINE_MAX){
+            std::memcpy(bytes,s.data(),s.size());
+            bytes[INLINE_MAX]=static_cast<char>(s.size());
+            return;
+        }
+        char* block=static_cast<char*>(SlabAllocator::getInstance().allocate(blockSize(s.size())));
+        uint32_t len=static_cast<uint32_t>(s.size());
+        std::memcpy(block,&len,sizeof(len));
+        std::memcpy(block+sizeof(len),s.data(),s.size());
+        std::memcpy(bytes,&block,sizeof(block));
+        bytes[INLINE_MAX]=static_cast<char>(HEAP);
+    }
+    void release(){
+        if(onHeap())SlabAllocator::getInstance().deallocate(heapBlock(),blockSize(size()));
+        bytes[INLINE_MAX]=0;
+    }
+};
+
+inline bool operator==(std::string_view s,const CompactString& c){ return c==s; }
+inline bool operator!=(std::string_view s,const CompactString& c){ return c!=s; }
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include "CompactString.h"
+#include "SlabAllocator.h"
+#include<string>
+#include<string_view>
+#include<vector>
+#include<utility>
+#include<functional>
+#include<iterator>
+#include<tuple>
+#include<type_traits>
+#include<cstddef>
+#include<cstdint>
+#include<new>
+
+/*
+Chained hash table from string keys to V, the keyspace's and big hashes'
+replacement for std::unordered_map. It exists for scan(): the bucket count
+is always a power of two, so a cursor that walks the buckets in
+reverse-binary order (as Redis' dictScan does) still visits every bucket of
+a table that grew or shrank between two calls. Such a cursor needs no state
+on the server and returns every key present for the whole walk at least
+once. The table doubles when it holds as many keys as buckets and halves
+once fewer than one bucket in eight is used, so a dict that was emptied
+does not keep its bucket array, and sampling does not walk empty buckets.
+
+The interface is the subset of unordered_map the database uses, looked up
+by string_view. Keys are CompactStrings and nodes come from the
+SlabAllocator, so a short key costs no allocation of its own and entries sit
+densely in their slabs. Nodes are never moved, so pointers and references to
+values stay valid until their key is erased, across rehashes too.
+*/
+template<typename V>
+class Dict{
+    struct Node{
+        std::pair<const CompactString,V> kv;
+        size_t hash;
+        Node* next;
+        template<typename K,typename... Args>
+        explicit Node(K&& key,Args&&... args)
+            :kv(std::piecewise_construct,std::forward_as_tuple(std::forward<K>(key)),
+                std::forward_as_tuple(std::forward<Args>(args)...)),hash(0),next(nullptr){}
+    };
+
+public:
+    using value_type=std::pair<const CompactString,V>;
+
+    template<bool Const>
+    class Iter{
+        using Entry=std::pair<const CompactString,V>;
+        using DictPtr=typename std::conditional<Const,const Dict*,Dict*>::type;
+        using Ref=typename std::conditional<Const,const Entry&,Entry&>::type;
+        using Ptr=typename std::conditional<Const,const Entry*,Entry*>::type;
+    public:
+        using iterator_category=std::forward_iterator_tag;
+        using value_type=Entry;
+        using difference_type=std::ptrdiff_t;
+        using pointer=Ptr;
+        using reference=Ref;
+        Iter():d(nullptr),bucket(0),node(nullptr){}
+        Iter(DictPtr d,size_t bucket,Node* node):d(d),bucket(bucket),node(node){}
+        //iterator converts to const_iterator
+        template<bool C=Const,typename=typename std::enable_if<C>::type>
+        Iter(const Iter<false>& o):d(o.d),bucket(o.bucket),node(o.node){}
+        Ref operator*() const { return node->kv; }
+        Ptr operator->() const { return &node->kv; }
+        Iter& operator++(){
+            node=node->next;
+            if(!node){
+                for(bucket++;bucket<d->table.size();bucket++){
+                    if((node=d->table[bucket]))break;
+                }
+            }
+            return *this;
+        }
+        Iter operator++(int){
+            Iter old=*this;
+            ++*this;
+            return old;
+        }
+        bool operator==(const Iter& o) const { return node==o.node; }
+        bool operator!=(const Iter& o) const { return node!=o.node; }
+    private:
+        friend class Dict;
+        template<bool> friend class Iter;
+        DictPtr d;
+        size_t bucket;
+        Node* node;
+    };
+    using iterator=Iter<false>;
+    using const_iterator=Iter<true>;
+
+    Dict()=default;
+    Dict(const Dict& o){ copyFrom(o); }
+    Dict(Dict&& o) noexcept:table(std::move(o.table)),count(o.count){ o.count=0; }
+    Dict& operator=(const Dict& o){
+        if(this!=&o){
+            clear();
+            copyFrom(o);
+        }
+        return *this;
+    }
+    Dict& operator=(Dict&& o) noexcept{
+        if(this!=&o){
+            clear();
+            table=std::move(o.table);
+            count=o.count;
+            o.count=0;
+        }
+        return *this;
+    }
+    ~Dict(){ clear(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count==0; }
+    size_t bucketCount() const { return table.size(); }
+
+    iterator begin(){
+        size_t b=0;
+        Node* n=firstFrom(b);
+        return iterator(this,b,n);
+    }
+    iterator end(){ return iterator(this,table.size(),nullptr); }
+    const_iterator begin() const{
+        size_t b=0;
+        Node* n=firstFrom(b);
+        return const_iterator(this,b,n);
+    }
+    const_iterator end() const { return const_iterator(this,table.size(),nullptr); }
+
+    iterator find(std::string_view key){
+        size_t b;
+        Node* n=lookup(key,b);
+        return n?iterator(this,b,n):end();
+    }
+    const_iterator find(std::string_view key) const{
+        size_t b;
+        Node* n=lookup(key,b);
+        return n?const_iterator(this,b,n):end();
+    }
+
+    //constructs the entry, then drops it if the key was already there
+    template<typename K,typename... Args>
+    std::pair<iterator,bool> emplace(K&& key,Args&&... args){
+        Node* n=newNode(std::forward<K>(key),std::forward<Args>(args)...);
+        n->hash=hashOf(n->kv.first);
+        size_t b;
+        if(Node* old=lookup(n->kv.first,n->hash,b)){
+            deleteNode(n);
+            return {iterator(this,b,old),false};
+        }
+        return {link(n),true};
+    }
+    template<typename K,typename M>
+    std::pair<iterator,bool> insert_or_assign(K&& key,M&& value){
+        size_t h=hashOf(key);
+        size_t b;
+        if(Node* old=lookup(key,h,b)){
+            old->kv.second=std::forward<M>(value);
+            return {iterator(this,b,old),false};
+        }
+        Node* n=newNode(std::forward<K>(key),std::forward<M>(value));
+        n->hash=h;
+        return {link(n),true};
+    }
+
+    //both erases may shrink the table, which invalidates every iterator;
+    //a loop that erases as it goes uses scan() instead
+    size_t erase(std::string_view key){
+        if(table.empty())return 0;
+        size_t h=hashOf(key);
+        for(Node** p=&table[h&(table.size()-1)];*p;p=&(*p)->next){
+            if((*p)->hash==h && (*p)->kv.first==key){
+                Node* n=*p;
+                *p=n->next;
+                deleteNode(n);
+                count--;
+                shrinkIfSparse();
+                return 1;
+            }
+        }
+        return 0;
+    }
+    void erase(const_iterator it){
+        Node** p=&table[it.bucket];
+        while(*p!=it.node)p=&(*p)->next;
+        *p=it.node->next;
+        deleteNode(it.node);
+        count--;
+        shrinkIfSparse();
+    }
+
+    void clear(){
+        for(Node* head:table){
+            while(head){
+                Node* next=head->next;
+                deleteNode(head);
+                head=next;
+            }
+        }
+        std::vector<Node*>().swap(table);
+        count=0;
+    }
+    //size the table for n keys up front (the snapshot loader knows the count)
+    void reserve(size_t n){
+        size_t want=MIN_BUCKETS;
+        while(want<n)want<<=1;
+        if(want>table.size())rehash(want);
+    }
+
+    //visit every entry of the bucket at cursor and return the cursor of the
+    //next bucket, 0 once the walk is complete. the cursor is advanced on its
+    //reversed bits, so buckets that a resize splits or merges are never
+    //skipped (they may be visited twice)
+    template<typename F>
+    size_t scan(size_t cursor,F&& fn) const{
+        if(table.empty())return 0;
+        size_t mask=table.size()-1;
+        for(Node* n=table[cursor&mask];n;n=n->next)fn(n->kv);
+        cursor|=~mask;
+        cursor=reverseBits(cursor);
+        cursor++;
+        return reverseBits(cursor);
+    }
+
+    //call fn on up to count entries, walking the buckets from start on; gives
+    //up after 10*count buckets, which at the 1/8 minimum fill normally holds
+    //count entries. eviction samples keys with it
+    template<typename F>
+    size_t sample(size_t start,size_t count,F&& fn) const{
+        if(table.empty())return 0;
+        size_t mask=table.size()-1,seen=0;
+        for(size_t step=0;step<table.size() && step<count*10 && seen<count;step++){
+            for(Node* n=table[(start+step)&mask];n && seen<count;n=n->next){
+                fn(n->kv);
+                seen++;
+            }
+        }
+        return seen;
+    }
+
+    //heap bytes of one entry (without a long key's block) and of the bucket
+    //array, for MEMORY USAGE
+    static size_t nodeBytes(){ return sizeof(Node); }
+    size_t tableBytes() const { return table.capacity()*sizeof(Node*); }
+
+private:
+    static const size_t MIN_BUCKETS=4;
+    std::vector<Node*> table;   //size is 0 or a power of two
+    size_t count=0;
+
+    static size_t hashOf(std::string_view key){ return std::hash<std::string_view>{}(key); }
+    template<typename K,typename... Args>
+    static Node* newNode(K&& key,Args&&... args){
+        void* mem=SlabAllocator::getInstance().allocate(sizeof(Node));
+        try{
+            return new(mem) Node(std::forward<K>(key),std::forward<Args>(args)...);
+        }catch(...){
+            SlabAllocator::getInstance().deallocate(mem,sizeof(Node));
+            throw;
+        }
+    }
+    static void deleteNode(Node* n){
+        n->~Node();
+        SlabAllocator::getInstance().deallocate(n,sizeof(Node));
+    }
+    static size_t reverseBits(size_t v){
+        uint64_t x=v;
+        x=((x>>1)&0x5555555555555555ULL)|((x&0x5555555555555555ULL)<<1);
+        x=((x>>2)&0x3333333333333333ULL)|((x&0x3333333333333333ULL)<<2);
+        x=((x>>4)&0x0F0F0F0F0F0F0F0FULL)|((x&0x0F0F0F0F0F0F0F0FULL)<<4);
+        return static_cast<size_t>(__builtin_bswap64(x));
+    }
+
+    //first node in bucket b or after it; b is left at that node's bucket,
+    //which the iterator needs to carry on from there
+    Node* firstFrom(size_t& b) const{
+        for(;b<table.size();b++){
+            if(table[b])return table[b];
+        }
+        return nullptr;
+    }
+    Node* lookup(std::string_view key,size_t& b) const{
+        return lookup(key,hashOf(key),b);
+    }
+    Node* lookup(std::string_view key,size_t h,size_t& b) const{
+        if(table.empty())return nullptr;
+        b=h&(table.size()-1);
+        for(Node* n=table[b];n;n=n->next){
+            if(n->hash==h && n->kv.first==key)return n;
+        }
+        return nullptr;
+    }
+    //insert a node known to be new; grows at load factor 1
+    iterator link(Node* n){
+        if(count>=table.size())rehash(table.empty()?MIN_BUCKETS:table.size()*2);
+        size_t b=n->hash&(table.size()-1);
+        n->next=table[b];
+        table[b]=n;
+        count++;
+        return iterator(this,b,n);
+    }
+    //halve once fewer than one bucket in 8 holds a key; run after every
+    //erase, so one step at a time keeps up
+    void shrinkIfSparse(){
+        if(table.size()>MIN_BUCKETS && count*8<table.size())rehash(table.size()/2);
+    }
+    void rehash(size_t buckets){
+        std::vector<Node*> fresh(buckets,nullptr);
+        for(Node* head:table){
+            while(head){
+                Node* next=head->next;
+                size_t b=head->hash&(buckets-1);
+                head->next=fresh[b];
+                fresh[b]=head;
+                head=next;
+            }
+        }
+        table.swap(fresh);
+    }
+    void copyFrom(const Dict& o){
+        reserve(o.count);
+        for(const auto& kv:o)emplace(kv.first,kv.second);
+    }
+};
+
+#endif
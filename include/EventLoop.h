@@ -0,0 +1,84 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include<string>
+#include<atomic>
+#include<vector>
+#include<memory>
+#include<mutex>
+#include<utility>
+#include "RedisCommandHandler.h"
+#include "RespParser.h"
+#include "ReplyBuffer.h"
+#include "ListWaiter.h"
+#include "PubSub.h"
+
+//one epoll reactor. the server runs one EventLoop per io thread; every loop
+//watches the shared listening socket and owns the clients it accepted.
+class EventLoop{
+public:
+    EventLoop(int listenFd,size_t maxClients,std::atomic<size_t>& clientCount,std::atomic<bool>& running);
+    ~EventLoop();
+    bool init();
+    //serve clients until running turns false, then close them
+    void run();
+
+private:
+    //per-client state, owned by the connection table and indexed by fd
+    struct Connection{
+        int fd;
+        std::string inbuf;      //bytes received but not yet parsed into commands
+        size_t inpos=0;         //parse position inside inbuf
+        RespParser parser;
+        std::vector<std::string> argv;  //reused for every command on this connection
+        ReplyBuffer out;        //replies not yet accepted by the kernel
+        bool closeAfterReply=false; //protocol error or peer gone: drop once out is sent
+        bool pendingFlush=false;    //queued in pendingFlush this round
+        bool logged=false;          //ran a write that went to the aof this round
+        BlockingClient client;      //parked by a blocking pop; input waits meanwhile
+        MultiState multi;           //MULTI queue and WATCHed keys
+        PubSubClient pubsub;        //channels and patterns it is subscribed to
+        int replicaPort=0;          //what a replica announced with REPLCONF listening-port
+        bool handoff=false;         //sent PSYNC: the connection goes to Replication
+        explicit Connection(int fd):fd(fd){}
+    };
+
+    int listenFd;
+    int epoll_fd;
+    size_t maxClients;
+    std::atomic<size_t>& clientCount;   //shared by all loops, enforces maxClients
+    std::atomic<bool>& running;
+    std::vector<std::unique_ptr<Connection>> connections;
+    RedisCommandHandler cmdHandler;
+    std::vector<int> pendingFlush;      //clients with replies from this round
+    std::vector<int> blockedClients;    //connections parked by a blocking pop
+    //served waiters handed over by whichever thread served them; wakeFd is an
+    //eventfd that interrupts epoll_wait when the list fills
+    int wakeFd;
+    std::mutex wokenMutex;
+    std::vector<std::pair<int,std::shared_ptr<ListWaiter>>> woken;
+    //messages published to this loop's subscribers, also signalled on wakeFd
+    Mailbox mailbox;
+
+    void acceptClients();
+    void handleRead(Connection& conn);
+    void processInput(Connection& conn);
+    bool flushOutput(Connection& conn);
+    void flushPending();
+    void closeConnection(int fd);
+    //give a replica's connection to Replication once its replies are out
+    void handOff(Connection& conn);
+    //thread-safe: queue a served waiter for the connection that parked it
+    void wakeClient(int fd,const std::shared_ptr<ListWaiter>& w);
+    //thread-safe: interrupt epoll_wait
+    void wakeup();
+    //queue the mailbox's messages to the subscribers still listening
+    void deliverMessages();
+    //reply to served and timed out clients and resume their input
+    void unblockClients();
+    void unblockClient(Connection& conn,bool timedOut);
+    //epoll_wait timeout: LOOP_TIMEOUT_MS or less if a blocked client expires sooner
+    int nextTimeout() const;
+};
+
+#endif
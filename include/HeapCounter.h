@@ -0,0 +1,21 @@
+#ifndef HEAP_COUNTER_H
+#define HEAP_COUNTER_H
+
+#include<cstddef>
+
+/*
+used_memory as redis' zmalloc keeps it. The server replaces operator new and
+delete (HeapHooks.cpp) and reports the usable size of every block it hands
+out or takes back. Counts go to one of a few cache-line sized slots picked
+per thread, so allocating threads rarely share a line; usedMemory() adds
+the slots up. Programs without the hooks (the benchmarks) read 0.
+*/
+void heapAllocated(size_t bytes);
+void heapFreed(size_t bytes);
+size_t usedMemory();
+//used memory once the server is set up but before the dataset is loaded,
+//what MEMORY STATS reports as startup.allocated
+void markStartupMemory();
+size_t startupMemory();
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef INT_SET_H
+#define INT_SET_H
+
+#include<string>
+#include<string_view>
+#include<vector>
+#include<cstddef>
+#include<cstdint>
+#include<cstring>
+
+/*
+Sorted array of distinct integers packed in one allocation, as in redis'
+intset. Every element takes the width of the widest one: 2, 4 or 8 bytes.
+Adding a value that does not fit rewrites the array at the next width, and
+the width never shrinks. Membership is a binary search that finishes with
+vector compares, and intersection a merge of two sorted arrays that compares
+a whole vector of each side at a time: SSE4.1, or AVX2 for 32 bit elements,
+where the cpu has them (checked at run time, the build needs no -march flag)
+and scalar code otherwise. Small sets made only of integers are an IntSet;
+anything else turns the set into a hashtable.
+*/
+class IntSet{
+public:
+    size_t size() const { return buf.size()/elemWidth; }
+    bool empty() const { return buf.empty(); }
+    size_t bytes() const { return buf.size(); }
+    //bytes per element: 2, 4 or 8
+    size_t width() const { return elemWidth; }
+
+    int64_t at(size_t i) const;
+    bool contains(int64_t v) const;
+    //false when v was already there
+    bool insert(int64_t v);
+    //add values, sorted and distinct, in one pass; returns how many were new
+    size_t insertSorted(const std::vector<int64_t>& values);
+    //false when v was not there
+    bool erase(int64_t v);
+    template<typename F>
+    void forEach(F fn) const{
+        for(size_t i=0,n=size();i<n;i++)fn(at(i));
+    }
+    //every element, ascending
+    void values(std::vector<int64_t>& out) const;
+
+    //elements of both, ascending
+    static void intersect(const IntSet& a,const IntSet& b,std::vector<int64_t>& out);
+
+    //s as an element: the canonical decimal form of an int64 only, so that
+    //"007" or "+7" stay strings and every member reads back as it was added
+    static bool parse(std::string_view s,int64_t& v);
+    //decimal text of v into buf (at least 21 bytes)
+    static std::string_view format(int64_t v,char* buf);
+
+private:
+    //the count is implied by the buffer size, which keeps an IntSet as
+    //small as a ListPack inside RedisObject
+    std::string buf;
+    uint8_t elemWidth=2;
+
+    static uint8_t widthFor(int64_t v);
+    void set(size_t i,int64_t v);
+    //rewrite every element at width w
+    void upgrade(uint8_t w);
+    //index of the first element not below v
+    size_t lowerBound(int64_t v) const;
+};
+
+#endif
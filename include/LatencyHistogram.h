@@ -0,0 +1,44 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include<atomic>
+#include<cstdint>
+#include<cstddef>
+#include<vector>
+
+/*
+HDR-style latency histogram over nanoseconds. Every power of two is split into
+2^SUB_BITS equal buckets, so any recorded value is known to within about 6%
+whatever its magnitude, in a fixed 4 KB. A histogram has a single writer (the
+io thread that owns it) which bumps buckets without read-modify-write atomics;
+readers on other threads add the buckets up into a plain vector and compute
+percentiles from that.
+*/
+class LatencyHistogram{
+public:
+    static const int SUB_BITS=4;
+    static const size_t SUB_BUCKETS=size_t(1)<<SUB_BITS;
+    //values from 2^(MAX_EXP+1) ns (~137s) up land in the last bucket
+    static const int MAX_EXP=36;
+    static const size_t BUCKETS=(MAX_EXP-SUB_BITS+2)*SUB_BUCKETS;
+
+    void record(uint64_t ns){
+        size_t i=bucketFor(ns);
+        buckets[i].store(buckets[i].load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+    }
+    //add this histogram's counts into counts (resized to BUCKETS)
+    void addTo(std::vector<uint64_t>& counts) const;
+
+    static size_t bucketFor(uint64_t ns);
+    //smallest and largest value bucket i holds
+    static uint64_t bucketLow(size_t i);
+    static uint64_t bucketHigh(size_t i);
+    //value below which a fraction p (0..1) of the recorded samples fall,
+    //taken as the midpoint of the bucket holding that rank; 0 when empty
+    static uint64_t percentile(const std::vector<uint64_t>& counts,double p);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS]={};
+};
+
+#endif
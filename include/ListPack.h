@@ -0,0 +1,74 @@
+#ifndef LIST_PACK_H
+#define LIST_PACK_H
+
+#include<string>
+#include<string_view>
+#include<cstddef>
+#include<vector>
+
+/*
+A sequence of strings packed back to back in one allocation.
+Entry layout: <varint len> <len bytes> <backlen>
+backlen is the size of the first two parts, stored so that it reads right to
+left. Every entry can therefore be walked in both directions without an index.
+Positions are byte offsets into the buffer; end() is one past the last entry.
+Inserting or erasing moves the bytes behind the entry, so packs are kept small.
+Small lists are a ListPack outright, and so are small hashes (field and value
+alternating). Every QuickList node is one too.
+*/
+class ListPack{
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count==0; }
+    size_t bytes() const { return buf.size(); }
+    //bytes an entry holding a value of len bytes takes up
+    static size_t entrySize(size_t len);
+
+    size_t begin() const { return 0; }
+    size_t end() const { return buf.size(); }
+    size_t next(size_t pos) const;
+    size_t prev(size_t pos) const;
+    std::string_view get(size_t pos) const;
+    //position of the entry at index (negative counts from the back), end() if out of range
+    size_t seek(long index) const;
+
+    void pushFront(std::string_view value){ insert(0,value); }
+    void pushBack(std::string_view value){ insert(buf.size(),value); }
+    std::string popFront();
+    std::string popBack();
+    //insert before pos; returns the new entry's position
+    size_t insert(size_t pos,std::string_view value);
+    //returns the position of the entry that followed the erased one
+    size_t erase(size_t pos);
+    //erase n entries starting at pos
+    void eraseRange(size_t pos,size_t n);
+    void replace(size_t pos,std::string_view value);
+    void clear(){ buf.clear(); count=0; }
+    //first entry equal to value, end() if none
+    size_t find(std::string_view value) const;
+
+    //list operations with the semantics of the commands of the same name;
+    //QuickList offers the same set so list code can work on either
+    bool index(long i,std::string& out) const;
+    bool set(long i,std::string_view value);
+    //LREM: count>0 from head, count<0 from tail, 0 removes every match
+    size_t remove(long limit,std::string_view value);
+    void range(long start,long stop,std::vector<std::string>& out) const;
+    void trim(long start,long stop);
+    //LINSERT: new size, or -1 when pivot is not present
+    long insert(std::string_view pivot,std::string_view value,bool before);
+    template<typename F>
+    void forEach(F fn) const{
+        for(size_t pos=begin();pos<end();pos=next(pos))fn(get(pos));
+    }
+
+    //normalise an LRANGE style inclusive [start,stop] for a sequence of len
+    //elements; false when it selects nothing
+    static bool clampRange(long& start,long& stop,size_t len);
+
+private:
+    std::string buf;
+    size_t count=0;
+};
+
+#endif
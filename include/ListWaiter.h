@@ -0,0 +1,48 @@
+#ifndef LIST_WAITER_H
+#define LIST_WAITER_H
+
+#include<string>
+#include<vector>
+#include<memory>
+#include<atomic>
+#include<functional>
+#include<cstdint>
+
+/*
+A client parked by BLPOP, BRPOP or BLMOVE. It sits in the waiter queue of
+each of its keys until a write to one of them lets the writing thread pop an
+element for it, or until its event loop times it out or the client goes
+away. Whoever claims it first owns it; entries left in other queues by a
+claimed waiter are stale and skipped.
+*/
+struct ListWaiter{
+    std::vector<std::string> keys;
+    bool fromFront=true;        //pop side: BLPOP, BLMOVE LEFT ...
+    bool move=false;            //BLMOVE: push the element onto destination
+    std::string destination;
+    bool toFront=true;
+    int64_t deadline=-1;        //unix ms, -1 waits forever
+    //filled in by whoever served it
+    std::string key;
+    std::string value;
+    bool wrongType=false;       //the destination held another type
+    //hands the served waiter back to its connection; runs on the serving thread
+    std::function<void(const std::shared_ptr<ListWaiter>&)> wake;
+
+    bool claim(){
+        bool expected=false;
+        return claimed.compare_exchange_strong(expected,true);
+    }
+    bool isClaimed() const { return claimed.load(); }
+
+private:
+    std::atomic<bool> claimed{false};
+};
+
+//what a blocking command needs from the connection that sent it
+struct BlockingClient{
+    std::function<void(const std::shared_ptr<ListWaiter>&)> wake;
+    std::shared_ptr<ListWaiter> blocked;    //set while the client is parked
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef PUB_SUB_H
+#define PUB_SUB_H
+
+#include<string>
+#include<vector>
+#include<set>
+#include<map>
+#include<unordered_map>
+#include<memory>
+#include<mutex>
+#include<shared_mutex>
+#include<functional>
+
+/*
+Channel and pattern subscriptions. PUBLISH serializes the message as RESP
+once per channel (and once per matching pattern, whose reply also names the
+pattern) and queues that one refcounted buffer to every subscriber; the
+subscribers' output buffers reference it instead of copying it. Publishers
+run on any io thread while subscribers belong to one event loop each, so the
+deliveries go to the subscriber's loop in one batch per loop: its Mailbox,
+drained by that loop after notify() wakes it.
+*/
+typedef std::shared_ptr<const std::string> SharedMessage;
+
+struct Subscriber;
+
+struct Delivery{
+    std::shared_ptr<Subscriber> sub;
+    SharedMessage msg;
+};
+
+//an event loop's incoming messages; posted from any thread
+struct Mailbox{
+    std::mutex mutex;
+    std::vector<Delivery> queue;
+    std::function<void()> notify;   //wakes the loop, called when queue stops being empty
+};
+
+//one subscribed connection. its sets are only touched by its own loop
+struct Subscriber{
+    int fd;
+    Mailbox* mailbox;
+    std::set<std::string> channels;
+    std::set<std::string> patterns;
+    Subscriber(int fd,Mailbox* mailbox):fd(fd),mailbox(mailbox){}
+    size_t count() const { return channels.size()+patterns.size(); }
+};
+
+//what SUBSCRIBE and friends need from the connection that sent them
+struct PubSubClient{
+    int fd=-1;
+    Mailbox* mailbox=nullptr;
+    std::shared_ptr<Subscriber> sub;    //set while subscribed to anything
+};
+
+class PubSub{
+public:
+    static PubSub& getInstance();
+
+    //both return the client's subscription count afterwards; unsubscribing
+    //from the last channel or pattern leaves subscribed mode (c.sub is reset)
+    size_t subscribe(PubSubClient& c,const std::string& name,bool pattern);
+    size_t unsubscribe(PubSubClient& c,const std::string& name,bool pattern);
+    //drop every subscription of a connection that goes away
+    void unsubscribeAll(PubSubClient& c);
+    //queue message to the subscribers of channel and of every pattern that
+    //matches it; returns how many deliveries were queued
+    size_t publish(const std::string& channel,const std::string& message);
+
+    //PUBSUB CHANNELS / NUMSUB / NUMPAT, and the counts INFO shows
+    std::vector<std::string> activeChannels(const std::string* pattern);
+    size_t numsub(const std::string& channel);
+    size_t numchannels();
+    size_t numpat();
+
+private:
+    PubSub()=default;
+    typedef std::vector<std::shared_ptr<Subscriber>> SubscriberList;
+    std::shared_mutex mutex;
+    std::unordered_map<std::string,SubscriberList> channels;
+    std::map<std::string,SubscriberList> patterns;
+};
+
+#endif
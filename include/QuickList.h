@@ -0,0 +1,67 @@
+#ifndef QUICK_LIST_H
+#define QUICK_LIST_H
+
+#include<string>
+#include<string_view>
+#include<vector>
+#include<deque>
+#include<cstddef>
+#include "ListPack.h"
+
+/*
+List encoding: a deque of ListPack nodes, each at most NODE_MAX_BYTES.
+Pushes and pops at either end touch only the outer node, so they are O(1)
+whatever the length of the list. Walks by index skip whole nodes by their
+entry count, then scan one contiguous buffer.
+*/
+class QuickList{
+public:
+    //same default as list-max-listpack-size -2 in redis
+    static const size_t NODE_MAX_BYTES=8*1024;
+
+    size_t size() const { return count; }
+    bool empty() const { return count==0; }
+    size_t nodeCount() const { return nodes.size(); }
+    //bytes of all node buffers; walks the nodes
+    size_t bytes() const{
+        size_t total=0;
+        for(const auto& node:nodes)total+=node.bytes();
+        return total;
+    }
+
+    void pushFront(std::string_view value);
+    void pushBack(std::string_view value);
+    std::string popFront();
+    std::string popBack();
+
+    //negative indexes count from the tail, as in LINDEX/LSET
+    bool index(long i,std::string& out) const;
+    bool set(long i,std::string_view value);
+    //LREM: count>0 from head, count<0 from tail, 0 removes every match
+    size_t remove(long limit,std::string_view value);
+    //LRANGE/LTRIM: inclusive bounds, negative from the tail, clamped
+    void range(long start,long stop,std::vector<std::string>& out) const;
+    void trim(long start,long stop);
+    //LINSERT: new length, or -1 when pivot is not in the list
+    long insert(std::string_view pivot,std::string_view value,bool before);
+
+    template<typename F>
+    void forEach(F fn) const{
+        for(const auto& node:nodes){
+            for(size_t pos=node.begin();pos<node.end();pos=node.next(pos))
+                fn(node.get(pos));
+        }
+    }
+
+private:
+    std::deque<ListPack> nodes;
+    size_t count=0;
+
+    //node holding element i (0 <= i < count) and i's index inside it
+    void locate(size_t i,size_t& node,size_t& offset) const;
+    //split node n in two once an insert or set pushed it past the limit
+    void splitIfOversized(size_t n);
+    void eraseNodeIfEmpty(size_t n);
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef RDB_FORMAT_H
+#define RDB_FORMAT_H
+
+#include<string>
+#include<string_view>
+#include<cstdint>
+#include<cstddef>
+
+/*
+Binary snapshot layout (all integers little endian):
+    "MYRDB" <version:1>
+    <varint key count>                  hint so the loader can pre-size tables
+    records:
+        [RDB_OP_EXPIRE <int64 unix ms>] <type:1> <key:string> <payload>
+        string : <string>
+        list   : <varint n> n x <string>
+        hash   : <varint n> n x <field:string><value:string>
+        zset   : <varint n> n x <member:string><score:int64 bits of the double>
+                 in ascending score order
+        set    : <varint n> n x <member:string>
+    RDB_OP_EOF <crc32c:4>               checksum of every byte before it
+A <string> is a varint length followed by the raw bytes, so values may hold
+any binary data.
+*/
+
+static const char RDB_MAGIC[]="MYRDB";
+static const size_t RDB_MAGIC_LEN=5;
+static const uint8_t RDB_VERSION=1;
+
+static const uint8_t RDB_TYPE_STRING=0;
+static const uint8_t RDB_TYPE_LIST=1;
+static const uint8_t RDB_TYPE_HASH=2;
+static const uint8_t RDB_TYPE_ZSET=3;
+static const uint8_t RDB_TYPE_SET=4;
+static const uint8_t RDB_OP_EXPIRE=0xFC;
+static const uint8_t RDB_OP_EOF=0xFF;
+
+uint32_t crc32c(uint32_t crc,const void* data,size_t len);
+
+//streams a snapshot to a file through a fixed buffer, checksumming as it goes
+class RdbWriter{
+public:
+    RdbWriter();
+    ~RdbWriter();
+    bool open(const std::string& path);
+    void writeByte(uint8_t b);
+    void writeVarint(uint64_t v);
+    void writeInt64(int64_t v);
+    void writeString(std::string_view s);
+    //append EOF marker and checksum, fsync and close; false on any I/O error
+    bool finish();
+
+private:
+    static const size_t BUF_SIZE=64*1024;
+    int fd;
+    char* buf;
+    size_t len;
+    uint32_t crc;
+    bool failed;
+    void writeRaw(const void* data,size_t n);
+    void flush();
+};
+
+//reads a snapshot through a read-only memory mapping. every read is bounds
+//checked; ok() turns false on truncation or a malformed length
+class RdbReader{
+public:
+    RdbReader();
+    ~RdbReader();
+    bool open(const std::string& path);
+    bool ok() const { return good; }
+    size_t remaining() const { return size-pos; }
+    uint8_t readByte();
+    uint64_t readVarint();
+    int64_t readInt64();
+    void readString(std::string& out);
+    //the same, without a copy: the view points into the mapping
+    std::string_view readStringView();
+    //after RDB_OP_EOF: compare the stored checksum with the bytes read so far
+    bool verifyChecksum();
+
+private:
+    const char* data;
+    size_t size;
+    size_t pos;
+    size_t crcPos;      //bytes already folded into crc
+    uint32_t crc;
+    bool good;
+    void catchUpCrc();
+};
+
+#endif
@@ -2,14 +2,38 @@
 #define REDIS_COMMAND_HANDLER_H
 
 #include<string>
+#include<vector>
+#include<chrono>
+#include "ReplyBuffer.h"
+#include "ListWaiter.h"
+#include "Transaction.h"
+#include "PubSub.h"
 
 class RedisCommandHandler{
 public:
-    RedisCommandHandler();
-    //process a command from client and return an RESP formatted response
-    std::string processCommand(const std::string& commandLine);
+    //masterLink: the handler applying a master's stream on a replica, the
+    //only one a replica lets write
+    explicit RedisCommandHandler(bool masterLink=false);
+    //execute a parsed command (argv[0] is the command name), appending the
+    //RESP reply to reply. with a client, BLPOP/BRPOP/BLMOVE on empty lists
+    //park it (client->blocked) instead of replying. with multi, MULTI queues
+    //the commands that follow until EXEC. with pubsub, SUBSCRIBE/PSUBSCRIBE
+    //register the connection, which then only takes pub/sub commands
+    void processCommand(const std::vector<std::string>& tokens,ReplyBuffer& reply,BlockingClient* client=nullptr,
+                        MultiState* multi=nullptr,PubSubClient* pubsub=nullptr);
+    //drop a connection's transaction and its WATCHes; before it goes away
+    void resetTransaction(MultiState& multi);
+    //reply for a parked client that was served by another client's write,
+    //or whose timeout ran out
+    void replyUnblocked(ListWaiter& w,bool timedOut,ReplyBuffer& reply);
+    //run a command without logging it anywhere; used to replay the aof
+    void executeCommand(const std::vector<std::string>& tokens,ReplyBuffer& reply);
+    //delete keys whose ttl has passed for at most budget, logging each as a
+    //DEL; the cron calls it, and it does nothing on a replica
+    static size_t activeExpireCycle(std::chrono::microseconds budget);
 
 private:
+    bool masterLink;
 };
  
 #endif
@@ -3,60 +3,418 @@
 
 #include<string>
 #include<mutex>
+#include<shared_mutex>
 #include<unordered_map>
 #include<vector>
+#include<array>
+#include<stdexcept>
 #include<chrono>
+#include<cstdint>
+#include<atomic>
+#include<optional>
+#include<deque>
+#include<memory>
+#include<functional>
+#include<sys/types.h>
+#include "RedisObject.h"
+#include "ListWaiter.h"
+
+//thrown when a command targets a key holding a different type of value
+class WrongTypeError:public std::runtime_error{
+public:
+    WrongTypeError():std::runtime_error("WRONGTYPE Operation against a key holding the wrong kind of value"){}
+};
+
+//snapshot file used by SAVE, BGSAVE, save points, shutdown and startup
+static const char DUMP_FILENAME[]="dump.my_rdb";
+
+//SET NX / SET XX
+enum class SetCondition{ Always, IfNotExists, IfExists };
+
+//ZADD options
+enum ZAddFlags:int{
+    ZADD_NX=1<<0,       //only add new members
+    ZADD_XX=1<<1,       //only update existing members
+    ZADD_GT=1<<2,       //only update to a greater score
+    ZADD_LT=1<<3,       //only update to a lower score
+    ZADD_INCR=1<<4,     //the score is an increment (ZINCRBY)
+};
+//what a ZADD did
+struct ZAddResult{
+    size_t added=0;         //new members
+    size_t updated=0;       //members whose score changed
+    //ZADD_INCR only: whether the increment was applied and the new score;
+    //nan when the sum is not a number, in which case nothing changed
+    bool applied=false;
+    double score=0;
+    bool nan=false;
+};
+
+//what happens once used memory passes maxmemory: noeviction fails writes
+//that need memory, the others delete keys until it is back under the limit
+enum class EvictionPolicy{ NoEviction, AllKeysLru, AllKeysLfu, VolatileTtl };
+
+//maxmemory-policy names, as in redis.conf
+const char* evictionPolicyName(EvictionPolicy policy);
+bool parseEvictionPolicy(const std::string& name,EvictionPolicy& policy);
+
+/*
+Reader/writer lock of one keyspace shard. EXEC runs a whole transaction with
+the shards of its keys locked exclusively and marked in held, a bit per shard
+for the running thread; the commands inside lock those shards again through
+the usual code paths, and the lock is skipped for a shard this thread already
+holds. Any other shard is locked as usual.
+*/
+class ShardMutex{
+public:
+    void lock(){ if(!heldHere())m.lock(); }
+    void unlock(){ if(!heldHere())m.unlock(); }
+    void lock_shared(){ if(!heldHere())m.lock_shared(); }
+    void unlock_shared(){ if(!heldHere())m.unlock_shared(); }
+    static inline thread_local uint64_t held=0;
+    uint64_t bit=0;         //this shard's bit in held, set by RedisDatabase
+private:
+    std::shared_mutex m;
+    bool heldHere() const { return held&bit; }
+};
+
+struct MaxmemoryConfig{
+    size_t maxmemory=0;     //bytes of used_memory, 0 for no limit
+    EvictionPolicy policy=EvictionPolicy::NoEviction;
+    size_t samples=5;       //keys sampled per shard visited, maxmemory-samples
+};
+
 class RedisDatabase{
 public:
     //get singleton instance
     static RedisDatabase& getInstance();
+    //current unix time in milliseconds, the timebase of every expiry
+    static int64_t nowMs();
+    //listpack conversion thresholds; set once at startup, before serving
+    void setEncodingLimits(const EncodingLimits& l){ limits=l; }
+    //maxmemory limit and policy; set once at startup, before serving
+    void setMaxmemory(const MaxmemoryConfig& c){ maxmemoryConfig=c; }
+    const MaxmemoryConfig& maxmemory() const { return maxmemoryConfig; }
+    bool overMaxmemory() const;
     // Common Comands
     bool flushAll();
 
+    //Transactions
+    //EXEC holds these for the whole batch: the shards of keys exclusively
+    //(every shard with all), with the commands' own locking of them skipped
+    class TransactionLock{
+    public:
+        //the moved-from lock gives up its bits, or its destructor would clear
+        //them while the shards are still locked
+        TransactionLock(TransactionLock&& o) noexcept:locks(std::move(o.locks)),mask(o.mask){ o.mask=0; }
+        TransactionLock& operator=(TransactionLock&&)=delete;
+        ~TransactionLock(){ ShardMutex::held&=~mask; }
+    private:
+        friend class RedisDatabase;
+        TransactionLock()=default;
+        //destroyed after the destructor body has cleared the held bits
+        std::vector<std::unique_lock<ShardMutex>> locks;
+        uint64_t mask=0;
+    };
+    TransactionLock lockForTransaction(const std::vector<std::string>& keys,bool all);
+    //WATCH: register a watcher of key and return the key's version, which
+    //every write to it (or its expiry, eviction, FLUSHALL) bumps
+    uint64_t watch(const std::string& key);
+    void unwatch(const std::string& key);
+    //true when every key still has the version watch() returned for it
+    bool unchangedSince(const std::vector<std::pair<std::string,uint64_t>>& versions);
+
     // Key/Value Operations
     void set(const std::string& key, const std::string& value);
+    //expireAt: absolute unix ms or -1 for no expiry; false when cond blocks the write
+    bool set(const std::string& key, const std::string& value,int64_t expireAt,SetCondition cond);
     bool get(const std::string& key, std::string& value);
-    std::vector<std::string> keys();
+    //multi-key commands lock every shard involved once, in index order, so
+    //the whole batch is applied atomically
+    //MSET; with IfNotExists nothing is written unless every key is missing (MSETNX)
+    bool mset(const std::vector<std::pair<std::string,std::string>>& pairs,SetCondition cond=SetCondition::Always);
+    //MGET; nullopt for missing keys and keys of another type
+    std::vector<std::optional<std::string>> mget(const std::vector<std::string>& keys);
+    //KEYS: every key matching the glob pattern, shard by shard
+    std::vector<std::string> keys(const std::string& pattern="*");
+    //SCAN: continue the keyspace walk at cursor, visiting about count keys
+    //and holding one shard's lock at a time. keys matching pattern (empty
+    //matches all) and of type (empty for any) are added to out; returns the
+    //cursor of the next call, 0 once the walk is complete
+    uint64_t scan(uint64_t cursor,size_t count,const std::string& pattern,const std::string& type,std::vector<std::string>& out);
     std::string type(const std::string& key);
+    //OBJECT ENCODING; empty for a missing key
+    std::string encoding(const std::string& key);
     bool del(const std::string& key);
+    //number of keys removed
+    size_t del(const std::vector<std::string>& keys);
+    //number of the keys that exist, a key named twice counts twice
+    size_t exists(const std::vector<std::string>& keys);
     bool expire(const std::string& key, int seconds);
+    bool pexpire(const std::string& key, int64_t milliseconds);
+    //a time in the past deletes the key right away, except on a replica or during a load
+    bool pexpireAt(const std::string& key, int64_t whenMs);
+    //remaining ttl in ms, -1 for a key without expiry, -2 for a missing key
+    int64_t pttl(const std::string& key);
+    //absolute expiry in unix ms; -2 missing, -1 no expiry
+    int64_t pexpiretime(const std::string& key);
+    bool persist(const std::string& key);
+    //drop every expired key from every shard
     void purgeExpired();
+    //find keys whose deadline passed, walking the shards' expiry heaps until
+    //nothing is due or the time budget runs out, and hand each to expire
+    //outside the shard lock; it takes the key's stripe and calls expireKey.
+    //does nothing on a replica or during a load; returns keys handed over
+    size_t activeExpireCycle(std::chrono::microseconds budget,const std::function<void(const std::string&)>& expire);
+    //delete key if its deadline has passed; false when it is gone or alive
+    bool expireKey(const std::string& key);
+    //keys this thread's writes found expired and deleted since the last call;
+    //the caller logs them as DEL ahead of the write
+    std::vector<std::string> takeExpired();
+    //only a master that is not loading deletes keys whose ttl has passed: a
+    //replica waits for its master's DEL, and a load replays commands against
+    //keys as they were when the commands ran. until then writes find such
+    //keys as they are, and reads (outside a load) treat them as missing
+    void setLoading(bool on){ loading.store(on,std::memory_order_release); }
+    void setReplica(bool on){ replica.store(on,std::memory_order_release); }
     bool rename(const std::string& oldKey, const std::string& newKey);
     // List Operations
     ssize_t llen(const std::string& key);
     void lpush(const std::string&key,const std::string& value);
     void rpush(const std::string&key,const std::string& value);
+    //push every value in order; returns the new length
+    size_t lpush(const std::string&key,const std::vector<std::string>& values);
+    size_t rpush(const std::string&key,const std::vector<std::string>& values);
     bool lpop(const std::string&key,std::string& value);
     bool rpop(const std::string&key,std::string& value);
+    //pop up to count elements into out; false when the key is missing
+    bool lpop(const std::string&key,size_t count,std::vector<std::string>& out);
+    bool rpop(const std::string&key,size_t count,std::vector<std::string>& out);
+    //LMOVE; false when source is missing
+    bool lmove(const std::string& source,const std::string& destination,bool fromFront,bool toFront,std::string& value);
+    //Blocking pops
+    //pop (or move) from the first non-empty key of w into w->key/value, or
+    //with block set park w in the waiter queue of every key. both happen under
+    //the keys' shard locks, so no push can slip in between. true when served
+    bool popOrBlock(const std::shared_ptr<ListWaiter>& w,bool block);
+    //the oldest live waiter on key if the list has an element for it
+    std::shared_ptr<ListWaiter> nextWaiter(const std::string& key);
+    //claim w and pop its element from key; false if it was claimed by someone
+    //else or the list emptied meanwhile
+    bool serveWaiter(const std::string& key,const std::shared_ptr<ListWaiter>& w);
+    //timeout or disconnect: claim w and drop it from its queues; false when a
+    //writer got to it first
+    bool cancelWaiter(const std::shared_ptr<ListWaiter>& w);
+    bool hasBlockedClients() const { return blockedClients.load(std::memory_order_relaxed)>0; }
     int lrem(const std::string&key,int count,const std::string& value);
     bool lindex(const std::string&key,int index, std::string& value);
     bool lset(const std::string&key,int index,const std::string& value);
+    //elements start..stop inclusive, negative indexes count from the tail
+    void lrange(const std::string&key,long start,long stop,std::vector<std::string>& out);
+    void ltrim(const std::string&key,long start,long stop);
+    //new length, -1 when pivot is missing, 0 when the key is missing
+    long linsert(const std::string&key,bool before,const std::string& pivot,const std::string& value);
     //Hash Operations
+    //true when the field is new
     bool hset(const std::string& key,const std::string& field,const std::string& val);
+    //number of fields that were new
+    size_t hset(const std::string& key,const std::vector<std::pair<std::string,std::string>>& fieldValues);
     bool hget(const std::string& key,const std::string& field,std::string& val);
     bool hexists(const std::string& key,const std::string& field);
     bool hdel(const std::string& key,const std::string& field);
-    std::unordered_map<std::string,std::string>hgetall(const std::string& key);
+    //number of fields removed
+    size_t hdel(const std::string& key,const std::vector<std::string>& fields);
+    //nullopt for missing fields
+    std::vector<std::optional<std::string>> hmget(const std::string& key,const std::vector<std::string>& fields);
+    std::vector<std::pair<std::string,std::string>> hgetall(const std::string& key);
     std::vector<std::string> hkeys(const std::string&key);
     std::vector<std::string> hvals(const std::string&key);
     ssize_t hlen(const std::string& key);
-    bool hmset(const std::string& key,const std::vector<std::pair<std::string,std::string>>fieldvalues);
+    //HSCAN, the same walk over one hash's fields. a listpack hash is small
+    //and goes out whole in the first call
+    uint64_t hscan(const std::string& key,uint64_t cursor,size_t count,const std::string& pattern,
+                   std::vector<std::pair<std::string,std::string>>& out);
+    //Sorted Set Operations
+    //ZADD / ZINCRBY: apply each score,member pair under flags (ZAddFlags)
+    ZAddResult zadd(const std::string& key,const std::vector<std::pair<double,std::string>>& pairs,int flags);
+    //number of members removed
+    size_t zrem(const std::string& key,const std::vector<std::string>& members);
+    bool zscore(const std::string& key,const std::string& member,double& score);
+    ssize_t zcard(const std::string& key);
+    //0-based rank by ascending score (descending with reverse), -1 when missing
+    long zrank(const std::string& key,const std::string& member,bool reverse);
+    //members and scores at ranks start..stop inclusive, negative ranks count
+    //from the end; reverse ranks from the highest score
+    void zrange(const std::string& key,long start,long stop,bool reverse,std::vector<std::pair<std::string,double>>& out);
+    //members with a score inside range in score order (descending with
+    //reverse), skipping offset of them and taking at most count (-1 for all)
+    void zrangeByScore(const std::string& key,const ScoreRange& range,bool reverse,size_t offset,long count,
+                       std::vector<std::pair<std::string,double>>& out);
+    size_t zcount(const std::string& key,const ScoreRange& range);
+    //Set Operations
+    //number of members that were new
+    size_t sadd(const std::string& key,const std::vector<std::string>& members);
+    //number of members removed
+    size_t srem(const std::string& key,const std::vector<std::string>& members);
+    bool sismember(const std::string& key,const std::string& member);
+    std::vector<std::string> smembers(const std::string& key);
+    ssize_t scard(const std::string& key);
+    //SSCAN, the HSCAN walk over a set's members; an intset is small and
+    //goes out whole in the first call
+    uint64_t sscan(const std::string& key,uint64_t cursor,size_t count,const std::string& pattern,
+                   std::vector<std::string>& out);
+    //SINTER / SUNION / SDIFF (the first set minus the others); a missing key
+    //is an empty set. the keys' shards are locked once, in index order
+    std::vector<std::string> sinter(const std::vector<std::string>& keys);
+    std::vector<std::string> sunion(const std::vector<std::string>& keys);
+    std::vector<std::string> sdiff(const std::vector<std::string>& keys);
     //persisitance :Dump/load the DB From a file.
     bool dump(const std::string& filename);
     bool load(const std::string& filename);
+    //fork a child that writes the snapshot from its copy-on-write view of
+    //memory while this process keeps serving; false if one is already running
+    bool bgsave(const std::string& filename);
+    //fork a child that writes a snapshot to filename and exits 0 on success;
+    //returns its pid (or -1), reaping it is up to the caller
+    pid_t forkSnapshot(const std::string& filename);
+    bool bgsaveInProgress();
+    //reap a finished bgsave child; block=true waits for it (used at shutdown)
+    void checkBgsave(bool block=false);
+    //unix seconds of the last successful save
+    int64_t lastSaveTime() const { return lastSave; }
+    bool lastBgsaveOk() const { return lastBgsaveStatus; }
+    //writes since the last successful save
+    uint64_t dirty();
+    //number of keys and of keys with an expiry; walks every shard, so it is
+    //meant for INFO rather than the request path
+    void countKeys(size_t& keys,size_t& volatileKeys);
+    //MEMORY USAGE: estimated bytes of the key's entry, name and value, 0 for a
+    //missing key. a big hash is extrapolated from its first samples fields
+    //(0 walks them all)
+    size_t memoryUsage(const std::string& key,size_t samples);
+    //Eviction
+    //the best key to evict under the policy, taken from a pool of sampled
+    //candidates; false when the policy forbids eviction or nothing qualifies
+    bool evictionCandidate(std::string& key);
+    //delete an eviction candidate; false when it is gone already
+    bool evictKey(const std::string& key);
+    uint64_t evictedKeys() const { return evicted.load(std::memory_order_relaxed); }
 
 private:
-    RedisDatabase() =default;
+    RedisDatabase();
     ~RedisDatabase()=default;
     RedisDatabase(const RedisDatabase&)=delete;
     RedisDatabase& operator=(const RedisDatabase&)=delete;
 
-    std::mutex db_mutex;
-    std::unordered_map<std::string,std::string>kv_store;
-    std::unordered_map<std::string,std::vector<std::string>>list_store;
-    std::unordered_map<std::string,std::unordered_map<std::string,std::string>>hash_store;
+    //the keyspace is split into SHARD_COUNT hash partitions, each guarded by
+    //its own reader/writer lock. single-key commands touch exactly one shard;
+    //commands spanning shards always lock them in ascending index order.
+    static const size_t SHARD_BITS=6;
+    static const size_t SHARD_COUNT=size_t(1)<<SHARD_BITS;
+    //pending deadline in a shard's expiry heap. entries are never updated in
+    //place: a changed or removed ttl leaves a stale entry that is recognised
+    //(expireAt no longer matches) and dropped when it reaches the top
+    struct ExpireEntry{
+        int64_t when;
+        CompactString key;
+    };
+    //every key maps to exactly one RedisObject carrying its type and expiry
+    //a watched key's version, kept while any client watches it
+    struct WatchedKey{
+        uint64_t version=0;
+        size_t watchers=0;
+    };
+    struct alignas(64) Shard{
+        ShardMutex mutex;
+        Dict<RedisObject>dict;
+        std::vector<ExpireEntry>expires;    //min-heap on when
+        std::atomic<uint64_t>dirty{0};      //writes applied to this shard, never reset
+        //clients blocked on an empty list, oldest first
+        std::unordered_map<std::string,std::deque<std::shared_ptr<ListWaiter>>>waiters;
+        Dict<WatchedKey>watched;            //empty unless a client runs WATCH
+    };
+    std::array<Shard,SHARD_COUNT> shards;
+    size_t expireCursor=0;  //shard the next active expire cycle starts from
+    std::atomic<bool> loading{false};   //replaying the aof
+    std::atomic<bool> replica{false};   //following a master
+    EncodingLimits limits;
+    MaxmemoryConfig maxmemoryConfig;
+    std::atomic<size_t> blockedClients{0};  //parked waiters not yet claimed
+
+    //eviction candidates kept across picks, best (highest score) last
+    struct EvictionCandidate{
+        uint64_t score;
+        std::string key;
+    };
+    std::mutex evictionMutex;               //guards evictionPool
+    std::vector<EvictionCandidate> evictionPool;
+    std::atomic<uint64_t> evicted{0};
+
+    std::mutex bgsaveMutex;                 //guards the child bookkeeping below
+    pid_t childPid=-1;
+    uint64_t dirtyAtFork=0;
+    uint64_t dirtyAtLastSave=0;
+    std::atomic<int64_t> lastSave{std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count()};
+    std::atomic<bool> lastBgsaveStatus{true};
 
-    std::unordered_map<std::string,std::chrono::steady_clock::time_point>expiry_map;
+    size_t shardIndex(const std::string& key) const;
+    Shard& shardFor(const std::string& key){ return shards[shardIndex(key)]; }
+    std::vector<std::unique_lock<ShardMutex>> lockAllShards();
+    std::vector<std::shared_lock<ShardMutex>> lockAllShardsShared();
+    //lock the given shards (one entry per key, repeats allowed) once each, in
+    //ascending index order
+    std::vector<std::unique_lock<ShardMutex>> lockShards(std::vector<size_t> indexes);
+    std::vector<std::shared_lock<ShardMutex>> lockShardsShared(std::vector<size_t> indexes);
+    std::vector<size_t> shardIndexes(const std::vector<std::string>& keys) const;
+    //shared bodies of LPUSH/RPUSH and of LPOP/RPOP with a count
+    size_t pushValues(const std::string& key,const std::string* values,size_t count,bool front);
+    bool popValues(const std::string& key,size_t count,bool front,std::vector<std::string>& out);
+    //move one element; the caller holds both shard locks and has checked the
+    //destination's type
+    void moveElement(Shard& from,RedisObject& src,const std::string& source,Shard& to,const std::string& destination,
+                     bool fromFront,bool toFront,std::string& value);
+    //caller holds the shard lock
+    void removeWaiter(Shard& shard,const std::string& key,const std::shared_ptr<ListWaiter>& w);
+    //drop a claimed waiter from the queues of its keys other than except
+    void forgetWaiter(const std::shared_ptr<ListWaiter>& w,const std::string* except);
+    //caller holds the shard lock exclusively
+    void setExpire(Shard& shard,std::string_view key,RedisObject& obj,int64_t when);
+    //caller holds every shard lock
+    bool loadSnapshot(const std::string& filename);
+    bool loadLegacy(const std::string& filename);
+    //write all shards to filename via a temp file and rename; no locking, the
+    //caller holds the shard locks or is a forked child with a frozen copy
+    bool writeSnapshot(const std::string& filename);
+    uint64_t totalDirty();
+    //every change to a key goes through here, with the shard locked exclusively
+    void markDirty(Shard& shard,std::string_view key,uint64_t n=1){
+        shard.dirty.fetch_add(n,std::memory_order_relaxed);
+        if(!shard.watched.empty())touchWatched(shard,key);
+    }
+    void touchWatched(Shard& shard,std::string_view key);
+    void touchAllWatched(Shard& shard);
+    //pop due heap entries, deleting their keys; at most limit entries
+    size_t expireDue(Shard& shard,int64_t now,size_t limit);
+    bool expiresKeys() const{
+        return !loading.load(std::memory_order_acquire) && !replica.load(std::memory_order_acquire);
+    }
+    //record an access for LRU/LFU eviction
+    void touch(RedisObject& obj) const;
+    //add the eviction candidates of one shard to the pool; both callers
+    //hold evictionMutex
+    void sampleShard(Shard& shard,uint32_t now);
+    void poolInsert(uint64_t score,std::string_view key);
+    //lookups return nullptr for missing or expired keys. the read variant works
+    //under a shared lock and leaves expired keys in place, the write variant
+    //needs the exclusive lock and deletes them (see setReplica for when they
+    //stay), noting them for takeExpired. both count as an access for
+    //eviction. typed variants throw WrongTypeError when the key holds
+    //another type.
+    const RedisObject* lookupRead(Shard& shard,const std::string& key) const;
+    const RedisObject* lookupRead(Shard& shard,const std::string& key,ObjectType type) const;
+    RedisObject* lookupWrite(Shard& shard,const std::string& key);
+    RedisObject* lookupWrite(Shard& shard,const std::string& key,ObjectType type);
 
 };
 
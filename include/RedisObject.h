@@ -0,0 +1,144 @@
+#ifndef REDIS_OBJECT_H
+#define REDIS_OBJECT_H
+
+#include<string>
+#include<vector>
+#include<memory>
+#include<variant>
+#include<cstdint>
+#include<ctime>
+#include "ListPack.h"
+#include "QuickList.h"
+#include "Dict.h"
+#include "CompactString.h"
+#include "SortedSet.h"
+#include "IntSet.h"
+
+//logical type of a value, what TYPE reports
+enum class ObjectType:uint8_t{ String, List, Hash, ZSet, Set };
+//physical representation behind the type; a type may have several encodings.
+//small lists, hashes and sorted sets start out as one ListPack and are
+//converted to a QuickList / HashTable / SkipList once they outgrow the
+//limits in EncodingLimits. sets of integers start out as an IntSet and
+//become a HashTable the same way
+enum class ObjectEncoding:uint8_t{ Raw, ListPack, QuickList, HashTable, SkipList, IntSet };
+
+using HashValue=Dict<CompactString>;
+//a set member has no value
+struct SetMember{};
+using SetValue=Dict<SetMember>;
+
+//when a listpack encoded object is converted to its big encoding
+struct EncodingLimits{
+    size_t listMaxListpackBytes=8*1024;     //list-max-listpack-size -2
+    size_t hashMaxListpackEntries=128;      //hash-max-listpack-entries
+    size_t hashMaxListpackValue=64;         //hash-max-listpack-value
+    size_t zsetMaxListpackEntries=128;      //zset-max-listpack-entries
+    size_t zsetMaxListpackValue=64;         //zset-max-listpack-value
+    size_t setMaxIntsetEntries=512;         //set-max-intset-entries
+};
+
+//LFU counter of a new object, so it is not the first to be evicted
+static const uint8_t LFU_INIT_VAL=5;
+
+//clock of the access times kept for eviction: whole seconds of the coarse
+//monotonic clock, cheap enough to read on every lookup
+inline uint32_t lruClock(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
+    return static_cast<uint32_t>(ts.tv_sec);
+}
+
+//the single value stored per key in the keyspace: type and encoding tags,
+//the eviction metadata, the key's expiry and the payload itself. strings are
+//CompactStrings and the rarer QuickList and SortedSet are boxed, which keeps
+//the object at 64 bytes (112 with an inline QuickList and std::string)
+struct RedisObject{
+    ObjectType type;
+    ObjectEncoding encoding;
+    //access bookkeeping for maxmemory eviction; fits in what would otherwise
+    //be padding before expireAt. readers update it under the shared lock, so
+    //it is only accessed through relaxed atomic builtins
+    uint8_t lfu;            //logarithmic access counter (allkeys-lfu)
+    uint32_t lru;           //last access, lruClock() seconds
+    int64_t expireAt=-1;    //absolute unix time in ms, -1 when the key never expires
+    std::variant<CompactString,ListPack,std::unique_ptr<QuickList>,HashValue,std::unique_ptr<SortedSet>,IntSet,SetValue> value;
+
+    static RedisObject makeString(std::string_view s){
+        return RedisObject{ObjectType::String,ObjectEncoding::Raw,LFU_INIT_VAL,lruClock(),-1,CompactString(s)};
+    }
+    static RedisObject makeList(){
+        return RedisObject{ObjectType::List,ObjectEncoding::ListPack,LFU_INIT_VAL,lruClock(),-1,ListPack()};
+    }
+    static RedisObject makeHash(){
+        return RedisObject{ObjectType::Hash,ObjectEncoding::ListPack,LFU_INIT_VAL,lruClock(),-1,ListPack()};
+    }
+    static RedisObject makeZSet(){
+        return RedisObject{ObjectType::ZSet,ObjectEncoding::ListPack,LFU_INIT_VAL,lruClock(),-1,ListPack()};
+    }
+    static RedisObject makeSet(){
+        return RedisObject{ObjectType::Set,ObjectEncoding::IntSet,LFU_INIT_VAL,lruClock(),-1,IntSet()};
+    }
+
+    uint32_t accessTime() const { return __atomic_load_n(&lru,__ATOMIC_RELAXED); }
+    uint8_t accessCount() const { return __atomic_load_n(&lfu,__ATOMIC_RELAXED); }
+    void setAccess(uint32_t time,uint8_t count){
+        //skip the store when nothing changed so hot keys read by many
+        //threads do not keep bouncing their cache line
+        if(accessTime()!=time)__atomic_store_n(&lru,time,__ATOMIC_RELAXED);
+        if(accessCount()!=count)__atomic_store_n(&lfu,count,__ATOMIC_RELAXED);
+    }
+
+    CompactString& str(){ return std::get<CompactString>(value); }
+    ListPack& listpack(){ return std::get<ListPack>(value); }
+    QuickList& quicklist(){ return *std::get<std::unique_ptr<QuickList>>(value); }
+    HashValue& hash(){ return std::get<HashValue>(value); }
+    SortedSet& zset(){ return *std::get<std::unique_ptr<SortedSet>>(value); }
+    IntSet& intset(){ return std::get<IntSet>(value); }
+    SetValue& set(){ return std::get<SetValue>(value); }
+    const CompactString& str() const { return std::get<CompactString>(value); }
+    const ListPack& listpack() const { return std::get<ListPack>(value); }
+    const QuickList& quicklist() const { return *std::get<std::unique_ptr<QuickList>>(value); }
+    const HashValue& hash() const { return std::get<HashValue>(value); }
+    const SortedSet& zset() const { return *std::get<std::unique_ptr<SortedSet>>(value); }
+    const IntSet& intset() const { return std::get<IntSet>(value); }
+    const SetValue& set() const { return std::get<SetValue>(value); }
+
+    //run fn on the list payload whichever encoding it has; ListPack and
+    //QuickList share the list operations
+    template<typename F>
+    decltype(auto) visitList(F&& fn){
+        if(encoding==ObjectEncoding::ListPack)return fn(listpack());
+        return fn(quicklist());
+    }
+    template<typename F>
+    decltype(auto) visitList(F&& fn) const{
+        if(encoding==ObjectEncoding::ListPack)return fn(listpack());
+        return fn(quicklist());
+    }
+
+    const char* typeName() const{
+        switch(type){
+            case ObjectType::String: return "string";
+            case ObjectType::List: return "list";
+            case ObjectType::Hash: return "hash";
+            case ObjectType::ZSet: return "zset";
+            case ObjectType::Set: return "set";
+        }
+        return "none";
+    }
+    //what OBJECT ENCODING reports
+    const char* encodingName() const{
+        switch(encoding){
+            case ObjectEncoding::Raw: return "raw";
+            case ObjectEncoding::ListPack: return "listpack";
+            case ObjectEncoding::QuickList: return "quicklist";
+            case ObjectEncoding::HashTable: return "hashtable";
+            case ObjectEncoding::SkipList: return "skiplist";
+            case ObjectEncoding::IntSet: return "intset";
+        }
+        return "none";
+    }
+};
+
+#endif
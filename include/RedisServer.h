@@ -3,20 +3,50 @@
 
 #include<string>
 #include<atomic>
+#include<vector>
+#include<memory>
+#include<cstdint>
+#include "EventLoop.h"
+
+//snapshot rule: bgsave once at least `changes` writes are at least `seconds` old
+struct SavePoint{
+    int64_t seconds;
+    uint64_t changes;
+};
 
 class RedisServer{
 public:
-    RedisServer(int port);
+    //backlog: pending connections the kernel queues before accept()
+    //maxClients: size of the connection table, extra clients are rejected
+    //ioThreads: number of event loops serving clients in parallel
+    //savePoints: automatic bgsave rules, empty disables them
+    RedisServer(int port,int backlog=511,size_t maxClients=10000,int ioThreads=1,
+                std::vector<SavePoint> savePoints=defaultSavePoints());
+    static std::vector<SavePoint> defaultSavePoints();
     void run();
     void shutdown();
+    //async-signal-safe: only flips the running flag, the event loops do the rest
+    void stop();
 
 private:
     int port;
+    int backlog;
+    size_t maxClients;
+    int ioThreads;
+    std::vector<SavePoint> savePoints;
+    int64_t lastBgsaveTry=0;    //unix seconds, throttles retries after a failed save
     int server_socket;
-    std::atomic<bool> running; 
+    std::atomic<bool> running;
+    std::atomic<size_t> clientCount{0};
+    std::vector<std::unique_ptr<EventLoop>> loops;
 
     void setupSignalHandler();
-    
+    //periodic background work (active expiry, bgsave bookkeeping), run
+    //CRON_HZ times a second on its own thread while the server is up
+    void cron();
+    //start a bgsave if any save point is satisfied
+    void checkSavePoints();
+
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,156 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include<string>
+#include<vector>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<atomic>
+#include<cstdint>
+#include<sys/types.h>
+
+/*
+Master-replica replication, modelled on redis' PSYNC protocol.
+
+Master side: once a replica has connected, every write is appended to the
+backlog, a ring of --repl-backlog-size bytes holding the tail of the write
+stream, in the same RESP form and order as the aof gets it. Stream bytes are
+numbered from 1; master_repl_offset is the number of the last one. A replica
+sends PSYNC <replid> <offset>, the next byte it wants. If replid is ours and
+that byte is still in the backlog, it gets +CONTINUE and the stream from
+there. Otherwise it gets +FULLRESYNC <replid> <offset> and a snapshot forked
+at exactly that offset, then the stream. One sender thread serves every
+replica straight from the backlog, so a replica costs no buffer of its own;
+one that falls further behind than the backlog holds is dropped and comes
+back for a full resync.
+
+Replica side: a link thread keeps the connection to the master, loads the
+snapshot and applies the stream through a RedisCommandHandler of its own,
+acknowledging its offset every second. After a drop it reconnects and asks
+to continue where it stopped. Clients may read from a replica; writes are
+refused with -READONLY.
+
+A replica does not serve replicas of its own.
+*/
+class Replication{
+public:
+    static Replication& getInstance();
+    //call once before clients are served
+    void configure(int listeningPort,size_t backlogSize);
+    //close the replica links, stop the threads, kill a snapshot child
+    void shutdown();
+
+    //master side
+    //true once the write stream is recorded; writers check it under their
+    //aof key stripes, which a full sync holds while it forks
+    bool active() const { return backlogOn.load(std::memory_order_acquire); }
+    //append one write to the stream; caller holds the stripes of its keys
+    void feed(const std::vector<std::string>& argv);
+    //append several writes as one piece of the stream (an EXEC's batch)
+    void feedAll(const std::vector<std::vector<std::string>>& cmds);
+    //take over a client connection that sent PSYNC or SYNC: argv is that
+    //command, listeningPort what it announced with REPLCONF (0 if nothing)
+    void addReplica(int fd,const std::vector<std::string>& argv,int listeningPort);
+
+    //replica side
+    bool isReplica() const { return replica.load(std::memory_order_acquire); }
+    //REPLICAOF host port: drop any replicas and follow that master
+    void replicaOf(const std::string& host,int port);
+    //REPLICAOF NO ONE: keep the dataset, become a master with a new replid
+    void promote();
+
+    //what INFO replication reports
+    struct ReplicaInfo{
+        std::string ip;
+        int port;
+        const char* state;
+        uint64_t ackOffset;
+        int64_t lagSeconds;
+    };
+    struct Status{
+        bool replica;
+        std::string masterHost;
+        int masterPort;
+        bool linkUp;
+        bool syncInProgress;
+        int64_t lastIoSecondsAgo;
+        std::string replid;
+        uint64_t offset;        //master_repl_offset, or what a replica applied
+        bool backlogActive;
+        size_t backlogSize;
+        uint64_t backlogFirstByte;
+        uint64_t backlogHistlen;
+        std::vector<ReplicaInfo> replicas;
+    };
+    Status status();
+
+private:
+    Replication();
+    Replication(const Replication&)=delete;
+    Replication& operator=(const Replication&)=delete;
+
+    struct Replica;
+    int listeningPort=0;
+
+    //the stream: backlog ring and offsets, guarded by backlogMutex
+    std::mutex backlogMutex;
+    std::atomic<bool> backlogOn{false};
+    std::vector<char> backlog;
+    size_t backlogSize=1024*1024;
+    uint64_t masterOffset=0;    //bytes fed since the replid was created
+    uint64_t histlen=0;         //bytes of the stream the ring still holds
+    std::string replid;
+
+    //replicas and the sender thread, guarded by mutex
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Replica>> replicas;
+    std::thread sender;
+    bool stopSender=false;
+    int wakeFd=-1;
+    std::atomic<bool> wakePending{false};
+    pid_t syncChild=-1;         //snapshot for the replicas waiting on a full sync
+    uint64_t syncOffset=0;
+    std::string syncFile;
+    int64_t lastPing=0;
+
+    //replica side, guarded by mutex; roleMutex serialises role changes
+    std::mutex roleMutex;
+    std::atomic<bool> replica{false};
+    std::string masterHost;
+    int masterPort=0;
+    std::string masterReplid;   //what the link continues from after a drop
+    std::atomic<uint64_t> replOffset{0};
+    std::atomic<bool> linkUp{false};
+    std::atomic<bool> syncing{false};
+    std::atomic<int64_t> lastIo{0};
+    std::thread link;
+    std::atomic<bool> stopLink{false};
+
+    static std::string newReplid();
+    void wake();
+    //copy serialized commands into the ring and wake the sender
+    void append(const std::string& cmds);
+    //up to max stream bytes from offset on into out (empty when there is
+    //nothing new); false once offset has left the backlog
+    bool readBacklog(uint64_t offset,std::string& out,size_t max);
+    //caller holds backlogMutex
+    bool inBacklogLocked(uint64_t offset) const;
+    //start or join the snapshot child for a full sync; caller holds mutex
+    bool startFullSync();
+    void senderLoop();
+    void serveReplicas(int64_t now);
+    bool sendStream(Replica& r);
+    bool sendSnapshot(Replica& r);
+    bool readAcks(Replica& r,int64_t now);
+    void reapSyncChild();
+    void dropReplicas();
+
+    void stopLinkThread();
+    void linkLoop(std::string host,int port);
+    //connect, handshake and sync, then apply the stream until the link
+    //breaks; false when it failed before the stream started
+    bool syncWithMaster(const std::string& host,int port);
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef REPLY_BUFFER_H
+#define REPLY_BUFFER_H
+
+#include<string>
+#include<string_view>
+#include<deque>
+#include<memory>
+#include<cstddef>
+
+/*
+Output queue of one connection. Replies are serialized as RESP straight into
+the tail chunk, so handlers never build intermediate strings. A bulk value of
+LARGE_VALUE bytes or more that is handed over by rvalue becomes a chunk of its
+own instead of being copied; writeTo() passes every chunk to writev as a
+separate iovec and remembers how far into the first chunk the kernel got, so
+a short write resumes exactly where it stopped. A published message is
+queued by reference (addShared): every subscriber's buffer points at the
+same serialized bytes.
+*/
+class ReplyBuffer{
+public:
+    static const size_t LARGE_VALUE=16*1024;
+
+    //position in the buffer, taken before a command runs to look at its reply
+    struct Mark{
+        size_t chunk;
+        size_t offset;
+    };
+
+    void addSimple(std::string_view s);        //+s
+    void addError(std::string_view msg);       //-msg, msg carries its own ERR prefix
+    void addInteger(long long v);
+    void addBulk(std::string_view v);
+    void addBulk(std::string&& v);
+    void addBulk(const char* v){ addBulk(std::string_view(v)); }
+    void addNull();                            //$-1
+    void addNullArray();                       //*-1
+    void addArrayHeader(size_t n);
+    //an already serialized reply, shared with other buffers rather than copied
+    void addShared(std::shared_ptr<const std::string> msg);
+
+    bool empty() const { return chunks.empty(); }
+    //bytes still waiting for the socket
+    size_t pending() const;
+    void clear();
+
+    Mark mark() const;
+    //up to n bytes of the reply that starts at m. a reply's type byte and
+    //header are always written together into one chunk, so short replies
+    //like ":0" or "$-1" can be recognised from here
+    std::string_view peek(const Mark& m,size_t n) const;
+
+    //write as much as the socket takes; false on a dead socket. whatever the
+    //kernel did not accept stays queued for the next call
+    bool writeTo(int fd);
+
+private:
+    //owns its bytes, or references a message queued to other buffers too
+    struct Chunk{
+        std::string own;
+        std::shared_ptr<const std::string> shared;
+        std::string_view view() const { return shared?std::string_view(*shared):std::string_view(own); }
+    };
+    std::deque<Chunk> chunks;
+    size_t sent=0;          //bytes of chunks.front() already written
+    size_t closedBytes=0;   //bytes of every chunk but an open tail
+    bool tailOpen=false;    //chunks.back() takes inline appends (not a moved-in value)
+    std::string spare;      //drained inline chunk kept for its capacity
+
+    std::string& tail();
+    //stop appending to the tail, a chunk of its own follows
+    void closeTail();
+    void appendHeader(char type,long long v);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef RESP_PARSER_H
+#define RESP_PARSER_H
+
+#include<string>
+#include<vector>
+#include<cstddef>
+
+//incremental RESP request parser.
+//one instance lives with each connection; when a command is only partly in the
+//buffer the parser remembers how far it got, so the next read resumes instead
+//of rescanning from the start.
+class RespParser{
+public:
+    enum class Status{ Complete, Incomplete, Error };
+
+    //parse one command starting at buf[pos]. on Complete argv holds the command
+    //(possibly empty for a blank inline line) and pos points past it. on
+    //Incomplete pos may have advanced past headers already consumed; keep
+    //buf[pos..] and call again once more bytes arrived.
+    Status parse(const std::string& buf,size_t& pos,std::vector<std::string>& argv);
+    //human readable reason for the last Error
+    const std::string& error() const { return errorMsg; }
+    void reset();
+
+private:
+    long multibulkLen=0;   //array elements still to read, 0 when between commands
+    long bulkLen=-1;       //length of the bulk string being read, -1 before its header
+    size_t argc=0;         //arguments stored for the current command
+    std::string errorMsg;
+
+    Status parseInline(const std::string& buf,size_t& pos,std::vector<std::string>& argv);
+    Status fail(const std::string& msg);
+    void storeArg(std::vector<std::string>& argv,const char* data,size_t len);
+};
+
+//one-shot helper: parse the first command contained in input
+std::vector<std::string> ParseRespCommand(const std::string& input);
+
+#endif
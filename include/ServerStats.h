@@ -0,0 +1,106 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include<atomic>
+#include<cstdint>
+#include<cstddef>
+#include<memory>
+#include<mutex>
+#include<vector>
+#include "LatencyHistogram.h"
+
+/*
+Counters behind INFO and LATENCY HISTOGRAM. Every thread that serves clients
+gets its own ThreadStats on first use and is its only writer, so the request
+path never takes a lock or a contended cache line; readers add up all
+threads' blocks. Single-writer counters are bumped with a relaxed load and
+store rather than fetch_add.
+*/
+inline void bumpCounter(std::atomic<uint64_t>& c,uint64_t n=1){
+    c.store(c.load(std::memory_order_relaxed)+n,std::memory_order_relaxed);
+}
+
+struct CommandMetrics{
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> nsec{0};
+    std::atomic<uint64_t> rejected{0};  //refused before running (arity, maxmemory)
+    std::atomic<uint64_t> failed{0};    //ran and replied with an error
+    LatencyHistogram latency;
+};
+
+struct ThreadStats{
+    static const size_t MAX_COMMANDS=128;
+    std::atomic<uint64_t> commands{0};
+    std::atomic<uint64_t> connections{0};       //accepted
+    std::atomic<uint64_t> disconnections{0};
+    std::atomic<uint64_t> rejectedConnections{0};
+    std::atomic<uint64_t> netInput{0};
+    std::atomic<uint64_t> netOutput{0};
+    //allocated by the owning thread the first time it runs a command
+    std::atomic<CommandMetrics*> perCommand[MAX_COMMANDS]={};
+
+    ~ThreadStats();
+    CommandMetrics& command(size_t id);
+};
+
+class ServerStats{
+public:
+    static ServerStats& getInstance();
+    //the calling thread's counters
+    static ThreadStats& local();
+
+    struct Totals{
+        uint64_t commands=0;
+        uint64_t connections=0;
+        uint64_t disconnections=0;
+        uint64_t rejectedConnections=0;
+        uint64_t netInput=0;
+        uint64_t netOutput=0;
+    };
+    Totals totals() const;
+    //sum of command id over all threads; latency (if given) receives the merged histogram
+    struct CommandTotals{
+        uint64_t calls=0;
+        uint64_t nsec=0;
+        uint64_t rejected=0;
+        uint64_t failed=0;
+    };
+    CommandTotals command(size_t id,std::vector<uint64_t>* latency=nullptr) const;
+
+    //static facts for INFO server/clients, set once before the loops start
+    void setServerInfo(int port,int ioThreads,size_t maxClients);
+    int port() const { return tcpPort; }
+    int ioThreads() const { return threadCount; }
+    size_t maxClients() const { return clientLimit; }
+    int64_t startTimeMs() const { return startMs; }
+
+    //called by the cron; ops/sec is averaged over the last SAMPLES samples
+    void sample(int64_t nowMs);
+    double opsPerSec() const;
+
+private:
+    ServerStats()=default;
+    ServerStats(const ServerStats&)=delete;
+    ServerStats& operator=(const ServerStats&)=delete;
+
+    static const size_t SAMPLES=16;
+
+    int tcpPort=0;
+    int threadCount=1;
+    size_t clientLimit=0;
+    int64_t startMs=0;
+
+    mutable std::mutex registryMutex;   //only taken to register a thread or to read
+    std::vector<std::unique_ptr<ThreadStats>> threads;
+
+    std::mutex sampleMutex;
+    int64_t lastSampleMs=0;
+    uint64_t lastSampleCommands=0;
+    double samples[SAMPLES]={};
+    size_t sampleIdx=0;
+    std::atomic<double> instantaneousOps{0};
+
+    ThreadStats& registerThread();
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include<cstddef>
+#include<cstdint>
+#include<mutex>
+
+/*
+Size-classed slab allocator for the small blocks the keyspace is made of:
+Dict entries and the heap part of CompactStrings. A slab is SLAB_SIZE bytes
+aligned to its size and cut into chunks of one class; its header records
+the class and the owning arena, so a chunk is freed by masking its address.
+Chunks carry no header of their own and classes are 8 bytes apart up to
+128 (16 beyond), so a 20 byte string costs 24 bytes where malloc takes 32,
+and entries of one size sit densely together. An emptied slab is returned
+as soon as its class has another one with room.
+
+Each thread allocates from one of ARENAS arenas, picked round robin on its
+first allocation and each with its own mutex, so io threads rarely contend.
+A chunk freed by another thread goes back to the arena owning its slab.
+Requests over MAX_SIZE fall through to operator new.
+
+used_memory counts chunks, not slabs, the way redis counts what jemalloc
+hands out: evicting a key lowers it at once, and the room left in slabs
+shows up in MEMORY STATS as slab.fragmentation.
+*/
+class SlabAllocator{
+public:
+    static const size_t SLAB_SIZE=64*1024;
+    static const size_t MAX_SIZE=256;
+
+    static SlabAllocator& getInstance();
+    void* allocate(size_t size);
+    //size must be the one passed to allocate
+    void deallocate(void* p,size_t size);
+
+    struct Stats{
+        size_t slabs=0;
+        size_t activeBytes=0;   //slabs held, in bytes
+        size_t usedBytes=0;     //chunks handed out, in bytes
+        size_t chunks=0;
+    };
+    Stats stats();
+
+private:
+    SlabAllocator();
+    SlabAllocator(const SlabAllocator&)=delete;
+    SlabAllocator& operator=(const SlabAllocator&)=delete;
+
+    static const size_t CLASSES=24;
+    static const size_t ARENAS=8;
+
+    struct Slab;
+    struct SizeClass{
+        Slab* partial=nullptr;  //slabs with a free chunk, doubly linked
+        size_t slabs=0;
+        size_t used=0;          //chunks handed out
+    };
+    struct alignas(64) Arena{
+        std::mutex mutex;
+        SizeClass classes[CLASSES];
+    };
+    Arena arenas[ARENAS];
+
+    static size_t classIndex(size_t size);
+    static size_t classSize(size_t index);
+    Arena& localArena();
+    Slab* newSlab(size_t arena,size_t cls);
+    static void unlink(SizeClass& sc,Slab* slab);
+    static void pushFront(SizeClass& sc,Slab* slab);
+    //fork handlers: hold every arena across fork() so the child never sees
+    //a free list half updated
+    static void lockAll();
+    static void unlockAll();
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef SLOW_LOG_H
+#define SLOW_LOG_H
+
+#include<atomic>
+#include<cstdint>
+#include<deque>
+#include<mutex>
+#include<string>
+#include<vector>
+
+//commands that ran longer than a threshold, newest first, as in redis'
+//SLOWLOG. the threshold test is one relaxed load; the mutex is only taken
+//for commands that actually get logged
+class SlowLog{
+public:
+    struct Entry{
+        uint64_t id;
+        int64_t time;       //unix seconds
+        int64_t durationUs;
+        std::vector<std::string> argv;
+    };
+    //argv is cut to this many arguments, each to MAX_ARG_LEN bytes
+    static const size_t MAX_ARGC=32;
+    static const size_t MAX_ARG_LEN=128;
+
+    static SlowLog& getInstance();
+    //slowlog-log-slower-than: negative disables the log, 0 logs every command
+    void setThreshold(int64_t usec){ threshold=usec; }
+    void setMaxLen(size_t n);
+    bool slower(int64_t durationUs) const{
+        int64_t t=threshold.load(std::memory_order_relaxed);
+        return t>=0 && durationUs>=t;
+    }
+    void record(const std::vector<std::string>& argv,int64_t durationUs);
+    //at most count entries, newest first
+    std::vector<Entry> get(size_t count);
+    size_t len();
+    void reset();
+
+private:
+    SlowLog()=default;
+    SlowLog(const SlowLog&)=delete;
+    SlowLog& operator=(const SlowLog&)=delete;
+
+    std::atomic<int64_t> threshold{10000};
+    std::mutex mutex;
+    std::deque<Entry> entries;
+    size_t maxLen=128;
+    uint64_t nextId=0;
+};
+
+#endif
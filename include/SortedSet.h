@@ -0,0 +1,94 @@
+#ifndef SORTED_SET_H
+#define SORTED_SET_H
+
+#include<string_view>
+#include<cstddef>
+#include<cstdint>
+#include "CompactString.h"
+#include "Dict.h"
+
+//ZRANGEBYSCORE / ZCOUNT bounds; "(1.5" makes a bound exclusive
+struct ScoreRange{
+    double min,max;
+    bool minExclusive=false,maxExclusive=false;
+    bool aboveMin(double v) const { return minExclusive?v>min:v>=min; }
+    bool belowMax(double v) const { return maxExclusive?v<max:v<=max; }
+    bool contains(double v) const { return aboveMin(v) && belowMax(v); }
+    //true when no score can fall inside
+    bool empty() const { return min>max || (min==max && (minExclusive || maxExclusive)); }
+};
+
+/*
+Skiplist of (score, member) pairs ordered by score, ties by member bytes, as
+in redis' zskiplist. Every forward link also records its span, the number of
+level 0 steps it jumps, so the rank of an element is the sum of the spans on
+the way down to it and an element is found by rank in O(log n) like by
+score. Level 0 is doubly linked for the reverse walks of ZREVRANGE. Nodes
+are sized to their height and come from the SlabAllocator.
+*/
+class SkipList{
+public:
+    static const int MAX_LEVEL=32;
+
+    struct Node{
+        struct Level{
+            Node* forward;
+            size_t span;
+        };
+        CompactString member;
+        double score;
+        Node* backward;
+        int height;
+        Level level[1];         //height entries; the node is allocated to fit
+        Node* next() const { return level[0].forward; }
+        Node* prev() const { return backward; }
+    };
+
+    SkipList();
+    ~SkipList();
+    SkipList(const SkipList&)=delete;
+    SkipList& operator=(const SkipList&)=delete;
+
+    size_t size() const { return length; }
+    Node* first() const { return header->level[0].forward; }
+    Node* last() const { return tail; }
+    //bytes of all nodes, the members' own heap blocks not included
+    size_t bytes() const { return nodeBytes; }
+
+    //member must not be in the list yet
+    Node* insert(double score,std::string_view member);
+    //false when the element is not there
+    bool erase(double score,std::string_view member);
+    //move an element to newScore; returns its (possibly new) node
+    Node* updateScore(double score,std::string_view member,double newScore);
+    //1-based rank, 0 when the element is not there
+    size_t rank(double score,std::string_view member) const;
+    //element at a 1-based rank, nullptr when out of range
+    Node* byRank(size_t rank) const;
+    //first / last element inside the range, nullptr when none is
+    Node* firstInRange(const ScoreRange& range) const;
+    Node* lastInRange(const ScoreRange& range) const;
+
+private:
+    Node* header;
+    Node* tail=nullptr;
+    size_t length=0;
+    int levels=1;           //height of the tallest node
+    size_t nodeBytes=0;
+
+    static size_t allocSize(int height){ return sizeof(Node)+(height-1)*sizeof(Node::Level); }
+    static Node* newNode(int height,double score,std::string_view member);
+    void freeNode(Node* n);
+    static int randomLevel();
+    //unlink x, update[i] being its predecessor on level i
+    void unlink(Node* x,Node** update);
+};
+
+//the skiplist encoding of a big sorted set: the list keeps the order, the
+//dict maps each member to its score for ZSCORE and ZADD's lookups
+struct SortedSet{
+    Dict<double> dict;
+    SkipList list;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef STRING_MATCH_H
+#define STRING_MATCH_H
+
+#include<string_view>
+
+//glob-style matching as KEYS, SCAN MATCH and HSCAN MATCH use it:
+//  *       any run of characters, including none
+//  ?       exactly one character
+//  [abc]   one of the listed characters; [^abc] none of them, [a-z] a range
+//  \x      the character x itself
+//an unterminated [ class ends at the end of the pattern
+bool stringMatch(std::string_view pattern,std::string_view str);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include<string>
+#include<vector>
+#include<utility>
+#include<cstdint>
+
+/*
+MULTI/EXEC state of one connection. Between MULTI and EXEC commands are only
+checked and queued; EXEC runs the queue as one batch, holding the shards of
+every key involved, so no other client sees it half applied, and answers
+with one array reply. WATCHed keys are registered with the database, which
+bumps a key's version on every change; EXEC compares the versions first and
+runs nothing if one moved.
+*/
+struct MultiState{
+    bool active=false;      //between MULTI and EXEC/DISCARD
+    bool aborted=false;     //a command was refused while queuing: EXEC fails
+    std::vector<std::vector<std::string>> queued;
+    //WATCHed keys with the versions they had then; kept across EXEC only
+    //until it has run
+    std::vector<std::pair<std::string,uint64_t>> watched;
+};
+
+#endif
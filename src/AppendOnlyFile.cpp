@@ -0,0 +1,424 @@
+#include "../include/AppendOnlyFile.h"
+#include "../include/RedisCommandHandler.h"
+#include "../include/RedisDatabase.h"
+#include "../include/RespParser.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>         // for open()
+#include <unistd.h>        // for write(), fdatasync(), close()
+#include <dirent.h>        // for opendir(), readdir()
+#include <sys/stat.h>      // for stat()
+#include <sys/wait.h>      // for waitpid()
+
+static const char AOF_PREFIX[]="appendonly.aof.";
+static const char BASE_SUFFIX[]=".base.rdb";
+static const char INCR_SUFFIX[]=".incr.aof";
+//incr files are replayed through a buffer of this size
+static const size_t REPLAY_CHUNK=1024*1024;
+//an automatic rewrite starts once the incr file is this many percent of the
+//base and at least AUTO_REWRITE_MIN_SIZE bytes (auto-aof-rewrite-* in redis)
+static const uint64_t AUTO_REWRITE_PERCENTAGE=100;
+static const uint64_t AUTO_REWRITE_MIN_SIZE=64*1024*1024;
+//the flush buffer is released instead of kept when it grew beyond this
+static const size_t BUF_KEEP=1024*1024;
+
+static std::string baseName(uint64_t gen){
+    return AOF_PREFIX+std::to_string(gen)+BASE_SUFFIX;
+}
+static std::string incrName(uint64_t gen){
+    return AOF_PREFIX+std::to_string(gen)+INCR_SUFFIX;
+}
+
+//"appendonly.aof.<gen><suffix>" -> gen, 0 when name does not match
+static uint64_t parseGen(const std::string& name,const char* suffix){
+    size_t prefixLen=sizeof(AOF_PREFIX)-1,suffixLen=std::strlen(suffix);
+    if(name.size()<=prefixLen+suffixLen || name.compare(0,prefixLen,AOF_PREFIX)!=0 ||
+       name.compare(name.size()-suffixLen,suffixLen,suffix)!=0)
+        return 0;
+    uint64_t gen=0;
+    for(size_t i=prefixLen;i<name.size()-suffixLen;i++){
+        if(name[i]<'0' || name[i]>'9')return 0;
+        gen=gen*10+(name[i]-'0');
+    }
+    return gen;
+}
+
+//generations of the base and incr files in the working directory, ascending
+static void scanFiles(std::vector<uint64_t>& bases,std::vector<uint64_t>& incrs){
+    DIR* dir=opendir(".");
+    if(!dir)return;
+    while(dirent* e=readdir(dir)){
+        std::string name=e->d_name;
+        if(uint64_t g=parseGen(name,BASE_SUFFIX))bases.push_back(g);
+        else if(uint64_t g=parseGen(name,INCR_SUFFIX))incrs.push_back(g);
+    }
+    closedir(dir);
+    std::sort(bases.begin(),bases.end());
+    std::sort(incrs.begin(),incrs.end());
+}
+
+static uint64_t fileSize(const std::string& name){
+    struct stat st;
+    return stat(name.c_str(),&st)==0?st.st_size:0;
+}
+
+static bool writeAll(int fd,const char* p,size_t n){
+    while(n>0){
+        ssize_t w=::write(fd,p,n);
+        if(w<0){
+            if(errno==EINTR)continue;
+            return false;
+        }
+        p+=w;
+        n-=w;
+    }
+    return true;
+}
+
+//singleton accessor
+AppendOnlyFile& AppendOnlyFile::getInstance(){
+    static AppendOnlyFile instance;
+    return instance;
+}
+
+bool AppendOnlyFile::open(FsyncPolicy fsyncPolicy,RedisCommandHandler& handler){
+    policy=fsyncPolicy;
+    RedisDatabase& db=RedisDatabase::getInstance();
+    std::vector<uint64_t> bases,incrs;
+    scanFiles(bases,incrs);
+    if(bases.empty() && incrs.empty()){
+        //first start with the aof on: the rdb dump becomes generation 1's base
+        if(db.load(DUMP_FILENAME))
+            std::cout<<"Database Loaded From "<<DUMP_FILENAME<<"\n";
+        gen=1;
+        if(!db.dump(baseName(gen))){
+            std::cerr<<"Error writing "<<baseName(gen)<<"\n";
+            return false;
+        }
+    }else{
+        //a base is only renamed into place once complete, so the newest one
+        //is good; incr files from a failed rewrite are replayed on top of it.
+        //nothing expires meanwhile: every command finds its keys as they
+        //were when it ran, and keys past their ttl go once the cron runs
+        uint64_t baseGen=bases.empty()?0:bases.back();
+        db.setLoading(true);
+        if(baseGen>0 && !db.load(baseName(baseGen))){
+            std::cerr<<"Bad AOF base "<<baseName(baseGen)<<"\n";
+            db.setLoading(false);
+            return false;
+        }
+        for(uint64_t g:incrs){
+            if(g>=baseGen && !replay(incrName(g),handler)){
+                db.setLoading(false);
+                return false;
+            }
+        }
+        db.setLoading(false);
+        gen=std::max(baseGen,incrs.empty()?uint64_t(1):incrs.back());
+        std::cout<<"Database Loaded From "<<AOF_PREFIX<<gen<<"\n";
+    }
+    baseSize=fileSize(baseName(gen));
+    if(!openIncr(gen))return false;
+    on=true;
+    syncThread=std::thread([this](){ syncLoop(); });
+    return true;
+}
+
+bool AppendOnlyFile::openIncr(uint64_t generation){
+    int newFd=::open(incrName(generation).c_str(),O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+    if(newFd<0){
+        std::cerr<<"Error opening "<<incrName(generation)<<": "<<std::strerror(errno)<<"\n";
+        return false;
+    }
+    if(fd!=-1)::close(fd);
+    fd=newFd;
+    gen=generation;
+    incrSize=fileSize(incrName(generation));
+    return true;
+}
+
+//feed every command of an incr file straight to the command handler. a crash
+//in the middle of an append leaves a torn last command; it is cut off
+bool AppendOnlyFile::replay(const std::string& filename,RedisCommandHandler& handler){
+    int in=::open(filename.c_str(),O_RDONLY|O_CLOEXEC);
+    if(in<0)return false;
+    posix_fadvise(in,0,0,POSIX_FADV_SEQUENTIAL);
+    RespParser parser;
+    std::vector<std::string> argv;
+    ReplyBuffer discard;        //replies of replayed commands are dropped
+    std::string chunk;
+    size_t pos=0;
+    uint64_t consumed=0;        //file offset of chunk[0]
+    uint64_t commandStart=0;    //file offset of the command being parsed
+    uint64_t commands=0;
+    bool eof=false;
+    while(true){
+        RespParser::Status st=parser.parse(chunk,pos,argv);
+        if(st==RespParser::Status::Complete){
+            if(!argv.empty()){
+                handler.executeCommand(argv,discard);
+                discard.clear();
+            }
+            commands++;
+            commandStart=consumed+pos;
+            continue;
+        }
+        if(st==RespParser::Status::Error){
+            std::cerr<<"Bad AOF "<<filename<<" at offset "<<commandStart<<": "<<parser.error()<<"\n";
+            ::close(in);
+            return false;
+        }
+        if(eof)break;
+        //keep the partial command, refill behind it
+        chunk.erase(0,pos);
+        consumed+=pos;
+        pos=0;
+        size_t old=chunk.size();
+        chunk.resize(old+REPLAY_CHUNK);
+        ssize_t n;
+        do{ n=::read(in,&chunk[old],REPLAY_CHUNK); }while(n<0 && errno==EINTR);
+        if(n<0){
+            ::close(in);
+            return false;
+        }
+        chunk.resize(old+n);
+        if(n==0)eof=true;
+    }
+    ::close(in);
+    uint64_t total=consumed+chunk.size();
+    if(commandStart<total){
+        std::cerr<<"AOF "<<filename<<" ends in an incomplete command, truncating it at offset "<<commandStart<<"\n";
+        if(truncate(filename.c_str(),commandStart)<0)return false;
+    }
+    std::cout<<"Replayed "<<commands<<" commands from "<<filename<<"\n";
+    return true;
+}
+
+std::vector<std::unique_lock<std::mutex>> AppendOnlyFile::lockKeys(const std::vector<std::string>& tokens,size_t first,size_t last,size_t step){
+    //stripes are taken in ascending order so multi-key commands cannot deadlock
+    std::vector<size_t> idx;
+    for(size_t i=first;i<last && i<tokens.size();i+=step)
+        idx.push_back(std::hash<std::string>{}(tokens[i])%KEY_STRIPES);
+    std::sort(idx.begin(),idx.end());
+    idx.erase(std::unique(idx.begin(),idx.end()),idx.end());
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(idx.size());
+    for(size_t s:idx)locks.emplace_back(stripes[s]);
+    return locks;
+}
+
+std::vector<std::unique_lock<std::mutex>> AppendOnlyFile::lockAllKeys(){
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(KEY_STRIPES);
+    for(auto& m:stripes)locks.emplace_back(m);
+    return locks;
+}
+
+void AppendOnlyFile::feed(const std::vector<std::string>& argv){
+    std::lock_guard<std::mutex> lock(mutex);
+    appendLocked(argv);
+}
+
+void AppendOnlyFile::feedAll(const std::vector<std::vector<std::string>>& cmds){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const auto& argv:cmds)appendLocked(argv);
+}
+
+//bytes fed by the calling thread, see fedOnThisThread
+static thread_local uint64_t fedHere=0;
+
+uint64_t AppendOnlyFile::fedOnThisThread(){
+    return fedHere;
+}
+
+void AppendOnlyFile::appendLocked(const std::vector<std::string>& argv){
+    size_t before=buf.size();
+    buf+='*';
+    buf+=std::to_string(argv.size());
+    buf+="\r\n";
+    for(const auto& arg:argv){
+        buf+='$';
+        buf+=std::to_string(arg.size());
+        buf+="\r\n";
+        buf+=arg;
+        buf+="\r\n";
+    }
+    fedBytes.fetch_add(buf.size()-before,std::memory_order_release);
+    fedHere+=buf.size()-before;
+}
+
+void AppendOnlyFile::acquireFlusher(std::unique_lock<std::mutex>& lock){
+    flushed.wait(lock,[this](){ return !flushing; });
+    flushing=true;
+}
+
+void AppendOnlyFile::releaseFlusher(){
+    flushing=false;
+    flushed.notify_all();
+}
+
+bool AppendOnlyFile::flushLocked(std::unique_lock<std::mutex>& lock,bool sync){
+    //take everything queued so far; writers keep feeding into the other buffer
+    spare.swap(buf);
+    uint64_t target=writtenBytes.load(std::memory_order_relaxed)+spare.size();
+    int out=fd;
+    uint64_t goodSize=incrSize;
+    bool failed=writeError.load(std::memory_order_relaxed);
+    lock.unlock();
+    //a failed flush may have left part of a command behind; it is cut off
+    //again before retrying, in case the truncate after the failure failed too
+    bool ok=!failed || ftruncate(out,goodSize)==0;
+    if(ok)ok=writeAll(out,spare.data(),spare.size());
+    if(ok && sync)ok=fdatasync(out)==0;
+    int err=errno;
+    //never leave a torn command in the file for later appends to follow
+    if(!ok && ftruncate(out,goodSize)<0){
+        //the retry truncates again before it writes
+    }
+    lock.lock();
+    if(!ok){
+        if(!failed)std::cerr<<"Error writing the AOF: "<<std::strerror(err)<<"\n";
+        writeErrno.store(err,std::memory_order_relaxed);
+        writeError.store(true,std::memory_order_release);
+        //the bytes stay queued, ahead of whatever was fed meanwhile, and
+        //the offsets stay put until a flush gets them to disk
+        spare+=buf;
+        buf.swap(spare);
+        spare.clear();
+        return false;
+    }
+    if(failed)std::cerr<<"AOF writes succeeded again\n";
+    writeError.store(false,std::memory_order_release);
+    incrSize+=spare.size();
+    writtenBytes.store(target,std::memory_order_release);
+    if(sync)syncedBytes.store(target,std::memory_order_release);
+    spare.clear();
+    if(spare.capacity()>BUF_KEEP)std::string().swap(spare);
+    return true;
+}
+
+bool AppendOnlyFile::commit(){
+    if(!on)return true;
+    bool always=policy==FsyncPolicy::Always;
+    uint64_t target=fedBytes.load(std::memory_order_acquire);
+    std::atomic<uint64_t>& done=always?syncedBytes:writtenBytes;
+    if(done.load(std::memory_order_acquire)>=target)return true;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(flushing){
+        //without fsync there is no need to wait: the running flush or the
+        //next commit picks up whatever is still queued
+        if(!always)return true;
+        flushed.wait(lock);
+        if(done.load(std::memory_order_acquire)>=target)return true;
+    }
+    flushing=true;
+    bool ok=flushLocked(lock,always);
+    releaseFlusher();
+    return ok || !always;
+}
+
+void AppendOnlyFile::syncLoop(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopSync){
+        syncWake.wait_for(lock,std::chrono::seconds(1));
+        if(stopSync)break;
+        //everysec fsyncs here; every policy also writes out what a commit
+        //left behind while another flush was running
+        bool sync=policy==FsyncPolicy::EverySec &&
+                  syncedBytes.load(std::memory_order_relaxed)<fedBytes.load(std::memory_order_relaxed);
+        if(!sync && buf.empty())continue;
+        acquireFlusher(lock);
+        flushLocked(lock,sync);
+        releaseFlusher();
+    }
+}
+
+bool AppendOnlyFile::rewriteInProgress(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return childPid!=-1;
+}
+
+bool AppendOnlyFile::rewrite(){
+    if(!on)return false;
+    //no write command may run between switching incr files and the fork, so
+    //the child's snapshot holds exactly what the older incr files hold
+    auto keyLocks=lockAllKeys();
+    std::unique_lock<std::mutex> lock(mutex);
+    if(childPid!=-1)return false;
+    acquireFlusher(lock);
+    //what is still queued is in the snapshot already; it must not move to
+    //the next incr file, where it would be replayed a second time
+    if(!flushLocked(lock,true)){
+        releaseFlusher();
+        return false;
+    }
+    uint64_t next=gen+1;
+    bool ok=openIncr(next);
+    pid_t pid=ok?RedisDatabase::getInstance().forkSnapshot(baseName(next)):-1;
+    if(pid<0 && ok)std::cerr<<"Error forking the AOF rewrite child\n";
+    if(pid>=0){
+        childPid=pid;
+        childGen=next;
+    }
+    releaseFlusher();
+    return pid>=0;
+}
+
+void AppendOnlyFile::removeOlderThan(uint64_t generation){
+    std::vector<uint64_t> bases,incrs;
+    scanFiles(bases,incrs);
+    for(uint64_t g:bases)if(g<generation)unlink(baseName(g).c_str());
+    for(uint64_t g:incrs)if(g<generation)unlink(incrName(g).c_str());
+}
+
+void AppendOnlyFile::cron(){
+    if(!on)return;
+    std::unique_lock<std::mutex> lock(mutex);
+    if(childPid!=-1){
+        int status=0;
+        pid_t done=waitpid(childPid,&status,WNOHANG);
+        if(done==0)return;
+        childPid=-1;
+        if(done>0 && WIFEXITED(status) && WEXITSTATUS(status)==0){
+            baseSize=fileSize(baseName(childGen));
+            removeOlderThan(childGen);
+            std::cout<<"Background AOF rewrite finished successfully\n";
+        }else{
+            //the new incr file stays; it is replayed after the old ones
+            std::cerr<<"Background AOF rewrite failed\n";
+        }
+        return;
+    }
+    bool grown=incrSize>=AUTO_REWRITE_MIN_SIZE && incrSize*100>=baseSize*AUTO_REWRITE_PERCENTAGE;
+    lock.unlock();
+    if(grown && rewrite())
+        std::cout<<"Starting automatic rewriting of AOF\n";
+}
+
+void AppendOnlyFile::close(){
+    if(!on)return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopSync=true;
+    }
+    syncWake.notify_all();
+    if(syncThread.joinable())syncThread.join();
+    std::unique_lock<std::mutex> lock(mutex);
+    acquireFlusher(lock);
+    flushLocked(lock,true);
+    releaseFlusher();
+    if(childPid!=-1){
+        //an unfinished rewrite is abandoned; the incr files stay complete
+        kill(childPid,SIGKILL);
+        waitpid(childPid,nullptr,0);
+        unlink((baseName(childGen)+".tmp-"+std::to_string(childPid)).c_str());
+        childPid=-1;
+    }
+    ::close(fd);
+    fd=-1;
+    on=false;
+}
@@ -0,0 +1,395 @@
+#include "../include/EventLoop.h"
+#include "../include/AppendOnlyFile.h"
+#include "../include/ServerStats.h"
+#include "../include/RedisDatabase.h"
+#include "../include/Replication.h"
+#include <algorithm>
+#include <iostream>
+#include <cerrno>          // for errno
+#include <cstdlib>         // for atoi()
+#include <strings.h>       // for strcasecmp()
+#include <unistd.h>        // for close()
+#include <netinet/in.h>    // for IPPROTO_TCP
+#include <netinet/tcp.h>   // for TCP_NODELAY
+#include <sys/socket.h>    // for accept4(), recv(), send()
+#include <sys/epoll.h>     // for epoll_create1(), epoll_ctl(), epoll_wait()
+#include <sys/eventfd.h>   // for eventfd()
+#include <poll.h>          // for poll()
+
+//events handed back by a single epoll_wait call
+static const int MAX_EVENTS=1024;
+//how long epoll_wait sleeps before the loop re-checks the running flag (ms)
+static const int LOOP_TIMEOUT_MS=100;
+//bytes pulled from a socket per recv() call
+static const size_t READ_CHUNK=16*1024;
+//a client whose unparsed input grows past this is dropped
+static const size_t MAX_QUERY_BUFFER=1024UL*1024*1024;
+//idle input buffers bigger than this are released instead of kept around
+static const size_t INBUF_KEEP=64*1024;
+//a subscriber that lets this much output pile up is dropped, like redis'
+//client-output-buffer-limit pubsub hard limit
+static const size_t PUBSUB_OUTPUT_LIMIT=32*1024*1024;
+
+EventLoop::EventLoop(int listenFd,size_t maxClients,std::atomic<size_t>& clientCount,std::atomic<bool>& running)
+    :listenFd(listenFd),epoll_fd(-1),maxClients(maxClients),clientCount(clientCount),running(running),wakeFd(-1){}
+
+EventLoop::~EventLoop(){
+    if(epoll_fd!=-1)close(epoll_fd);
+    if(wakeFd!=-1)close(wakeFd);
+}
+
+bool EventLoop::init(){
+    epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd<0){
+        std::cerr<<"Error Creating Epoll Instance\n";
+        return false;
+    }
+    //EPOLLEXCLUSIVE: a new connection wakes one loop instead of all of them
+    epoll_event ev{};
+    ev.events=EPOLLIN|EPOLLET|EPOLLEXCLUSIVE;
+    ev.data.fd=listenFd;
+    if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,listenFd,&ev)<0){
+        std::cerr<<"Error Registering Server Socket\n";
+        return false;
+    }
+    wakeFd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    ev.events=EPOLLIN|EPOLLET;
+    ev.data.fd=wakeFd;
+    if(wakeFd<0 || epoll_ctl(epoll_fd,EPOLL_CTL_ADD,wakeFd,&ev)<0){
+        std::cerr<<"Error Creating Wakeup Descriptor\n";
+        return false;
+    }
+    mailbox.notify=[this](){ wakeup(); };
+    return true;
+}
+
+void EventLoop::acceptClients(){
+    //edge-triggered: drain the whole accept queue before going back to epoll
+    while(true){
+        int client_socket=accept4(listenFd,nullptr,nullptr,SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if(client_socket<0){
+            if(errno==EINTR)continue;
+            if(errno!=EAGAIN && errno!=EWOULDBLOCK)
+                std::cerr<< "Error Accepting Client Connection\n";
+            return;
+        }
+        if(clientCount.fetch_add(1)>=maxClients){
+            clientCount--;
+            bumpCounter(ServerStats::local().rejectedConnections);
+            static const char err[]="-ERR max number of clients reached\r\n";
+            send(client_socket,err,sizeof(err)-1,MSG_NOSIGNAL);
+            close(client_socket);
+            continue;
+        }
+        int opt=1;
+        setsockopt(client_socket,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+
+        //EPOLLOUT is registered up front; with EPOLLET it only fires when a
+        //full socket buffer drains, so no epoll_ctl MOD is needed per reply
+        epoll_event ev{};
+        ev.events=EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+        ev.data.fd=client_socket;
+        if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,client_socket,&ev)<0){
+            clientCount--;
+            close(client_socket);
+            continue;
+        }
+        if(static_cast<size_t>(client_socket)>=connections.size())
+            connections.resize(client_socket+1);
+        connections[client_socket].reset(new Connection(client_socket));
+        connections[client_socket]->client.wake=[this,client_socket](const std::shared_ptr<ListWaiter>& w){
+            wakeClient(client_socket,w);
+        };
+        connections[client_socket]->pubsub.fd=client_socket;
+        connections[client_socket]->pubsub.mailbox=&mailbox;
+        bumpCounter(ServerStats::local().connections);
+    }
+}
+
+//execute every complete command sitting in the input buffer, appending all
+//replies to the output buffer so a pipelined batch goes out in one writev
+void EventLoop::processInput(Connection& conn){
+    //a parked client's pipelined commands wait in inbuf until it is unblocked
+    while(!conn.closeAfterReply && !conn.client.blocked && !conn.handoff){
+        RespParser::Status st=conn.parser.parse(conn.inbuf,conn.inpos,conn.argv);
+        if(st==RespParser::Status::Incomplete)break;
+        if(st==RespParser::Status::Error){
+            conn.out.addError("ERR Protocol error: "+conn.parser.error());
+            conn.closeAfterReply=true;
+            break;
+        }
+        if(conn.argv.empty())continue;
+        //a replica announcing itself: the port goes into INFO, PSYNC (or the
+        //old SYNC) turns the connection into a replication link
+        const std::string& name=conn.argv[0];
+        if(name.size()==8 && conn.argv.size()==3 && strcasecmp(name.c_str(),"replconf")==0 &&
+           strcasecmp(conn.argv[1].c_str(),"listening-port")==0){
+            conn.replicaPort=atoi(conn.argv[2].c_str());
+        }else if((name.size()==5 && strcasecmp(name.c_str(),"psync")==0) ||
+                 (name.size()==4 && strcasecmp(name.c_str(),"sync")==0)){
+            conn.handoff=true;
+            break;
+        }
+        uint64_t fed=AppendOnlyFile::fedOnThisThread();
+        cmdHandler.processCommand(conn.argv,conn.out,&conn.client,&conn.multi,&conn.pubsub);
+        if(AppendOnlyFile::fedOnThisThread()!=fed)conn.logged=true;
+        if(conn.client.blocked)blockedClients.push_back(conn.fd);
+    }
+    //drop the consumed prefix; a partial command stays at the front
+    if(conn.inpos==conn.inbuf.size()){
+        conn.inbuf.clear();
+        if(conn.inbuf.capacity()>INBUF_KEEP)std::string().swap(conn.inbuf);
+    }else if(conn.inpos>0){
+        conn.inbuf.erase(0,conn.inpos);
+    }
+    conn.inpos=0;
+}
+
+void EventLoop::handleRead(Connection& conn){
+    char buffer[READ_CHUNK];
+    bool peerClosed=false;
+    while(!conn.closeAfterReply){
+        ssize_t bytes=recv(conn.fd,buffer,sizeof(buffer),0);
+        if(bytes>0){
+            bumpCounter(ServerStats::local().netInput,bytes);
+            conn.inbuf.append(buffer,bytes);
+            processInput(conn);
+            if(conn.handoff)return handOff(conn);
+            if(conn.inbuf.size()>MAX_QUERY_BUFFER){
+                peerClosed=true;
+                break;
+            }
+            continue;
+        }
+        if(bytes==0){
+            peerClosed=true;
+            break;
+        }
+        if(errno==EINTR)continue;
+        if(errno!=EAGAIN && errno!=EWOULDBLOCK)peerClosed=true;
+        break;
+    }
+    //replies wait until the end of this epoll round so the aof can commit
+    //every write of the round first; a closing peer still gets its replies
+    if(peerClosed)conn.closeAfterReply=true;
+    if(!conn.pendingFlush){
+        conn.pendingFlush=true;
+        pendingFlush.push_back(conn.fd);
+    }
+}
+
+//make the round's writes durable (appendfsync always) before acknowledging
+//them, then send every reply produced in the round
+void EventLoop::flushPending(){
+    if(pendingFlush.empty())return;
+    bool durable=AppendOnlyFile::getInstance().commit();
+    for(int fd:pendingFlush){
+        if(!connections[fd] || !connections[fd]->pendingFlush)continue;
+        Connection& conn=*connections[fd];
+        conn.pendingFlush=false;
+        bool logged=conn.logged;
+        conn.logged=false;
+        //under appendfsync always a write that did not reach the disk is not
+        //acknowledged: the client is dropped, as if the server had crashed
+        if(!durable && logged){
+            closeConnection(fd);
+            continue;
+        }
+        //a closing connection stays until the socket has taken all of its
+        //output; the rest goes out on EPOLLOUT
+        if(!flushOutput(conn) || (conn.closeAfterReply && conn.out.empty()))
+            closeConnection(fd);
+    }
+    pendingFlush.clear();
+}
+
+//send as much of the pending output as the socket takes; false on a dead socket
+bool EventLoop::flushOutput(Connection& conn){
+    size_t before=conn.out.pending();
+    bool ok=conn.out.writeTo(conn.fd);
+    bumpCounter(ServerStats::local().netOutput,before-conn.out.pending());
+    return ok;
+}
+
+void EventLoop::closeConnection(int fd){
+    epoll_ctl(epoll_fd,EPOLL_CTL_DEL,fd,nullptr);
+    close(fd);
+    if(connections[fd]){
+        if(auto& w=connections[fd]->client.blocked){
+            //if a writer claimed it first, the element it popped is lost with
+            //the client, as in redis when a served client disconnects
+            RedisDatabase::getInstance().cancelWaiter(w);
+            blockedClients.erase(std::find(blockedClients.begin(),blockedClients.end(),fd));
+        }
+        cmdHandler.resetTransaction(connections[fd]->multi);
+        PubSub::getInstance().unsubscribeAll(connections[fd]->pubsub);
+        connections[fd].reset();
+        clientCount--;
+        bumpCounter(ServerStats::local().disconnections);
+    }
+}
+
+void EventLoop::handOff(Connection& conn){
+    int fd=conn.fd;
+    //the replies to its handshake go out first, and after the round's writes
+    //are durable like any other reply
+    AppendOnlyFile::getInstance().commit();
+    int64_t deadline=RedisDatabase::nowMs()+1000;
+    bool ok=true;
+    while(ok && !conn.out.empty() && RedisDatabase::nowMs()<deadline){
+        ok=flushOutput(conn);
+        if(ok && !conn.out.empty()){
+            pollfd p{fd,POLLOUT,0};
+            poll(&p,1,LOOP_TIMEOUT_MS);
+        }
+    }
+    if(!ok || !conn.out.empty()){
+        closeConnection(fd);
+        return;
+    }
+    epoll_ctl(epoll_fd,EPOLL_CTL_DEL,fd,nullptr);
+    std::vector<std::string> argv=std::move(conn.argv);
+    int port=conn.replicaPort;
+    cmdHandler.resetTransaction(conn.multi);
+    PubSub::getInstance().unsubscribeAll(conn.pubsub);
+    //the fd stays open: Replication owns it from here
+    connections[fd].reset();
+    clientCount--;
+    bumpCounter(ServerStats::local().disconnections);
+    Replication::getInstance().addReplica(fd,argv,port);
+}
+
+void EventLoop::wakeClient(int fd,const std::shared_ptr<ListWaiter>& w){
+    {
+        std::lock_guard<std::mutex> lock(wokenMutex);
+        woken.emplace_back(fd,w);
+    }
+    wakeup();
+}
+
+void EventLoop::wakeup(){
+    uint64_t one=1;
+    if(write(wakeFd,&one,sizeof(one))<0){
+        //EAGAIN: the counter is saturated, a wakeup is pending anyway
+    }
+}
+
+void EventLoop::deliverMessages(){
+    std::vector<Delivery> ready;
+    {
+        std::lock_guard<std::mutex> lock(mailbox.mutex);
+        ready.swap(mailbox.queue);
+    }
+    for(auto& d:ready){
+        int fd=d.sub->fd;
+        //the client may have unsubscribed from everything, or gone, since
+        if(!connections[fd] || connections[fd]->pubsub.sub!=d.sub)continue;
+        Connection& conn=*connections[fd];
+        if(conn.closeAfterReply)continue;
+        conn.out.addShared(std::move(d.msg));
+        //the backlog is what it is dropped for, so it is not sent first
+        if(conn.out.pending()>PUBSUB_OUTPUT_LIMIT){
+            closeConnection(fd);
+            continue;
+        }
+        if(!conn.pendingFlush){
+            conn.pendingFlush=true;
+            pendingFlush.push_back(fd);
+        }
+    }
+}
+
+void EventLoop::unblockClient(Connection& conn,bool timedOut){
+    std::shared_ptr<ListWaiter> w=std::move(conn.client.blocked);
+    conn.client.blocked.reset();
+    blockedClients.erase(std::find(blockedClients.begin(),blockedClients.end(),conn.fd));
+    cmdHandler.replyUnblocked(*w,timedOut,conn.out);
+    //run whatever the client pipelined behind the blocking command
+    processInput(conn);
+    if(conn.handoff)return handOff(conn);
+    if(!conn.pendingFlush){
+        conn.pendingFlush=true;
+        pendingFlush.push_back(conn.fd);
+    }
+}
+
+void EventLoop::unblockClients(){
+    std::vector<std::pair<int,std::shared_ptr<ListWaiter>>> ready;
+    {
+        std::lock_guard<std::mutex> lock(wokenMutex);
+        ready.swap(woken);
+    }
+    for(auto& entry:ready){
+        int fd=entry.first;
+        //the fd may have been closed, or even reused, since the waiter parked
+        if(!connections[fd] || connections[fd]->client.blocked!=entry.second)continue;
+        unblockClient(*connections[fd],false);
+    }
+    if(blockedClients.empty())return;
+    int64_t now=RedisDatabase::nowMs();
+    std::vector<int> expired;
+    for(int fd:blockedClients){
+        const ListWaiter& w=*connections[fd]->client.blocked;
+        if(w.deadline>=0 && w.deadline<=now)expired.push_back(fd);
+    }
+    for(int fd:expired){
+        //losing the claim means a writer is serving it; the wakeup follows
+        if(RedisDatabase::getInstance().cancelWaiter(connections[fd]->client.blocked))
+            unblockClient(*connections[fd],true);
+    }
+}
+
+int EventLoop::nextTimeout() const{
+    int64_t timeout=LOOP_TIMEOUT_MS;
+    if(blockedClients.empty())return timeout;
+    int64_t now=RedisDatabase::nowMs();
+    for(int fd:blockedClients){
+        int64_t deadline=connections[fd]->client.blocked->deadline;
+        if(deadline>=0)timeout=std::min(timeout,std::max<int64_t>(0,deadline-now));
+    }
+    return static_cast<int>(timeout);
+}
+
+void EventLoop::run(){
+    epoll_event events[MAX_EVENTS];
+    while(running){
+        int n=epoll_wait(epoll_fd,events,MAX_EVENTS,nextTimeout());
+        if(n<0){
+            if(errno==EINTR)continue;
+            std::cerr<<"Error Waiting On Epoll\n";
+            break;
+        }
+        for(int i=0;i<n;i++){
+            int fd=events[i].data.fd;
+            uint32_t mask=events[i].events;
+            if(fd==listenFd){
+                acceptClients();
+                continue;
+            }
+            if(fd==wakeFd){
+                uint64_t count;
+                while(read(wakeFd,&count,sizeof(count))>0){}
+                continue;
+            }
+            if(static_cast<size_t>(fd)>=connections.size() || !connections[fd])continue;
+            Connection& conn=*connections[fd];
+            if(mask&(EPOLLERR|EPOLLHUP)){
+                closeConnection(fd);
+                continue;
+            }
+            if(mask&(EPOLLIN|EPOLLRDHUP)){
+                handleRead(conn);
+                continue;
+            }
+            if((mask&EPOLLOUT) && !conn.pendingFlush &&
+               (!flushOutput(conn) || (conn.closeAfterReply && conn.out.empty())))
+                closeConnection(fd);
+        }
+        unblockClients();
+        deliverMessages();
+        flushPending();
+    }
+    for(auto& conn:connections){
+        if(conn)closeConnection(conn->fd);
+    }
+}
@@ -0,0 +1,37 @@
+#include "../include/HeapCounter.h"
+#include <atomic>
+#include <cstdint>
+
+static const size_t SLOTS=16;
+
+struct alignas(64) HeapSlot{
+    std::atomic<int64_t> bytes{0};
+};
+//a block freed by another thread than the one that allocated it makes a
+//slot go negative; only the sum is meaningful
+static HeapSlot slots[SLOTS];
+static std::atomic<size_t> nextSlot{0};
+static std::atomic<size_t> startup{0};
+
+static HeapSlot& localSlot(){
+    thread_local size_t slot=nextSlot.fetch_add(1,std::memory_order_relaxed)%SLOTS;
+    return slots[slot];
+}
+
+void heapAllocated(size_t bytes){
+    localSlot().bytes.fetch_add(static_cast<int64_t>(bytes),std::memory_order_relaxed);
+}
+void heapFreed(size_t bytes){
+    localSlot().bytes.fetch_sub(static_cast<int64_t>(bytes),std::memory_order_relaxed);
+}
+size_t usedMemory(){
+    int64_t total=0;
+    for(const auto& slot:slots)total+=slot.bytes.load(std::memory_order_relaxed);
+    return total>0?static_cast<size_t>(total):0;
+}
+void markStartupMemory(){
+    startup.store(usedMemory(),std::memory_order_relaxed);
+}
+size_t startupMemory(){
+    return startup.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,34 @@
+//the server's global operator new and delete: plain malloc and free that
+//report every block to HeapCounter. linked into my_redis_server only; the
+//benchmark programs keep the default operators or bring their own
+#include "../include/HeapCounter.h"
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+
+static void* allocate(size_t n){
+    void* p=std::malloc(n?n:1);
+    if(!p)throw std::bad_alloc();
+    heapAllocated(malloc_usable_size(p));
+    return p;
+}
+static void release(void* p){
+    if(!p)return;
+    heapFreed(malloc_usable_size(p));
+    std::free(p);
+}
+
+void* operator new(size_t n){ return allocate(n); }
+void* operator new[](size_t n){ return allocate(n); }
+void* operator new(size_t n,const std::nothrow_t&) noexcept{
+    void* p=std::malloc(n?n:1);
+    if(p)heapAllocated(malloc_usable_size(p));
+    return p;
+}
+void* operator new[](size_t n,const std::nothrow_t& tag) noexcept{ return operator new(n,tag); }
+void operator delete(void* p) noexcept{ release(p); }
+void operator delete[](void* p) noexcept{ release(p); }
+void operator delete(void* p,size_t) noexcept{ release(p); }
+void operator delete[](void* p,size_t) noexcept{ release(p); }
+void operator delete(void* p,const std::nothrow_t&) noexcept{ release(p); }
+void operator delete[](void* p,const std::nothrow_t&) noexcept{ release(p); }
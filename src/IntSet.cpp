@@ -0,0 +1,346 @@
+#include "../include/IntSet.h"
+#include <algorithm>
+#include <charconv>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define INTSET_SSE 1
+//the kernels are compiled for SSE4.1 / AVX2 on their own and only called
+//after the cpu check, so the rest of the build keeps its baseline
+//instruction set
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+static bool haveSse41(){
+    static const bool ok=(__builtin_cpu_init(),__builtin_cpu_supports("sse4.1"));
+    return ok;
+}
+static bool haveAvx2(){
+    static const bool ok=(__builtin_cpu_init(),__builtin_cpu_supports("avx2"));
+    return ok;
+}
+#endif
+
+//elements are read and written through memcpy, the buffer is plain bytes
+template<typename T>
+static inline T load(const char* p,size_t i){
+    T v;
+    std::memcpy(&v,p+i*sizeof(T),sizeof(T));
+    return v;
+}
+
+template<typename T>
+static size_t lowerBoundIn(const char* p,size_t n,T v){
+    size_t lo=0,hi=n;
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        if(load<T>(p,mid)<v)lo=mid+1;
+        else hi=mid;
+    }
+    return lo;
+}
+
+//merge from a[i..] and b[j..]
+template<typename T>
+static void intersectScalar(const char* a,size_t na,const char* b,size_t nb,size_t i,size_t j,std::vector<int64_t>& out){
+    while(i<na && j<nb){
+        T x=load<T>(a,i),y=load<T>(b,j);
+        if(x<y)i++;
+        else if(y<x)j++;
+        else{
+            out.push_back(x);
+            i++;
+            j++;
+        }
+    }
+}
+
+#ifdef INTSET_SSE
+template<typename T>
+SSE41 static inline __m128i splat(T v){
+    if constexpr(sizeof(T)==2)return _mm_set1_epi16(v);
+    else if constexpr(sizeof(T)==4)return _mm_set1_epi32(v);
+    else return _mm_set1_epi64x(v);
+}
+template<typename T>
+SSE41 static inline __m128i cmpEq(__m128i a,__m128i b){
+    if constexpr(sizeof(T)==2)return _mm_cmpeq_epi16(a,b);
+    else if constexpr(sizeof(T)==4)return _mm_cmpeq_epi32(a,b);
+    else return _mm_cmpeq_epi64(a,b);
+}
+//movemask sets one bit per byte; keep the first byte of every lane
+template<typename T>
+static inline unsigned laneBits(){
+    return sizeof(T)==2?0x5555:sizeof(T)==4?0x1111:0x0101;
+}
+//lanes of va equal to any lane of vb. the rotations of vb are taken from vb
+//itself, not one from the other, so they do not wait on each other
+template<typename T>
+SSE41 static inline __m128i matchBlock(__m128i va,__m128i vb){
+    if constexpr(sizeof(T)==8){
+        return _mm_or_si128(_mm_cmpeq_epi64(va,vb),_mm_cmpeq_epi64(va,_mm_shuffle_epi32(vb,0x4E)));
+    }else if constexpr(sizeof(T)==4){
+        __m128i m01=_mm_or_si128(_mm_cmpeq_epi32(va,vb),_mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,0x39)));
+        __m128i m23=_mm_or_si128(_mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,0x4E)),_mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,0x93)));
+        return _mm_or_si128(m01,m23);
+    }else{
+        __m128i m01=_mm_or_si128(_mm_cmpeq_epi16(va,vb),_mm_cmpeq_epi16(va,_mm_alignr_epi8(vb,vb,2)));
+        __m128i m23=_mm_or_si128(_mm_cmpeq_epi16(va,_mm_alignr_epi8(vb,vb,4)),_mm_cmpeq_epi16(va,_mm_alignr_epi8(vb,vb,6)));
+        __m128i m45=_mm_or_si128(_mm_cmpeq_epi16(va,_mm_alignr_epi8(vb,vb,8)),_mm_cmpeq_epi16(va,_mm_alignr_epi8(vb,vb,10)));
+        __m128i m67=_mm_or_si128(_mm_cmpeq_epi16(va,_mm_alignr_epi8(vb,vb,12)),_mm_cmpeq_epi16(va,_mm_alignr_epi8(vb,vb,14)));
+        return _mm_or_si128(_mm_or_si128(m01,m23),_mm_or_si128(m45,m67));
+    }
+}
+
+//binary search down to a window of four vectors, then compare the whole
+//window at once instead of taking the last, badly predicted branches
+template<typename T>
+SSE41 static bool containsSse(const char* p,size_t n,T v){
+    const size_t LANES=16/sizeof(T);
+    size_t base=0,len=n;
+    while(len>4*LANES){
+        size_t half=len/2;
+        if(load<T>(p,base+half)<v)base+=half;
+        len-=half;
+    }
+    //v, if present, is somewhere in [base, base+len]
+    size_t end=std::min(n,base+len+1);
+    __m128i key=splat<T>(v);
+    __m128i hit=_mm_setzero_si128();
+    size_t i=base;
+    for(;i+LANES<=end;i+=LANES)
+        hit=_mm_or_si128(hit,cmpEq<T>(key,_mm_loadu_si128(reinterpret_cast<const __m128i*>(p+i*sizeof(T)))));
+    if(_mm_movemask_epi8(hit))return true;
+    for(;i<end;i++){
+        if(load<T>(p,i)==v)return true;
+    }
+    return false;
+}
+
+static const size_t STAGE=256;
+
+//block merge: compare one vector of a with one vector of b in every
+//pairing, which finds all elements the two blocks share, then move on past
+//the block with the smaller last element (both on a tie). the kernels
+//stage matches in a small buffer, as sizing out for the worst case would
+//mean zeroing it, and leave i and j where the scalar merge takes over
+template<typename T>
+SSE41 static void intersectSse(const char* a,size_t na,const char* b,size_t nb,size_t& i,size_t& j,std::vector<int64_t>& out){
+    const size_t LANES=16/sizeof(T);
+    int64_t dst[STAGE];
+    size_t x=i,y=j,n=0;
+    while(x+LANES<=na && y+LANES<=nb){
+        if(n>STAGE-LANES){
+            out.insert(out.end(),dst,dst+n);
+            n=0;
+        }
+        __m128i va=_mm_loadu_si128(reinterpret_cast<const __m128i*>(a+x*sizeof(T)));
+        __m128i vb=_mm_loadu_si128(reinterpret_cast<const __m128i*>(b+y*sizeof(T)));
+        unsigned bits=static_cast<unsigned>(_mm_movemask_epi8(matchBlock<T>(va,vb)))&laneBits<T>();
+        while(bits){
+            dst[n++]=load<T>(a,x+__builtin_ctz(bits)/sizeof(T));
+            bits&=bits-1;
+        }
+        T lastA=load<T>(a,x+LANES-1),lastB=load<T>(b,y+LANES-1);
+        x+=lastA<=lastB?LANES:0;
+        y+=lastB<=lastA?LANES:0;
+    }
+    out.insert(out.end(),dst,dst+n);
+    i=x;
+    j=y;
+}
+
+//32 bit elements, the usual width for ids, also get an AVX2 kernel with
+//twice the lanes: rotations inside each 128 bit half, then the same with the
+//halves swapped
+AVX2 static void intersectAvx2(const char* a,size_t na,const char* b,size_t nb,size_t& i,size_t& j,std::vector<int64_t>& out){
+    const size_t LANES=8;
+    int64_t dst[STAGE];
+    size_t x=i,y=j,n=0;
+    while(x+LANES<=na && y+LANES<=nb){
+        if(n>STAGE-LANES){
+            out.insert(out.end(),dst,dst+n);
+            n=0;
+        }
+        __m256i va=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+x*4));
+        __m256i vb=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+y*4));
+        __m256i vs=_mm256_permute2x128_si256(vb,vb,1);
+        __m256i m0=_mm256_or_si256(_mm256_cmpeq_epi32(va,vb),_mm256_cmpeq_epi32(va,_mm256_shuffle_epi32(vb,0x39)));
+        __m256i m1=_mm256_or_si256(_mm256_cmpeq_epi32(va,_mm256_shuffle_epi32(vb,0x4E)),_mm256_cmpeq_epi32(va,_mm256_shuffle_epi32(vb,0x93)));
+        __m256i m2=_mm256_or_si256(_mm256_cmpeq_epi32(va,vs),_mm256_cmpeq_epi32(va,_mm256_shuffle_epi32(vs,0x39)));
+        __m256i m3=_mm256_or_si256(_mm256_cmpeq_epi32(va,_mm256_shuffle_epi32(vs,0x4E)),_mm256_cmpeq_epi32(va,_mm256_shuffle_epi32(vs,0x93)));
+        __m256i hit=_mm256_or_si256(_mm256_or_si256(m0,m1),_mm256_or_si256(m2,m3));
+        unsigned bits=static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(hit)));
+        while(bits){
+            dst[n++]=load<int32_t>(a,x+__builtin_ctz(bits));
+            bits&=bits-1;
+        }
+        int32_t lastA=load<int32_t>(a,x+LANES-1),lastB=load<int32_t>(b,y+LANES-1);
+        x+=lastA<=lastB?LANES:0;
+        y+=lastB<=lastA?LANES:0;
+    }
+    out.insert(out.end(),dst,dst+n);
+    i=x;
+    j=y;
+}
+#endif
+
+template<typename T>
+static bool containsIn(const char* p,size_t n,T v){
+#ifdef INTSET_SSE
+    if(haveSse41())return containsSse<T>(p,n,v);
+#endif
+    size_t i=lowerBoundIn<T>(p,n,v);
+    return i<n && load<T>(p,i)==v;
+}
+
+template<typename T>
+static void intersectIn(const char* a,size_t na,const char* b,size_t nb,std::vector<int64_t>& out){
+    size_t i=0,j=0;
+#ifdef INTSET_SSE
+    if(sizeof(T)==4 && haveAvx2())intersectAvx2(a,na,b,nb,i,j,out);
+    else if(haveSse41())intersectSse<T>(a,na,b,nb,i,j,out);
+#endif
+    intersectScalar<T>(a,na,b,nb,i,j,out);
+}
+
+uint8_t IntSet::widthFor(int64_t v){
+    if(v>=INT16_MIN && v<=INT16_MAX)return 2;
+    if(v>=INT32_MIN && v<=INT32_MAX)return 4;
+    return 8;
+}
+
+int64_t IntSet::at(size_t i) const{
+    switch(elemWidth){
+        case 2: return load<int16_t>(buf.data(),i);
+        case 4: return load<int32_t>(buf.data(),i);
+        default: return load<int64_t>(buf.data(),i);
+    }
+}
+
+void IntSet::set(size_t i,int64_t v){
+    char* p=&buf[i*elemWidth];
+    if(elemWidth==2){
+        int16_t x=static_cast<int16_t>(v);
+        std::memcpy(p,&x,sizeof(x));
+    }else if(elemWidth==4){
+        int32_t x=static_cast<int32_t>(v);
+        std::memcpy(p,&x,sizeof(x));
+    }else{
+        std::memcpy(p,&v,sizeof(v));
+    }
+}
+
+void IntSet::upgrade(uint8_t w){
+    std::vector<int64_t> all;
+    values(all);
+    elemWidth=w;
+    buf.assign(all.size()*w,'\0');
+    for(size_t i=0;i<all.size();i++)set(i,all[i]);
+}
+
+size_t IntSet::lowerBound(int64_t v) const{
+    size_t n=size();
+    switch(elemWidth){
+        case 2: return lowerBoundIn<int16_t>(buf.data(),n,static_cast<int16_t>(v));
+        case 4: return lowerBoundIn<int32_t>(buf.data(),n,static_cast<int32_t>(v));
+        default: return lowerBoundIn<int64_t>(buf.data(),n,v);
+    }
+}
+
+bool IntSet::contains(int64_t v) const{
+    //a value wider than the elements cannot be one of them
+    if(widthFor(v)>elemWidth)return false;
+    size_t n=size();
+    switch(elemWidth){
+        case 2: return containsIn<int16_t>(buf.data(),n,static_cast<int16_t>(v));
+        case 4: return containsIn<int32_t>(buf.data(),n,static_cast<int32_t>(v));
+        default: return containsIn<int64_t>(buf.data(),n,v);
+    }
+}
+
+bool IntSet::insert(int64_t v){
+    uint8_t w=widthFor(v);
+    if(w>elemWidth){
+        //v lies outside every element, so it goes at one end
+        upgrade(w);
+        size_t pos=v<0?0:size();
+        buf.insert(pos*elemWidth,elemWidth,'\0');
+        set(pos,v);
+        return true;
+    }
+    size_t pos=lowerBound(v);
+    if(pos<size() && at(pos)==v)return false;
+    buf.insert(pos*elemWidth,elemWidth,'\0');
+    set(pos,v);
+    return true;
+}
+
+size_t IntSet::insertSorted(const std::vector<int64_t>& add){
+    if(add.empty())return 0;
+    uint8_t w=std::max(widthFor(add.front()),widthFor(add.back()));
+    if(w>elemWidth)upgrade(w);
+    std::vector<int64_t> old;
+    values(old);
+    //merge into a buffer sized for the worst case, then cut it down
+    buf.assign((old.size()+add.size())*elemWidth,'\0');
+    size_t n=0,i=0,j=0;
+    while(i<old.size() || j<add.size()){
+        int64_t v;
+        if(j==add.size() || (i<old.size() && old[i]<add[j]))v=old[i++];
+        else if(i==old.size() || add[j]<old[i])v=add[j++];
+        else{
+            v=old[i++];
+            j++;
+        }
+        set(n++,v);
+    }
+    buf.resize(n*elemWidth);
+    return n-old.size();
+}
+
+bool IntSet::erase(int64_t v){
+    if(widthFor(v)>elemWidth)return false;
+    size_t pos=lowerBound(v);
+    if(pos==size() || at(pos)!=v)return false;
+    buf.erase(pos*elemWidth,elemWidth);
+    return true;
+}
+
+void IntSet::values(std::vector<int64_t>& out) const{
+    size_t n=size();
+    out.reserve(out.size()+n);
+    for(size_t i=0;i<n;i++)out.push_back(at(i));
+}
+
+void IntSet::intersect(const IntSet& a,const IntSet& b,std::vector<int64_t>& out){
+    const IntSet& small=a.size()<=b.size()?a:b;
+    const IntSet& big=a.size()<=b.size()?b:a;
+    size_t ns=small.size(),nb=big.size();
+    //very different sizes, or widths the kernels cannot pair up: look each
+    //element of the smaller set up in the bigger one
+    if(small.elemWidth!=big.elemWidth || ns*16<nb){
+        for(size_t i=0;i<ns;i++){
+            int64_t v=small.at(i);
+            if(big.contains(v))out.push_back(v);
+        }
+        return;
+    }
+    switch(small.elemWidth){
+        case 2: return intersectIn<int16_t>(small.buf.data(),ns,big.buf.data(),nb,out);
+        case 4: return intersectIn<int32_t>(small.buf.data(),ns,big.buf.data(),nb,out);
+        default: return intersectIn<int64_t>(small.buf.data(),ns,big.buf.data(),nb,out);
+    }
+}
+
+bool IntSet::parse(std::string_view s,int64_t& v){
+    if(s.empty() || s.size()>20)return false;
+    //no leading zeros, no "-0": those would not read back the same
+    size_t digits=s[0]=='-'?1:0;
+    if(digits==s.size() || (s[digits]=='0' && (s.size()>1)))return false;
+    auto res=std::from_chars(s.data(),s.data()+s.size(),v);
+    return res.ec==std::errc() && res.ptr==s.data()+s.size();
+}
+
+std::string_view IntSet::format(int64_t v,char* buf){
+    return std::string_view(buf,std::to_chars(buf,buf+21,v).ptr-buf);
+}
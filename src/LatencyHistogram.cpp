@@ -0,0 +1,43 @@
+#include "../include/LatencyHistogram.h"
+
+size_t LatencyHistogram::bucketFor(uint64_t ns){
+    //values below 2^SUB_BITS have a bucket each
+    if(ns<SUB_BUCKETS)return static_cast<size_t>(ns);
+    int exp=63-__builtin_clzll(ns);
+    if(exp>MAX_EXP)return BUCKETS-1;
+    size_t sub=static_cast<size_t>(ns>>(exp-SUB_BITS))-SUB_BUCKETS;
+    return static_cast<size_t>(exp-SUB_BITS+1)*SUB_BUCKETS+sub;
+}
+
+uint64_t LatencyHistogram::bucketLow(size_t i){
+    if(i<SUB_BUCKETS)return i;
+    int exp=static_cast<int>(i/SUB_BUCKETS)+SUB_BITS-1;
+    return (SUB_BUCKETS+i%SUB_BUCKETS)<<(exp-SUB_BITS);
+}
+
+uint64_t LatencyHistogram::bucketHigh(size_t i){
+    if(i<SUB_BUCKETS)return i;
+    int exp=static_cast<int>(i/SUB_BUCKETS)+SUB_BITS-1;
+    return bucketLow(i)+(uint64_t(1)<<(exp-SUB_BITS))-1;
+}
+
+void LatencyHistogram::addTo(std::vector<uint64_t>& counts) const{
+    counts.resize(BUCKETS);
+    for(size_t i=0;i<BUCKETS;i++)counts[i]+=buckets[i].load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(const std::vector<uint64_t>& counts,double p){
+    uint64_t total=0;
+    for(uint64_t c:counts)total+=c;
+    if(total==0)return 0;
+    //rank of the sample we are after, 1-based
+    uint64_t rank=static_cast<uint64_t>(p*total+0.5);
+    if(rank<1)rank=1;
+    if(rank>total)rank=total;
+    uint64_t seen=0;
+    for(size_t i=0;i<counts.size();i++){
+        seen+=counts[i];
+        if(seen>=rank)return (bucketLow(i)+bucketHigh(i))/2;
+    }
+    return bucketHigh(counts.size()-1);
+}
@@ -0,0 +1,220 @@
+#include "../include/ListPack.h"
+
+static size_t varintSize(size_t v){
+    size_t n=1;
+    while(v>=0x80){
+        v>>=7;
+        n++;
+    }
+    return n;
+}
+
+static size_t writeVarint(char* p,size_t v){
+    size_t n=0;
+    while(v>=0x80){
+        p[n++]=static_cast<char>((v&0x7F)|0x80);
+        v>>=7;
+    }
+    p[n++]=static_cast<char>(v);
+    return n;
+}
+
+static size_t readVarint(const char* p,size_t& v){
+    v=0;
+    size_t n=0;
+    for(int shift=0;;shift+=7){
+        unsigned char b=static_cast<unsigned char>(p[n++]);
+        v|=static_cast<size_t>(b&0x7F)<<shift;
+        if(!(b&0x80))return n;
+    }
+}
+
+//backlen: most significant group first, every byte but the leftmost has the
+//high bit set, so reading from the right stops at the byte without it
+static void writeBacklen(char* p,size_t v,size_t n){
+    for(size_t i=n;i-->0;){
+        p[i]=static_cast<char>((v&0x7F)|(i>0?0x80:0));
+        v>>=7;
+    }
+}
+
+//read the backlen ending just before end; returns the size of header+payload
+static size_t readBacklen(const char* end,size_t& backlenBytes){
+    size_t v=0;
+    backlenBytes=0;
+    for(int shift=0;;shift+=7){
+        unsigned char b=static_cast<unsigned char>(*--end);
+        backlenBytes++;
+        v|=static_cast<size_t>(b&0x7F)<<shift;
+        if(!(b&0x80))return v;
+    }
+}
+
+size_t ListPack::entrySize(size_t len){
+    size_t body=varintSize(len)+len;
+    return body+varintSize(body);
+}
+
+size_t ListPack::next(size_t pos) const{
+    size_t len;
+    readVarint(buf.data()+pos,len);
+    return pos+entrySize(len);
+}
+
+size_t ListPack::prev(size_t pos) const{
+    size_t backlenBytes;
+    size_t body=readBacklen(buf.data()+pos,backlenBytes);
+    return pos-backlenBytes-body;
+}
+
+std::string_view ListPack::get(size_t pos) const{
+    size_t len;
+    size_t hdr=readVarint(buf.data()+pos,len);
+    return std::string_view(buf.data()+pos+hdr,len);
+}
+
+size_t ListPack::seek(long index) const{
+    if(index<0)index+=static_cast<long>(count);
+    if(index<0 || index>=static_cast<long>(count))return end();
+    //walk from whichever end is closer
+    if(static_cast<size_t>(index)<=count/2){
+        size_t pos=begin();
+        for(long i=0;i<index;i++)pos=next(pos);
+        return pos;
+    }
+    size_t pos=end();
+    for(long i=count;i>index;i--)pos=prev(pos);
+    return pos;
+}
+
+size_t ListPack::insert(size_t pos,std::string_view value){
+    size_t body=varintSize(value.size())+value.size();
+    size_t backlen=varintSize(body);
+    buf.insert(pos,body+backlen,'\0');
+    char* p=&buf[pos];
+    size_t hdr=writeVarint(p,value.size());
+    value.copy(p+hdr,value.size());
+    writeBacklen(p+body,body,backlen);
+    count++;
+    return pos;
+}
+
+size_t ListPack::erase(size_t pos){
+    size_t len;
+    readVarint(buf.data()+pos,len);
+    buf.erase(pos,entrySize(len));
+    count--;
+    return pos;
+}
+
+void ListPack::eraseRange(size_t pos,size_t n){
+    size_t stop=pos;
+    for(size_t i=0;i<n;i++)stop=next(stop);
+    buf.erase(pos,stop-pos);
+    count-=n;
+}
+
+void ListPack::replace(size_t pos,std::string_view value){
+    size_t len;
+    readVarint(buf.data()+pos,len);
+    if(len==value.size()){
+        //same length: overwrite the payload in place
+        value.copy(&buf[pos+varintSize(len)],len);
+        return;
+    }
+    erase(pos);
+    insert(pos,value);
+}
+
+std::string ListPack::popFront(){
+    std::string v(get(begin()));
+    erase(begin());
+    return v;
+}
+
+std::string ListPack::popBack(){
+    size_t pos=prev(end());
+    std::string v(get(pos));
+    buf.resize(pos);
+    count--;
+    return v;
+}
+
+size_t ListPack::find(std::string_view value) const{
+    for(size_t pos=begin();pos<end();pos=next(pos)){
+        if(get(pos)==value)return pos;
+    }
+    return end();
+}
+
+bool ListPack::index(long i,std::string& out) const{
+    size_t pos=seek(i);
+    if(pos==end())return false;
+    out.assign(get(pos));
+    return true;
+}
+
+bool ListPack::set(long i,std::string_view value){
+    size_t pos=seek(i);
+    if(pos==end())return false;
+    replace(pos,value);
+    return true;
+}
+
+size_t ListPack::remove(long limit,std::string_view value){
+    size_t removed=0;
+    size_t want=limit<0?static_cast<size_t>(-limit):static_cast<size_t>(limit);
+    if(limit>=0){
+        for(size_t pos=begin();pos<end() && (limit==0 || removed<want);){
+            if(get(pos)==value){
+                pos=erase(pos);
+                removed++;
+            }else{
+                pos=next(pos);
+            }
+        }
+        return removed;
+    }
+    for(size_t pos=end();pos>begin() && removed<want;){
+        pos=prev(pos);
+        if(get(pos)==value){
+            erase(pos);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+bool ListPack::clampRange(long& start,long& stop,size_t len){
+    long n=static_cast<long>(len);
+    if(start<0)start+=n;
+    if(stop<0)stop+=n;
+    if(start<0)start=0;
+    if(stop>=n)stop=n-1;
+    return start<=stop && start<n;
+}
+
+void ListPack::range(long start,long stop,std::vector<std::string>& out) const{
+    if(!clampRange(start,stop,count))return;
+    out.reserve(out.size()+(stop-start+1));
+    size_t pos=seek(start);
+    for(long i=start;i<=stop;i++,pos=next(pos))
+        out.emplace_back(get(pos));
+}
+
+void ListPack::trim(long start,long stop){
+    if(!clampRange(start,stop,count)){
+        clear();
+        return;
+    }
+    size_t tail=count-1-stop;
+    if(tail>0)eraseRange(seek(stop+1),tail);
+    if(start>0)eraseRange(begin(),start);
+}
+
+long ListPack::insert(std::string_view pivot,std::string_view value,bool before){
+    size_t pos=find(pivot);
+    if(pos==end())return -1;
+    insert(before?pos:next(pos),value);
+    return static_cast<long>(count);
+}
@@ -0,0 +1,156 @@
+#include "../include/PubSub.h"
+#include "../include/StringMatch.h"
+#include <algorithm>
+#include <charconv>
+#include <initializer_list>
+#include <string_view>
+
+PubSub& PubSub::getInstance(){
+    static PubSub instance;
+    return instance;
+}
+
+//a RESP array of bulk strings, as a subscriber receives it
+static SharedMessage encodeMessage(std::initializer_list<std::string_view> parts){
+    size_t len=16;
+    for(auto p:parts)len+=p.size()+16;
+    std::string out;
+    out.reserve(len);
+    char buf[24];
+    out.push_back('*');
+    out.append(buf,std::to_chars(buf,buf+sizeof(buf),parts.size()).ptr-buf);
+    out.append("\r\n",2);
+    for(auto p:parts){
+        out.push_back('$');
+        out.append(buf,std::to_chars(buf,buf+sizeof(buf),p.size()).ptr-buf);
+        out.append("\r\n",2);
+        out.append(p);
+        out.append("\r\n",2);
+    }
+    return std::make_shared<const std::string>(std::move(out));
+}
+
+static void removeSubscriber(std::vector<std::shared_ptr<Subscriber>>& list,const Subscriber* s){
+    auto it=std::find_if(list.begin(),list.end(),[s](const std::shared_ptr<Subscriber>& e){ return e.get()==s; });
+    if(it==list.end())return;
+    *it=std::move(list.back());
+    list.pop_back();
+}
+
+size_t PubSub::subscribe(PubSubClient& c,const std::string& name,bool pattern){
+    if(!c.sub)c.sub=std::make_shared<Subscriber>(c.fd,c.mailbox);
+    std::set<std::string>& mine=pattern?c.sub->patterns:c.sub->channels;
+    if(mine.insert(name).second){
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if(pattern)patterns[name].push_back(c.sub);
+        else channels[name].push_back(c.sub);
+    }
+    return c.sub->count();
+}
+
+size_t PubSub::unsubscribe(PubSubClient& c,const std::string& name,bool pattern){
+    if(!c.sub)return 0;
+    std::set<std::string>& mine=pattern?c.sub->patterns:c.sub->channels;
+    if(mine.erase(name)){
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if(pattern){
+            auto it=patterns.find(name);
+            removeSubscriber(it->second,c.sub.get());
+            if(it->second.empty())patterns.erase(it);
+        }else{
+            auto it=channels.find(name);
+            removeSubscriber(it->second,c.sub.get());
+            if(it->second.empty())channels.erase(it);
+        }
+    }
+    size_t n=c.sub->count();
+    //messages still in the mailbox for the old subscriber are dropped
+    if(n==0)c.sub.reset();
+    return n;
+}
+
+void PubSub::unsubscribeAll(PubSubClient& c){
+    if(!c.sub)return;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for(const auto& name:c.sub->channels){
+            auto it=channels.find(name);
+            removeSubscriber(it->second,c.sub.get());
+            if(it->second.empty())channels.erase(it);
+        }
+        for(const auto& name:c.sub->patterns){
+            auto it=patterns.find(name);
+            removeSubscriber(it->second,c.sub.get());
+            if(it->second.empty())patterns.erase(it);
+        }
+    }
+    c.sub.reset();
+}
+
+size_t PubSub::publish(const std::string& channel,const std::string& message){
+    //one batch per event loop, so each mailbox is locked and woken once
+    std::vector<std::pair<Mailbox*,std::vector<Delivery>>> batches;
+    auto queue=[&batches](const std::shared_ptr<Subscriber>& s,const SharedMessage& msg){
+        auto it=std::find_if(batches.begin(),batches.end(),[&s](const auto& b){ return b.first==s->mailbox; });
+        if(it==batches.end()){
+            batches.emplace_back(s->mailbox,std::vector<Delivery>());
+            it=batches.end()-1;
+        }
+        it->second.push_back({s,msg});
+    };
+    size_t receivers=0;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it=channels.find(channel);
+        if(it!=channels.end()){
+            SharedMessage msg=encodeMessage({"message",channel,message});
+            for(const auto& s:it->second)queue(s,msg);
+            receivers+=it->second.size();
+        }
+        for(const auto& p:patterns){
+            if(!stringMatch(p.first,channel))continue;
+            SharedMessage msg=encodeMessage({"pmessage",p.first,channel,message});
+            for(const auto& s:p.second)queue(s,msg);
+            receivers+=p.second.size();
+        }
+    }
+    for(auto& b:batches){
+        Mailbox& box=*b.first;
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(box.mutex);
+            //a non-empty queue already has a wakeup pending
+            wake=box.queue.empty();
+            if(wake)box.queue.swap(b.second);
+            else box.queue.insert(box.queue.end(),std::make_move_iterator(b.second.begin()),
+                                  std::make_move_iterator(b.second.end()));
+        }
+        if(wake)box.notify();
+    }
+    return receivers;
+}
+
+std::vector<std::string> PubSub::activeChannels(const std::string* pattern){
+    std::vector<std::string> out;
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    for(const auto& ch:channels){
+        if(!pattern || stringMatch(*pattern,ch.first))out.push_back(ch.first);
+    }
+    return out;
+}
+
+size_t PubSub::numsub(const std::string& channel){
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it=channels.find(channel);
+    return it==channels.end()?0:it->second.size();
+}
+
+size_t PubSub::numchannels(){
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return channels.size();
+}
+
+size_t PubSub::numpat(){
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return patterns.size();
+}
@@ -0,0 +1,165 @@
+#include "../include/QuickList.h"
+
+void QuickList::pushFront(std::string_view value){
+    if(nodes.empty() || nodes.front().bytes()+ListPack::entrySize(value.size())>NODE_MAX_BYTES)
+        nodes.emplace_front();
+    nodes.front().pushFront(value);
+    count++;
+}
+
+void QuickList::pushBack(std::string_view value){
+    if(nodes.empty() || nodes.back().bytes()+ListPack::entrySize(value.size())>NODE_MAX_BYTES)
+        nodes.emplace_back();
+    nodes.back().pushBack(value);
+    count++;
+}
+
+std::string QuickList::popFront(){
+    std::string v=nodes.front().popFront();
+    if(nodes.front().empty())nodes.pop_front();
+    count--;
+    return v;
+}
+
+std::string QuickList::popBack(){
+    std::string v=nodes.back().popBack();
+    if(nodes.back().empty())nodes.pop_back();
+    count--;
+    return v;
+}
+
+void QuickList::locate(size_t i,size_t& node,size_t& offset) const{
+    if(i<count/2){
+        node=0;
+        while(i>=nodes[node].size()){
+            i-=nodes[node].size();
+            node++;
+        }
+        offset=i;
+        return;
+    }
+    //closer to the tail: walk backwards
+    size_t fromBack=count-1-i;
+    node=nodes.size()-1;
+    while(fromBack>=nodes[node].size()){
+        fromBack-=nodes[node].size();
+        node--;
+    }
+    offset=nodes[node].size()-1-fromBack;
+}
+
+bool QuickList::index(long i,std::string& out) const{
+    if(i<0)i+=static_cast<long>(count);
+    if(i<0 || i>=static_cast<long>(count))return false;
+    size_t n,off;
+    locate(i,n,off);
+    out.assign(nodes[n].get(nodes[n].seek(off)));
+    return true;
+}
+
+bool QuickList::set(long i,std::string_view value){
+    if(i<0)i+=static_cast<long>(count);
+    if(i<0 || i>=static_cast<long>(count))return false;
+    size_t n,off;
+    locate(i,n,off);
+    nodes[n].replace(nodes[n].seek(off),value);
+    splitIfOversized(n);
+    return true;
+}
+
+void QuickList::splitIfOversized(size_t n){
+    ListPack& node=nodes[n];
+    if(node.bytes()<=NODE_MAX_BYTES || node.size()<2)return;
+    //move the back half into a new node right after this one
+    size_t half=node.size()/2;
+    size_t mid=node.seek(half);
+    ListPack tail;
+    for(size_t pos=mid;pos<node.end();pos=node.next(pos))
+        tail.pushBack(node.get(pos));
+    node.eraseRange(mid,node.size()-half);
+    nodes.insert(nodes.begin()+n+1,std::move(tail));
+}
+
+void QuickList::eraseNodeIfEmpty(size_t n){
+    if(nodes[n].empty())nodes.erase(nodes.begin()+n);
+}
+
+size_t QuickList::remove(long limit,std::string_view value){
+    size_t removed=0;
+    size_t want=limit<0?static_cast<size_t>(-limit):static_cast<size_t>(limit);
+    if(limit>=0){
+        for(size_t n=0;n<nodes.size() && (limit==0 || removed<want);){
+            removed+=nodes[n].remove(limit==0?0:static_cast<long>(want-removed),value);
+            if(nodes[n].empty())nodes.erase(nodes.begin()+n);
+            else n++;
+        }
+    }else{
+        for(size_t n=nodes.size();n-->0 && removed<want;){
+            removed+=nodes[n].remove(-static_cast<long>(want-removed),value);
+            eraseNodeIfEmpty(n);
+        }
+    }
+    count-=removed;
+    return removed;
+}
+
+void QuickList::range(long start,long stop,std::vector<std::string>& out) const{
+    if(!ListPack::clampRange(start,stop,count))return;
+    size_t want=stop-start+1;
+    out.reserve(out.size()+want);
+    size_t n,off;
+    locate(start,n,off);
+    size_t pos=nodes[n].seek(off);
+    while(want>0){
+        if(pos>=nodes[n].end()){
+            n++;
+            pos=nodes[n].begin();
+            continue;
+        }
+        out.emplace_back(nodes[n].get(pos));
+        pos=nodes[n].next(pos);
+        want--;
+    }
+}
+
+void QuickList::trim(long start,long stop){
+    if(!ListPack::clampRange(start,stop,count)){
+        nodes.clear();
+        count=0;
+        return;
+    }
+    size_t dropFront=start;
+    size_t dropBack=count-1-stop;
+    count-=dropFront+dropBack;
+    //whole nodes go at once, only the boundary nodes are cut
+    while(dropFront>0){
+        ListPack& node=nodes.front();
+        if(node.size()<=dropFront){
+            dropFront-=node.size();
+            nodes.pop_front();
+        }else{
+            node.eraseRange(node.begin(),dropFront);
+            dropFront=0;
+        }
+    }
+    while(dropBack>0){
+        ListPack& node=nodes.back();
+        if(node.size()<=dropBack){
+            dropBack-=node.size();
+            nodes.pop_back();
+        }else{
+            node.eraseRange(node.seek(node.size()-dropBack),dropBack);
+            dropBack=0;
+        }
+    }
+}
+
+long QuickList::insert(std::string_view pivot,std::string_view value,bool before){
+    for(size_t n=0;n<nodes.size();n++){
+        if(nodes[n].insert(pivot,value,before)<0)continue;
+        count++;
+        splitIfOversized(n);
+        return static_cast<long>(count);
+    }
+    return -1;
+}
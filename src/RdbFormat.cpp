@@ -0,0 +1,249 @@
+#include "../include/RdbFormat.h"
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>         // for open()
+#include <unistd.h>        // for write(), fsync(), close()
+#include <sys/mman.h>      // for mmap(), madvise()
+#include <sys/stat.h>      // for fstat()
+
+//the reader folds consumed bytes into the checksum in chunks of this size,
+//while they are still in cache
+static const size_t CRC_CHUNK=1024*1024;
+
+//crc32c (Castagnoli), slicing-by-8 tables built once on first use
+struct CrcTables{
+    uint32_t t[8][256];
+    CrcTables(){
+        for(uint32_t i=0;i<256;i++){
+            uint32_t c=i;
+            for(int k=0;k<8;k++)c=(c&1)?(c>>1)^0x82F63B78u:(c>>1);
+            t[0][i]=c;
+        }
+        for(uint32_t i=0;i<256;i++){
+            for(int j=1;j<8;j++)
+                t[j][i]=(t[j-1][i]>>8)^t[0][t[j-1][i]&0xFF];
+        }
+    }
+};
+static const CrcTables& crcTables(){
+    static const CrcTables tables;
+    return tables;
+}
+
+uint32_t crc32c(uint32_t crc,const void* data,size_t len){
+    const auto& t=crcTables().t;
+    const unsigned char* p=static_cast<const unsigned char*>(data);
+    crc=~crc;
+    while(len>=8){
+        uint32_t lo,hi;
+        std::memcpy(&lo,p,4);
+        std::memcpy(&hi,p+4,4);
+        lo^=crc;
+        crc=t[7][lo&0xFF]^t[6][(lo>>8)&0xFF]^t[5][(lo>>16)&0xFF]^t[4][lo>>24]^
+            t[3][hi&0xFF]^t[2][(hi>>8)&0xFF]^t[1][(hi>>16)&0xFF]^t[0][hi>>24];
+        p+=8;
+        len-=8;
+    }
+    while(len--)crc=(crc>>8)^t[0][(crc^*p++)&0xFF];
+    return ~crc;
+}
+
+//-----------------------------
+//RdbWriter
+//-----------------------------
+RdbWriter::RdbWriter():fd(-1),buf(new char[BUF_SIZE]),len(0),crc(0),failed(false){}
+
+RdbWriter::~RdbWriter(){
+    if(fd!=-1)close(fd);
+    delete[] buf;
+}
+
+bool RdbWriter::open(const std::string& path){
+    fd=::open(path.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+    if(fd<0)return false;
+    writeRaw(RDB_MAGIC,RDB_MAGIC_LEN);
+    writeByte(RDB_VERSION);
+    return true;
+}
+
+void RdbWriter::flush(){
+    if(len==0 || failed)return;
+    crc=crc32c(crc,buf,len);
+    size_t off=0;
+    while(off<len){
+        ssize_t n=::write(fd,buf+off,len-off);
+        if(n<0){
+            if(errno==EINTR)continue;
+            failed=true;
+            return;
+        }
+        off+=n;
+    }
+    len=0;
+}
+
+void RdbWriter::writeRaw(const void* data,size_t n){
+    const char* p=static_cast<const char*>(data);
+    if(n>=BUF_SIZE){
+        //large payloads bypass the buffer
+        flush();
+        if(failed)return;
+        crc=crc32c(crc,p,n);
+        while(n>0){
+            ssize_t w=::write(fd,p,n);
+            if(w<0){
+                if(errno==EINTR)continue;
+                failed=true;
+                return;
+            }
+            p+=w;
+            n-=w;
+        }
+        return;
+    }
+    if(len+n>BUF_SIZE)flush();
+    std::memcpy(buf+len,p,n);
+    len+=n;
+}
+
+void RdbWriter::writeByte(uint8_t b){
+    if(len==BUF_SIZE)flush();
+    buf[len++]=static_cast<char>(b);
+}
+
+void RdbWriter::writeVarint(uint64_t v){
+    char tmp[10];
+    size_t n=0;
+    while(v>=0x80){
+        tmp[n++]=static_cast<char>((v&0x7F)|0x80);
+        v>>=7;
+    }
+    tmp[n++]=static_cast<char>(v);
+    writeRaw(tmp,n);
+}
+
+void RdbWriter::writeInt64(int64_t v){
+    char tmp[8];
+    uint64_t u=static_cast<uint64_t>(v);
+    for(int i=0;i<8;i++)tmp[i]=static_cast<char>((u>>(8*i))&0xFF);
+    writeRaw(tmp,8);
+}
+
+void RdbWriter::writeString(std::string_view s){
+    writeVarint(s.size());
+    writeRaw(s.data(),s.size());
+}
+
+bool RdbWriter::finish(){
+    writeByte(RDB_OP_EOF);
+    flush();
+    char tmp[4];
+    for(int i=0;i<4;i++)tmp[i]=static_cast<char>((crc>>(8*i))&0xFF);
+    if(!failed && ::write(fd,tmp,4)!=4)failed=true;
+    if(!failed && fsync(fd)<0)failed=true;
+    if(close(fd)<0)failed=true;
+    fd=-1;
+    return !failed;
+}
+
+//-----------------------------
+//RdbReader
+//-----------------------------
+RdbReader::RdbReader():data(nullptr),size(0),pos(0),crcPos(0),crc(0),good(false){}
+
+RdbReader::~RdbReader(){
+    if(data && size>0)munmap(const_cast<char*>(data),size);
+}
+
+bool RdbReader::open(const std::string& path){
+    int fd=::open(path.c_str(),O_RDONLY|O_CLOEXEC);
+    if(fd<0)return false;
+    struct stat st;
+    if(fstat(fd,&st)<0 || st.st_size==0){
+        close(fd);
+        return false;
+    }
+    size=st.st_size;
+    void* m=mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(m==MAP_FAILED){
+        size=0;
+        return false;
+    }
+    //one front-to-back pass: let the kernel read ahead aggressively
+    madvise(m,size,MADV_SEQUENTIAL|MADV_WILLNEED);
+    data=static_cast<const char*>(m);
+    good=true;
+    return true;
+}
+
+void RdbReader::catchUpCrc(){
+    crc=crc32c(crc,data+crcPos,pos-crcPos);
+    crcPos=pos;
+}
+
+uint8_t RdbReader::readByte(){
+    if(!good || pos>=size){
+        good=false;
+        return 0;
+    }
+    if(pos-crcPos>=CRC_CHUNK)catchUpCrc();
+    return static_cast<uint8_t>(data[pos++]);
+}
+
+uint64_t RdbReader::readVarint(){
+    uint64_t v=0;
+    for(int shift=0;shift<64;shift+=7){
+        if(!good || pos>=size){
+            good=false;
+            return 0;
+        }
+        uint8_t b=static_cast<uint8_t>(data[pos++]);
+        v|=static_cast<uint64_t>(b&0x7F)<<shift;
+        if(!(b&0x80))return v;
+    }
+    good=false;
+    return 0;
+}
+
+int64_t RdbReader::readInt64(){
+    if(!good || size-pos<8){
+        good=false;
+        return 0;
+    }
+    uint64_t u=0;
+    for(int i=0;i<8;i++)u|=static_cast<uint64_t>(static_cast<uint8_t>(data[pos+i]))<<(8*i);
+    pos+=8;
+    return static_cast<int64_t>(u);
+}
+
+void RdbReader::readString(std::string& out){
+    uint64_t n=readVarint();
+    if(!good || n>size-pos){
+        good=false;
+        out.clear();
+        return;
+    }
+    out.assign(data+pos,n);
+    pos+=n;
+}
+std::string_view RdbReader::readStringView(){
+    uint64_t n=readVarint();
+    if(!good || n>size-pos){
+        good=false;
+        return std::string_view();
+    }
+    std::string_view s(data+pos,n);
+    pos+=n;
+    return s;
+}
+
+bool RdbReader::verifyChecksum(){
+    if(!good || size-pos<4)return false;
+    catchUpCrc();
+    uint32_t stored=0;
+    for(int i=0;i<4;i++)stored|=static_cast<uint32_t>(static_cast<uint8_t>(data[pos+i]))<<(8*i);
+    pos+=4;
+    return stored==crc && pos==size;
+}
@@ -1,9 +1,29 @@
 #include "../include/RedisCommandHandler.h"
 #include "../include/RedisDatabase.h"
+#include "../include/AppendOnlyFile.h"
+#include "../include/ServerStats.h"
+#include "../include/SlowLog.h"
+#include "../include/HeapCounter.h"
+#include "../include/SlabAllocator.h"
+#include "../include/Replication.h"
+#include "../include/PubSub.h"
 #include <vector>
-#include <sstream>
 #include <algorithm>
-#include <iostream>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <charconv>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <string_view>
+#include <unordered_map>
+#include <optional>
 //PARSE TO RESP
 /*
 simple strings :   +OK\r\n
@@ -48,366 +68,1821 @@ Sending Commands to a server:  C:*2\r\n$4\r\nLLEN\r\n$6\r\nmylist\r\n   S: S: :4
 
 */
 
-std::vector<std::string> ParseRespCommand(const std::string &input){
-    std::vector<std::string>tokens;
-    //if it doesnt start with '*' (does not look like its RSEP)just split by whitespace
-    if(input.empty())return tokens;
-    if(input[0] !='*'){
-        std::stringstream iss(input);
-        std::string token;
-        while(iss>>token){
-            tokens.push_back(token);
-        }
-        return tokens;
-    }
-    size_t pos =0;
-    //expect '*' then a number 
-    if(input[pos]!='*')return tokens;
-    pos++;//skip *
-    size_t crlf =input.find("\r\n",pos);
-    if(crlf== std::string::npos)return tokens;
-
-    int numElements = std::stoi(input.substr(pos,crlf-pos));
-    pos= crlf+2;
-    for(int i=0;i< numElements;i++){
-        if(pos>=input.size() ||input[pos]!='$')break;
-        pos++; //skip the $
-        crlf=input.find("\r\n",pos);
-        if(crlf== std::string::npos)break;
-        int len= std::stoi(input.substr(pos,crlf-pos));
-        pos=crlf+2;
-        if(pos+len>=input.size())break;
-        std::string token =input.substr(pos,len); 
-        tokens.push_back(token);
-        pos+=len+2;
-
-    }
-    return tokens;
-}
-
 //----------------------
 // Common Commands
 //----------------------
-static std::string handlePing(const std::vector<std::string>& /*tokens*/, RedisDatabase& /*db*/) {
-    return "+PONG\r\n";
+static void handlePing(const std::vector<std::string>& /*tokens*/, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    return reply.addSimple("PONG");
 }
 
-static std::string handleEcho(const std::vector<std::string>& tokens, RedisDatabase& /*db*/) {
-    if (tokens.size() < 2)
-        return "-ERR: ECHO requires a message\r\n";
-    return "+" + tokens[1] + "\r\n";
+static void handleEcho(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    return reply.addSimple(tokens[1]);
 }
 
-static std::string handleFlushAll(const std::vector<std::string>& /*tokens*/, RedisDatabase& db) {
+static void handleFlushAll(const std::vector<std::string>& /*tokens*/, RedisDatabase& db, ReplyBuffer& reply) {
     db.flushAll();
-    return "+OK\r\n";
+    return reply.addSimple("OK");
+}
+
+static void handleSave(const std::vector<std::string>& /*tokens*/, RedisDatabase& db, ReplyBuffer& reply) {
+    if (db.bgsaveInProgress())
+        return reply.addError("ERR Background save already in progress");
+    if (!db.dump(DUMP_FILENAME))
+        return reply.addError("ERR Error saving the database");
+    return reply.addSimple("OK");
+}
+
+static void handleBgsave(const std::vector<std::string>& /*tokens*/, RedisDatabase& db, ReplyBuffer& reply) {
+    if (db.bgsaveInProgress())
+        return reply.addError("ERR Background save already in progress");
+    if (!db.bgsave(DUMP_FILENAME))
+        return reply.addError("ERR Background save failed to start");
+    return reply.addSimple("Background saving started");
+}
+
+static void handleBgrewriteaof(const std::vector<std::string>& /*tokens*/, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    AppendOnlyFile& aof = AppendOnlyFile::getInstance();
+    if (!aof.enabled())
+        return reply.addError("ERR AOF is turned off");
+    if (aof.rewriteInProgress())
+        return reply.addError("ERR Background append only file rewriting already in progress");
+    if (!aof.rewrite())
+        return reply.addError("ERR Can't rewrite append only file in background");
+    return reply.addSimple("Background append only file rewriting started");
+}
+
+static void handleLastSave(const std::vector<std::string>& /*tokens*/, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(db.lastSaveTime());
+}
+
+//REPLICAOF host port | NO ONE
+static void handleReplicaof(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    Replication& repl = Replication::getInstance();
+    if (strcasecmp(tokens[1].c_str(), "no") == 0 && strcasecmp(tokens[2].c_str(), "one") == 0) {
+        repl.promote();
+        return reply.addSimple("OK");
+    }
+    long long port;
+    try {
+        port = std::stoll(tokens[2]);
+    } catch (const std::exception&) {
+        return reply.addError("ERR value is not an integer or out of range");
+    }
+    if (port <= 0 || port > 65535)
+        return reply.addError("ERR Invalid master port");
+    Replication::Status st = repl.status();
+    if (st.replica && st.masterHost == tokens[1] && st.masterPort == port)
+        return reply.addSimple("OK Already connected to specified master");
+    repl.replicaOf(tokens[1], static_cast<int>(port));
+    return reply.addSimple("OK");
+}
+
+//REPLCONF listening-port <port> | ACK <offset>: the event loop and the
+//replication thread read what they need; a client only gets its OK
+static void handleReplconf(const std::vector<std::string>& /*tokens*/, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    return reply.addSimple("OK");
 }
 
 //----------------------
 // Key/Value Operations
 //----------------------
-static std::string handleSet(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if (tokens.size() < 3)
-        return "-ERR: SET requires key and value\r\n";
-    db.set(tokens[1], tokens[2]);
-    return "+OK\r\n";
+//absolute deadline in ms for amount units of unitMs, from now or from the
+//epoch; false when that does not fit an int64 (signed overflow would wrap it
+//into the past and delete the key instead)
+static bool expireDeadline(long long amount, int64_t unitMs, bool absolute, int64_t& when) {
+    int64_t ms;
+    if (__builtin_mul_overflow(static_cast<int64_t>(amount), unitMs, &ms))
+        return false;
+    return !__builtin_add_overflow(absolute ? 0 : RedisDatabase::nowMs(), ms, &when);
+}
+
+static void handleSet(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    //SET key value [EX seconds | PX milliseconds] [NX | XX]
+    int64_t expireAt = -1;
+    SetCondition cond = SetCondition::Always;
+    for (size_t i = 3; i < tokens.size(); i++) {
+        std::string opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if ((opt == "EX" || opt == "PX") && i + 1 < tokens.size() && expireAt < 0) {
+            long long amount;
+            try {
+                amount = std::stoll(tokens[++i]);
+            } catch (const std::exception&) {
+                return reply.addError("ERR value is not an integer or out of range");
+            }
+            if (amount <= 0 || !expireDeadline(amount, opt == "EX" ? 1000 : 1, false, expireAt))
+                return reply.addError("ERR invalid expire time in 'set' command");
+        } else if (opt == "NX" && cond == SetCondition::Always) {
+            cond = SetCondition::IfNotExists;
+        } else if (opt == "XX" && cond == SetCondition::Always) {
+            cond = SetCondition::IfExists;
+        } else {
+            return reply.addError("ERR syntax error");
+        }
+    }
+    if (!db.set(tokens[1], tokens[2], expireAt, cond))
+        return reply.addNull();
+    return reply.addSimple("OK");
 }
 
-static std::string handleGet(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if (tokens.size() < 2)
-        return "-ERR: GET requires key\r\n";
+static void handleGet(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     std::string value;
     if (db.get(tokens[1], value))
-        return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
-    return "$-1\r\n";
+        return reply.addBulk(std::move(value));
+    return reply.addNull();
+}
+
+//MSET/MSETNX take key value pairs after the name
+static bool collectPairs(const std::vector<std::string>& tokens, size_t first, const char* name,
+                         std::vector<std::pair<std::string,std::string>>& pairs, ReplyBuffer& reply) {
+    if ((tokens.size() - first) % 2 != 0) {
+        reply.addError(std::string("ERR wrong number of arguments for '") + name + "' command");
+        return false;
+    }
+    pairs.reserve((tokens.size() - first) / 2);
+    for (size_t i = first; i < tokens.size(); i += 2)
+        pairs.emplace_back(tokens[i], tokens[i + 1]);
+    return true;
+}
+
+static void replyOptionals(std::vector<std::optional<std::string>>& values, ReplyBuffer& reply) {
+    reply.addArrayHeader(values.size());
+    for (auto& v : values) {
+        if (v) reply.addBulk(std::move(*v));
+        else reply.addNull();
+    }
+}
+
+static void handleMset(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    std::vector<std::pair<std::string,std::string>> pairs;
+    if (!collectPairs(tokens, 1, "mset", pairs, reply))
+        return;
+    db.mset(pairs);
+    return reply.addSimple("OK");
+}
+
+static void handleMsetnx(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    std::vector<std::pair<std::string,std::string>> pairs;
+    if (!collectPairs(tokens, 1, "msetnx", pairs, reply))
+        return;
+    return reply.addInteger(db.mset(pairs, SetCondition::IfNotExists) ? 1 : 0);
+}
+
+static void handleMget(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    auto values = db.mget(std::vector<std::string>(tokens.begin() + 1, tokens.end()));
+    return replyOptionals(values, reply);
+}
+
+static void handleKeys(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    auto allKeys = db.keys(tokens[1]);
+    reply.addArrayHeader(allKeys.size());
+    for (auto& key : allKeys)
+        reply.addBulk(std::move(key));
+}
+
+//SCAN family: the cursor argument, then [MATCH pattern] [COUNT n] and, for
+//SCAN only, [TYPE type] starting at tokens[first]
+struct ScanOptions{
+    uint64_t cursor=0;
+    std::string pattern;    //empty matches everything
+    size_t count=10;
+    std::string type;
+};
+static bool parseScanArgs(const std::vector<std::string>& tokens,size_t first,bool allowType,
+                          ScanOptions& opt,ReplyBuffer& reply){
+    const std::string& arg=tokens[first];
+    char* end=nullptr;
+    errno=0;
+    opt.cursor=std::strtoull(arg.c_str(),&end,10);
+    if(arg.empty() || arg[0]=='-' || *end || errno==ERANGE){
+        reply.addError("ERR invalid cursor");
+        return false;
+    }
+    for(size_t i=first+1;i<tokens.size();i+=2){
+        std::string name=tokens[i];
+        std::transform(name.begin(),name.end(),name.begin(),::toupper);
+        if(i+1>=tokens.size() || (name!="MATCH" && name!="COUNT" && (name!="TYPE" || !allowType))){
+            reply.addError("ERR syntax error");
+            return false;
+        }
+        if(name=="MATCH"){
+            opt.pattern=tokens[i+1]=="*"?"":tokens[i+1];
+        }else if(name=="COUNT"){
+            long long n;
+            try{
+                n=std::stoll(tokens[i+1]);
+            }
+            catch(const std::exception&){
+                reply.addError("ERR value is not an integer or out of range");
+                return false;
+            }
+            if(n<1){
+                reply.addError("ERR syntax error");
+                return false;
+            }
+            opt.count=n;
+        }else{
+            opt.type=tokens[i+1];
+            std::transform(opt.type.begin(),opt.type.end(),opt.type.begin(),::tolower);
+        }
+    }
+    return true;
+}
+static void handleScan(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    ScanOptions opt;
+    if(!parseScanArgs(tokens,1,true,opt,reply))return;
+    std::vector<std::string> keys;
+    uint64_t next=db.scan(opt.cursor,opt.count,opt.pattern,opt.type,keys);
+    reply.addArrayHeader(2);
+    reply.addBulk(std::to_string(next));
+    reply.addArrayHeader(keys.size());
+    for(auto& key:keys)
+        reply.addBulk(std::move(key));
 }
 
-static std::string handleKeys(const std::vector<std::string>& /*tokens*/, RedisDatabase& db) {
-    auto allKeys = db.keys();
-    std::ostringstream oss;
-    oss << "*" << allKeys.size() << "\r\n";
-    for (const auto& key : allKeys)
-        oss << "$" << key.size() << "\r\n" << key << "\r\n";
-    return oss.str();
+static void handleObject(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub != "ENCODING")
+        return reply.addError("ERR unknown subcommand '" + tokens[1] + "'");
+    std::string enc = db.encoding(tokens[2]);
+    if (enc.empty())
+        return reply.addNull();
+    return reply.addBulk(enc);
 }
 
-static std::string handleType(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if (tokens.size() < 2)
-        return "-ERR: TYPE requires key\r\n";
-    return "+" + db.type(tokens[1]) + "\r\n";
+//resident set size from /proc, 0 when it cannot be read
+static uint64_t residentMemory(){
+    uint64_t rss=0;
+    if(FILE* f=fopen("/proc/self/statm","r")){
+        unsigned long long pages,resident;
+        if(fscanf(f,"%llu %llu",&pages,&resident)==2)rss=resident*sysconf(_SC_PAGESIZE);
+        fclose(f);
+    }
+    return rss;
+}
+
+static void addRatio(ReplyBuffer& reply,double v){
+    char buf[32];
+    snprintf(buf,sizeof(buf),"%.2f",v);
+    reply.addBulk(std::string_view(buf));
 }
 
-static std::string handleDel(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if (tokens.size() < 2)
-        return "-ERR: DEL requires key\r\n";
-    bool res = db.del(tokens[1]);
-    return ":" + std::to_string(res ? 1 : 0) + "\r\n";
+//MEMORY STATS: where used_memory goes, as name/value pairs. the slab
+//figures cover keyspace entries and long strings; slab.fragmentation is
+//slab memory held per byte handed out, fragmentation rss per used byte
+static void memoryStats(RedisDatabase& db,ReplyBuffer& reply){
+    size_t used=usedMemory(),startup=startupMemory(),rss=residentMemory();
+    size_t keys,volatileKeys;
+    db.countKeys(keys,volatileKeys);
+    size_t dataset=used>startup?used-startup:0;
+    SlabAllocator::Stats slab=SlabAllocator::getInstance().stats();
+    reply.addArrayHeader(24);
+    reply.addBulk("total.allocated");
+    reply.addInteger(used);
+    reply.addBulk("startup.allocated");
+    reply.addInteger(startup);
+    reply.addBulk("keys.count");
+    reply.addInteger(keys);
+    reply.addBulk("keys.bytes-per-key");
+    reply.addInteger(keys?dataset/keys:0);
+    reply.addBulk("dataset.bytes");
+    reply.addInteger(dataset);
+    reply.addBulk("dataset.percentage");
+    addRatio(reply,used?100.0*dataset/used:0.0);
+    reply.addBulk("slab.slabs");
+    reply.addInteger(slab.slabs);
+    reply.addBulk("slab.active");
+    reply.addInteger(slab.activeBytes);
+    reply.addBulk("slab.used");
+    reply.addInteger(slab.usedBytes);
+    reply.addBulk("slab.fragmentation");
+    addRatio(reply,slab.usedBytes?double(slab.activeBytes)/slab.usedBytes:0.0);
+    reply.addBulk("rss-bytes");
+    reply.addInteger(rss);
+    reply.addBulk("fragmentation");
+    addRatio(reply,used?double(rss)/used:0.0);
 }
 
-static std::string handleExpire(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if (tokens.size() < 3)
-        return "-ERR: EXPIRE requires key and time in seconds\r\n";
+//MEMORY USAGE key [SAMPLES count] | MEMORY STATS
+static void handleMemory(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    std::string sub=tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if(sub=="STATS" && tokens.size()==2)
+        return memoryStats(db,reply);
+    if(sub!="USAGE" || (tokens.size()!=3 && tokens.size()!=5))
+        return reply.addError("ERR unknown subcommand or wrong number of arguments for '"+tokens[1]+"'");
+    long long samples=5;
+    if(tokens.size()==5){
+        std::string opt=tokens[3];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if(opt!="SAMPLES")return reply.addError("ERR syntax error");
+        try{
+            samples=std::stoll(tokens[4]);
+        }catch(const std::exception&){
+            return reply.addError("ERR value is not an integer or out of range");
+        }
+        if(samples<0)return reply.addError("ERR syntax error");
+    }
+    size_t bytes=db.memoryUsage(tokens[2],samples);
+    if(bytes==0)
+        return reply.addNull();
+    return reply.addInteger(bytes);
+}
+
+static void handleType(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addSimple(db.type(tokens[1]));
+}
+
+static void handleDel(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    if (tokens.size() == 2)
+        return reply.addInteger(db.del(tokens[1]) ? 1 : 0);
+    return reply.addInteger(db.del(std::vector<std::string>(tokens.begin() + 1, tokens.end())));
+}
+
+static void handleExists(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(db.exists(std::vector<std::string>(tokens.begin() + 1, tokens.end())));
+}
+
+//EXPIRE/PEXPIRE/EXPIREAT/PEXPIREAT share this; unitMs scales the argument and
+//absolute says whether it is a unix timestamp rather than a relative ttl
+static void expireGeneric(const std::vector<std::string>& tokens, RedisDatabase& db, int64_t unitMs, bool absolute, ReplyBuffer& reply) {
+    long long amount;
     try {
-        int seconds = std::stoi(tokens[2]);
-        if (db.expire(tokens[1], seconds))
-            return "+OK\r\n";
-        else
-            return "-ERR: Key not found\r\n";
+        amount = std::stoll(tokens[2]);
     } catch (const std::exception&) {
-        return "-ERR: Invalid expiration time\r\n";
+        return reply.addError("ERR: Invalid expiration time");
     }
+    int64_t when;
+    if (!expireDeadline(amount, unitMs, absolute, when)) {
+        std::string name = tokens[0];
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        return reply.addError("ERR invalid expire time in '" + name + "' command");
+    }
+    return reply.addInteger(db.pexpireAt(tokens[1], when) ? 1 : 0);
+}
+
+static void handleExpire(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return expireGeneric(tokens, db, 1000, false, reply);
+}
+
+static void handlePexpire(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return expireGeneric(tokens, db, 1, false, reply);
+}
+
+static void handleExpireat(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return expireGeneric(tokens, db, 1000, true, reply);
+}
+
+static void handlePexpireat(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return expireGeneric(tokens, db, 1, true, reply);
+}
+
+static void handleTtl(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    int64_t ms = db.pttl(tokens[1]);
+    //round up so a key with 1500ms left reports 2 seconds, like Redis
+    return reply.addInteger(ms < 0 ? ms : (ms + 500) / 1000);
+}
+
+static void handlePttl(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(db.pttl(tokens[1]));
 }
 
-static std::string handleRename(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if (tokens.size() < 3)
-        return "-ERR: RENAME requires old key and new key\r\n";
+static void handlePersist(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(db.persist(tokens[1]) ? 1 : 0);
+}
+
+static void handleRename(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     if (db.rename(tokens[1], tokens[2]))
-        return "+OK\r\n";
-    return "-ERR: Key not found or rename failed\r\n";
+        return reply.addSimple("OK");
+    return reply.addError("ERR: Key not found or rename failed");
 }
 //-------------------------
 //LIST COMMANDS
 //-------------------------
-static std::string handleLlen(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<2)
-        return "-ERR: LLEN requires a key\r\n";
+static void handleLlen(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     ssize_t len=db.llen(tokens[1]);
-    return ":"+ std::to_string(len)+"\r\n";
+    return reply.addInteger(len);
 }
-static std::string handleLpush(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<3)
-        return "-ERR: LPUSH requires a key and value\r\n";
-    db.lpush(tokens[1],tokens[2]);
-    ssize_t len=db.llen(tokens[1]);
-    return ":"+ std::to_string(len)+"\r\n";
+static void handleLpush(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    size_t len=db.lpush(tokens[1],std::vector<std::string>(tokens.begin()+2,tokens.end()));
+    return reply.addInteger(len);
 }
-static std::string handleRpush(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<3)
-        return "-ERR: RPUSH requires a key and a value\r\n";
-    db.rpush(tokens[1],tokens[2]);
-    ssize_t len=db.llen(tokens[1]);
-    return ":"+ std::to_string(len)+"\r\n";
-}
-static std::string handleLpop(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<2)
-        return "-ERR: LPOP requires a key\r\n";
-    std::string val;
-    if(db.lpop(tokens[1],val))
-        return "$" +std::to_string(val.size())+"\r\n"+val +"\r\n";
-    return "$-1\r\n";
-}
-static std::string handleRpop(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<2)
-        return "-ERR: Rpop requires a key\r\n";
-     std::string val;
-    if(db.lpop(tokens[1],val))
-        return "$" +std::to_string(val.size())+"\r\n"+val +"\r\n";
-    return "$-1\r\n";
-}
-static std::string handleLrem(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<4)
-        return "-ERR: LREM requires a key,count and value\r\n";
+static void handleRpush(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    size_t len=db.rpush(tokens[1],std::vector<std::string>(tokens.begin()+2,tokens.end()));
+    return reply.addInteger(len);
+}
+//LPOP/RPOP key [count]: a bulk string without count, an array with it
+static void popGeneric(const std::vector<std::string>& tokens, RedisDatabase& db, bool front, ReplyBuffer& reply) {
+    if(tokens.size()>3)
+        return reply.addError(std::string("ERR wrong number of arguments for '")+(front?"lpop":"rpop")+"' command");
+    if(tokens.size()==2){
+        std::string val;
+        bool found=front?db.lpop(tokens[1],val):db.rpop(tokens[1],val);
+        if(found)
+            return reply.addBulk(std::move(val));
+        return reply.addNull();
+    }
+    long long count;
+    try{
+        count=std::stoll(tokens[2]);
+    }
+    catch(const std::exception&){
+        return reply.addError("ERR value is out of range, must be positive");
+    }
+    if(count<0)
+        return reply.addError("ERR value is out of range, must be positive");
+    std::vector<std::string> items;
+    bool found=front?db.lpop(tokens[1],count,items):db.rpop(tokens[1],count,items);
+    if(!found)
+        return reply.addNullArray();
+    reply.addArrayHeader(items.size());
+    for(auto& item:items)
+        reply.addBulk(std::move(item));
+}
+static void handleLpop(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return popGeneric(tokens,db,true,reply);
+}
+static void handleRpop(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return popGeneric(tokens,db,false,reply);
+}
+//LEFT/RIGHT argument of LMOVE and BLMOVE
+static bool parseDirection(const std::string& arg,bool& front){
+    std::string where=arg;
+    std::transform(where.begin(), where.end(), where.begin(), ::toupper);
+    if(where!="LEFT" && where!="RIGHT")return false;
+    front=where=="LEFT";
+    return true;
+}
+static void handleLmove(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    bool fromFront,toFront;
+    if(!parseDirection(tokens[3],fromFront) || !parseDirection(tokens[4],toFront))
+        return reply.addError("ERR syntax error");
+    std::string value;
+    if(db.lmove(tokens[1],tokens[2],fromFront,toFront,value))
+        return reply.addBulk(std::move(value));
+    return reply.addNull();
+}
+//blocking timeouts are seconds with an optional fraction; 0 waits forever
+static bool parseTimeout(const std::string& arg,int64_t& ms,ReplyBuffer& reply){
+    double secs;
+    size_t used=0;
+    try{
+        secs=std::stod(arg,&used);
+    }
+    catch(const std::exception&){
+        used=0;
+    }
+    if(used==0 || used!=arg.size() || !std::isfinite(secs)){
+        reply.addError("ERR timeout is not a float or out of range");
+        return false;
+    }
+    if(secs<0){
+        reply.addError("ERR timeout is negative");
+        return false;
+    }
+    ms=static_cast<int64_t>(secs*1000);
+    return true;
+}
+//reply of a blocking pop: [key, value] for BLPOP/BRPOP, the value for BLMOVE
+static void replyWaiter(ListWaiter& w,bool timedOut,ReplyBuffer& reply){
+    if(timedOut)
+        return w.move?reply.addNull():reply.addNullArray();
+    if(w.wrongType)
+        return reply.addError(WrongTypeError().what());
+    if(w.move)
+        return reply.addBulk(std::move(w.value));
+    reply.addArrayHeader(2);
+    reply.addBulk(w.key);
+    reply.addBulk(std::move(w.value));
+}
+//serve w right away or park the client on its keys. without a client (aof
+//replay) there is nobody to park and an empty result is a nil reply
+static void blockOrServe(const std::shared_ptr<ListWaiter>& w, int64_t timeoutMs, RedisDatabase& db, ReplyBuffer& reply, BlockingClient* client) {
+    if(client){
+        w->wake=client->wake;
+        if(timeoutMs>0)w->deadline=RedisDatabase::nowMs()+timeoutMs;
+    }
+    if(db.popOrBlock(w,client!=nullptr))
+        return replyWaiter(*w,false,reply);
+    if(client){
+        client->blocked=w;
+        return;
+    }
+    return replyWaiter(*w,true,reply);
+}
+//BLPOP/BRPOP key [key ...] timeout
+static void bpopGeneric(const std::vector<std::string>& tokens, RedisDatabase& db, bool front, ReplyBuffer& reply, BlockingClient* client) {
+    int64_t timeoutMs;
+    if(!parseTimeout(tokens.back(),timeoutMs,reply))
+        return;
+    auto w=std::make_shared<ListWaiter>();
+    w->keys.assign(tokens.begin()+1,tokens.end()-1);
+    w->fromFront=front;
+    return blockOrServe(w,timeoutMs,db,reply,client);
+}
+//BLMOVE source destination LEFT|RIGHT LEFT|RIGHT timeout
+static void blmoveGeneric(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, BlockingClient* client) {
+    auto w=std::make_shared<ListWaiter>();
+    if(!parseDirection(tokens[3],w->fromFront) || !parseDirection(tokens[4],w->toFront))
+        return reply.addError("ERR syntax error");
+    int64_t timeoutMs;
+    if(!parseTimeout(tokens[5],timeoutMs,reply))
+        return;
+    w->keys.push_back(tokens[1]);
+    w->move=true;
+    w->destination=tokens[2];
+    return blockOrServe(w,timeoutMs,db,reply,client);
+}
+static void handleBlpop(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return bpopGeneric(tokens,db,true,reply,nullptr);
+}
+static void handleBrpop(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return bpopGeneric(tokens,db,false,reply,nullptr);
+}
+static void handleBlmove(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return blmoveGeneric(tokens,db,reply,nullptr);
+}
+static void blockBlpop(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, BlockingClient& client) {
+    return bpopGeneric(tokens,db,true,reply,&client);
+}
+static void blockBrpop(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, BlockingClient& client) {
+    return bpopGeneric(tokens,db,false,reply,&client);
+}
+static void blockBlmove(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, BlockingClient& client) {
+    return blmoveGeneric(tokens,db,reply,&client);
+}
+static void handleLrem(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     try{
         int count= std::stoi(tokens[2]);
         int removed =db.lrem(tokens[1],count,tokens[3]);
-        return ":" +std::to_string(removed)+"\r\n";
+        return reply.addInteger(removed);
 
     }
     catch(const std::exception&){
-        return "-ERR:Invalid Count\r\n";
+        return reply.addError("ERR:Invalid Count");
     }
 }
-static std::string handleLindex(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<3)
-        return "-ERR: LINDEX requires a key and index\r\n";
+static void handleLindex(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     try{
         int index= std::stoi(tokens[2]);
         std::string value;
         if(db.lindex(tokens[1],index,value))
-            return "$" +std::to_string(value.size())+"\r\n"+value +"\r\n";
+            return reply.addBulk(std::move(value));
          else 
-            return "$-1\r\n";
+            return reply.addNull();
     }
     catch(const std::exception&){
-        return "-ERR:Invalid Index\r\n";
+        return reply.addError("ERR:Invalid Index");
     }
 }
-static std::string handleLset(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<4)
-        return "-ERR: LSET requires a key,index,value\r\n";
+static void handleLset(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     try{
         int index= std::stoi(tokens[2]);
         std::string value=tokens[3];
         if(db.lset(tokens[1],index,value))
-            return "+OK\r\n";
+            return reply.addSimple("OK");
         else 
-            return "-ERR:Index out of Range\r\n";
+            return reply.addError("ERR:Index out of Range");
 
     }
     catch(const std::exception&){
-        return "-ERR:Invalid Index\r\n";
+        return reply.addError("ERR:Invalid Index");
     }
 }
+static void handleLrange(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    try{
+        long start=std::stol(tokens[2]);
+        long stop=std::stol(tokens[3]);
+        std::vector<std::string> items;
+        db.lrange(tokens[1],start,stop,items);
+        reply.addArrayHeader(items.size());
+        for(auto& item:items)
+            reply.addBulk(std::move(item));
+    }
+    catch(const std::exception&){
+        return reply.addError("ERR:Invalid Index");
+    }
+}
+static void handleLtrim(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    try{
+        db.ltrim(tokens[1],std::stol(tokens[2]),std::stol(tokens[3]));
+        return reply.addSimple("OK");
+    }
+    catch(const std::exception&){
+        return reply.addError("ERR:Invalid Index");
+    }
+}
+static void handleLinsert(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    std::string where=tokens[2];
+    std::transform(where.begin(), where.end(), where.begin(), ::toupper);
+    if(where!="BEFORE" && where!="AFTER")
+        return reply.addError("ERR syntax error");
+    long len=db.linsert(tokens[1],where=="BEFORE",tokens[3],tokens[4]);
+    return reply.addInteger(len);
+}
 //-----------------------------
 //HASH COMMANDS
 //------------------------------
-static std::string handleHset(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<4)
-        return "-ERR: HSET requires a key ,field,value\r\n";
-    db.hset(tokens[1],tokens[2],tokens[3]);
-    return ":1\r\n";
-}
-static std::string handleHget(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if (tokens.size() < 3) 
-        return "-Error: HSET requires key and field\r\n";
+static void handleHset(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    if(tokens.size()==4)
+        return reply.addInteger(db.hset(tokens[1],tokens[2],tokens[3])?1:0);
+    std::vector<std::pair<std::string,std::string>> fieldValues;
+    if(!collectPairs(tokens,2,"hset",fieldValues,reply))
+        return;
+    return reply.addInteger(db.hset(tokens[1],fieldValues));
+}
+static void handleHget(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     std::string value;
     if (db.hget(tokens[1], tokens[2], value))
-        return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
-    return "$-1\r\n";
+        return reply.addBulk(std::move(value));
+    return reply.addNull();
 }
 
-static std::string handleHexists(const std::vector<std::string>& tokens, RedisDatabase& db) {
-     if(tokens.size()<3)
-            return "-ERR: HEXISTS requires a key and a field\r\n";
+static void handleHexists(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     bool exists =db.hexists(tokens[1],tokens[2]);
-    return ":"+std::to_string(exists?1:0)+"\r\n";
+    return reply.addInteger(exists?1:0);
 
 }
-static std::string handleHdel(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<3)
-            return "-ERR: HDEL requires a key and a field\r\n";
-    bool res=db.hdel(tokens[1],tokens[2]);
-    return ":"+std::to_string(res?1:0)+"\r\n";
+static void handleHdel(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    if(tokens.size()==3)
+        return reply.addInteger(db.hdel(tokens[1],tokens[2])?1:0);
+    return reply.addInteger(db.hdel(tokens[1],std::vector<std::string>(tokens.begin()+2,tokens.end())));
+}
+static void handleHmget(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    auto values=db.hmget(tokens[1],std::vector<std::string>(tokens.begin()+2,tokens.end()));
+    return replyOptionals(values,reply);
 }
-static std::string handleHgetall(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<2)
-            return "-ERR: HGETALL requires a key\r\n";
+static void handleHgetall(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     auto hash =db.hgetall(tokens[1]);
-    std::ostringstream oss;
-    oss<<"*"<< hash.size()*2 <<"\r\n";
-    for(const auto& pair:hash){
-        oss<<"$"<<pair.first.size()<<"\r\n"<<pair.first<<"\r\n";
-        oss<<"$"<<pair.second.size()<<"\r\n"<<pair.second<<"\r\n";
-
+    reply.addArrayHeader(hash.size()*2);
+    for(auto& pair:hash){
+        reply.addBulk(std::move(pair.first));
+        reply.addBulk(std::move(pair.second));
+    }
+}
+static void handleHscan(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    ScanOptions opt;
+    if(!parseScanArgs(tokens,2,false,opt,reply))return;
+    std::vector<std::pair<std::string,std::string>> pairs;
+    uint64_t next=db.hscan(tokens[1],opt.cursor,opt.count,opt.pattern,pairs);
+    reply.addArrayHeader(2);
+    reply.addBulk(std::to_string(next));
+    reply.addArrayHeader(pairs.size()*2);
+    for(auto& pair:pairs){
+        reply.addBulk(std::move(pair.first));
+        reply.addBulk(std::move(pair.second));
     }
-    return oss.str();
 }
-static std::string handleHkeys(const std::vector<std::string>& tokens, RedisDatabase& db) {
- if(tokens.size()<2)
-            return "-ERR: HKEYS requires a key\r\n";
+static void handleHkeys(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
     auto keys =db.hkeys(tokens[1]);
-    std::ostringstream oss;
-    oss<<"*"<< keys.size()<<"\r\n";
-    for(const auto& key:keys){
-        oss<<"$"<<key.size()<<"\r\n"<<key<<"\r\n";
+    reply.addArrayHeader(keys.size());
+    for(auto& key:keys)
+        reply.addBulk(std::move(key));
+}
+static void handleHvals(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    auto values =db.hvals(tokens[1]);
+    reply.addArrayHeader(values.size());
+    for(auto& value:values)
+        reply.addBulk(std::move(value));
+}
+static void handleHlen(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    ssize_t len =db.hlen(tokens[1]);
+    return reply.addInteger(len);
 
+}
+static void handleHmset(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    std::vector<std::pair<std::string,std::string>> fieldValues;
+    if(!collectPairs(tokens,2,"hmset",fieldValues,reply))
+        return;
+    db.hset(tokens[1],fieldValues);
+    return reply.addSimple("OK");
+}
+//----------------------
+// Sorted Set Operations
+//----------------------
+//a score is any float including inf, +inf and -inf; nan is refused
+static bool parseScore(const std::string& arg,double& score){
+    if(arg.empty() || isspace(static_cast<unsigned char>(arg[0])))return false;
+    char* end;
+    errno=0;
+    score=std::strtod(arg.c_str(),&end);
+    if(end!=arg.c_str()+arg.size() || std::isnan(score))return false;
+    //an overflowing literal, not an explicit inf
+    return !(errno==ERANGE && std::isinf(score));
+}
+//ZRANGEBYSCORE / ZCOUNT bound: a score, "(" in front makes it exclusive
+static bool parseScoreBound(const std::string& arg,double& score,bool& exclusive){
+    exclusive=!arg.empty() && arg[0]=='(';
+    return parseScore(exclusive?arg.substr(1):arg,score);
+}
+static bool parseScoreRange(const std::string& min,const std::string& max,ScoreRange& range,ReplyBuffer& reply){
+    if(parseScoreBound(min,range.min,range.minExclusive) && parseScoreBound(max,range.max,range.maxExclusive))
+        return true;
+    reply.addError("ERR min or max is not a float");
+    return false;
+}
+//shortest text that reads back as the same double; inf and -inf as such
+static void addScore(ReplyBuffer& reply,double score){
+    char buf[32];
+    char* end=std::to_chars(buf,buf+sizeof(buf),score).ptr;
+    reply.addBulk(std::string_view(buf,end-buf));
+}
+//ZADD key [NX|XX] [GT|LT] [CH] [INCR] score member [score member ...]
+static void handleZadd(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    int flags=0;
+    bool ch=false;
+    size_t i=2;
+    for(;i<tokens.size();i++){
+        const char* opt=tokens[i].c_str();
+        if(strcasecmp(opt,"nx")==0)flags|=ZADD_NX;
+        else if(strcasecmp(opt,"xx")==0)flags|=ZADD_XX;
+        else if(strcasecmp(opt,"gt")==0)flags|=ZADD_GT;
+        else if(strcasecmp(opt,"lt")==0)flags|=ZADD_LT;
+        else if(strcasecmp(opt,"incr")==0)flags|=ZADD_INCR;
+        else if(strcasecmp(opt,"ch")==0)ch=true;
+        else break;
+    }
+    size_t n=tokens.size()-i;
+    if(n==0 || n%2!=0)
+        return reply.addError("ERR syntax error");
+    if((flags&ZADD_NX) && (flags&ZADD_XX))
+        return reply.addError("ERR XX and NX options at the same time are not compatible");
+    if(((flags&ZADD_GT) && (flags&ZADD_LT)) || ((flags&ZADD_NX) && (flags&(ZADD_GT|ZADD_LT))))
+        return reply.addError("ERR GT, LT, and/or NX options at the same time are not compatible");
+    if((flags&ZADD_INCR) && n>2)
+        return reply.addError("ERR INCR option supports a single increment-element pair");
+    std::vector<std::pair<double,std::string>> pairs;
+    pairs.reserve(n/2);
+    for(;i<tokens.size();i+=2){
+        double score;
+        if(!parseScore(tokens[i],score))
+            return reply.addError("ERR value is not a valid float");
+        pairs.emplace_back(score,tokens[i+1]);
     }
-    return oss.str();
+    ZAddResult res=db.zadd(tokens[1],pairs,flags);
+    if(flags&ZADD_INCR){
+        if(res.nan)return reply.addError("ERR resulting score is not a number (NaN)");
+        return res.applied?addScore(reply,res.score):reply.addNull();
+    }
+    return reply.addInteger(static_cast<long long>(ch?res.added+res.updated:res.added));
+}
+static void handleZincrby(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    double increment;
+    if(!parseScore(tokens[2],increment))
+        return reply.addError("ERR value is not a valid float");
+    ZAddResult res=db.zadd(tokens[1],{{increment,tokens[3]}},ZADD_INCR);
+    if(res.nan)return reply.addError("ERR resulting score is not a number (NaN)");
+    return addScore(reply,res.score);
+}
+static void handleZrem(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    std::vector<std::string> members(tokens.begin()+2,tokens.end());
+    return reply.addInteger(static_cast<long long>(db.zrem(tokens[1],members)));
+}
+static void handleZscore(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    double score;
+    if(db.zscore(tokens[1],tokens[2],score))return addScore(reply,score);
+    return reply.addNull();
+}
+static void handleZcard(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(db.zcard(tokens[1]));
+}
+static void zrankGeneric(const std::vector<std::string>& tokens, RedisDatabase& db, bool reverse, ReplyBuffer& reply) {
+    long rank=db.zrank(tokens[1],tokens[2],reverse);
+    if(rank<0)return reply.addNull();
+    return reply.addInteger(rank);
+}
+static void handleZrank(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    zrankGeneric(tokens,db,false,reply);
+}
+static void handleZrevrank(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    zrankGeneric(tokens,db,true,reply);
+}
+//ZRANGE key start stop [BYSCORE] [REV] [LIMIT offset count] [WITHSCORES]
+//and the older forms, which fix byScore and reverse instead. by score and
+//reversed, the bounds come max first
+static void zrangeGeneric(const std::vector<std::string>& tokens, RedisDatabase& db, bool byScore, bool reverse,
+                          bool options, ReplyBuffer& reply) {
+    bool withScores=false,limit=false;
+    long long offset=0,count=-1;
+    for(size_t i=4;i<tokens.size();i++){
+        const char* opt=tokens[i].c_str();
+        if(strcasecmp(opt,"withscores")==0){
+            withScores=true;
+        }else if(options && strcasecmp(opt,"byscore")==0){
+            byScore=true;
+        }else if(options && strcasecmp(opt,"rev")==0){
+            reverse=true;
+        }else if(strcasecmp(opt,"limit")==0 && i+2<tokens.size()){
+            try{
+                offset=std::stoll(tokens[i+1]);
+                count=std::stoll(tokens[i+2]);
+            }catch(const std::exception&){
+                return reply.addError("ERR value is not an integer or out of range");
+            }
+            limit=true;
+            i+=2;
+        }else{
+            return reply.addError("ERR syntax error");
+        }
+    }
+    std::vector<std::pair<std::string,double>> items;
+    if(byScore){
+        ScoreRange range;
+        if(!parseScoreRange(tokens[reverse?3:2],tokens[reverse?2:3],range,reply))return;
+        //a negative offset selects nothing, a negative count everything
+        if(offset>=0)db.zrangeByScore(tokens[1],range,reverse,offset,count<0?-1:count,items);
+    }else{
+        if(limit)
+            return reply.addError("ERR syntax error, LIMIT is only supported in combination with either BYSCORE or BYLEX");
+        long start,stop;
+        try{
+            start=std::stol(tokens[2]);
+            stop=std::stol(tokens[3]);
+        }catch(const std::exception&){
+            return reply.addError("ERR value is not an integer or out of range");
+        }
+        db.zrange(tokens[1],start,stop,reverse,items);
+    }
+    reply.addArrayHeader(withScores?items.size()*2:items.size());
+    for(auto& item:items){
+        reply.addBulk(std::move(item.first));
+        if(withScores)addScore(reply,item.second);
+    }
+}
+static void handleZrange(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    zrangeGeneric(tokens,db,false,false,true,reply);
+}
+static void handleZrevrange(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    zrangeGeneric(tokens,db,false,true,false,reply);
+}
+static void handleZrangebyscore(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    zrangeGeneric(tokens,db,true,false,false,reply);
+}
+static void handleZrevrangebyscore(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    zrangeGeneric(tokens,db,true,true,false,reply);
+}
+static void handleZcount(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    ScoreRange range;
+    if(!parseScoreRange(tokens[2],tokens[3],range,reply))return;
+    return reply.addInteger(static_cast<long long>(db.zcount(tokens[1],range)));
 }
-static std::string handleHvals(const std::vector<std::string>& tokens, RedisDatabase& db) {
-  if(tokens.size()<2)
-            return "-ERR: HVALS requires a key\r\n";
-    auto values =db.hvals(tokens[1]);
-    std::ostringstream oss;
-    oss<<"*"<< values.size()<<"\r\n";
-    for(const auto& value:values){
-        oss<<"$"<<value.size()<<"\r\n"<<value<<"\r\n";
 
+//----------------------
+// Set Operations
+//----------------------
+static void replyMembers(std::vector<std::string>& members, ReplyBuffer& reply) {
+    reply.addArrayHeader(members.size());
+    for(auto& member:members)
+        reply.addBulk(std::move(member));
+}
+static void handleSadd(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(static_cast<long long>(db.sadd(tokens[1],std::vector<std::string>(tokens.begin()+2,tokens.end()))));
+}
+static void handleSrem(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(static_cast<long long>(db.srem(tokens[1],std::vector<std::string>(tokens.begin()+2,tokens.end()))));
+}
+static void handleSismember(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(db.sismember(tokens[1],tokens[2])?1:0);
+}
+static void handleSmembers(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    auto members=db.smembers(tokens[1]);
+    return replyMembers(members,reply);
+}
+static void handleScard(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    return reply.addInteger(db.scard(tokens[1]));
+}
+static void handleSscan(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    ScanOptions opt;
+    if(!parseScanArgs(tokens,2,false,opt,reply))return;
+    std::vector<std::string> members;
+    uint64_t next=db.sscan(tokens[1],opt.cursor,opt.count,opt.pattern,members);
+    reply.addArrayHeader(2);
+    reply.addBulk(std::to_string(next));
+    return replyMembers(members,reply);
+}
+static void handleSinter(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    auto members=db.sinter(std::vector<std::string>(tokens.begin()+1,tokens.end()));
+    return replyMembers(members,reply);
+}
+static void handleSunion(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    auto members=db.sunion(std::vector<std::string>(tokens.begin()+1,tokens.end()));
+    return replyMembers(members,reply);
+}
+static void handleSdiff(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    auto members=db.sdiff(std::vector<std::string>(tokens.begin()+1,tokens.end()));
+    return replyMembers(members,reply);
+}
+
+//----------------------
+// Pub/Sub
+//----------------------
+static void handlePublish(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    return reply.addInteger(static_cast<long long>(PubSub::getInstance().publish(tokens[1],tokens[2])));
+}
+
+//PUBSUB CHANNELS [pattern] | NUMSUB [channel ...] | NUMPAT
+static void handlePubsub(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    PubSub& ps=PubSub::getInstance();
+    const char* sub=tokens[1].c_str();
+    if(strcasecmp(sub,"channels")==0 && tokens.size()<=3){
+        std::vector<std::string> names=ps.activeChannels(tokens.size()==3?&tokens[2]:nullptr);
+        reply.addArrayHeader(names.size());
+        for(auto& n:names)reply.addBulk(std::move(n));
+        return;
     }
-    return oss.str();
+    if(strcasecmp(sub,"numsub")==0){
+        reply.addArrayHeader(2*(tokens.size()-2));
+        for(size_t i=2;i<tokens.size();i++){
+            reply.addBulk(tokens[i]);
+            reply.addInteger(static_cast<long long>(ps.numsub(tokens[i])));
+        }
+        return;
+    }
+    if(strcasecmp(sub,"numpat")==0 && tokens.size()==2)
+        return reply.addInteger(static_cast<long long>(ps.numpat()));
+    return reply.addError("ERR unknown subcommand or wrong number of arguments for 'pubsub' command");
+}
+
+//subscribing needs a connection to deliver to: the aof and a master link have none
+static void handleNoSubscriber(const std::vector<std::string>& /*tokens*/, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    return reply.addError("ERR this connection cannot subscribe");
+}
+
+static void replySubscription(ReplyBuffer& reply,const char* kind,const std::string* name,size_t count){
+    reply.addArrayHeader(3);
+    reply.addBulk(kind);
+    if(name)reply.addBulk(*name);
+    else reply.addNull();
+    reply.addInteger(static_cast<long long>(count));
 }
-static std::string handleHlen(const std::vector<std::string>& tokens, RedisDatabase& db) {
-     if(tokens.size()<2)
-            return "-ERR: HLEN requires a key\r\n";
-    ssize_t len =db.hlen(tokens[1]);
-    return ":" +std::to_string(len)+"\r\n";
 
+static void subscribeGeneric(const std::vector<std::string>& tokens, ReplyBuffer& reply, PubSubClient& c, bool pattern) {
+    PubSub& ps=PubSub::getInstance();
+    for(size_t i=1;i<tokens.size();i++)
+        replySubscription(reply,pattern?"psubscribe":"subscribe",&tokens[i],ps.subscribe(c,tokens[i],pattern));
 }
-static std::string handleHmset(const std::vector<std::string>& tokens, RedisDatabase& db) {
-    if(tokens.size()<4 || (tokens.size()%2)==1){
-            return "-ERR: HMSET requires a key followed by key value pairs\r\n";
 
+//without arguments: from every channel (or pattern), one reply each
+static void unsubscribeGeneric(const std::vector<std::string>& tokens, ReplyBuffer& reply, PubSubClient& c, bool pattern) {
+    PubSub& ps=PubSub::getInstance();
+    const char* kind=pattern?"punsubscribe":"unsubscribe";
+    std::vector<std::string> names(tokens.begin()+1,tokens.end());
+    if(names.empty() && c.sub){
+        const std::set<std::string>& mine=pattern?c.sub->patterns:c.sub->channels;
+        names.assign(mine.begin(),mine.end());
+    }
+    if(names.empty())
+        return replySubscription(reply,kind,nullptr,c.sub?c.sub->count():0);
+    for(const auto& name:names)
+        replySubscription(reply,kind,&name,ps.unsubscribe(c,name,pattern));
+}
+
+static void pubsubSubscribe(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply, PubSubClient& c) {
+    subscribeGeneric(tokens,reply,c,false);
+}
+static void pubsubPsubscribe(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply, PubSubClient& c) {
+    subscribeGeneric(tokens,reply,c,true);
+}
+static void pubsubUnsubscribe(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply, PubSubClient& c) {
+    unsubscribeGeneric(tokens,reply,c,false);
+}
+static void pubsubPunsubscribe(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply, PubSubClient& c) {
+    unsubscribeGeneric(tokens,reply,c,true);
+}
+
+//a subscribed client is answered in the push format it is reading
+static void pubsubPing(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, PubSubClient& c) {
+    if(!c.sub)return handlePing(tokens,db,reply);
+    reply.addArrayHeader(2);
+    reply.addBulk("pong");
+    reply.addBulk(tokens.size()>1?std::string_view(tokens[1]):std::string_view());
+}
+
+//-----------------------------
+//SERVER COMMANDS
+//------------------------------
+static void handleInfo(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply);
+static void handleSlowlog(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply);
+static void handleLatency(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply);
+static void handleTransactionReplay(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply);
+static void multiMulti(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, MultiState& m);
+static void multiExec(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, MultiState& m);
+static void multiDiscard(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, MultiState& m);
+static void multiWatch(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, MultiState& m);
+static void multiUnwatch(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, MultiState& m);
+
+//-----------------------------
+//COMMAND TABLE
+//------------------------------
+typedef void (*CommandProc)(const std::vector<std::string>&, RedisDatabase&, ReplyBuffer&);
+//variant of a command that may park the connection instead of replying
+typedef void (*BlockingProc)(const std::vector<std::string>&, RedisDatabase&, ReplyBuffer&, BlockingClient&);
+//variant of a transaction command that works on the connection's MULTI state
+typedef void (*MultiProc)(const std::vector<std::string>&, RedisDatabase&, ReplyBuffer&, MultiState&);
+//variant of a pub/sub command that works on the connection's subscriptions
+typedef void (*PubSubProc)(const std::vector<std::string>&, RedisDatabase&, ReplyBuffer&, PubSubClient&);
+
+enum CommandFlags:uint32_t{
+    CMD_WRITE=1<<0,      //modifies the keyspace: logged to the aof and sent to replicas
+    CMD_READONLY=1<<1,   //only reads keys
+    CMD_DENYOOM=1<<2,    //may grow the dataset: refused over maxmemory if eviction cannot make room
+    CMD_NOMULTI=1<<3,    //refused inside MULTI: it waits on threads an EXEC may block
+    CMD_PUBSUB=1<<4,     //allowed while the connection is subscribed
+};
+
+struct Command{
+    const char* name;
+    CommandProc proc;
+    int arity;          //argc including the name; -N means at least N
+    uint32_t flags;
+    //key positions as in redis' COMMAND INFO: first and last key argument
+    //(negative counts from the end) and the step between keys; 0 = no keys
+    int firstKey,lastKey,keyStep;
+    //used instead of proc when the caller can park the client; proc then
+    //serves replay, where an empty list just means nil
+    BlockingProc blockingProc;
+    //used instead of proc when the caller keeps MULTI state; run at once
+    //even inside MULTI. proc then serves replay
+    MultiProc multiProc;
+    //used instead of proc when the caller can take subscriptions
+    PubSubProc pubsubProc;
+};
+
+//a command's index in this table is its id in ServerStats
+static const Command COMMANDS[]={
+    {"ping",handlePing,-1,CMD_PUBSUB,0,0,0,nullptr,nullptr,pubsubPing},
+    {"echo",handleEcho,2,0,0,0,0},
+    {"info",handleInfo,-1,0,0,0,0},
+    {"slowlog",handleSlowlog,-2,0,0,0,0},
+    {"latency",handleLatency,-2,0,0,0,0},
+    {"flushall",handleFlushAll,-1,CMD_WRITE,0,0,0},
+    {"save",handleSave,1,0,0,0,0},
+    {"bgsave",handleBgsave,-1,0,0,0,0},
+    {"lastsave",handleLastSave,1,0,0,0,0},
+    {"bgrewriteaof",handleBgrewriteaof,1,CMD_NOMULTI,0,0,0},
+    {"replicaof",handleReplicaof,3,CMD_NOMULTI,0,0,0},
+    {"slaveof",handleReplicaof,3,CMD_NOMULTI,0,0,0},
+    {"replconf",handleReplconf,-1,CMD_NOMULTI,0,0,0},
+    {"multi",handleTransactionReplay,1,0,0,0,0,nullptr,multiMulti},
+    {"exec",handleTransactionReplay,1,0,0,0,0,nullptr,multiExec},
+    {"discard",handleTransactionReplay,1,0,0,0,0,nullptr,multiDiscard},
+    {"watch",handleTransactionReplay,-2,0,1,-1,1,nullptr,multiWatch},
+    {"unwatch",handleTransactionReplay,1,0,0,0,0,nullptr,multiUnwatch},
+    {"publish",handlePublish,3,0,0,0,0},
+    {"pubsub",handlePubsub,-2,0,0,0,0},
+    {"subscribe",handleNoSubscriber,-2,CMD_NOMULTI|CMD_PUBSUB,0,0,0,nullptr,nullptr,pubsubSubscribe},
+    {"unsubscribe",handleNoSubscriber,-1,CMD_NOMULTI|CMD_PUBSUB,0,0,0,nullptr,nullptr,pubsubUnsubscribe},
+    {"psubscribe",handleNoSubscriber,-2,CMD_NOMULTI|CMD_PUBSUB,0,0,0,nullptr,nullptr,pubsubPsubscribe},
+    {"punsubscribe",handleNoSubscriber,-1,CMD_NOMULTI|CMD_PUBSUB,0,0,0,nullptr,nullptr,pubsubPunsubscribe},
+    {"set",handleSet,-3,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"get",handleGet,2,CMD_READONLY,1,1,1},
+    {"mset",handleMset,-3,CMD_WRITE|CMD_DENYOOM,1,-1,2},
+    {"msetnx",handleMsetnx,-3,CMD_WRITE|CMD_DENYOOM,1,-1,2},
+    {"mget",handleMget,-2,CMD_READONLY,1,-1,1},
+    {"keys",handleKeys,2,CMD_READONLY,0,0,0},
+    {"scan",handleScan,-2,CMD_READONLY,0,0,0},
+    {"type",handleType,2,CMD_READONLY,1,1,1},
+    {"object",handleObject,-3,CMD_READONLY,2,2,1},
+    {"memory",handleMemory,-2,CMD_READONLY,2,2,1},
+    {"del",handleDel,-2,CMD_WRITE,1,-1,1},
+    {"unlink",handleDel,-2,CMD_WRITE,1,-1,1},
+    {"exists",handleExists,-2,CMD_READONLY,1,-1,1},
+    {"expire",handleExpire,3,CMD_WRITE,1,1,1},
+    {"pexpire",handlePexpire,3,CMD_WRITE,1,1,1},
+    {"expireat",handleExpireat,3,CMD_WRITE,1,1,1},
+    {"pexpireat",handlePexpireat,3,CMD_WRITE,1,1,1},
+    {"ttl",handleTtl,2,CMD_READONLY,1,1,1},
+    {"pttl",handlePttl,2,CMD_READONLY,1,1,1},
+    {"persist",handlePersist,2,CMD_WRITE,1,1,1},
+    {"rename",handleRename,3,CMD_WRITE,1,2,1},
+    {"llen",handleLlen,2,CMD_READONLY,1,1,1},
+    {"lpush",handleLpush,-3,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"rpush",handleRpush,-3,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"lpop",handleLpop,-2,CMD_WRITE,1,1,1},
+    {"rpop",handleRpop,-2,CMD_WRITE,1,1,1},
+    {"lmove",handleLmove,5,CMD_WRITE|CMD_DENYOOM,1,2,1},
+    {"blpop",handleBlpop,-3,CMD_WRITE,1,-2,1,blockBlpop},
+    {"brpop",handleBrpop,-3,CMD_WRITE,1,-2,1,blockBrpop},
+    {"blmove",handleBlmove,6,CMD_WRITE|CMD_DENYOOM,1,2,1,blockBlmove},
+    {"lrem",handleLrem,4,CMD_WRITE,1,1,1},
+    {"lindex",handleLindex,3,CMD_READONLY,1,1,1},
+    {"lset",handleLset,4,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"lrange",handleLrange,4,CMD_READONLY,1,1,1},
+    {"ltrim",handleLtrim,4,CMD_WRITE,1,1,1},
+    {"linsert",handleLinsert,5,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"hset",handleHset,-4,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"hget",handleHget,3,CMD_READONLY,1,1,1},
+    {"hdel",handleHdel,-3,CMD_WRITE,1,1,1},
+    {"hmget",handleHmget,-3,CMD_READONLY,1,1,1},
+    {"hgetall",handleHgetall,2,CMD_READONLY,1,1,1},
+    {"hscan",handleHscan,-3,CMD_READONLY,1,1,1},
+    {"hexists",handleHexists,3,CMD_READONLY,1,1,1},
+    {"hkeys",handleHkeys,2,CMD_READONLY,1,1,1},
+    {"hvals",handleHvals,2,CMD_READONLY,1,1,1},
+    {"hlen",handleHlen,2,CMD_READONLY,1,1,1},
+    {"hmset",handleHmset,-4,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"zadd",handleZadd,-4,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"zincrby",handleZincrby,4,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"zrem",handleZrem,-3,CMD_WRITE,1,1,1},
+    {"zscore",handleZscore,3,CMD_READONLY,1,1,1},
+    {"zcard",handleZcard,2,CMD_READONLY,1,1,1},
+    {"zrank",handleZrank,3,CMD_READONLY,1,1,1},
+    {"zrevrank",handleZrevrank,3,CMD_READONLY,1,1,1},
+    {"zrange",handleZrange,-4,CMD_READONLY,1,1,1},
+    {"zrevrange",handleZrevrange,-4,CMD_READONLY,1,1,1},
+    {"zrangebyscore",handleZrangebyscore,-4,CMD_READONLY,1,1,1},
+    {"zrevrangebyscore",handleZrevrangebyscore,-4,CMD_READONLY,1,1,1},
+    {"zcount",handleZcount,4,CMD_READONLY,1,1,1},
+    {"sadd",handleSadd,-3,CMD_WRITE|CMD_DENYOOM,1,1,1},
+    {"srem",handleSrem,-3,CMD_WRITE,1,1,1},
+    {"sismember",handleSismember,3,CMD_READONLY,1,1,1},
+    {"smembers",handleSmembers,2,CMD_READONLY,1,1,1},
+    {"scard",handleScard,2,CMD_READONLY,1,1,1},
+    {"sscan",handleSscan,-3,CMD_READONLY,1,1,1},
+    {"sinter",handleSinter,-2,CMD_READONLY,1,-1,1},
+    {"sunion",handleSunion,-2,CMD_READONLY,1,-1,1},
+    {"sdiff",handleSdiff,-2,CMD_READONLY,1,-1,1},
+};
+static const size_t COMMAND_COUNT=sizeof(COMMANDS)/sizeof(COMMANDS[0]);
+static_assert(COMMAND_COUNT<=ThreadStats::MAX_COMMANDS,"raise ThreadStats::MAX_COMMANDS");
+
+static char asciiLower(char c){
+    return (c>='A' && c<='Z')?static_cast<char>(c+('a'-'A')):c;
+}
+
+//command names are matched case-insensitively without copying argv[0]
+struct CaseInsensitiveHash{
+    size_t operator()(std::string_view s) const{
+        uint64_t h=14695981039346656037ULL;     //FNV-1a
+        for(char c:s){
+            h^=static_cast<unsigned char>(asciiLower(c));
+            h*=1099511628211ULL;
+        }
+        return static_cast<size_t>(h);
+    }
+};
+struct CaseInsensitiveEqual{
+    bool operator()(std::string_view a,std::string_view b) const{
+        if(a.size()!=b.size())return false;
+        for(size_t i=0;i<a.size();i++){
+            if(asciiLower(a[i])!=asciiLower(b[i]))return false;
+        }
+        return true;
+    }
+};
+
+static const Command* lookupCommand(std::string_view name){
+    static const std::unordered_map<std::string_view,const Command*,CaseInsensitiveHash,CaseInsensitiveEqual> table=[]{
+        std::unordered_map<std::string_view,const Command*,CaseInsensitiveHash,CaseInsensitiveEqual> t;
+        for(auto& c:COMMANDS)t.emplace(c.name,&c);
+        return t;
+    }();
+    auto it=table.find(name);
+    return it==table.end()?nullptr:it->second;
+}
+
+static bool arityOk(const Command& c,size_t argc){
+    return c.arity>=0?argc==static_cast<size_t>(c.arity):argc>=static_cast<size_t>(-c.arity);
+}
+
+//validate argc and run the command; false when it was refused before running
+static bool callCommand(const Command* c,const std::vector<std::string>& tokens,ReplyBuffer& reply,BlockingClient* client=nullptr,
+                        MultiState* multi=nullptr,PubSubClient* pubsub=nullptr){
+    if(!c){
+        reply.addError("ERR unknown command '"+tokens[0]+"'");
+        return false;
+    }
+    if(!arityOk(*c,tokens.size())){
+        reply.addError(std::string("ERR wrong number of arguments for '")+c->name+"' command");
+        return false;
+    }
+    try{
+        if(multi && c->multiProc)c->multiProc(tokens,RedisDatabase::getInstance(),reply,*multi);
+        else if(client && c->blockingProc)c->blockingProc(tokens,RedisDatabase::getInstance(),reply,*client);
+        else if(pubsub && c->pubsubProc)c->pubsubProc(tokens,RedisDatabase::getInstance(),reply,*pubsub);
+        else c->proc(tokens,RedisDatabase::getInstance(),reply);
+    }catch(const WrongTypeError& e){
+        reply.addError(e.what());
+    }
+    return true;
+}
+
+//-----------------------------
+//INFO
+//------------------------------
+static void appendf(std::string& out,const char* fmt,...) __attribute__((format(printf,2,3)));
+static void appendf(std::string& out,const char* fmt,...){
+    char line[512];
+    va_list ap;
+    va_start(ap,fmt);
+    int n=vsnprintf(line,sizeof(line),fmt,ap);
+    va_end(ap);
+    if(n>0)out.append(line,std::min(static_cast<size_t>(n),sizeof(line)-1));
+}
+
+//1.50K, 12.00M ... as in redis' used_memory_human
+static std::string bytesToHuman(uint64_t n){
+    static const char units[]="BKMGTP";
+    double v=static_cast<double>(n);
+    size_t u=0;
+    while(v>=1024 && u+1<sizeof(units)-1){
+        v/=1024;
+        u++;
+    }
+    char buf[32];
+    if(u==0)snprintf(buf,sizeof(buf),"%lluB",(unsigned long long)n);
+    else snprintf(buf,sizeof(buf),"%.2f%c",v,units[u]);
+    return buf;
+}
+
+static void infoServer(std::string& out){
+    ServerStats& stats=ServerStats::getInstance();
+    utsname name{};
+    uname(&name);
+    int64_t uptime=(RedisDatabase::nowMs()-stats.startTimeMs())/1000;
+    out+="# Server\r\n";
+    appendf(out,"redis_version:7.0.0\r\nredis_mode:standalone\r\nos:%s %s %s\r\narch_bits:%d\r\n",
+            name.sysname,name.release,name.machine,static_cast<int>(sizeof(void*)*8));
+    appendf(out,"multiplexing_api:epoll\r\nio_threads_active:%d\r\nprocess_id:%d\r\ntcp_port:%d\r\n",
+            stats.ioThreads(),static_cast<int>(getpid()),stats.port());
+    appendf(out,"uptime_in_seconds:%lld\r\nuptime_in_days:%lld\r\n",(long long)uptime,(long long)uptime/86400);
+}
+
+static void infoClients(std::string& out){
+    ServerStats& stats=ServerStats::getInstance();
+    ServerStats::Totals t=stats.totals();
+    out+="# Clients\r\n";
+    appendf(out,"connected_clients:%llu\r\nmaxclients:%zu\r\n",
+            (unsigned long long)(t.connections-t.disconnections),stats.maxClients());
+}
+
+static void infoMemory(std::string& out,RedisDatabase& db){
+    //every block handed out by operator new, as counted by HeapCounter
+    uint64_t used=usedMemory();
+    const MaxmemoryConfig& limit=db.maxmemory();
+    uint64_t rss=residentMemory();
+    out+="# Memory\r\n";
+    appendf(out,"used_memory:%llu\r\nused_memory_human:%s\r\n",(unsigned long long)used,bytesToHuman(used).c_str());
+    appendf(out,"used_memory_rss:%llu\r\nused_memory_rss_human:%s\r\n",(unsigned long long)rss,bytesToHuman(rss).c_str());
+    appendf(out,"maxmemory:%zu\r\nmaxmemory_human:%s\r\nmaxmemory_policy:%s\r\n",
+            limit.maxmemory,bytesToHuman(limit.maxmemory).c_str(),evictionPolicyName(limit.policy));
+    appendf(out,"mem_fragmentation_ratio:%.2f\r\nmem_allocator:libc\r\n",used?double(rss)/used:0.0);
+}
+
+static void infoPersistence(std::string& out,RedisDatabase& db){
+    AppendOnlyFile& aof=AppendOnlyFile::getInstance();
+    out+="# Persistence\r\n";
+    appendf(out,"loading:0\r\nrdb_changes_since_last_save:%llu\r\nrdb_bgsave_in_progress:%d\r\n",
+            (unsigned long long)db.dirty(),db.bgsaveInProgress()?1:0);
+    appendf(out,"rdb_last_save_time:%lld\r\nrdb_last_bgsave_status:%s\r\n",
+            (long long)db.lastSaveTime(),db.lastBgsaveOk()?"ok":"err");
+    appendf(out,"aof_enabled:%d\r\naof_rewrite_in_progress:%d\r\n",aof.enabled()?1:0,aof.rewriteInProgress()?1:0);
+    appendf(out,"aof_last_write_status:%s\r\n",aof.writeFailed()?"err":"ok");
+}
+
+static void infoStats(std::string& out,RedisDatabase& db){
+    ServerStats& stats=ServerStats::getInstance();
+    ServerStats::Totals t=stats.totals();
+    out+="# Stats\r\n";
+    appendf(out,"total_connections_received:%llu\r\ntotal_commands_processed:%llu\r\ninstantaneous_ops_per_sec:%.0f\r\n",
+            (unsigned long long)t.connections,(unsigned long long)t.commands,stats.opsPerSec());
+    appendf(out,"total_net_input_bytes:%llu\r\ntotal_net_output_bytes:%llu\r\nrejected_connections:%llu\r\n",
+            (unsigned long long)t.netInput,(unsigned long long)t.netOutput,(unsigned long long)t.rejectedConnections);
+    appendf(out,"evicted_keys:%llu\r\n",(unsigned long long)db.evictedKeys());
+    appendf(out,"pubsub_channels:%zu\r\npubsub_patterns:%zu\r\n",
+            PubSub::getInstance().numchannels(),PubSub::getInstance().numpat());
+}
+
+static void infoReplication(std::string& out){
+    Replication::Status st=Replication::getInstance().status();
+    out+="# Replication\r\n";
+    if(st.replica){
+        appendf(out,"role:slave\r\nmaster_host:%s\r\nmaster_port:%d\r\nmaster_link_status:%s\r\n",
+                st.masterHost.c_str(),st.masterPort,st.linkUp?"up":"down");
+        appendf(out,"master_last_io_seconds_ago:%lld\r\nmaster_sync_in_progress:%d\r\n",
+                st.linkUp?(long long)st.lastIoSecondsAgo:-1LL,st.syncInProgress?1:0);
+        appendf(out,"slave_repl_offset:%llu\r\nslave_read_only:1\r\n",(unsigned long long)st.offset);
+    }else{
+        appendf(out,"role:master\r\n");
+    }
+    appendf(out,"connected_slaves:%zu\r\n",st.replicas.size());
+    for(size_t i=0;i<st.replicas.size();i++){
+        const Replication::ReplicaInfo& r=st.replicas[i];
+        appendf(out,"slave%zu:ip=%s,port=%d,state=%s,offset=%llu,lag=%lld\r\n",
+                i,r.ip.c_str(),r.port,r.state,(unsigned long long)r.ackOffset,(long long)r.lagSeconds);
+    }
+    appendf(out,"master_replid:%s\r\nmaster_repl_offset:%llu\r\n",st.replid.c_str(),(unsigned long long)st.offset);
+    appendf(out,"repl_backlog_active:%d\r\nrepl_backlog_size:%zu\r\n",st.backlogActive?1:0,st.backlogSize);
+    appendf(out,"repl_backlog_first_byte_offset:%llu\r\nrepl_backlog_histlen:%llu\r\n",
+            (unsigned long long)st.backlogFirstByte,(unsigned long long)st.backlogHistlen);
+}
+
+static void infoKeyspace(std::string& out,RedisDatabase& db){
+    size_t keys,volatileKeys;
+    db.countKeys(keys,volatileKeys);
+    out+="# Keyspace\r\n";
+    if(keys>0)appendf(out,"db0:keys=%zu,expires=%zu\r\n",keys,volatileKeys);
+}
+
+static void infoCommandStats(std::string& out){
+    ServerStats& stats=ServerStats::getInstance();
+    out+="# Commandstats\r\n";
+    for(size_t id=0;id<COMMAND_COUNT;id++){
+        ServerStats::CommandTotals t=stats.command(id);
+        if(t.calls==0 && t.rejected==0)continue;
+        appendf(out,"cmdstat_%s:calls=%llu,usec=%llu,usec_per_call=%.2f,rejected_calls=%llu,failed_calls=%llu\r\n",
+                COMMANDS[id].name,(unsigned long long)t.calls,(unsigned long long)(t.nsec/1000),
+                t.calls?t.nsec/1000.0/t.calls:0.0,(unsigned long long)t.rejected,(unsigned long long)t.failed);
+    }
+}
+
+static void infoLatencyStats(std::string& out){
+    ServerStats& stats=ServerStats::getInstance();
+    out+="# Latencystats\r\n";
+    std::vector<uint64_t> hist;
+    for(size_t id=0;id<COMMAND_COUNT;id++){
+        hist.assign(LatencyHistogram::BUCKETS,0);
+        if(stats.command(id,&hist).calls==0)continue;
+        appendf(out,"latency_percentiles_usec_%s:p50=%.3f,p99=%.3f,p99.9=%.3f\r\n",COMMANDS[id].name,
+                LatencyHistogram::percentile(hist,0.50)/1000.0,LatencyHistogram::percentile(hist,0.99)/1000.0,
+                LatencyHistogram::percentile(hist,0.999)/1000.0);
+    }
+}
+
+//INFO [section ...]: no section means the default set; "all" adds the
+//per-command sections
+static void handleInfo(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply) {
+    struct Section{
+        const char* name;
+        bool byDefault;
+        void (*fn)(std::string&,RedisDatabase&);
+    };
+    static const Section sections[]={
+        {"server",true,[](std::string& o,RedisDatabase&){ infoServer(o); }},
+        {"clients",true,[](std::string& o,RedisDatabase&){ infoClients(o); }},
+        {"memory",true,infoMemory},
+        {"persistence",true,infoPersistence},
+        {"stats",true,infoStats},
+        {"replication",true,[](std::string& o,RedisDatabase&){ infoReplication(o); }},
+        {"commandstats",false,[](std::string& o,RedisDatabase&){ infoCommandStats(o); }},
+        {"latencystats",false,[](std::string& o,RedisDatabase&){ infoLatencyStats(o); }},
+        {"keyspace",true,infoKeyspace},
+    };
+    std::vector<std::string> wanted;
+    for(size_t i=1;i<tokens.size();i++){
+        std::string w=tokens[i];
+        std::transform(w.begin(), w.end(), w.begin(), ::tolower);
+        wanted.push_back(w);
+    }
+    bool all=std::find(wanted.begin(),wanted.end(),"all")!=wanted.end() ||
+             std::find(wanted.begin(),wanted.end(),"everything")!=wanted.end();
+    bool defaults=wanted.empty() || std::find(wanted.begin(),wanted.end(),"default")!=wanted.end();
+    std::string out;
+    for(const auto& sec:sections){
+        bool named=std::find(wanted.begin(),wanted.end(),sec.name)!=wanted.end();
+        if(!(all || named || (defaults && sec.byDefault)))continue;
+        if(!out.empty())out+="\r\n";
+        sec.fn(out,db);
+    }
+    reply.addBulk(std::move(out));
+}
+
+//SLOWLOG GET [count] | LEN | RESET
+static void handleSlowlog(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    SlowLog& log=SlowLog::getInstance();
+    std::string sub=tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if(sub=="LEN" && tokens.size()==2)
+        return reply.addInteger(log.len());
+    if(sub=="RESET" && tokens.size()==2){
+        log.reset();
+        return reply.addSimple("OK");
+    }
+    if(sub!="GET" || tokens.size()>3)
+        return reply.addError("ERR unknown subcommand or wrong number of arguments for '"+tokens[1]+"'");
+    long long count=10;
+    if(tokens.size()==3){
+        try{
+            count=std::stoll(tokens[2]);
+        }catch(const std::exception&){
+            return reply.addError("ERR value is not an integer or out of range");
+        }
+        //-1 returns the whole log
+        if(count<-1)return reply.addError("ERR count should be greater than or equal to -1");
+    }
+    auto entries=log.get(count<0?SIZE_MAX:static_cast<size_t>(count));
+    reply.addArrayHeader(entries.size());
+    for(auto& e:entries){
+        reply.addArrayHeader(4);
+        reply.addInteger(e.id);
+        reply.addInteger(e.time);
+        reply.addInteger(e.durationUs);
+        reply.addArrayHeader(e.argv.size());
+        for(auto& arg:e.argv)reply.addBulk(std::move(arg));
+    }
+}
+
+//LATENCY HISTOGRAM [command ...]: per command, the number of calls and the
+//cumulative count of calls at or below each power-of-two microsecond bound
+static void handleLatency(const std::vector<std::string>& tokens, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    std::string sub=tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if(sub!="HISTOGRAM")
+        return reply.addError("ERR unknown subcommand '"+tokens[1]+"'");
+    std::vector<size_t> ids;
+    for(size_t i=2;i<tokens.size();i++){
+        const Command* c=lookupCommand(tokens[i]);
+        if(c && std::find(ids.begin(),ids.end(),size_t(c-COMMANDS))==ids.end())ids.push_back(c-COMMANDS);
+    }
+    if(tokens.size()==2){
+        for(size_t id=0;id<COMMAND_COUNT;id++)ids.push_back(id);
+    }
+    ServerStats& stats=ServerStats::getInstance();
+    std::vector<std::pair<size_t,std::vector<uint64_t>>> found;
+    for(size_t id:ids){
+        std::vector<uint64_t> hist(LatencyHistogram::BUCKETS,0);
+        if(stats.command(id,&hist).calls>0)found.emplace_back(id,std::move(hist));
+    }
+    reply.addArrayHeader(found.size()*2);
+    for(const auto& f:found){
+        const std::vector<uint64_t>& hist=f.second;
+        //bounds of 1024ns*2^k line up with bucket edges; labelled in usec as redis does
+        std::vector<std::pair<uint64_t,uint64_t>> points;
+        uint64_t total=0,cumulative=0,last=0;
+        for(uint64_t c:hist)total+=c;
+        size_t i=0;
+        for(uint64_t boundNs=1024,usec=1;cumulative<total;boundNs<<=1,usec<<=1){
+            while(i<hist.size() && LatencyHistogram::bucketHigh(i)<boundNs)cumulative+=hist[i++];
+            if(i==hist.size())cumulative=total;
+            if(cumulative>last){
+                points.emplace_back(usec,cumulative);
+                last=cumulative;
+            }
+        }
+        reply.addBulk(COMMANDS[f.first].name);
+        reply.addArrayHeader(4);
+        reply.addBulk("calls");
+        reply.addInteger(total);
+        reply.addBulk("histogram_usec");
+        reply.addArrayHeader(points.size()*2);
+        for(const auto& p:points){
+            reply.addInteger(p.first);
+            reply.addInteger(p.second);
+        }
+    }
+}
+
+RedisCommandHandler::RedisCommandHandler(bool masterLink):masterLink(masterLink) {}
+
+//set while EXEC runs its batch: the writes are collected here and
+//propagated together afterwards, wrapped in MULTI/EXEC
+static thread_local std::vector<std::vector<std::string>>* execBatch=nullptr;
+
+//hand one write to the aof and the replication stream; the caller holds the
+//stripes of its keys, so both see writes to a key in the same order
+static void propagate(const std::vector<std::string>& argv){
+    if(execBatch){
+        execBatch->push_back(argv);
+        return;
+    }
+    AppendOnlyFile& aof=AppendOnlyFile::getInstance();
+    if(aof.enabled())aof.feed(argv);
+    Replication& repl=Replication::getInstance();
+    if(repl.active())repl.feed(argv);
+}
+
+//propagate a successful write, judging success by the reply that starts at
+//mark. relative expiries would restart on replay, so they are logged as the
+//absolute PEXPIREAT the key ended up with
+static void propagateWrite(const Command& c,const std::vector<std::string>& tokens,
+                           const ReplyBuffer& reply,const ReplyBuffer::Mark& mark,RedisDatabase& db){
+    std::string_view head=reply.peek(mark,5);
+    if(head.empty() || head[0]=='-')return;
+    bool isSet=c.proc==handleSet;
+    bool isExpire=c.proc==handleExpire || c.proc==handlePexpire || c.proc==handleExpireat || c.proc==handlePexpireat;
+    if((isSet && tokens.size()>3) || isExpire){
+        if(head=="$-1\r\n" || head.substr(0,4)==":0\r\n")return;
+        const std::string& key=tokens[1];
+        int64_t when=db.pexpiretime(key);
+        if(when==-2){
+            //an expiry in the past deleted the key
+            propagate({"DEL",key});
+            return;
+        }
+        if(isSet)propagate({"SET",key,tokens[2]});
+        if(when>=0)propagate({"PEXPIREAT",key,std::to_string(when)});
+        return;
+    }
+    propagate(tokens);
+}
+
+//log the keys a write found expired and deleted as DEL, ahead of the write
+//itself; they are among its keys, so the caller holds their stripes
+static void propagateExpired(RedisDatabase& db){
+    for(const auto& key:db.takeExpired())propagate({"DEL",key});
+}
+
+//a write may have handed an element to clients blocked on one of its keys:
+//serve them now, on this thread, oldest first. each pop is logged as the
+//LPOP/RPOP/LMOVE it amounts to, under the stripes of the keys it touches,
+//and the client is only woken once that entry is queued
+static void serveBlockedClients(const Command& c,const std::vector<std::string>& tokens,RedisDatabase& db){
+    AppendOnlyFile& aof=AppendOnlyFile::getInstance();
+    std::vector<std::string> ready;
+    size_t last=c.lastKey<0?tokens.size()+c.lastKey:c.lastKey;
+    for(size_t i=c.firstKey;i<=last && i<tokens.size();i+=c.keyStep)
+        ready.push_back(tokens[i]);
+    //a served BLMOVE fills its destination, which may have waiters too
+    for(size_t i=0;i<ready.size();i++){
+        const std::string key=ready[i];
+        while(std::shared_ptr<ListWaiter> w=db.nextWaiter(key)){
+            std::vector<std::unique_lock<std::mutex>> locks;
+            locks=aof.lockKeys({key,w->destination},0,w->move?2:1);
+            bool served=db.serveWaiter(key,w);
+            propagateExpired(db);
+            if(!served)continue;
+            if(w->move && !w->wrongType){
+                propagate({"LMOVE",key,w->destination,w->fromFront?"LEFT":"RIGHT",w->toFront?"LEFT":"RIGHT"});
+                ready.push_back(w->destination);
+            }else if(!w->move){
+                propagate({w->fromFront?"LPOP":"RPOP",key});
+            }
+            locks.clear();
+            w->wake(w);
+        }
+    }
+}
+
+//make room before a command that may grow the dataset: evict keys by the
+//maxmemory policy until used memory is back under the limit, propagating
+//each eviction as a DEL. false when nothing more may be evicted
+static bool freeMemoryIfNeeded(RedisDatabase& db){
+    AppendOnlyFile& aof=AppendOnlyFile::getInstance();
+    std::string key;
+    while(db.overMaxmemory()){
+        if(!db.evictionCandidate(key))return false;
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks=aof.lockKeys({key},0,1);
+        if(db.evictKey(key))propagate({"DEL",key});
+    }
+    return true;
+}
+
+//the cron's expiry pass: like an eviction, each key is deleted and its DEL
+//propagated under the key's stripe, so a write to it cannot slip in between
+size_t RedisCommandHandler::activeExpireCycle(std::chrono::microseconds budget){
+    RedisDatabase& db=RedisDatabase::getInstance();
+    AppendOnlyFile& aof=AppendOnlyFile::getInstance();
+    return db.activeExpireCycle(budget,[&](const std::string& key){
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks=aof.lockKeys({key},0,1);
+        if(db.expireKey(key))propagate({"DEL",key});
+    });
+}
+
+//the error for writes refused while the aof cannot be written, as redis has it
+static std::string aofMisconf(){
+    return std::string("MISCONF Errors writing to the AOF file: ")+
+           std::strerror(AppendOnlyFile::getInstance().lastWriteErrno());
+}
+
+//count a finished call in the stats and the slow log; its reply starts at mark
+static void recordCall(const Command& c,const std::vector<std::string>& tokens,std::chrono::steady_clock::time_point start,
+                       const ReplyBuffer& reply,const ReplyBuffer::Mark& mark){
+    uint64_t nsec=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+    ThreadStats& stats=ServerStats::local();
+    CommandMetrics& m=stats.command(&c-COMMANDS);
+    bumpCounter(stats.commands);
+    bumpCounter(m.calls);
+    bumpCounter(m.nsec,nsec);
+    m.latency.record(nsec);
+    if(reply.peek(mark,1)=="-")bumpCounter(m.failed);
+    SlowLog& slowlog=SlowLog::getInstance();
+    if(slowlog.slower(nsec/1000))slowlog.record(tokens,nsec/1000);
+}
+
+//----------------------
+// Transactions
+//----------------------
+//without MULTI state (aof replay) MULTI/EXEC only frame commands that are
+//applied one by one as they come
+static void handleTransactionReplay(const std::vector<std::string>& /*tokens*/, RedisDatabase& /*db*/, ReplyBuffer& reply) {
+    return reply.addSimple("OK");
+}
+
+static void unwatchAll(MultiState& m,RedisDatabase& db){
+    for(const auto& w:m.watched)db.unwatch(w.first);
+    m.watched.clear();
+}
+
+//check a command while MULTI is open; it runs at EXEC. a refused command
+//fails the whole transaction, as in redis
+static void queueCommand(const Command* c,const std::vector<std::string>& tokens,bool readOnly,MultiState& m,ReplyBuffer& reply){
+    m.aborted=true;
+    if(!c)return reply.addError("ERR unknown command '"+tokens[0]+"'");
+    if(!arityOk(*c,tokens.size()))
+        return reply.addError(std::string("ERR wrong number of arguments for '")+c->name+"' command");
+    if(c->flags&CMD_NOMULTI)return reply.addError("ERR Command not allowed inside a transaction");
+    if(readOnly && (c->flags&CMD_WRITE))return reply.addError("READONLY You can't write against a read only replica.");
+    m.aborted=false;
+    m.queued.push_back(tokens);
+    return reply.addSimple("QUEUED");
+}
+
+//run a queued batch as one unit. it takes the stripes of its writes' keys,
+//then every shard of its keys (and of the WATCHed ones) at once, checks the
+//watched versions and runs the commands under those locks; blocking
+//commands behave as their non-blocking forms. the writes are propagated as
+//one MULTI/EXEC block before the stripes are released
+static void execTransaction(const std::vector<std::vector<std::string>>& queued,
+                            const std::vector<std::pair<std::string,uint64_t>>& watched,
+                            RedisDatabase& db,ReplyBuffer& reply){
+    AppendOnlyFile& aof=AppendOnlyFile::getInstance();
+    Replication& repl=Replication::getInstance();
+    std::vector<const Command*> cmds;
+    std::vector<std::string> shardKeys,writeKeys;
+    bool allShards=false,allStripes=false,denyoom=false,anyWrite=false;
+    for(const auto& tokens:queued){
+        const Command* c=lookupCommand(tokens[0]);
+        cmds.push_back(c);
+        bool write=(c->flags&CMD_WRITE)!=0;
+        denyoom|=(c->flags&CMD_DENYOOM)!=0;
+        anyWrite|=write;
+        //a command without key positions may touch any shard
+        if(c->firstKey==0){
+            allShards=true;
+            allStripes|=write;
+            continue;
+        }
+        size_t last=c->lastKey<0?tokens.size()+c->lastKey:c->lastKey;
+        for(size_t i=c->firstKey;i<=last && i<tokens.size();i+=c->keyStep){
+            shardKeys.push_back(tokens[i]);
+            if(write)writeKeys.push_back(tokens[i]);
+        }
+    }
+    if(anyWrite && !repl.isReplica() && aof.writeFailed())
+        return reply.addError(aofMisconf());
+    //evictions lock stripes and shards of their own, so they run first
+    if(denyoom && !repl.isReplica() && !freeMemoryIfNeeded(db))
+        return reply.addError("OOM command not allowed when used memory > 'maxmemory'.");
+    std::vector<std::unique_lock<std::mutex>> stripes;
+    if(allStripes)stripes=aof.lockAllKeys();
+    else if(!writeKeys.empty())stripes=aof.lockKeys(writeKeys,0,writeKeys.size());
+    for(const auto& w:watched)shardKeys.push_back(w.first);
+    std::vector<std::vector<std::string>> batch;
+    {
+        RedisDatabase::TransactionLock tx=db.lockForTransaction(shardKeys,allShards);
+        if(!db.unchangedSince(watched))return reply.addNullArray();
+        bool propagating=aof.enabled() || repl.active();
+        reply.addArrayHeader(queued.size());
+        execBatch=&batch;
+        for(size_t i=0;i<queued.size();i++){
+            ReplyBuffer::Mark mark=reply.mark();
+            auto start=std::chrono::steady_clock::now();
+            callCommand(cmds[i],queued[i],reply);
+            propagateExpired(db);
+            recordCall(*cmds[i],queued[i],start,reply,mark);
+            if(propagating && (cmds[i]->flags&CMD_WRITE))propagateWrite(*cmds[i],queued[i],reply,mark,db);
+        }
+        execBatch=nullptr;
+    }
+    if(batch.size()>1){
+        batch.insert(batch.begin(),{"MULTI"});
+        batch.push_back({"EXEC"});
+    }
+    if(!batch.empty()){
+        if(aof.enabled())aof.feedAll(batch);
+        if(repl.active())repl.feedAll(batch);
+    }
+    stripes.clear();
+    if(!db.hasBlockedClients())return;
+    for(size_t i=0;i<queued.size();i++){
+        if((cmds[i]->flags&CMD_WRITE) && cmds[i]->firstKey>0)serveBlockedClients(*cmds[i],queued[i],db);
+    }
+}
+
+static void multiMulti(const std::vector<std::string>& /*tokens*/, RedisDatabase& /*db*/, ReplyBuffer& reply, MultiState& m) {
+    if (m.active)
+        return reply.addError("ERR MULTI calls can not be nested");
+    m.active = true;
+    return reply.addSimple("OK");
+}
+
+static void multiExec(const std::vector<std::string>& /*tokens*/, RedisDatabase& db, ReplyBuffer& reply, MultiState& m) {
+    if (!m.active)
+        return reply.addError("ERR EXEC without MULTI");
+    std::vector<std::vector<std::string>> queued;
+    queued.swap(m.queued);
+    bool aborted = m.aborted;
+    m.active = false;
+    m.aborted = false;
+    if (aborted)
+        reply.addError("EXECABORT Transaction discarded because of previous errors.");
+    else
+        execTransaction(queued, m.watched, db, reply);
+    unwatchAll(m, db);
+}
+
+static void multiDiscard(const std::vector<std::string>& /*tokens*/, RedisDatabase& db, ReplyBuffer& reply, MultiState& m) {
+    if (!m.active)
+        return reply.addError("ERR DISCARD without MULTI");
+    m.active = false;
+    m.aborted = false;
+    m.queued.clear();
+    unwatchAll(m, db);
+    return reply.addSimple("OK");
+}
+
+static void multiWatch(const std::vector<std::string>& tokens, RedisDatabase& db, ReplyBuffer& reply, MultiState& m) {
+    if (m.active)
+        return reply.addError("ERR WATCH inside MULTI is not allowed");
+    for (size_t i = 1; i < tokens.size(); i++)
+        m.watched.emplace_back(tokens[i], db.watch(tokens[i]));
+    return reply.addSimple("OK");
+}
+
+static void multiUnwatch(const std::vector<std::string>& /*tokens*/, RedisDatabase& db, ReplyBuffer& reply, MultiState& m) {
+    unwatchAll(m, db);
+    return reply.addSimple("OK");
+}
+
+void RedisCommandHandler::resetTransaction(MultiState& multi){
+    multi.active=false;
+    multi.aborted=false;
+    multi.queued.clear();
+    unwatchAll(multi,RedisDatabase::getInstance());
+}
+
+void RedisCommandHandler::replyUnblocked(ListWaiter& w,bool timedOut,ReplyBuffer& reply){
+    replyWaiter(w,timedOut,reply);
+}
+
+void RedisCommandHandler::executeCommand(const std::vector<std::string>& tokens,ReplyBuffer& reply){
+    if(tokens.empty()) return reply.addError("ERR Empty command");
+    callCommand(lookupCommand(tokens[0]),tokens,reply);
+}
+
+void RedisCommandHandler::processCommand(const std::vector<std::string>& tokens,ReplyBuffer& reply,BlockingClient* client,
+                                         MultiState* multi,PubSubClient* pubsub){
+    if(tokens.empty()) return reply.addError("ERR Empty command");
+    const Command* c=lookupCommand(tokens[0]);
+    ThreadStats& stats=ServerStats::local();
+    RedisDatabase& db=RedisDatabase::getInstance();
+    Replication& repl=Replication::getInstance();
+    //only the master link writes to a replica, and the master evicts for it
+    bool replica=repl.isReplica();
+    if(pubsub && pubsub->sub && !(c && (c->flags&CMD_PUBSUB))){
+        std::string name=tokens[0];
+        std::transform(name.begin(),name.end(),name.begin(),::tolower);
+        reply.addError("ERR Can't execute '"+name+"': only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING are allowed in this context");
+        if(c)bumpCounter(stats.command(c-COMMANDS).rejected);
+        return;
+    }
+    if(multi && multi->active && !(c && c->multiProc))
+        return queueCommand(c,tokens,replica && !masterLink,*multi,reply);
+    if(c && (c->flags&CMD_WRITE) && replica && !masterLink){
+        reply.addError("READONLY You can't write against a read only replica.");
+        bumpCounter(stats.command(c-COMMANDS).rejected);
+        return;
+    }
+    //a write the aof cannot log is refused until the aof can be written again
+    if(c && (c->flags&CMD_WRITE) && !masterLink && AppendOnlyFile::getInstance().writeFailed()){
+        reply.addError(aofMisconf());
+        bumpCounter(stats.command(c-COMMANDS).rejected);
+        return;
+    }
+    //before any stripe is taken: evictions lock the stripes of their keys
+    if(c && (c->flags&CMD_DENYOOM) && !replica && !freeMemoryIfNeeded(db)){
+        reply.addError("OOM command not allowed when used memory > 'maxmemory'.");
+        bumpCounter(stats.command(c-COMMANDS).rejected);
+        return;
+    }
+    AppendOnlyFile& aof = AppendOnlyFile::getInstance();
+    bool write=c && (c->flags&CMD_WRITE) && arityOk(*c,tokens.size());
+    //hold the keys' stripes from execution until the command is propagated;
+    //a write without keys (FLUSHALL) holds all of them. taken even with no
+    //aof: a full sync holds every stripe while it turns the stream on
+    std::vector<std::unique_lock<std::mutex>> locks;
+    if(write){
+        if(c->firstKey==0){
+            locks=aof.lockAllKeys();
+        }else{
+            size_t last=c->lastKey<0?tokens.size()+c->lastKey:c->lastKey;
+            locks=aof.lockKeys(tokens,c->firstKey,last+1,c->keyStep);
+        }
+    }
+    ReplyBuffer::Mark mark=reply.mark();
+    auto start=std::chrono::steady_clock::now();
+    if(!callCommand(c,tokens,reply,client,multi,pubsub)){
+        if(c)bumpCounter(stats.command(c-COMMANDS).rejected);
+        return;
+    }
+    propagateExpired(db);
+    recordCall(*c,tokens,start,reply,mark);
+    if(write && (aof.enabled() || repl.active()))propagateWrite(*c,tokens,reply,mark,db);
+    if((c->flags&CMD_WRITE) && c->firstKey>0 && db.hasBlockedClients()){
+        locks.clear();
+        serveBlockedClients(*c,tokens,db);
     }
-    std::vector<std::pair<std::string,std::string>> fieldValues;
-    for(size_t i=2;i<(tokens.size());i+=2){
-        fieldValues.emplace_back(tokens[i],tokens[i+1]);
-    }
-    db.hmset(tokens[1],fieldValues);
-    return "+OK\r\n";
-}
-RedisCommandHandler::RedisCommandHandler() {}
-std::string RedisCommandHandler::processCommand(const std::string& commandLine){
-    RedisDatabase& db = RedisDatabase::getInstance();  // ✅ Add this line
-    auto tokens = ParseRespCommand(commandLine);
-    if(tokens.empty()) return "-ERR Empty command\r\n";
-    std::cout <<commandLine <<"\n";
-    for(auto& t:tokens){
-    	std::cout<<t<< "\n";
-    }
-    std::string cmd = tokens[0];
-    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
-    std::ostringstream response;
-   // Common Commands
-    if (cmd == "PING")
-        return handlePing(tokens, db);
-    else if (cmd == "ECHO")
-        return handleEcho(tokens, db);
-    else if (cmd == "FLUSHALL")
-        return handleFlushAll(tokens, db);
-    // Key/Value Operations
-    else if (cmd == "SET")
-        return handleSet(tokens, db);
-    else if (cmd == "GET")
-        return handleGet(tokens, db);
-    else if (cmd == "KEYS")
-        return handleKeys(tokens, db);
-    else if (cmd == "TYPE")
-        return handleType(tokens, db);
-    else if (cmd == "DEL" || cmd == "UNLINK")
-        return handleDel(tokens, db);
-    else if (cmd == "EXPIRE")
-        return handleExpire(tokens, db);
-    else if (cmd == "RENAME")
-        return handleRename(tokens, db);
-    //list operations
-    else if(cmd=="LLEN")
-        return handleLlen(tokens,db);
-    else if(cmd=="LPUSH")
-        return handleLpush(tokens,db);
-    else if(cmd=="RPUSH")
-        return handleRpush(tokens,db);
-    else if(cmd=="LPOP")
-        return handleLpop(tokens,db);
-    else if(cmd=="RPOP")
-        return handleRpop(tokens,db);
-    else if(cmd=="LREM")
-        return handleLrem(tokens,db);
-    else if(cmd=="LINDEX")
-        return handleLindex(tokens,db);
-    else if(cmd=="LSET")
-        return handleLset(tokens,db);
-    //hash operations
-    else if(cmd=="HSET")
-        return handleHset(tokens,db);
-    else if(cmd=="HGET")
-        return handleHget(tokens,db);
-    else if(cmd=="HDEL")
-        return handleHdel(tokens,db);
-    else if(cmd=="HGETALL")
-        return handleHgetall(tokens,db);
-    else if(cmd=="HEXISTS")
-        return handleHexists(tokens,db);
-    else if(cmd=="HKEYS")
-        return handleHkeys(tokens,db);
-    else if(cmd=="HVALS")
-        return handleHvals(tokens,db);
-    else if(cmd=="HLEN")
-        return handleHlen(tokens,db);
-    else if(cmd=="HMSET")
-        return handleHmset(tokens,db);
-    else {
-        return "-ERR unknown command " + cmd + "\r\n";
-    }
-    
-   
 }
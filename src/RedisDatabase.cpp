@@ -1,12 +1,118 @@
 #include "../include/RedisDatabase.h"
+#include "../include/RdbFormat.h"
+#include "../include/StringMatch.h"
+#include "../include/HeapCounter.h"
 #include <fstream>
 #include<sstream>
 #include<algorithm>
+#include<chrono>
+#include<cstring>
+#include<cmath>
+#include<unistd.h>
+#include<sys/wait.h>
 //singleton accessor
 RedisDatabase& RedisDatabase::getInstance(){
     static RedisDatabase instance;
     return instance;
 }
+
+RedisDatabase::RedisDatabase(){
+    static_assert(SHARD_COUNT<=64,"ShardMutex::held has a bit per shard");
+    for(size_t i=0;i<SHARD_COUNT;i++)
+        shards[i].mutex.bit=uint64_t(1)<<i;
+}
+
+//shard selection uses the high bits of the hash so it stays independent of
+//the bucket index the per-shard Dict derives from the low bits
+size_t RedisDatabase::shardIndex(const std::string& key) const{
+    size_t h=std::hash<std::string>{}(key);
+    h^=h>>29;
+    h*=0xbf58476d1ce4e5b9ULL;
+    return (h>>32)&(SHARD_COUNT-1);
+}
+//whole-keyspace operations: take every shard lock, always in index order,
+//so they can never deadlock against each other or against rename
+std::vector<std::unique_lock<ShardMutex>> RedisDatabase::lockAllShards(){
+    std::vector<std::unique_lock<ShardMutex>> locks;
+    locks.reserve(SHARD_COUNT);
+    for(auto& shard:shards)
+        locks.emplace_back(shard.mutex);
+    return locks;
+}
+std::vector<std::shared_lock<ShardMutex>> RedisDatabase::lockAllShardsShared(){
+    std::vector<std::shared_lock<ShardMutex>> locks;
+    locks.reserve(SHARD_COUNT);
+    for(auto& shard:shards)
+        locks.emplace_back(shard.mutex);
+    return locks;
+}
+//multi-key commands: the distinct shards of their keys are locked in
+//ascending index order, the same order lockAllShards and rename use
+static void sortShardIndexes(std::vector<size_t>& indexes){
+    std::sort(indexes.begin(),indexes.end());
+    indexes.erase(std::unique(indexes.begin(),indexes.end()),indexes.end());
+}
+std::vector<std::unique_lock<ShardMutex>> RedisDatabase::lockShards(std::vector<size_t> indexes){
+    sortShardIndexes(indexes);
+    std::vector<std::unique_lock<ShardMutex>> locks;
+    locks.reserve(indexes.size());
+    for(size_t i:indexes)
+        locks.emplace_back(shards[i].mutex);
+    return locks;
+}
+std::vector<std::shared_lock<ShardMutex>> RedisDatabase::lockShardsShared(std::vector<size_t> indexes){
+    sortShardIndexes(indexes);
+    std::vector<std::shared_lock<ShardMutex>> locks;
+    locks.reserve(indexes.size());
+    for(size_t i:indexes)
+        locks.emplace_back(shards[i].mutex);
+    return locks;
+}
+std::vector<size_t> RedisDatabase::shardIndexes(const std::vector<std::string>& keys) const{
+    std::vector<size_t> indexes;
+    indexes.reserve(keys.size());
+    for(const auto& key:keys)
+        indexes.push_back(shardIndex(key));
+    return indexes;
+}
+//transactions: the shards are locked like a multi-key command's, then marked
+//held so the commands of the batch do not lock them a second time
+RedisDatabase::TransactionLock RedisDatabase::lockForTransaction(const std::vector<std::string>& keys,bool all){
+    TransactionLock tx;
+    tx.locks=all?lockAllShards():lockShards(shardIndexes(keys));
+    for(auto& lock:tx.locks)tx.mask|=lock.mutex()->bit;
+    ShardMutex::held|=tx.mask;
+    return tx;
+}
+uint64_t RedisDatabase::watch(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    WatchedKey& w=shard.watched.emplace(key).first->second;
+    w.watchers++;
+    return w.version;
+}
+void RedisDatabase::unwatch(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    auto it=shard.watched.find(key);
+    if(it!=shard.watched.end() && --it->second.watchers==0)shard.watched.erase(it);
+}
+bool RedisDatabase::unchangedSince(const std::vector<std::pair<std::string,uint64_t>>& versions){
+    for(const auto& v:versions){
+        Shard& shard=shardFor(v.first);
+        std::shared_lock<ShardMutex> lock(shard.mutex);
+        auto it=shard.watched.find(v.first);
+        if(it==shard.watched.end() || it->second.version!=v.second)return false;
+    }
+    return true;
+}
+void RedisDatabase::touchWatched(Shard& shard,std::string_view key){
+    auto it=shard.watched.find(key);
+    if(it!=shard.watched.end())it->second.version++;
+}
+void RedisDatabase::touchAllWatched(Shard& shard){
+    for(auto& kv:shard.watched)kv.second.version++;
+}
 //key/val oper
 //list opers
 //hash opers
@@ -14,281 +120,1433 @@ RedisDatabase& RedisDatabase::getInstance(){
 /*
 Memory->file -dump()
 file->memory -load()
-K= Key Value
-L=List
-H=Hash
+dump() writes the binary format described in RdbFormat.h; load() also
+accepts the older text format (K=Key Value, L=List, H=Hash lines).
 */
 
 /*
-Key-Value (K)
-kv_store["name"] = "Alice";
-kv_store["city"] = "Berlin";
+Every key lives in exactly one shard's dict as a RedisObject:
+dict["name"]     = {String, Raw,       "Alice"}
+dict["fruits"]   = {List,   QuickList,    {"apple", "banana", "orange"}}
+dict["user:100"] = {Hash,   HashTable, {{"name", "Bob"}, {"age", "30"}}}
+dict["board"]    = {ZSet,   SkipList,  {{"bob", 12}, {"alice", 40}}}
+dict["tag:7"]    = {Set,    IntSet,    {3, 19, 1024}}
+A command against a key of another type fails with WRONGTYPE.
+*/
+//expiry heap entries popped per exclusive lock hold in the active cycle
+static const size_t ACTIVE_EXPIRE_BATCH=128;
 
-List (L)
-list_store["fruits"] = {"apple", "banana", "orange"};
-list_store["colors"] = {"red", "green", "blue"};
+int64_t RedisDatabase::nowMs(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+static bool isExpired(const RedisObject& obj){
+    return obj.expireAt>=0 && obj.expireAt<=RedisDatabase::nowMs();
+}
+//std heap functions build a max-heap; invert to keep the earliest deadline on top
+template<typename Entry>
+static bool laterDeadline(const Entry& a,const Entry& b){
+    return a.when>b.when;
+}
 
-Hash (H)
-hash_store["user:100"] = {
-    {"name", "Bob"},
-    {"age", "30"},
-    {"email", "bob@example.com"}
-};
+void RedisDatabase::setExpire(Shard& shard,std::string_view key,RedisObject& obj,int64_t when){
+    obj.expireAt=when;
+    if(when<0)return;
+    shard.expires.push_back(ExpireEntry{when,key});
+    std::push_heap(shard.expires.begin(),shard.expires.end(),laterDeadline<ExpireEntry>);
+    //keys whose ttl keeps being refreshed leave stale entries behind; rebuild
+    //the heap from the dict once they outnumber the live keys
+    if(shard.expires.size()>2*shard.dict.size()+1024){
+        shard.expires.clear();
+        for(const auto& kv:shard.dict){
+            if(kv.second.expireAt>=0)
+                shard.expires.push_back(ExpireEntry{kv.second.expireAt,kv.first});
+        }
+        std::make_heap(shard.expires.begin(),shard.expires.end(),laterDeadline<ExpireEntry>);
+    }
+}
+
+size_t RedisDatabase::expireDue(Shard& shard,int64_t now,size_t limit){
+    size_t expired=0;
+    while(limit>0 && !shard.expires.empty() && shard.expires.front().when<=now){
+        std::pop_heap(shard.expires.begin(),shard.expires.end(),laterDeadline<ExpireEntry>);
+        ExpireEntry entry=std::move(shard.expires.back());
+        shard.expires.pop_back();
+        limit--;
+        auto it=shard.dict.find(entry.key);
+        //stale entry: key gone, or its ttl was changed after this was queued
+        if(it==shard.dict.end() || it->second.expireAt!=entry.when)continue;
+        shard.dict.erase(it);
+        markDirty(shard,entry.key.view());
+        expired++;
+    }
+    return expired;
+}
+
+size_t RedisDatabase::activeExpireCycle(std::chrono::microseconds budget,const std::function<void(const std::string&)>& expire){
+    if(!expiresKeys())return 0;
+    auto deadline=std::chrono::steady_clock::now()+budget;
+    size_t expired=0;
+    std::vector<std::string> due;
+    for(size_t n=0;n<SHARD_COUNT;n++){
+        size_t idx=(expireCursor+n)%SHARD_COUNT;
+        Shard& shard=shards[idx];
+        int64_t now=nowMs();
+        {
+            //peek under the shared lock so idle shards never block readers
+            std::shared_lock<ShardMutex>lock(shard.mutex);
+            if(shard.expires.empty() || shard.expires.front().when>now)continue;
+        }
+        while(true){
+            size_t popped=0;
+            due.clear();
+            {
+                //take due entries off the heap; a key whose ttl changes after
+                //this has a new entry, and expireKey checks it again anyway
+                std::unique_lock<ShardMutex>lock(shard.mutex);
+                while(popped<ACTIVE_EXPIRE_BATCH && !shard.expires.empty() && shard.expires.front().when<=now){
+                    std::pop_heap(shard.expires.begin(),shard.expires.end(),laterDeadline<ExpireEntry>);
+                    ExpireEntry entry=std::move(shard.expires.back());
+                    shard.expires.pop_back();
+                    popped++;
+                    auto it=shard.dict.find(entry.key);
+                    if(it!=shard.dict.end() && it->second.expireAt==entry.when)
+                        due.emplace_back(entry.key.view());
+                }
+            }
+            //the caller takes each key's stripe, which comes before the shard lock
+            for(const auto& key:due)expire(key);
+            expired+=due.size();
+            if(std::chrono::steady_clock::now()>=deadline){
+                //out of time: resume from this shard next cycle
+                expireCursor=idx;
+                return expired;
+            }
+            if(popped<ACTIVE_EXPIRE_BATCH)break;
+        }
+    }
+    expireCursor=(expireCursor+1)%SHARD_COUNT;
+    return expired;
+}
+bool RedisDatabase::expireKey(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    auto it=shard.dict.find(key);
+    if(it==shard.dict.end() || !isExpired(it->second) || !expiresKeys())return false;
+    shard.dict.erase(it);
+    markDirty(shard,key);
+    return true;
+}
 
-hash_store["user:200"] = {
-    {"name", "Eve"},
-    {"age", "25"},
-    {"email", "eve@example.com"}
+//keys deleted by lookupWrite on this thread, until the command's caller
+//takes them to log
+static thread_local std::vector<std::string> lazyExpired;
+std::vector<std::string> RedisDatabase::takeExpired(){
+    std::vector<std::string> keys;
+    keys.swap(lazyExpired);
+    return keys;
+}
+
+//-------------------
+// Eviction
+//-------------------
+//allkeys-lfu as redis does it: the counter grows with probability
+//1/((counter-LFU_INIT_VAL)*LFU_LOG_FACTOR+1), so about a million hits
+//saturate it, and it loses one for every LFU_DECAY_SECONDS without access
+static const unsigned LFU_LOG_FACTOR=10;
+static const uint32_t LFU_DECAY_SECONDS=60;
+//shards sampled per pick; the pool remembers the best candidates of earlier
+//picks, so a few shards per pick are enough
+static const size_t EVICTION_SHARDS=4;
+static const size_t EVICTION_POOL_SIZE=16;
+
+static const std::pair<EvictionPolicy,const char*> EVICTION_POLICY_NAMES[]={
+    {EvictionPolicy::NoEviction,"noeviction"},
+    {EvictionPolicy::AllKeysLru,"allkeys-lru"},
+    {EvictionPolicy::AllKeysLfu,"allkeys-lfu"},
+    {EvictionPolicy::VolatileTtl,"volatile-ttl"},
 };
-*/
+const char* evictionPolicyName(EvictionPolicy policy){
+    for(const auto& p:EVICTION_POLICY_NAMES){
+        if(p.first==policy)return p.second;
+    }
+    return "noeviction";
+}
+bool parseEvictionPolicy(const std::string& name,EvictionPolicy& policy){
+    for(const auto& p:EVICTION_POLICY_NAMES){
+        if(name==p.second){
+            policy=p.first;
+            return true;
+        }
+    }
+    return false;
+}
+
+//xorshift64*, per thread; good enough for sampling and the lfu coin flip
+static uint64_t randomNext(){
+    thread_local uint64_t state=0x9E3779B97F4A7C15ULL^reinterpret_cast<uintptr_t>(&state);
+    state^=state>>12;
+    state^=state<<25;
+    state^=state>>27;
+    return state*0x2545F4914F6CDD1DULL;
+}
+static uint8_t lfuDecayed(const RedisObject& obj,uint32_t now){
+    uint32_t periods=(now-obj.accessTime())/LFU_DECAY_SECONDS;
+    uint8_t count=obj.accessCount();
+    return periods>=count?0:static_cast<uint8_t>(count-periods);
+}
+static uint8_t lfuIncrement(uint8_t count){
+    if(count==255)return count;
+    double base=count>LFU_INIT_VAL?count-LFU_INIT_VAL:0;
+    double r=(randomNext()>>11)*0x1.0p-53;
+    return r<1.0/(base*LFU_LOG_FACTOR+1)?count+1:count;
+}
+void RedisDatabase::touch(RedisObject& obj) const{
+    uint32_t now=lruClock();
+    uint8_t count=obj.accessCount();
+    if(maxmemoryConfig.policy==EvictionPolicy::AllKeysLfu)count=lfuIncrement(lfuDecayed(obj,now));
+    obj.setAccess(now,count);
+}
+bool RedisDatabase::overMaxmemory() const{
+    return maxmemoryConfig.maxmemory>0 && usedMemory()>maxmemoryConfig.maxmemory;
+}
+//pool of the best candidates, ordered by score; a key already in it only
+//gets its score refreshed
+void RedisDatabase::poolInsert(uint64_t score,std::string_view key){
+    std::vector<EvictionCandidate>& pool=evictionPool;
+    for(auto it=pool.begin();it!=pool.end();++it){
+        if(it->key==key){
+            pool.erase(it);
+            break;
+        }
+    }
+    if(pool.size()>=EVICTION_POOL_SIZE && score<=pool.front().score)return;
+    auto pos=std::upper_bound(pool.begin(),pool.end(),score,
+        [](uint64_t s,const EvictionCandidate& c){ return s<c.score; });
+    pool.insert(pos,EvictionCandidate{score,std::string(key)});
+    if(pool.size()>EVICTION_POOL_SIZE)pool.erase(pool.begin());
+}
+//lru scores idle seconds, lfu the decayed counter inverted. volatile-ttl
+//reads the shard's expiry heap instead of sampling: its first entries are
+//the soonest deadlines, checked against the dict since some may be stale
+void RedisDatabase::sampleShard(Shard& shard,uint32_t now){
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    EvictionPolicy policy=maxmemoryConfig.policy;
+    size_t samples=maxmemoryConfig.samples;
+    if(policy==EvictionPolicy::VolatileTtl){
+        for(size_t i=0;i<shard.expires.size() && i<samples;i++){
+            const ExpireEntry& entry=shard.expires[i];
+            auto it=shard.dict.find(entry.key);
+            if(it!=shard.dict.end() && it->second.expireAt==entry.when)
+                poolInsert(UINT64_MAX-static_cast<uint64_t>(entry.when),entry.key);
+        }
+        return;
+    }
+    shard.dict.sample(randomNext(),samples,[&](const auto& pair){
+        uint64_t score=policy==EvictionPolicy::AllKeysLfu?255-lfuDecayed(pair.second,now)
+                                                          :now-pair.second.accessTime();
+        poolInsert(score,pair.first);
+    });
+}
+bool RedisDatabase::evictionCandidate(std::string& key){
+    if(maxmemoryConfig.policy==EvictionPolicy::NoEviction)return false;
+    std::lock_guard<std::mutex> lock(evictionMutex);
+    uint32_t now=lruClock();
+    for(size_t i=0;i<EVICTION_SHARDS;i++)
+        sampleShard(shards[randomNext()%SHARD_COUNT],now);
+    //a small keyspace may leave the shards picked empty
+    if(evictionPool.empty()){
+        for(auto& shard:shards)sampleShard(shard,now);
+    }
+    if(evictionPool.empty())return false;
+    key=std::move(evictionPool.back().key);
+    evictionPool.pop_back();
+    return true;
+}
+bool RedisDatabase::evictKey(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    if(shard.dict.erase(key)==0)return false;
+    markDirty(shard,key);
+    evicted.fetch_add(1,std::memory_order_relaxed);
+    //volatile-ttl samples the top of the heap, so keep stale entries (like
+    //the one of the key just evicted) from piling up there
+    while(!shard.expires.empty()){
+        const ExpireEntry& top=shard.expires.front();
+        auto it=shard.dict.find(top.key);
+        if(it!=shard.dict.end() && it->second.expireAt==top.when)break;
+        std::pop_heap(shard.expires.begin(),shard.expires.end(),laterDeadline<ExpireEntry>);
+        shard.expires.pop_back();
+    }
+    return true;
+}
+
+const RedisObject* RedisDatabase::lookupRead(Shard& shard,const std::string& key) const{
+    auto it=shard.dict.find(key);
+    if(it==shard.dict.end())return nullptr;
+    if(isExpired(it->second) && !loading.load(std::memory_order_acquire))return nullptr;
+    touch(it->second);
+    return &it->second;
+}
+const RedisObject* RedisDatabase::lookupRead(Shard& shard,const std::string& key,ObjectType type) const{
+    const RedisObject* obj=lookupRead(shard,key);
+    if(obj && obj->type!=type)throw WrongTypeError();
+    return obj;
+}
+RedisObject* RedisDatabase::lookupWrite(Shard& shard,const std::string& key){
+    auto it=shard.dict.find(key);
+    if(it==shard.dict.end())return nullptr;
+    if(isExpired(it->second) && expiresKeys()){
+        shard.dict.erase(it);
+        if(!shard.watched.empty())touchWatched(shard,key);
+        lazyExpired.push_back(key);
+        return nullptr;
+    }
+    touch(it->second);
+    return &it->second;
+}
+RedisObject* RedisDatabase::lookupWrite(Shard& shard,const std::string& key,ObjectType type){
+    RedisObject* obj=lookupWrite(shard,key);
+    if(obj && obj->type!=type)throw WrongTypeError();
+    return obj;
+}
 
     //common commands
     bool RedisDatabase::flushAll(){
-        std::lock_guard<std::mutex>lock(db_mutex);
-        kv_store.clear();
-        list_store.clear();
-        hash_store.clear();
+        auto locks=lockAllShards();
+        for(auto& shard:shards){
+            shard.dirty.fetch_add(shard.dict.size(),std::memory_order_relaxed);
+            touchAllWatched(shard);
+            shard.dict.clear();
+            shard.expires.clear();
+        }
         return true;
     }
 
     //key/Value Operations
     void RedisDatabase::set(const std::string&key ,const std::string& value){
-       std::lock_guard<std::mutex>lock(db_mutex);
-       kv_store[key]=value;
-
+       set(key,value,-1,SetCondition::Always);
+    }
+    bool RedisDatabase::set(const std::string&key ,const std::string& value,int64_t expireAt,SetCondition cond){
+       Shard& shard=shardFor(key);
+       std::unique_lock<ShardMutex>lock(shard.mutex);
+       RedisObject* existing=lookupWrite(shard,key);
+       if(cond==SetCondition::IfNotExists && existing)return false;
+       if(cond==SetCondition::IfExists && !existing)return false;
+       //SET replaces whatever the key held, including its expiry
+       RedisObject& obj=shard.dict.insert_or_assign(key,RedisObject::makeString(value)).first->second;
+       if(expireAt>=0)setExpire(shard,key,obj,expireAt);
+       markDirty(shard,key);
+       return true;
     }
     bool RedisDatabase::get(const std::string&key , std::string& value){
-        std::lock_guard<std::mutex>lock(db_mutex);
-        purgeExpired();
-        auto it =kv_store.find(key);
-        if(it!=kv_store.end()){
-            value=it->second;
+        Shard& shard=shardFor(key);
+        std::shared_lock<ShardMutex>lock(shard.mutex);
+        const RedisObject* obj=lookupRead(shard,key,ObjectType::String);
+        if(obj){
+            value=obj->str();
             return true;
         }
         return false;
     }
-    std::vector<std::string>RedisDatabase::keys(){
-        std::lock_guard<std::mutex>lock(db_mutex);
-        purgeExpired();
-        std::vector<std::string>result;
-        for(const auto& pair:kv_store){
-            result.push_back(pair.first);
+    bool RedisDatabase::mset(const std::vector<std::pair<std::string,std::string>>& pairs,SetCondition cond){
+        std::vector<size_t> idx;
+        idx.reserve(pairs.size());
+        for(const auto& pair:pairs)
+            idx.push_back(shardIndex(pair.first));
+        auto locks=lockShards(idx);
+        //conditions are checked for every key before anything is written
+        if(cond!=SetCondition::Always){
+            for(size_t i=0;i<pairs.size();i++){
+                bool exists=lookupWrite(shards[idx[i]],pairs[i].first)!=nullptr;
+                if(exists!=(cond==SetCondition::IfExists))return false;
+            }
         }
-        for(const auto& pair:list_store){
-            result.push_back(pair.first);
+        for(size_t i=0;i<pairs.size();i++){
+            Shard& shard=shards[idx[i]];
+            shard.dict.insert_or_assign(pairs[i].first,RedisObject::makeString(pairs[i].second));
+            markDirty(shard,pairs[i].first);
         }
-        for(const auto& pair:hash_store){
-            result.push_back(pair.first);
+        return true;
+    }
+    std::vector<std::optional<std::string>> RedisDatabase::mget(const std::vector<std::string>& keys){
+        std::vector<size_t> idx=shardIndexes(keys);
+        auto locks=lockShardsShared(idx);
+        std::vector<std::optional<std::string>> values;
+        values.reserve(keys.size());
+        for(size_t i=0;i<keys.size();i++){
+            //another type is not an error for MGET, it reads as nil
+            const RedisObject* obj=lookupRead(shards[idx[i]],keys[i]);
+            if(obj && obj->type==ObjectType::String)values.emplace_back(obj->str());
+            else values.emplace_back();
+        }
+        return values;
+    }
+    std::vector<std::string>RedisDatabase::keys(const std::string& pattern){
+        std::vector<std::string>result;
+        bool all=pattern=="*";
+        for(auto& shard:shards){
+            std::shared_lock<ShardMutex>lock(shard.mutex);
+            for(const auto& pair:shard.dict){
+                if(!isExpired(pair.second) && (all || stringMatch(pattern,pair.first)))
+                    result.emplace_back(pair.first.view());
+            }
         }
         return result;
     }
+    //the cursor packs the shard into its low SHARD_BITS bits and that shard's
+    //Dict bucket cursor above them. a call stops after count keys or, so a
+    //sparse table cannot hold the lock for long, after 10*count buckets
+    uint64_t RedisDatabase::scan(uint64_t cursor,size_t count,const std::string& pattern,const std::string& type,
+                                 std::vector<std::string>& out){
+        size_t idx=cursor&(SHARD_COUNT-1);
+        uint64_t bucket=cursor>>SHARD_BITS;
+        size_t visited=0,buckets=0,maxBuckets=count*10;
+        for(;idx<SHARD_COUNT;idx++,bucket=0){
+            Shard& shard=shards[idx];
+            std::shared_lock<ShardMutex>lock(shard.mutex);
+            do{
+                bucket=shard.dict.scan(bucket,[&](const auto& pair){
+                    visited++;
+                    if(isExpired(pair.second))return;
+                    if(!type.empty() && type!=pair.second.typeName())return;
+                    if(!pattern.empty() && !stringMatch(pattern,pair.first))return;
+                    out.emplace_back(pair.first.view());
+                });
+                buckets++;
+            }while(bucket!=0 && visited<count && buckets<maxBuckets);
+            if(bucket!=0)return (bucket<<SHARD_BITS)|idx;
+            if(visited>=count || buckets>=maxBuckets)
+                return idx+1<SHARD_COUNT?idx+1:0;
+        }
+        return 0;
+    }
     std::string RedisDatabase::type(const std::string& key){
-        std::lock_guard<std::mutex>lock(db_mutex);
-        if(kv_store.find(key)!=kv_store.end())
-            return "string" ;
-        if(list_store.find(key)!=list_store.end())
-            return "list" ;
-        if(hash_store.find(key)!=hash_store.end())
-            return "hash" ;
-         return "none";
+        Shard& shard=shardFor(key);
+        std::shared_lock<ShardMutex>lock(shard.mutex);
+        const RedisObject* obj=lookupRead(shard,key);
+        return obj?obj->typeName():"none";
+    }
+    std::string RedisDatabase::encoding(const std::string& key){
+        Shard& shard=shardFor(key);
+        std::shared_lock<ShardMutex>lock(shard.mutex);
+        const RedisObject* obj=lookupRead(shard,key);
+        return obj?obj->encodingName():"";
     }
     bool RedisDatabase::del(const std::string& key){
-        std::lock_guard<std::mutex>lock(db_mutex);
-        bool erased=false;
-        erased |=kv_store.erase(key)>0;
-        erased |=list_store.erase(key)>0;
-        erased |=hash_store.erase(key)>0;
-        return erased;
+        Shard& shard=shardFor(key);
+        std::unique_lock<ShardMutex>lock(shard.mutex);
+        if(!lookupWrite(shard,key))return false;
+        shard.dict.erase(key);
+        markDirty(shard,key);
+        return true;
+    }
+    size_t RedisDatabase::del(const std::vector<std::string>& keys){
+        std::vector<size_t> idx=shardIndexes(keys);
+        auto locks=lockShards(idx);
+        size_t removed=0;
+        for(size_t i=0;i<keys.size();i++){
+            Shard& shard=shards[idx[i]];
+            if(!lookupWrite(shard,keys[i]))continue;
+            shard.dict.erase(keys[i]);
+            markDirty(shard,keys[i]);
+            removed++;
+        }
+        return removed;
+    }
+    size_t RedisDatabase::exists(const std::vector<std::string>& keys){
+        std::vector<size_t> idx=shardIndexes(keys);
+        auto locks=lockShardsShared(idx);
+        size_t found=0;
+        for(size_t i=0;i<keys.size();i++){
+            if(lookupRead(shards[idx[i]],keys[i]))found++;
+        }
+        return found;
     }
     //expire
     bool RedisDatabase::expire(const std::string&key,int seconds){
-        std::lock_guard<std::mutex>lock(db_mutex);
-        bool exist =((kv_store.find(key)!=kv_store.end())||
-                    (list_store.find(key)!=list_store.end())||
-                    (hash_store.find(key)!=hash_store.end()));
-        if(!exist)return false;
-        expiry_map[key]=std::chrono::steady_clock::now()+std::chrono::seconds(seconds);
+        return pexpireAt(key,nowMs()+static_cast<int64_t>(seconds)*1000);
+    }
+    bool RedisDatabase::pexpire(const std::string&key,int64_t milliseconds){
+        return pexpireAt(key,nowMs()+milliseconds);
+    }
+    bool RedisDatabase::pexpireAt(const std::string&key,int64_t whenMs){
+        Shard& shard=shardFor(key);
+        std::unique_lock<ShardMutex>lock(shard.mutex);
+        RedisObject* obj=lookupWrite(shard,key);
+        if(!obj)return false;
+        markDirty(shard,key);
+        if(whenMs<=nowMs() && expiresKeys()){
+            shard.dict.erase(key);
+            return true;
+        }
+        setExpire(shard,key,*obj,whenMs);
+        return true;
+    }
+    int64_t RedisDatabase::pttl(const std::string&key){
+        Shard& shard=shardFor(key);
+        std::shared_lock<ShardMutex>lock(shard.mutex);
+        const RedisObject* obj=lookupRead(shard,key);
+        if(!obj)return -2;
+        if(obj->expireAt<0)return -1;
+        return std::max<int64_t>(0,obj->expireAt-nowMs());
+    }
+    int64_t RedisDatabase::pexpiretime(const std::string&key){
+        Shard& shard=shardFor(key);
+        std::shared_lock<ShardMutex>lock(shard.mutex);
+        const RedisObject* obj=lookupRead(shard,key);
+        if(!obj)return -2;
+        return obj->expireAt;
+    }
+    bool RedisDatabase::persist(const std::string&key){
+        Shard& shard=shardFor(key);
+        std::unique_lock<ShardMutex>lock(shard.mutex);
+        RedisObject* obj=lookupWrite(shard,key);
+        if(!obj || obj->expireAt<0)return false;
+        //the heap entry goes stale and is discarded when it surfaces
+        obj->expireAt=-1;
+        markDirty(shard,key);
         return true;
     }
     //purgeexpired
     void RedisDatabase::purgeExpired(){
-        auto now=std::chrono::steady_clock::now();
-        for (auto it= expiry_map.begin();it!=expiry_map.end();){
-            if(now>it->second){
-                kv_store.erase(it->first);
-                list_store.erase(it->first);
-                hash_store.erase(it->first);
-            }else{
-                it++;
-            }
+        int64_t now=nowMs();
+        for(auto& shard:shards){
+            std::unique_lock<ShardMutex>lock(shard.mutex);
+            expireDue(shard,now,SIZE_MAX);
         }
     }
     //rename
     bool RedisDatabase::rename(const std::string& oldKey ,const std::string& newKey){
-        std::lock_guard<std::mutex>lock(db_mutex);
-        bool found=false;
-        auto itKv=kv_store.find(oldKey);
-        if(itKv!=kv_store.end()){
-            kv_store[newKey]=itKv->second;
-            kv_store.erase(itKv);
-            found=true;
-        }
-        auto itlist=list_store.find(oldKey);
-        if(itlist!=list_store.end()){
-            list_store[newKey]=itlist->second;
-            list_store.erase(itlist);
-            found=true;
-        }
-        auto ithash=hash_store.find(oldKey);
-        if(ithash!=hash_store.end()){
-            hash_store[newKey]=ithash->second;
-            hash_store.erase(ithash);
-            found=true;
-        }
-    return found;
+        //lock both shards lowest index first; one lock when they coincide
+        size_t a=shardIndex(oldKey),b=shardIndex(newKey);
+        std::unique_lock<ShardMutex>first(shards[std::min(a,b)].mutex);
+        std::unique_lock<ShardMutex>second;
+        if(a!=b)second=std::unique_lock<ShardMutex>(shards[std::max(a,b)].mutex);
+        Shard& from=shards[a];
+        Shard& to=shards[b];
+        RedisObject* obj=lookupWrite(from,oldKey);
+        if(!obj)return false;
+        if(oldKey==newKey)return true;
+        //the value moves with its type and expiry
+        RedisObject moved=std::move(*obj);
+        from.dict.erase(oldKey);
+        RedisObject& target=to.dict.insert_or_assign(newKey,std::move(moved)).first->second;
+        if(target.expireAt>=0)setExpire(to,newKey,target,target.expireAt);
+        markDirty(from,oldKey,0);
+        markDirty(to,newKey);
+    return true;
     }
+//-------------------
+// Encoding helpers
+//-------------------
+static size_t listLength(const RedisObject& obj){
+    return obj.visitList([](const auto& lst){ return lst.size(); });
+}
+//a listpack list that outgrew its byte limit becomes a quicklist
+static void convertListIfNeeded(RedisObject& obj,const EncodingLimits& limits){
+    if(obj.encoding!=ObjectEncoding::ListPack || obj.listpack().bytes()<=limits.listMaxListpackBytes)return;
+    auto ql=std::make_unique<QuickList>();
+    obj.listpack().forEach([&ql](std::string_view item){ ql->pushBack(item); });
+    obj.value=std::move(ql);
+    obj.encoding=ObjectEncoding::QuickList;
+}
+static void convertHashToTable(RedisObject& obj){
+    const ListPack& lp=obj.listpack();
+    HashValue hash;
+    hash.reserve(lp.size()/2);
+    for(size_t pos=lp.begin();pos<lp.end();){
+        size_t valuePos=lp.next(pos);
+        hash.emplace(lp.get(pos),lp.get(valuePos));
+        pos=lp.next(valuePos);
+    }
+    obj.value=std::move(hash);
+    obj.encoding=ObjectEncoding::HashTable;
+}
+//a listpack hash alternates field,value; position of field or end()
+static size_t packFindField(const ListPack& lp,std::string_view field){
+    for(size_t pos=lp.begin();pos<lp.end();pos=lp.next(lp.next(pos))){
+        if(lp.get(pos)==field)return pos;
+    }
+    return lp.end();
+}
+static size_t hashLength(const RedisObject& obj){
+    return obj.encoding==ObjectEncoding::ListPack?obj.listpack().size()/2:obj.hash().size();
+}
+//set one field, true when it is new; a pair too long for the listpack, or
+//one field too many, converts the hash to a table first
+static bool hashSet(RedisObject& obj,const std::string& field,const std::string& val,const EncodingLimits& limits){
+    if(obj.encoding==ObjectEncoding::ListPack){
+        if(field.size()>limits.hashMaxListpackValue || val.size()>limits.hashMaxListpackValue){
+            convertHashToTable(obj);
+        }else{
+            ListPack& lp=obj.listpack();
+            size_t pos=packFindField(lp,field);
+            if(pos!=lp.end()){
+                lp.replace(lp.next(pos),val);
+                return false;
+            }
+            lp.pushBack(field);
+            lp.pushBack(val);
+            if(lp.size()/2>limits.hashMaxListpackEntries)convertHashToTable(obj);
+            return true;
+        }
+    }
+    return obj.hash().insert_or_assign(field,val).second;
+}
+//remove one field, true when it was there; the caller drops an emptied hash
+static bool hashDelete(RedisObject& obj,const std::string& field){
+    if(obj.encoding==ObjectEncoding::ListPack){
+        ListPack& lp=obj.listpack();
+        size_t pos=packFindField(lp,field);
+        if(pos==lp.end())return false;
+        lp.eraseRange(pos,2);
+        return true;
+    }
+    return obj.hash().erase(field)>0;
+}
+static bool hashGet(const RedisObject& obj,const std::string& field,std::string& val){
+    if(obj.encoding==ObjectEncoding::ListPack){
+        const ListPack& lp=obj.listpack();
+        size_t pos=packFindField(lp,field);
+        if(pos==lp.end())return false;
+        val.assign(lp.get(lp.next(pos)));
+        return true;
+    }
+    auto it=obj.hash().find(field);
+    if(it==obj.hash().end())return false;
+    val=it->second;
+    return true;
+}
+
+//a listpack sorted set alternates member,score in (score, member) order;
+//a score is the 8 bytes of its double
+static std::string_view packScore(double score,char (&buf)[sizeof(double)]){
+    std::memcpy(buf,&score,sizeof(double));
+    return std::string_view(buf,sizeof(double));
+}
+static double unpackScore(std::string_view v){
+    double score;
+    std::memcpy(&score,v.data(),sizeof(double));
+    return score;
+}
+static size_t zsetLength(const RedisObject& obj){
+    return obj.encoding==ObjectEncoding::ListPack?obj.listpack().size()/2:obj.zset().list.size();
+}
+static void convertZSetToSkipList(RedisObject& obj){
+    const ListPack& lp=obj.listpack();
+    auto zs=std::make_unique<SortedSet>();
+    zs->dict.reserve(lp.size()/2);
+    for(size_t pos=lp.begin();pos<lp.end();){
+        size_t scorePos=lp.next(pos);
+        double score=unpackScore(lp.get(scorePos));
+        zs->list.insert(score,lp.get(pos));
+        zs->dict.emplace(lp.get(pos),score);
+        pos=lp.next(scorePos);
+    }
+    obj.value=std::move(zs);
+    obj.encoding=ObjectEncoding::SkipList;
+}
+static bool zsetScore(const RedisObject& obj,std::string_view member,double& score){
+    if(obj.encoding==ObjectEncoding::ListPack){
+        const ListPack& lp=obj.listpack();
+        size_t pos=packFindField(lp,member);
+        if(pos==lp.end())return false;
+        score=unpackScore(lp.get(lp.next(pos)));
+        return true;
+    }
+    auto it=obj.zset().dict.find(member);
+    if(it==obj.zset().dict.end())return false;
+    score=it->second;
+    return true;
+}
+//add a member that is not in the set; a member too long for the listpack,
+//or one member too many, converts the set to a skiplist
+static void zsetInsert(RedisObject& obj,double score,std::string_view member,const EncodingLimits& limits){
+    if(obj.encoding==ObjectEncoding::ListPack){
+        if(member.size()>limits.zsetMaxListpackValue){
+            convertZSetToSkipList(obj);
+        }else{
+            ListPack& lp=obj.listpack();
+            size_t pos=lp.begin();
+            while(pos<lp.end()){
+                size_t scorePos=lp.next(pos);
+                double s=unpackScore(lp.get(scorePos));
+                if(s>score || (s==score && lp.get(pos)>member))break;
+                pos=lp.next(scorePos);
+            }
+            char buf[sizeof(double)];
+            pos=lp.insert(pos,member);
+            lp.insert(lp.next(pos),packScore(score,buf));
+            if(lp.size()/2>limits.zsetMaxListpackEntries)convertZSetToSkipList(obj);
+            return;
+        }
+    }
+    SortedSet& zs=obj.zset();
+    zs.list.insert(score,member);
+    zs.dict.emplace(member,score);
+}
+//remove a member that has the given score; the caller drops an emptied set
+static void zsetRemove(RedisObject& obj,double score,std::string_view member){
+    if(obj.encoding==ObjectEncoding::ListPack){
+        ListPack& lp=obj.listpack();
+        lp.eraseRange(packFindField(lp,member),2);
+        return;
+    }
+    SortedSet& zs=obj.zset();
+    zs.list.erase(score,member);
+    zs.dict.erase(member);
+}
+enum class ZAddOutcome{ Added, Updated, Unchanged, Skipped, NotANumber };
+//one score,member pair of ZADD; score is the member's new score afterwards
+static ZAddOutcome zsetAdd(RedisObject& obj,double& score,const std::string& member,int flags,const EncodingLimits& limits){
+    double current;
+    if(!zsetScore(obj,member,current)){
+        if(flags&ZADD_XX)return ZAddOutcome::Skipped;
+        zsetInsert(obj,score,member,limits);
+        return ZAddOutcome::Added;
+    }
+    if(flags&ZADD_NX)return ZAddOutcome::Skipped;
+    if(flags&ZADD_INCR){
+        score+=current;
+        if(std::isnan(score))return ZAddOutcome::NotANumber;
+    }
+    if(((flags&ZADD_GT) && score<=current) || ((flags&ZADD_LT) && score>=current))return ZAddOutcome::Skipped;
+    if(score==current)return ZAddOutcome::Unchanged;
+    if(obj.encoding==ObjectEncoding::ListPack){
+        zsetRemove(obj,current,member);
+        zsetInsert(obj,score,member,limits);
+    }else{
+        SortedSet& zs=obj.zset();
+        zs.list.updateScore(current,member,score);
+        zs.dict.find(member)->second=score;
+    }
+    return ZAddOutcome::Updated;
+}
+//ZRANK on a listpack: position of member in score order, -1 when missing
+static long packRank(const ListPack& lp,std::string_view member){
+    long rank=0;
+    for(size_t pos=lp.begin();pos<lp.end();pos=lp.next(lp.next(pos)),rank++){
+        if(lp.get(pos)==member)return rank;
+    }
+    return -1;
+}
+//a set is an IntSet while every member is an integer and there are at most
+//setMaxIntsetEntries of them, a SetValue hashtable otherwise
+static size_t setLength(const RedisObject& obj){
+    return obj.encoding==ObjectEncoding::IntSet?obj.intset().size():obj.set().size();
+}
+static void convertSetToHashTable(RedisObject& obj){
+    SetValue set;
+    set.reserve(obj.intset().size());
+    char buf[24];
+    obj.intset().forEach([&](int64_t v){ set.emplace(IntSet::format(v,buf)); });
+    obj.value=std::move(set);
+    obj.encoding=ObjectEncoding::HashTable;
+}
+static bool setContains(const RedisObject& obj,std::string_view member){
+    if(obj.encoding==ObjectEncoding::IntSet){
+        int64_t v;
+        return IntSet::parse(member,v) && obj.intset().contains(v);
+    }
+    return obj.set().find(member)!=obj.set().end();
+}
+static bool setContains(const RedisObject& obj,int64_t v){
+    if(obj.encoding==ObjectEncoding::IntSet)return obj.intset().contains(v);
+    char buf[24];
+    return obj.set().find(IntSet::format(v,buf))!=obj.set().end();
+}
+//true when member is new
+static bool setAdd(RedisObject& obj,std::string_view member,const EncodingLimits& limits){
+    if(obj.encoding==ObjectEncoding::IntSet){
+        int64_t v;
+        if(IntSet::parse(member,v)){
+            if(!obj.intset().insert(v))return false;
+            if(obj.intset().size()>limits.setMaxIntsetEntries)convertSetToHashTable(obj);
+            return true;
+        }
+        convertSetToHashTable(obj);
+    }
+    return obj.set().emplace(member).second;
+}
+static bool setRemove(RedisObject& obj,std::string_view member){
+    if(obj.encoding==ObjectEncoding::IntSet){
+        int64_t v;
+        return IntSet::parse(member,v) && obj.intset().erase(v);
+    }
+    return obj.set().erase(member)>0;
+}
+static void setMembers(const RedisObject& obj,std::vector<std::string>& out){
+    out.reserve(out.size()+setLength(obj));
+    if(obj.encoding==ObjectEncoding::IntSet){
+        char buf[24];
+        obj.intset().forEach([&](int64_t v){ out.emplace_back(IntSet::format(v,buf)); });
+        return;
+    }
+    for(const auto& pair:obj.set())out.emplace_back(pair.first.view());
+}
+static void formatInts(const std::vector<int64_t>& ints,std::vector<std::string>& out){
+    char buf[24];
+    out.reserve(out.size()+ints.size());
+    for(int64_t v:ints)out.emplace_back(IntSet::format(v,buf));
+}
+
 //-------------------
 // List Operations
 //------------------{
 
 ssize_t RedisDatabase::llen(const std::string& key){
-        std::lock_guard<std::mutex>lock(db_mutex);
-    auto it=list_store.find(key);
-    if(it!=list_store.end()){
-        return it->second.size();
-    }
-    return 0;
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex>lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::List);
+    return obj?listLength(*obj):0;
 }
 void RedisDatabase::lpush(const std::string&key,const std::string& value){
-        std::lock_guard<std::mutex>lock(db_mutex);
-    list_store[key].insert(list_store[key].begin(),value);
-    
+    pushValues(key,&value,1,true);
 }
 void RedisDatabase::rpush(const std::string&key,const std::string& value){
-        std::lock_guard<std::mutex>lock(db_mutex);
-    list_store[key].insert(list_store[key].end(),value);
-
-    
+    pushValues(key,&value,1,false);
 }
-bool RedisDatabase::lpop(const std::string&key,std::string& value){
-        std::lock_guard<std::mutex>lock(db_mutex);
-    auto it=list_store.find(key);
-    if(it!=list_store.end() && !it->second.empty()){
-         value=it->second.front();
-         it->second.erase(it->second.begin());
-        return true;
+//one lock hold and one conversion check per element: a big batch pushed
+//into a listpack moves to a quicklist as soon as it outgrows the limit
+size_t RedisDatabase::pushValues(const std::string& key,const std::string* values,size_t count,bool front){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::List);
+    if(!obj)obj=&shard.dict.emplace(key,RedisObject::makeList()).first->second;
+    for(size_t i=0;i<count;i++){
+        const std::string& value=values[i];
+        if(front)obj->visitList([&value](auto& lst){ lst.pushFront(value); });
+        else obj->visitList([&value](auto& lst){ lst.pushBack(value); });
+        convertListIfNeeded(*obj,limits);
     }
-    return false;
+    markDirty(shard,key,count);
+    return listLength(*obj);
 }
-bool RedisDatabase::rpop(const std::string&key,std::string& value){
-        std::lock_guard<std::mutex>lock(db_mutex);
-    auto it=list_store.find(key);
-    if(it!=list_store.end() && !it->second.empty()){
-         value=it->second.back();
-         it->second.pop_back();
+size_t RedisDatabase::lpush(const std::string&key,const std::vector<std::string>& values){
+    return pushValues(key,values.data(),values.size(),true);
+}
+size_t RedisDatabase::rpush(const std::string&key,const std::vector<std::string>& values){
+    return pushValues(key,values.data(),values.size(),false);
+}
+bool RedisDatabase::popValues(const std::string& key,size_t count,bool front,std::vector<std::string>& out){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::List);
+    if(!obj)return false;
+    size_t n=std::min(count,listLength(*obj));
+    out.reserve(out.size()+n);
+    for(size_t i=0;i<n;i++){
+        if(front)out.push_back(obj->visitList([](auto& lst){ return lst.popFront(); }));
+        else out.push_back(obj->visitList([](auto& lst){ return lst.popBack(); }));
+    }
+    if(listLength(*obj)==0)shard.dict.erase(key);
+    if(n>0)markDirty(shard,key,n);
+    return true;
+}
+bool RedisDatabase::lpop(const std::string&key,size_t count,std::vector<std::string>& out){
+    return popValues(key,count,true,out);
+}
+bool RedisDatabase::rpop(const std::string&key,size_t count,std::vector<std::string>& out){
+    return popValues(key,count,false,out);
+}
+//------------------
+// LMOVE and blocking pops
+//------------------
+static void listPush(RedisObject& obj,const std::string& value,bool front,const EncodingLimits& limits){
+    if(front)obj.visitList([&value](auto& lst){ lst.pushFront(value); });
+    else obj.visitList([&value](auto& lst){ lst.pushBack(value); });
+    convertListIfNeeded(obj,limits);
+}
+static std::string listPop(RedisObject& obj,bool front){
+    if(front)return obj.visitList([](auto& lst){ return lst.popFront(); });
+    return obj.visitList([](auto& lst){ return lst.popBack(); });
+}
+static bool holdsOtherThanList(const RedisObject* obj){
+    return obj && obj->type!=ObjectType::List;
+}
+void RedisDatabase::moveElement(Shard& from,RedisObject& src,const std::string& source,Shard& to,const std::string& destination,
+                                bool fromFront,bool toFront,std::string& value){
+    value=listPop(src,fromFront);
+    //element pointers survive a rehash, so src stays valid across the emplace;
+    //with source==destination this is a rotation and src never empties
+    RedisObject* dst=lookupWrite(to,destination,ObjectType::List);
+    if(!dst)dst=&to.dict.emplace(destination,RedisObject::makeList()).first->second;
+    listPush(*dst,value,toFront,limits);
+    if(listLength(src)==0)from.dict.erase(source);
+    markDirty(from,source);
+    markDirty(to,destination);
+}
+bool RedisDatabase::lmove(const std::string& source,const std::string& destination,bool fromFront,bool toFront,std::string& value){
+    size_t a=shardIndex(source),b=shardIndex(destination);
+    auto locks=lockShards({a,b});
+    RedisObject* src=lookupWrite(shards[a],source,ObjectType::List);
+    if(!src)return false;
+    if(holdsOtherThanList(lookupWrite(shards[b],destination)))throw WrongTypeError();
+    moveElement(shards[a],*src,source,shards[b],destination,fromFront,toFront,value);
+    return true;
+}
+bool RedisDatabase::popOrBlock(const std::shared_ptr<ListWaiter>& w,bool block){
+    std::vector<size_t> idx=shardIndexes(w->keys);
+    size_t to=w->move?shardIndex(w->destination):0;
+    std::vector<size_t> all=idx;
+    if(w->move)all.push_back(to);
+    auto locks=lockShards(all);
+    for(size_t i=0;i<w->keys.size();i++){
+        Shard& shard=shards[idx[i]];
+        RedisObject* obj=lookupWrite(shard,w->keys[i],ObjectType::List);
+        if(!obj)continue;
+        w->key=w->keys[i];
+        if(w->move){
+            if(holdsOtherThanList(lookupWrite(shards[to],w->destination)))throw WrongTypeError();
+            moveElement(shard,*obj,w->key,shards[to],w->destination,w->fromFront,w->toFront,w->value);
+            return true;
+        }
+        w->value=listPop(*obj,w->fromFront);
+        if(listLength(*obj)==0)shard.dict.erase(w->key);
+        markDirty(shard,w->key);
         return true;
     }
+    if(!block)return false;
+    for(size_t i=0;i<w->keys.size();i++)
+        shards[idx[i]].waiters[w->keys[i]].push_back(w);
+    blockedClients.fetch_add(1);
     return false;
 }
+std::shared_ptr<ListWaiter> RedisDatabase::nextWaiter(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    auto it=shard.waiters.find(key);
+    if(it==shard.waiters.end())return nullptr;
+    const RedisObject* obj=lookupRead(shard,key);
+    if(!obj || obj->type!=ObjectType::List)return nullptr;
+    auto& queue=it->second;
+    //stale entries of waiters served through another key or timed out
+    while(!queue.empty() && queue.front()->isClaimed())queue.pop_front();
+    if(queue.empty()){
+        shard.waiters.erase(it);
+        return nullptr;
+    }
+    return queue.front();
+}
+bool RedisDatabase::serveWaiter(const std::string& key,const std::shared_ptr<ListWaiter>& w){
+    size_t a=shardIndex(key),b=w->move?shardIndex(w->destination):a;
+    {
+        auto locks=lockShards({a,b});
+        RedisObject* src=lookupWrite(shards[a],key);
+        if(!src || src->type!=ObjectType::List)return false;
+        //like LMOVE, a destination of another type is an error for the client
+        bool wrongType=w->move && holdsOtherThanList(lookupWrite(shards[b],w->destination));
+        if(!w->claim())return false;
+        blockedClients.fetch_sub(1);
+        removeWaiter(shards[a],key,w);
+        w->key=key;
+        w->wrongType=wrongType;
+        if(w->move){
+            if(!wrongType)moveElement(shards[a],*src,key,shards[b],w->destination,w->fromFront,w->toFront,w->value);
+        }else{
+            w->value=listPop(*src,w->fromFront);
+            if(listLength(*src)==0)shards[a].dict.erase(key);
+            markDirty(shards[a],key);
+        }
+    }
+    forgetWaiter(w,&key);
+    return true;
+}
+bool RedisDatabase::cancelWaiter(const std::shared_ptr<ListWaiter>& w){
+    if(!w->claim())return false;
+    blockedClients.fetch_sub(1);
+    forgetWaiter(w,nullptr);
+    return true;
+}
+void RedisDatabase::removeWaiter(Shard& shard,const std::string& key,const std::shared_ptr<ListWaiter>& w){
+    auto it=shard.waiters.find(key);
+    if(it==shard.waiters.end())return;
+    auto& queue=it->second;
+    queue.erase(std::remove(queue.begin(),queue.end(),w),queue.end());
+    if(queue.empty())shard.waiters.erase(it);
+}
+void RedisDatabase::forgetWaiter(const std::shared_ptr<ListWaiter>& w,const std::string* except){
+    for(const auto& key:w->keys){
+        if(except && key==*except)continue;
+        Shard& shard=shardFor(key);
+        std::unique_lock<ShardMutex>lock(shard.mutex);
+        removeWaiter(shard,key,w);
+    }
+}
+bool RedisDatabase::lpop(const std::string&key,std::string& value){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::List);
+    if(!obj)return false;
+    value=obj->visitList([](auto& lst){ return lst.popFront(); });
+    //an emptied list disappears from the keyspace
+    if(listLength(*obj)==0)shard.dict.erase(key);
+    markDirty(shard,key);
+    return true;
+}
+bool RedisDatabase::rpop(const std::string&key,std::string& value){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::List);
+    if(!obj)return false;
+    value=obj->visitList([](auto& lst){ return lst.popBack(); });
+    if(listLength(*obj)==0)shard.dict.erase(key);
+    markDirty(shard,key);
+    return true;
+}
 bool RedisDatabase::lindex(const std::string&key,int index, std::string& value){
-        std::lock_guard<std::mutex>lock(db_mutex);
-    auto it=list_store.find(key);
-    if(it==list_store.end()){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex>lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::List);
+    if(!obj){
         return false;
     }
-    const auto& lst=it->second;
-    if(index<0)
-        index=lst.size()+index;
-    if(index<0 || index>=static_cast<int>(lst.size()))return false;
-    value=lst[index];
-    return true;
+    return obj->visitList([&](const auto& lst){ return lst.index(index,value); });
 }
 int RedisDatabase::lrem(const std::string&key,int count,const std::string& value){
-        std::lock_guard<std::mutex>lock(db_mutex);
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
     int removed =0;
-    auto it=list_store.find(key);
-    if(it==list_store.end()){
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::List);
+    if(!obj){
         return 0;
     }
-    auto& lst=it->second;
-    if(count==0){
-        //remove all occurences
-        auto new_end =std::remove(lst.begin(),lst.end(),value);
-        removed=std::distance(new_end,lst.end());
-        lst.erase(new_end,lst.end());
-    }else if(count<0){
-        //remove |count| occurences from tail to head
-        for (auto riter = lst.rbegin(); riter != lst.rend() && removed < (-count); ) {
-            if (*riter == value) {
-                auto fwdIter = riter.base();
-                --fwdIter;
-                fwdIter = lst.erase(fwdIter);
-                ++removed;
-                riter = std::reverse_iterator<std::vector<std::string>::iterator>(fwdIter);
-            } else {
-                ++riter;
+    removed=obj->visitList([&](auto& lst){ return lst.remove(count,value); });
+    if(listLength(*obj)==0)shard.dict.erase(key);
+    if(removed>0)markDirty(shard,key,removed);
+    return removed;
+}
+bool RedisDatabase::lset(const std::string&key,int index,const std::string& value){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::List);
+    if(!obj){
+        return false;
+    }
+    if(!obj->visitList([&](auto& lst){ return lst.set(index,value); }))return false;
+    convertListIfNeeded(*obj,limits);
+    markDirty(shard,key);
+    return true;
+}
+void RedisDatabase::lrange(const std::string&key,long start,long stop,std::vector<std::string>& out){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex>lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::List);
+    if(obj)obj->visitList([&](const auto& lst){ lst.range(start,stop,out); });
+}
+void RedisDatabase::ltrim(const std::string&key,long start,long stop){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::List);
+    if(!obj)return;
+    obj->visitList([&](auto& lst){ lst.trim(start,stop); });
+    if(listLength(*obj)==0)shard.dict.erase(key);
+    markDirty(shard,key);
+}
+long RedisDatabase::linsert(const std::string&key,bool before,const std::string& pivot,const std::string& value){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex>lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::List);
+    if(!obj)return 0;
+    long len=obj->visitList([&](auto& lst){ return lst.insert(pivot,value,before); });
+    convertListIfNeeded(*obj,limits);
+    if(len>0)markDirty(shard,key);
+    return len;
+}
+
+//one keyspace entry in the binary snapshot format (see RdbFormat.h)
+static void writeObject(RdbWriter& out,std::string_view key,const RedisObject& obj){
+    if(obj.expireAt>=0){
+        out.writeByte(RDB_OP_EXPIRE);
+        out.writeInt64(obj.expireAt);
+    }
+    switch(obj.type){
+        case ObjectType::String:
+            out.writeByte(RDB_TYPE_STRING);
+            out.writeString(key);
+            out.writeString(obj.str());
+            break;
+        case ObjectType::List:
+            out.writeByte(RDB_TYPE_LIST);
+            out.writeString(key);
+            obj.visitList([&out](const auto& lst){
+                out.writeVarint(lst.size());
+                lst.forEach([&out](std::string_view item){ out.writeString(item); });
+            });
+            break;
+        case ObjectType::Hash:
+            out.writeByte(RDB_TYPE_HASH);
+            out.writeString(key);
+            out.writeVarint(hashLength(obj));
+            //a listpack already holds field,value,... in record order
+            if(obj.encoding==ObjectEncoding::ListPack){
+                obj.listpack().forEach([&out](std::string_view item){ out.writeString(item); });
+                break;
+            }
+            for(const auto& field_val:obj.hash()){
+                out.writeString(field_val.first);
+                out.writeString(field_val.second);
             }
+            break;
+        case ObjectType::ZSet:{
+            out.writeByte(RDB_TYPE_ZSET);
+            out.writeString(key);
+            out.writeVarint(zsetLength(obj));
+            //in score order either way, so the loader appends at the end
+            auto writePair=[&out](std::string_view member,double score){
+                int64_t bits;
+                std::memcpy(&bits,&score,sizeof(bits));
+                out.writeString(member);
+                out.writeInt64(bits);
+            };
+            if(obj.encoding==ObjectEncoding::ListPack){
+                const ListPack& lp=obj.listpack();
+                for(size_t pos=lp.begin();pos<lp.end();pos=lp.next(lp.next(pos)))
+                    writePair(lp.get(pos),unpackScore(lp.get(lp.next(pos))));
+                break;
+            }
+            for(const SkipList::Node* n=obj.zset().list.first();n;n=n->next())
+                writePair(n->member.view(),n->score);
+            break;
         }
-    }else{
-        //remove count occurences from head to tail
-        for(auto iter=lst.begin();iter!=lst.end() && removed<count;){
-            if(*iter==value){
-                iter=lst.erase(iter);
-                ++removed;
-            }else{
-                ++iter;
+        case ObjectType::Set:{
+            out.writeByte(RDB_TYPE_SET);
+            out.writeString(key);
+            out.writeVarint(setLength(obj));
+            if(obj.encoding==ObjectEncoding::IntSet){
+                char buf[24];
+                obj.intset().forEach([&](int64_t v){ out.writeString(IntSet::format(v,buf)); });
+                break;
             }
+            for(const auto& pair:obj.set())out.writeString(pair.first);
+            break;
         }
     }
-        
-    
-    return removed;
 }
-bool RedisDatabase::lset(const std::string&key,int index,const std::string& value){
-        std::lock_guard<std::mutex>lock(db_mutex);
-    auto it=list_store.find(key);
-    if(it==list_store.end()){
+
+//payload of one entry; false on a malformed record
+static bool readObject(RdbReader& in,uint8_t type,RedisObject& obj,const EncodingLimits& limits){
+    std::string item;
+    switch(type){
+        case RDB_TYPE_STRING:
+            obj=RedisObject::makeString(in.readStringView());
+            break;
+        case RDB_TYPE_LIST:{
+            obj=RedisObject::makeList();
+            uint64_t n=in.readVarint();
+            //every element takes at least one byte, so a larger count is corrupt
+            if(n>in.remaining())return false;
+            for(uint64_t i=0;i<n && in.ok();i++){
+                in.readString(item);
+                obj.visitList([&item](auto& lst){ lst.pushBack(item); });
+                convertListIfNeeded(obj,limits);
+            }
+            break;
+        }
+        case RDB_TYPE_HASH:{
+            obj=RedisObject::makeHash();
+            uint64_t n=in.readVarint();
+            if(n>in.remaining())return false;
+            std::string value;
+            if(n<=limits.hashMaxListpackEntries){
+                for(uint64_t i=0;i<n && in.ok();i++){
+                    in.readString(item);
+                    in.readString(value);
+                    hashSet(obj,item,value,limits);
+                }
+                break;
+            }
+            obj.value=HashValue();
+            obj.encoding=ObjectEncoding::HashTable;
+            auto& hash=obj.hash();
+            hash.reserve(n);
+            for(uint64_t i=0;i<n && in.ok();i++){
+                in.readString(item);
+                in.readString(value);
+                hash.emplace(std::move(item),std::move(value));
+            }
+            break;
+        }
+        case RDB_TYPE_ZSET:{
+            obj=RedisObject::makeZSet();
+            uint64_t n=in.readVarint();
+            if(n>in.remaining())return false;
+            if(n>limits.zsetMaxListpackEntries){
+                obj.value=std::make_unique<SortedSet>();
+                obj.encoding=ObjectEncoding::SkipList;
+                obj.zset().dict.reserve(n);
+            }
+            for(uint64_t i=0;i<n && in.ok();i++){
+                in.readString(item);
+                int64_t bits=in.readInt64();
+                double score;
+                std::memcpy(&score,&bits,sizeof(score));
+                double current;
+                if(std::isnan(score) || zsetScore(obj,item,current))return false;
+                zsetInsert(obj,score,item,limits);
+            }
+            break;
+        }
+        case RDB_TYPE_SET:{
+            obj=RedisObject::makeSet();
+            uint64_t n=in.readVarint();
+            if(n>in.remaining())return false;
+            if(n>limits.setMaxIntsetEntries){
+                obj.value=SetValue();
+                obj.encoding=ObjectEncoding::HashTable;
+                obj.set().reserve(n);
+            }
+            //an intset comes back in ascending order, so each insert appends
+            for(uint64_t i=0;i<n && in.ok();i++){
+                in.readString(item);
+                if(!setAdd(obj,item,limits))return false;
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+    return in.ok();
+}
+
+bool RedisDatabase::writeSnapshot(const std::string& filename){
+    //write next to the target and rename over it, so a crash mid-write never
+    //leaves a truncated dump in place of the last good one
+    std::string tmp=filename+".tmp-"+std::to_string(getpid());
+    RdbWriter out;
+    if(!out.open(tmp))return false;
+    size_t total=0;
+    for(const auto& shard:shards)total+=shard.dict.size();
+    out.writeVarint(total);
+    int64_t now=nowMs();
+    for(const auto& shard:shards){
+        for(const auto& kv:shard.dict){
+            if(kv.second.expireAt>=0 && kv.second.expireAt<=now)continue;
+            writeObject(out,kv.first,kv.second);
+        }
+    }
+    if(!out.finish() || ::rename(tmp.c_str(),filename.c_str())<0){
+        unlink(tmp.c_str());
         return false;
     }
-     auto& lst=it->second;
-    if(index<0)
-        index=lst.size()+index;
-    if(index<0 ||index>=static_cast<int>(lst.size()))return false;
-    lst[index]=value;
     return true;
 }
-
+uint64_t RedisDatabase::totalDirty(){
+    uint64_t total=0;
+    for(const auto& shard:shards)total+=shard.dirty.load(std::memory_order_relaxed);
+    return total;
+}
+uint64_t RedisDatabase::dirty(){
+    std::lock_guard<std::mutex> guard(bgsaveMutex);
+    return totalDirty()-dirtyAtLastSave;
+}
+void RedisDatabase::countKeys(size_t& keys,size_t& volatileKeys){
+    keys=0;
+    volatileKeys=0;
+    for(auto& shard:shards){
+        std::shared_lock<ShardMutex> lock(shard.mutex);
+        keys+=shard.dict.size();
+        for(const auto& kv:shard.dict){
+            if(kv.second.expireAt>=0)volatileKeys++;
+        }
+    }
+}
+size_t RedisDatabase::memoryUsage(const std::string& key,size_t samples){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key);
+    if(!obj)return 0;
+    size_t bytes=Dict<RedisObject>::nodeBytes()+shard.dict.find(key)->first.heapBytes();
+    switch(obj->encoding){
+        case ObjectEncoding::Raw:
+            bytes+=obj->str().heapBytes();
+            break;
+        case ObjectEncoding::ListPack:
+            bytes+=obj->listpack().bytes();
+            break;
+        case ObjectEncoding::QuickList:
+            bytes+=sizeof(QuickList)+obj->quicklist().bytes()+obj->quicklist().nodeCount()*sizeof(ListPack);
+            break;
+        case ObjectEncoding::IntSet:
+            bytes+=obj->intset().bytes();
+            break;
+        case ObjectEncoding::HashTable:{
+            if(obj->type==ObjectType::Set){
+                const SetValue& set=obj->set();
+                size_t seen=0,sampled=0;
+                for(const auto& pair:set){
+                    if(samples>0 && seen==samples)break;
+                    sampled+=pair.first.heapBytes();
+                    seen++;
+                }
+                bytes+=set.tableBytes()+set.size()*SetValue::nodeBytes();
+                if(seen>0)bytes+=sampled*set.size()/seen;
+                break;
+            }
+            const HashValue& hash=obj->hash();
+            size_t seen=0,sampled=0;
+            for(const auto& pair:hash){
+                if(samples>0 && seen==samples)break;
+                sampled+=pair.first.heapBytes()+pair.second.heapBytes();
+                seen++;
+            }
+            bytes+=hash.tableBytes()+hash.size()*HashValue::nodeBytes();
+            if(seen>0)bytes+=sampled*hash.size()/seen;
+            break;
+        }
+        case ObjectEncoding::SkipList:{
+            const SortedSet& zs=obj->zset();
+            size_t seen=0,sampled=0;
+            for(const SkipList::Node* n=zs.list.first();n && (samples==0 || seen<samples);n=n->next()){
+                sampled+=n->member.heapBytes();
+                seen++;
+            }
+            bytes+=sizeof(SortedSet)+zs.list.bytes()+zs.dict.tableBytes()+zs.dict.size()*Dict<double>::nodeBytes();
+            //the node and the dict hold a copy of each member
+            if(seen>0)bytes+=2*sampled*zs.list.size()/seen;
+            break;
+        }
+    }
+    return bytes;
+}
 bool RedisDatabase::dump(const std::string& filename){
-    std::lock_guard<std::mutex> lock(db_mutex);
-    std::ofstream ofs(filename,std::ios::binary);
-    if(!ofs)return false;
-    for(const auto& kv:kv_store){
-        ofs <<"K"<<kv.first<<" "<<kv.second <<"\n";
+    uint64_t dirtyNow;
+    {
+        auto locks=lockAllShardsShared();
+        dirtyNow=totalDirty();
+        if(!writeSnapshot(filename))return false;
+    }
+    //shard locks are released first: bgsave() takes bgsaveMutex before them
+    std::lock_guard<std::mutex> guard(bgsaveMutex);
+    dirtyAtLastSave=dirtyNow;
+    lastSave=nowMs()/1000;
+    return true;
+}
+pid_t RedisDatabase::forkSnapshot(const std::string& filename){
+    //hold every shard while forking so the child's copy sits between
+    //commands; afterwards the parent's writes only trigger copy-on-write
+    auto locks=lockAllShards();
+    pid_t pid=fork();
+    if(pid==0){
+        //child: only this thread exists and the shard mutexes are copies
+        //held by a parent thread, so never take them; write and leave
+        _exit(writeSnapshot(filename)?0:1);
+    }
+    return pid;
+}
+bool RedisDatabase::bgsave(const std::string& filename){
+    std::lock_guard<std::mutex> guard(bgsaveMutex);
+    if(childPid!=-1)return false;
+    //read before the fork: writes that slip in between are saved but still
+    //counted as dirty, which only errs towards saving again
+    dirtyAtFork=totalDirty();
+    pid_t pid=forkSnapshot(filename);
+    if(pid<0){
+        lastBgsaveStatus=false;
+        return false;
     }
-    for(const auto& kv:list_store){
-        ofs <<"L"<<kv.first;
-        for(const auto& item:kv.second){
-            ofs<<" "<<item;
+    childPid=pid;
+    return true;
+}
+bool RedisDatabase::bgsaveInProgress(){
+    std::lock_guard<std::mutex> guard(bgsaveMutex);
+    return childPid!=-1;
+}
+void RedisDatabase::checkBgsave(bool block){
+    std::lock_guard<std::mutex> guard(bgsaveMutex);
+    if(childPid==-1)return;
+    int status=0;
+    pid_t done=waitpid(childPid,&status,block?0:WNOHANG);
+    if(done==0)return;
+    childPid=-1;
+    bool ok=done>0 && WIFEXITED(status) && WEXITSTATUS(status)==0;
+    lastBgsaveStatus=ok;
+    if(ok){
+        dirtyAtLastSave=dirtyAtFork;
+        lastSave=nowMs()/1000;
+    }
+}
+bool RedisDatabase::load(const std::string& filename){
+    bool ok;
+    {
+        auto locks=lockAllShards();
+        ok=loadSnapshot(filename);
+        //even a failed load may have dropped keys
+        for(auto& shard:shards)touchAllWatched(shard);
+    }
+    if(!ok)return false;
+    //whatever was just loaded is already on disk
+    std::lock_guard<std::mutex> guard(bgsaveMutex);
+    dirtyAtLastSave=totalDirty();
+    lastSave=nowMs()/1000;
+    return true;
+}
+//caller holds every shard lock
+bool RedisDatabase::loadSnapshot(const std::string& filename){
+    RdbReader in;
+    if(!in.open(filename))return false;
+    char magic[RDB_MAGIC_LEN];
+    for(size_t i=0;i<RDB_MAGIC_LEN;i++)magic[i]=static_cast<char>(in.readByte());
+    if(!in.ok() || std::memcmp(magic,RDB_MAGIC,RDB_MAGIC_LEN)!=0)
+        return loadLegacy(filename);
+    if(in.readByte()>RDB_VERSION)return false;
+
+    for(auto& shard:shards){
+        shard.dict.clear();
+        shard.expires.clear();
+    }
+    //pre-size every shard's table from the key count in the header
+    uint64_t total=in.readVarint();
+    if(!in.ok())return false;
+    if(total<=in.remaining()){
+        for(auto& shard:shards)
+            shard.dict.reserve(total/SHARD_COUNT+total/(4*SHARD_COUNT)+1);
+    }
+    int64_t now=nowMs();
+    std::string key;
+    bool complete=false;
+    while(in.ok()){
+        uint8_t type=in.readByte();
+        if(type==RDB_OP_EOF){
+            complete=in.verifyChecksum();
+            break;
         }
-        ofs<<"\n";
+        int64_t expireAt=-1;
+        if(type==RDB_OP_EXPIRE){
+            expireAt=in.readInt64();
+            type=in.readByte();
+        }
+        in.readString(key);
+        RedisObject obj=RedisObject::makeString(std::string_view());
+        if(!readObject(in,type,obj,limits))break;
+        //keys that expired while the server was down are not restored, unless
+        //their DEL is still to come from the master or the aof
+        if(expireAt>=0 && expireAt<=now && expiresKeys())continue;
+        Shard& shard=shardFor(key);
+        auto it=shard.dict.insert_or_assign(std::move(key),std::move(obj)).first;
+        if(expireAt>=0)setExpire(shard,it->first,it->second,expireAt);
     }
-    for(const auto& kv:hash_store){
-        ofs <<"H"<<kv.first;
-        for(const auto& field_val:kv.second){
-            ofs<<" "<<field_val.first<<":"<<field_val.second;
+    if(!complete){
+        //truncated or corrupt: never run with half a dataset
+        for(auto& shard:shards){
+            shard.dict.clear();
+            shard.expires.clear();
         }
-        ofs<<"\n";
+        return false;
     }
     return true;
 }
-bool RedisDatabase::load(const std::string& filename){
-    std::lock_guard<std::mutex> lock(db_mutex);
+//pre-binary text dumps: one "K"/"L"/"H" line per key, space separated.
+//caller holds every shard lock
+bool RedisDatabase::loadLegacy(const std::string& filename){
     std::ifstream ifs(filename,std::ios::binary);
 
     if(!ifs)return false;
-    kv_store.clear();
-    list_store.clear();
-    hash_store.clear();
+    for(auto& shard:shards){
+        shard.dict.clear();
+        shard.expires.clear();
+    }
 
     std::string line;
     while(std::getline(ifs,line)){
@@ -298,107 +1556,555 @@ bool RedisDatabase::load(const std::string& filename){
         if(type=='K'){
             std::string key,value;
             iss>>key>>value;
-            kv_store[key]=value;
+            shardFor(key).dict.insert_or_assign(key,RedisObject::makeString(value));
         }else if(type=='L'){
             std::string key;
             iss>>key;
             std::string item;
-            std::vector<std::string>list;
+            RedisObject list=RedisObject::makeList();
             while(iss>>item){
-                list.push_back(item);
+                list.visitList([&item](auto& lst){ lst.pushBack(item); });
+                convertListIfNeeded(list,limits);
             }
-            list_store[key]=list;
+            if(listLength(list)>0)
+                shardFor(key).dict.insert_or_assign(key,std::move(list));
         }else if(type== 'H'){
             std::string key;
             iss>>key;
             std::string pair;
-            std::unordered_map<std::string,std::string>hash;
+            RedisObject hash=RedisObject::makeHash();
             while(iss>>pair){
                 auto pos =pair.find(':');
                 if(pos!=std::string::npos){
                     std::string field=pair.substr(0,pos);
                     std::string value =pair.substr(pos+1);
-                    hash[field]=value;
+                    hashSet(hash,field,value,limits);
                 }
 
             }
-            hash_store[key]=hash;
+            if(hashLength(hash)>0)
+                shardFor(key).dict.insert_or_assign(key,std::move(hash));
         }
     }
     return true;
 
 }
 bool RedisDatabase::hset(const std::string& key,const std::string& field,const std::string& val){
-    std::lock_guard<std::mutex> lock(db_mutex);
-    hash_store[key][field]=val;
-    return true;
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::Hash);
+    if(!obj)obj=&shard.dict.emplace(key,RedisObject::makeHash()).first->second;
+    bool added=hashSet(*obj,field,val,limits);
+    markDirty(shard,key);
+    return added;
+}
+size_t RedisDatabase::hset(const std::string& key,const std::vector<std::pair<std::string,std::string>>& fieldValues){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::Hash);
+    if(!obj)obj=&shard.dict.emplace(key,RedisObject::makeHash()).first->second;
+    size_t added=0;
+    for(const auto& pair:fieldValues){
+        if(hashSet(*obj,pair.first,pair.second,limits))added++;
+    }
+    markDirty(shard,key,fieldValues.size());
+    return added;
 }
 bool RedisDatabase::hget(const std::string& key,const std::string& field,std::string& val){
-    std::lock_guard<std::mutex> lock(db_mutex);
-    auto it=hash_store.find(key);
-    if(it!=hash_store.end()){
-        auto it2=it->second.find(field);
-        if(it2!=it->second.end()){
-            val=it2->second;
-            return true;
-        }
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Hash);
+    return obj && hashGet(*obj,field,val);
+}
+std::vector<std::optional<std::string>> RedisDatabase::hmget(const std::string& key,const std::vector<std::string>& fields){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Hash);
+    std::vector<std::optional<std::string>> values(fields.size());
+    if(!obj)return values;
+    std::string val;
+    for(size_t i=0;i<fields.size();i++){
+        if(hashGet(*obj,fields[i],val))values[i]=std::move(val);
     }
-    return false;
+    return values;
 }
 bool RedisDatabase::hexists(const std::string& key,const std::string& field){
-    std::lock_guard<std::mutex> lock(db_mutex);
-    auto it =hash_store.find(key);
-    if(it !=hash_store.end())
-        return it->second.find(field)!=it->second.end();
-    return false;
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Hash);
+    if(!obj)return false;
+    if(obj->encoding==ObjectEncoding::ListPack)
+        return packFindField(obj->listpack(),field)!=obj->listpack().end();
+    return obj->hash().find(field)!=obj->hash().end();
 
 }
 bool RedisDatabase::hdel(const std::string& key,const std::string& field){
-    std::lock_guard<std::mutex> lock(db_mutex);
-    auto it=hash_store.find(key);
-    if(it!=hash_store.end())
-        return it->second.erase(field)>0;
-    return false;
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::Hash);
+    if(!obj)return false;
+    bool erased=hashDelete(*obj,field);
+    //an emptied hash disappears from the keyspace
+    if(hashLength(*obj)==0)shard.dict.erase(key);
+    if(erased)markDirty(shard,key);
+    return erased;
 
 }
-std::unordered_map<std::string,std::string> RedisDatabase::hgetall(const std::string& key){
-    std::lock_guard<std::mutex> lock(db_mutex);
-    if(hash_store.find(key)!=hash_store.end())
-        return hash_store[key];
-    return {};
+size_t RedisDatabase::hdel(const std::string& key,const std::vector<std::string>& fields){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::Hash);
+    if(!obj)return 0;
+    size_t erased=0;
+    for(const auto& field:fields){
+        if(hashDelete(*obj,field))erased++;
+    }
+    if(hashLength(*obj)==0)shard.dict.erase(key);
+    if(erased>0)markDirty(shard,key,erased);
+    return erased;
+}
+std::vector<std::pair<std::string,std::string>> RedisDatabase::hgetall(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    std::vector<std::pair<std::string,std::string>> pairs;
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Hash);
+    if(!obj)return pairs;
+    pairs.reserve(hashLength(*obj));
+    if(obj->encoding==ObjectEncoding::ListPack){
+        //one pass over one buffer
+        const ListPack& lp=obj->listpack();
+        for(size_t pos=lp.begin();pos<lp.end();){
+            size_t valuePos=lp.next(pos);
+            pairs.emplace_back(lp.get(pos),lp.get(valuePos));
+            pos=lp.next(valuePos);
+        }
+        return pairs;
+    }
+    pairs.assign(obj->hash().begin(),obj->hash().end());
+    return pairs;
 
 }
+uint64_t RedisDatabase::hscan(const std::string& key,uint64_t cursor,size_t count,const std::string& pattern,
+                              std::vector<std::pair<std::string,std::string>>& out){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Hash);
+    if(!obj)return 0;
+    if(obj->encoding==ObjectEncoding::ListPack){
+        const ListPack& lp=obj->listpack();
+        for(size_t pos=lp.begin();pos<lp.end();){
+            size_t valuePos=lp.next(pos);
+            std::string_view field=lp.get(pos);
+            if(pattern.empty() || stringMatch(pattern,field))out.emplace_back(field,lp.get(valuePos));
+            pos=lp.next(valuePos);
+        }
+        return 0;
+    }
+    size_t visited=0,buckets=0,maxBuckets=count*10;
+    do{
+        cursor=obj->hash().scan(cursor,[&](const auto& pair){
+            visited++;
+            if(pattern.empty() || stringMatch(pattern,pair.first))out.emplace_back(pair.first.view(),pair.second.view());
+        });
+        buckets++;
+    }while(cursor!=0 && visited<count && buckets<maxBuckets);
+    return cursor;
+}
 std::vector<std::string> RedisDatabase::hkeys(const std::string&key){
-    std::lock_guard<std::mutex> lock(db_mutex);
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     std::vector<std::string>fields;
-    auto it=hash_store.find(key);
-    if(it!=hash_store.end()){
-        for(const auto& pair:it->second)
-            fields.push_back(pair.first);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Hash);
+    if(!obj)return fields;
+    if(obj->encoding==ObjectEncoding::ListPack){
+        const ListPack& lp=obj->listpack();
+        for(size_t pos=lp.begin();pos<lp.end();pos=lp.next(lp.next(pos)))
+            fields.emplace_back(lp.get(pos));
+        return fields;
     }
+    for(const auto& pair:obj->hash())
+        fields.emplace_back(pair.first.view());
     return fields;
 
 }
 std::vector<std::string> RedisDatabase::hvals(const std::string&key){
-    std::lock_guard<std::mutex> lock(db_mutex);
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
      std::vector<std::string>vals;
-    auto it=hash_store.find(key);
-    if(it!=hash_store.end()){
-        for(const auto& pair:it->second)
-            vals.push_back(pair.second);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Hash);
+    if(!obj)return vals;
+    if(obj->encoding==ObjectEncoding::ListPack){
+        const ListPack& lp=obj->listpack();
+        for(size_t pos=lp.next(lp.begin());pos<lp.end();pos=lp.next(lp.next(pos)))
+            vals.emplace_back(lp.get(pos));
+        return vals;
     }
+    for(const auto& pair:obj->hash())
+        vals.emplace_back(pair.second.view());
     return vals;
 }
 ssize_t RedisDatabase::hlen(const std::string& key){
-    std::lock_guard<std::mutex> lock(db_mutex);
-        auto it=hash_store.find(key);
-    return (it!=hash_store.end())?it->second.size():0;
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Hash);
+    return obj?hashLength(*obj):0;
 }
-bool RedisDatabase::hmset(const std::string& key,const std::vector<std::pair<std::string,std::string>>fieldvalues){
-    std::lock_guard<std::mutex> lock(db_mutex);
-
-    for(const auto& pair:fieldvalues){
-        hash_store[key][pair.first]=pair.second;
+ZAddResult RedisDatabase::zadd(const std::string& key,const std::vector<std::pair<double,std::string>>& pairs,int flags){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    ZAddResult res;
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::ZSet);
+    if(!obj){
+        //XX never creates the key
+        if(flags&ZADD_XX)return res;
+        obj=&shard.dict.emplace(key,RedisObject::makeZSet()).first->second;
     }
-    return true;
+    for(const auto& pair:pairs){
+        double score=pair.first;
+        ZAddOutcome outcome=zsetAdd(*obj,score,pair.second,flags,limits);
+        if(outcome==ZAddOutcome::NotANumber){
+            res.nan=true;
+            break;
+        }
+        if(outcome==ZAddOutcome::Added)res.added++;
+        else if(outcome==ZAddOutcome::Updated)res.updated++;
+        if(outcome!=ZAddOutcome::Skipped){
+            res.applied=true;
+            res.score=score;
+        }
+    }
+    if(zsetLength(*obj)==0)shard.dict.erase(key);
+    if(res.added+res.updated>0)markDirty(shard,key,res.added+res.updated);
+    return res;
+}
+size_t RedisDatabase::zrem(const std::string& key,const std::vector<std::string>& members){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::ZSet);
+    if(!obj)return 0;
+    size_t removed=0;
+    double score;
+    for(const auto& member:members){
+        if(!zsetScore(*obj,member,score))continue;
+        zsetRemove(*obj,score,member);
+        removed++;
+    }
+    //an emptied sorted set disappears from the keyspace
+    if(zsetLength(*obj)==0)shard.dict.erase(key);
+    if(removed>0)markDirty(shard,key,removed);
+    return removed;
+}
+bool RedisDatabase::zscore(const std::string& key,const std::string& member,double& score){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::ZSet);
+    return obj && zsetScore(*obj,member,score);
+}
+ssize_t RedisDatabase::zcard(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::ZSet);
+    return obj?zsetLength(*obj):0;
+}
+long RedisDatabase::zrank(const std::string& key,const std::string& member,bool reverse){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::ZSet);
+    if(!obj)return -1;
+    long rank;
+    if(obj->encoding==ObjectEncoding::ListPack){
+        rank=packRank(obj->listpack(),member);
+    }else{
+        const SortedSet& zs=obj->zset();
+        auto it=zs.dict.find(member);
+        if(it==zs.dict.end())return -1;
+        rank=static_cast<long>(zs.list.rank(it->second,member))-1;
+    }
+    if(rank<0)return -1;
+    return reverse?static_cast<long>(zsetLength(*obj))-1-rank:rank;
+}
+void RedisDatabase::zrange(const std::string& key,long start,long stop,bool reverse,
+                           std::vector<std::pair<std::string,double>>& out){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::ZSet);
+    if(!obj)return;
+    size_t len=zsetLength(*obj);
+    if(!ListPack::clampRange(start,stop,len))return;
+    size_t n=stop-start+1;
+    out.reserve(out.size()+n);
+    //in ascending order the first element is at start, in descending order
+    //at the mirrored position, and the walk goes backwards
+    size_t first=reverse?len-1-start:start;
+    if(obj->encoding==ObjectEncoding::ListPack){
+        const ListPack& lp=obj->listpack();
+        size_t pos=lp.seek(static_cast<long>(2*first));
+        for(size_t i=0;i<n;i++){
+            out.emplace_back(lp.get(pos),unpackScore(lp.get(lp.next(pos))));
+            if(i+1<n)pos=reverse?lp.prev(lp.prev(pos)):lp.next(lp.next(pos));
+        }
+        return;
+    }
+    const SkipList::Node* node=obj->zset().list.byRank(first+1);
+    for(size_t i=0;i<n && node;i++){
+        out.emplace_back(node->member.view(),node->score);
+        node=reverse?node->prev():node->next();
+    }
+}
+void RedisDatabase::zrangeByScore(const std::string& key,const ScoreRange& range,bool reverse,size_t offset,long count,
+                                  std::vector<std::pair<std::string,double>>& out){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::ZSet);
+    if(!obj || range.empty())return;
+    auto take=[&](std::string_view member,double score){
+        if(offset>0){
+            offset--;
+            return true;
+        }
+        if(count==0)return false;
+        out.emplace_back(member,score);
+        if(count>0)count--;
+        return true;
+    };
+    if(obj->encoding==ObjectEncoding::ListPack){
+        const ListPack& lp=obj->listpack();
+        if(lp.empty())return;
+        //walk member positions from the low or the high end
+        size_t pos=reverse?lp.prev(lp.prev(lp.end())):lp.begin();
+        while(true){
+            double score=unpackScore(lp.get(lp.next(pos)));
+            if(reverse?!range.aboveMin(score):!range.belowMax(score))break;
+            if(range.contains(score) && !take(lp.get(pos),score))break;
+            if(reverse){
+                if(pos==lp.begin())break;
+                pos=lp.prev(lp.prev(pos));
+            }else{
+                pos=lp.next(lp.next(pos));
+                if(pos>=lp.end())break;
+            }
+        }
+        return;
+    }
+    const SkipList& list=obj->zset().list;
+    const SkipList::Node* node=reverse?list.lastInRange(range):list.firstInRange(range);
+    while(node && range.contains(node->score) && take(node->member.view(),node->score))
+        node=reverse?node->prev():node->next();
+}
+size_t RedisDatabase::zcount(const std::string& key,const ScoreRange& range){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::ZSet);
+    if(!obj || range.empty())return 0;
+    if(obj->encoding==ObjectEncoding::ListPack){
+        const ListPack& lp=obj->listpack();
+        size_t n=0;
+        for(size_t pos=lp.next(lp.begin());pos<lp.end();pos=lp.next(lp.next(pos))){
+            double score=unpackScore(lp.get(pos));
+            if(!range.belowMax(score))break;
+            if(range.aboveMin(score))n++;
+        }
+        return n;
+    }
+    //the difference of the ranks of the first and the last element inside
+    const SkipList& list=obj->zset().list;
+    const SkipList::Node* first=list.firstInRange(range);
+    if(!first)return 0;
+    const SkipList::Node* last=list.lastInRange(range);
+    return list.rank(last->score,last->member.view())-list.rank(first->score,first->member.view())+1;
+}
+size_t RedisDatabase::sadd(const std::string& key,const std::vector<std::string>& members){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::Set);
+    if(!obj)obj=&shard.dict.emplace(key,RedisObject::makeSet()).first->second;
+    size_t added=0;
+    std::vector<int64_t> ints;
+    if(obj->encoding==ObjectEncoding::IntSet && members.size()>1){
+        ints.reserve(members.size());
+        int64_t v;
+        for(const auto& member:members){
+            if(!IntSet::parse(member,v))break;
+            ints.push_back(v);
+        }
+    }
+    if(!ints.empty() && ints.size()==members.size()){
+        //a batch of integers is merged into the intset in one pass instead
+        //of moving its tail once per member
+        std::sort(ints.begin(),ints.end());
+        ints.erase(std::unique(ints.begin(),ints.end()),ints.end());
+        added=obj->intset().insertSorted(ints);
+        if(obj->intset().size()>limits.setMaxIntsetEntries)convertSetToHashTable(*obj);
+    }else{
+        for(const auto& member:members){
+            if(setAdd(*obj,member,limits))added++;
+        }
+    }
+    if(added>0)markDirty(shard,key,added);
+    return added;
+}
+size_t RedisDatabase::srem(const std::string& key,const std::vector<std::string>& members){
+    Shard& shard=shardFor(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    RedisObject* obj=lookupWrite(shard,key,ObjectType::Set);
+    if(!obj)return 0;
+    size_t removed=0;
+    for(const auto& member:members){
+        if(setRemove(*obj,member))removed++;
+    }
+    //an emptied set disappears from the keyspace
+    if(setLength(*obj)==0)shard.dict.erase(key);
+    if(removed>0)markDirty(shard,key,removed);
+    return removed;
+}
+bool RedisDatabase::sismember(const std::string& key,const std::string& member){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Set);
+    return obj && setContains(*obj,member);
+}
+std::vector<std::string> RedisDatabase::smembers(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    std::vector<std::string> members;
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Set);
+    if(obj)setMembers(*obj,members);
+    return members;
+}
+ssize_t RedisDatabase::scard(const std::string& key){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Set);
+    return obj?setLength(*obj):0;
+}
+uint64_t RedisDatabase::sscan(const std::string& key,uint64_t cursor,size_t count,const std::string& pattern,
+                              std::vector<std::string>& out){
+    Shard& shard=shardFor(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    const RedisObject* obj=lookupRead(shard,key,ObjectType::Set);
+    if(!obj)return 0;
+    if(obj->encoding==ObjectEncoding::IntSet){
+        char buf[24];
+        obj->intset().forEach([&](int64_t v){
+            std::string_view member=IntSet::format(v,buf);
+            if(pattern.empty() || stringMatch(pattern,member))out.emplace_back(member);
+        });
+        return 0;
+    }
+    size_t visited=0,buckets=0,maxBuckets=count*10;
+    do{
+        cursor=obj->set().scan(cursor,[&](const auto& pair){
+            visited++;
+            if(pattern.empty() || stringMatch(pattern,pair.first))out.emplace_back(pair.first);
+        });
+        buckets++;
+    }while(cursor!=0 && visited<count && buckets<maxBuckets);
+    return cursor;
+}
+std::vector<std::string> RedisDatabase::sinter(const std::vector<std::string>& keys){
+    std::vector<size_t> idx=shardIndexes(keys);
+    auto locks=lockShardsShared(idx);
+    std::vector<std::string> out;
+    std::vector<const RedisObject*> sets;
+    for(size_t i=0;i<keys.size();i++){
+        const RedisObject* obj=lookupRead(shards[idx[i]],keys[i],ObjectType::Set);
+        //a missing key is an empty set, and so is the intersection
+        if(!obj)return out;
+        sets.push_back(obj);
+    }
+    //walk the smallest set and look its members up in the others
+    std::sort(sets.begin(),sets.end(),[](const RedisObject* a,const RedisObject* b){ return setLength(*a)<setLength(*b); });
+    const RedisObject& first=*sets[0];
+    if(first.encoding==ObjectEncoding::IntSet){
+        std::vector<int64_t> ints;
+        size_t next=1;
+        //two intsets go through the merge kernel, the rest filter its result
+        if(sets.size()>1 && sets[1]->encoding==ObjectEncoding::IntSet){
+            IntSet::intersect(first.intset(),sets[1]->intset(),ints);
+            next=2;
+        }else{
+            first.intset().values(ints);
+        }
+        for(size_t i=next;i<sets.size() && !ints.empty();i++){
+            const RedisObject& other=*sets[i];
+            ints.erase(std::remove_if(ints.begin(),ints.end(),[&other](int64_t v){ return !setContains(other,v); }),ints.end());
+        }
+        formatInts(ints,out);
+        return out;
+    }
+    for(const auto& pair:first.set()){
+        std::string_view member=pair.first.view();
+        bool all=true;
+        for(size_t i=1;i<sets.size() && all;i++)all=setContains(*sets[i],member);
+        if(all)out.emplace_back(member);
+    }
+    return out;
+}
+std::vector<std::string> RedisDatabase::sunion(const std::vector<std::string>& keys){
+    std::vector<size_t> idx=shardIndexes(keys);
+    auto locks=lockShardsShared(idx);
+    std::vector<const RedisObject*> sets;
+    bool allInts=true;
+    for(size_t i=0;i<keys.size();i++){
+        const RedisObject* obj=lookupRead(shards[idx[i]],keys[i],ObjectType::Set);
+        if(!obj)continue;
+        sets.push_back(obj);
+        if(obj->encoding!=ObjectEncoding::IntSet)allInts=false;
+    }
+    std::vector<std::string> out;
+    if(allInts){
+        //intsets are sorted: merge them one after the other
+        std::vector<int64_t> merged,ints,tmp;
+        for(const RedisObject* obj:sets){
+            ints.clear();
+            obj->intset().values(ints);
+            tmp.clear();
+            std::set_union(merged.begin(),merged.end(),ints.begin(),ints.end(),std::back_inserter(tmp));
+            merged.swap(tmp);
+        }
+        formatInts(merged,out);
+        return out;
+    }
+    SetValue seen;
+    char buf[24];
+    for(const RedisObject* obj:sets){
+        if(obj->encoding==ObjectEncoding::IntSet){
+            obj->intset().forEach([&](int64_t v){ seen.emplace(IntSet::format(v,buf)); });
+            continue;
+        }
+        for(const auto& pair:obj->set())seen.emplace(pair.first.view());
+    }
+    out.reserve(seen.size());
+    for(const auto& pair:seen)out.emplace_back(pair.first.view());
+    return out;
+}
+std::vector<std::string> RedisDatabase::sdiff(const std::vector<std::string>& keys){
+    std::vector<size_t> idx=shardIndexes(keys);
+    auto locks=lockShardsShared(idx);
+    std::vector<const RedisObject*> sets;
+    for(size_t i=0;i<keys.size();i++){
+        const RedisObject* obj=lookupRead(shards[idx[i]],keys[i],ObjectType::Set);
+        //missing keys after the first remove nothing
+        if(obj || i==0)sets.push_back(obj);
+    }
+    std::vector<std::string> out;
+    const RedisObject* first=sets[0];
+    if(!first)return out;
+    auto inOthers=[&sets](auto member){
+        for(size_t i=1;i<sets.size();i++){
+            if(setContains(*sets[i],member))return true;
+        }
+        return false;
+    };
+    if(first->encoding==ObjectEncoding::IntSet){
+        std::vector<int64_t> ints;
+        first->intset().values(ints);
+        ints.erase(std::remove_if(ints.begin(),ints.end(),inOthers),ints.end());
+        formatInts(ints,out);
+        return out;
+    }
+    for(const auto& pair:first->set()){
+        if(!inOthers(pair.first.view()))out.emplace_back(pair.first.view());
+    }
+    return out;
 }
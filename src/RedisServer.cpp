@@ -1,59 +1,137 @@
 #include "../include/RedisServer.h"
 #include "../include/RedisCommandHandler.h"
-#include "../include/RedisDatabase.h" 
+#include "../include/RedisDatabase.h"
+#include "../include/AppendOnlyFile.h"
+#include "../include/Replication.h"
+#include "../include/ServerStats.h"
 #include <iostream>
-#include <cstring>         // for memset
 #include <thread>          // for std::thread
-#include <vector>          // for std::vector
+#include <chrono>
 #include <unistd.h>        // for close()
+#include <fcntl.h>         // for fcntl()
 #include <netinet/in.h>    // for sockaddr_in
-#include <sys/socket.h>    // for socket(), bind(), listen(), accept()
+#include <sys/socket.h>    // for socket(), bind(), listen()
 #include <arpa/inet.h>     // for htons, htonl
+#include <sys/resource.h>  // for setrlimit()
 #include <csignal>
 
 static RedisServer* globalServer=nullptr;
 
+//cron ticks per second
+static const int CRON_HZ=10;
+//share of each tick the active expire cycle may spend deleting keys
+static const std::chrono::microseconds ACTIVE_EXPIRE_BUDGET(1000000/CRON_HZ/4);
+//after a failed bgsave, wait this long before a save point may try again
+static const int64_t BGSAVE_RETRY_DELAY=5;
 
 void signalHandler(int signum){
+    //only set a flag here; dumping from inside the handler could deadlock
+    //on a database lock held by the interrupted event loop
     if(globalServer){
-        std::cout<<"Caught signal"<<signum<<",Shutting Down...\n";
-        globalServer->shutdown();
-
+        globalServer->stop();
     }
-    exit(signum);
+}
+
+static bool setNonBlocking(int fd){
+    int flags=fcntl(fd,F_GETFL,0);
+    if(flags<0)return false;
+    return fcntl(fd,F_SETFL,flags|O_NONBLOCK)==0;
 }
 
 void RedisServer::setupSignalHandler(){
     signal(SIGINT,signalHandler);
+    signal(SIGTERM,signalHandler);
+    //a client vanishing mid-reply must not kill the whole server
+    signal(SIGPIPE,SIG_IGN);
 }
-RedisServer::RedisServer(int port) :port(port),server_socket(-1) ,running(true){
-    globalServer=this; 
+RedisServer::RedisServer(int port,int backlog,size_t maxClients,int ioThreads,std::vector<SavePoint> savePoints)
+    :port(port),backlog(backlog),maxClients(maxClients),ioThreads(ioThreads<1?1:ioThreads),
+     savePoints(std::move(savePoints)),server_socket(-1),running(true){
+    globalServer=this;
     setupSignalHandler();
 }
 
+void RedisServer::stop(){
+    running=false;
+}
+
+//same rules as redis.conf's default "save 3600 1 300 100 60 10000"
+std::vector<SavePoint> RedisServer::defaultSavePoints(){
+    return {{3600,1},{300,100},{60,10000}};
+}
+
+void RedisServer::checkSavePoints(){
+    RedisDatabase& db=RedisDatabase::getInstance();
+    if(savePoints.empty() || db.bgsaveInProgress())return;
+    int64_t now=RedisDatabase::nowMs()/1000;
+    if(!db.lastBgsaveOk() && now-lastBgsaveTry<BGSAVE_RETRY_DELAY)return;
+    uint64_t dirty=db.dirty();
+    int64_t sinceSave=now-db.lastSaveTime();
+    for(const auto& sp:savePoints){
+        if(dirty>=sp.changes && sinceSave>=sp.seconds){
+            lastBgsaveTry=now;
+            if(db.bgsave(DUMP_FILENAME))
+                std::cout<<dirty<<" changes in "<<sp.seconds<<" seconds. Background saving started\n";
+            else
+                std::cerr<<"Error starting background save\n";
+            return;
+        }
+    }
+}
+
+void RedisServer::cron(){
+    RedisDatabase& db=RedisDatabase::getInstance();
+    while(running){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000/CRON_HZ));
+        RedisCommandHandler::activeExpireCycle(ACTIVE_EXPIRE_BUDGET);
+        db.checkBgsave();
+        checkSavePoints();
+        AppendOnlyFile::getInstance().cron();
+        ServerStats::getInstance().sample(RedisDatabase::nowMs());
+    }
+}
+
 void RedisServer::shutdown(){
     running=false;
 
     if(server_socket!=-1){
+        //no master stream may apply writes once the final dump begins
+        Replication::getInstance().shutdown();
+        //every write acknowledged so far reaches the aof before exit
+        AppendOnlyFile::getInstance().close();
+        //let a running bgsave finish so it cannot rename over the final dump
+        RedisDatabase::getInstance().checkBgsave(true);
          // Before shutdown, persist the database
-        if (RedisDatabase::getInstance().dump("dump.my_rdb"))
+        if (RedisDatabase::getInstance().dump(DUMP_FILENAME))
             std::cout << "Database Dumped to dump.my_rdb\n";
-        else 
+        else
             std::cerr << "Error dumping database\n";
         close(server_socket);
-
+        server_socket=-1;
     }
     std::cout <<"Server Shutdown Gracefully!\n";
 }
 
+//make sure the process may hold maxClients sockets plus a few spare descriptors
+static void raiseFdLimit(size_t maxClients){
+    rlimit lim{};
+    if(getrlimit(RLIMIT_NOFILE,&lim)<0)return;
+    rlim_t wanted=maxClients+32;
+    if(lim.rlim_cur>=wanted)return;
+    lim.rlim_cur=(lim.rlim_max==RLIM_INFINITY || wanted<lim.rlim_max)?wanted:lim.rlim_max;
+    if(setrlimit(RLIMIT_NOFILE,&lim)<0 || lim.rlim_cur<wanted)
+        std::cerr<<"Warning: open file limit "<<lim.rlim_cur<<" is below maxclients\n";
+}
+
 void RedisServer::run(){
+    raiseFdLimit(maxClients);
     //create a socket(TCP/IPV4)
     server_socket=socket(AF_INET,SOCK_STREAM,0);
     //ipv4,reliable connection oriented byte stream.default proto type 0
     if(server_socket<0){
         std::cerr<<"Error Creating Server Socket\n";
         return;
-    } 
+    }
     //even if the port is showing occupied we will bind the socket to this port
     int opt=1;
     setsockopt(server_socket,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt));
@@ -66,47 +144,35 @@ void RedisServer::run(){
     if(bind(server_socket,(struct sockaddr*)&serverAddr,sizeof(serverAddr))<0){
         std::cerr<<"Error Binding Socket\n";
         return ;
-    }   
-    //10 incoming connections can queue up before os will reject new cinections
-    if(listen(server_socket,10)<0){
+    }
+    //backlog incoming connections can queue up before os will reject new connections
+    if(listen(server_socket,backlog)<0){
         std::cerr<<"Error Listening On Server Socket\n";
         return ;
     }
+    if(!setNonBlocking(server_socket)){
+        std::cerr<<"Error Setting Server Socket Non-Blocking\n";
+        return ;
+    }
+    ServerStats::getInstance().setServerInfo(port,ioThreads,maxClients);
+    for(int i=0;i<ioThreads;i++){
+        loops.emplace_back(new EventLoop(server_socket,maxClients,clientCount,running));
+        if(!loops.back()->init())return;
+    }
     //server is ready to accept clients
     std::cout<<"Redis Server Litening On port :" <<port<< "\n";
 
+    //loop 0 runs on the calling thread, the others get their own
     std::vector<std::thread>threads;
-    RedisCommandHandler cmdHandler;
-    while(running){
-        int client_socket =accept(server_socket,nullptr,nullptr);
-        if(client_socket<0){
-            if(running){
-                std::cerr<< "Error Accepting Client Connection\n";
-            }
-            break;
-        }
-        threads.emplace_back([client_socket,&cmdHandler](){
-            char buffer[1024];
-            while(true){
-                memset(buffer,0,sizeof(buffer));
-                int bytes=recv(client_socket,buffer,sizeof(buffer)-1,0);
-                if(bytes<=0)break;
-                std::string request(buffer,bytes);
-                std::string response=cmdHandler.processCommand(request);
-                send(client_socket,response.c_str(),response.size(),0);
-            }
-            close(client_socket);
-        });
-        
+    threads.emplace_back([this](){ cron(); });
+    for(int i=1;i<ioThreads;i++){
+        threads.emplace_back([this,i](){ loops[i]->run(); });
     }
+    loops[0]->run();
     for(auto& t:threads){
         if(t.joinable())t.join();
-
     }
-    // //before shutting down.persist the db.
-    // if(RedisDatabase::getInstance().dump("dump.my_rdb")){
-    //     std::cout <<"Database Dumped to dump.my_rdb\n";
-    // }else{
-    //   std::cerr <<"Error Dumping Database\n";
-    // }
+    loops.clear();
+    //before shutting down.persist the db.
+    shutdown();
 }
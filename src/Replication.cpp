@@ -0,0 +1,763 @@
+#include "../include/Replication.h"
+#include "../include/RedisDatabase.h"
+#include "../include/RedisCommandHandler.h"
+#include "../include/AppendOnlyFile.h"
+#include "../include/RespParser.h"
+#include "../include/ReplyBuffer.h"
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+//the master pings its replicas this often, so a quiet master can be told
+//from a dead one (ms)
+static const int64_t REPL_PING_PERIOD=10*1000;
+//a link silent for this long is broken, on either side (ms)
+static const int64_t REPL_TIMEOUT=60*1000;
+//replicas acknowledge their offset this often (ms)
+static const int64_t REPL_ACK_PERIOD=1000;
+//while the snapshot is being forked and written the master sends a bare
+//newline this often, so the replica does not time out (ms)
+static const int64_t REPL_KEEPALIVE_PERIOD=1000;
+//connecting to the master gives up after this long (ms)
+static const int CONNECT_TIMEOUT_MS=5000;
+//bytes handed to send() or sendfile() per call
+static const size_t SEND_CHUNK=64*1024;
+//how long the threads sleep in poll() before they look at the clock again (ms)
+static const int POLL_MS=100;
+
+struct Replication::Replica{
+    enum class State{ WaitBgsave, SendRdb, Online };
+    int fd;
+    std::string ip;
+    int port=0;
+    State state=State::WaitBgsave;
+    uint64_t offset=0;          //next stream byte to send
+    uint64_t ackOffset=0;
+    int64_t lastAck=0;          //unix ms of the last REPLCONF ACK
+    int64_t lastKeepalive=0;
+    int rdbFd=-1;
+    off_t rdbSent=0;
+    off_t rdbSize=0;
+    std::string header;         //"$<size>\r\n" still to go out before the snapshot
+    std::string inbuf;          //acks not yet parsed
+    size_t inpos=0;
+    RespParser parser;
+    std::vector<std::string> argv;
+    bool dead=false;
+    explicit Replica(int fd):fd(fd){}
+    ~Replica(){
+        if(rdbFd!=-1)close(rdbFd);
+        close(fd);
+    }
+    const char* stateName() const{
+        switch(state){
+            case State::WaitBgsave: return "wait_bgsave";
+            case State::SendRdb: return "send_bulk";
+            case State::Online: return "online";
+        }
+        return "none";
+    }
+};
+
+static void appendCommand(std::string& out,const std::vector<std::string>& argv){
+    out+='*';
+    out+=std::to_string(argv.size());
+    out+="\r\n";
+    for(const auto& arg:argv){
+        out+='$';
+        out+=std::to_string(arg.size());
+        out+="\r\n";
+        out+=arg;
+        out+="\r\n";
+    }
+}
+
+static std::string respCommand(const std::vector<std::string>& argv){
+    std::string out;
+    appendCommand(out,argv);
+    return out;
+}
+
+static bool equalsIgnoreCase(const std::string& a,const char* b){
+    return strcasecmp(a.c_str(),b)==0;
+}
+
+//write all of data to a non-blocking socket, waiting up to timeoutMs for room
+static bool sendAll(int fd,std::string_view data,int64_t timeoutMs){
+    int64_t deadline=RedisDatabase::nowMs()+timeoutMs;
+    while(!data.empty()){
+        ssize_t n=send(fd,data.data(),data.size(),MSG_NOSIGNAL);
+        if(n>0){
+            data.remove_prefix(n);
+            continue;
+        }
+        if(n<0 && errno==EINTR)continue;
+        if(n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK)return false;
+        if(RedisDatabase::nowMs()>=deadline)return false;
+        pollfd p{fd,POLLOUT,0};
+        poll(&p,1,POLL_MS);
+    }
+    return true;
+}
+
+Replication& Replication::getInstance(){
+    static Replication instance;
+    return instance;
+}
+
+Replication::Replication(){
+    wakeFd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    replid=newReplid();
+}
+
+void Replication::configure(int port,size_t size){
+    listeningPort=port;
+    if(size>0)backlogSize=size;
+}
+
+std::string Replication::newReplid(){
+    static const char hex[]="0123456789abcdef";
+    std::random_device rd;
+    std::string id(40,'0');
+    for(auto& c:id)c=hex[rd()&15];
+    return id;
+}
+
+void Replication::wake(){
+    if(wakePending.exchange(true))return;
+    uint64_t one=1;
+    if(write(wakeFd,&one,sizeof(one))<0){
+        //EAGAIN: the counter is saturated, a wakeup is pending anyway
+    }
+}
+
+//-----------------------------
+// master side
+//-----------------------------
+void Replication::feed(const std::vector<std::string>& argv){
+    //serialized before the lock, so writers only contend on the copy
+    thread_local std::string cmd;
+    cmd.clear();
+    appendCommand(cmd,argv);
+    append(cmd);
+}
+
+void Replication::feedAll(const std::vector<std::vector<std::string>>& cmds){
+    std::string all;
+    for(const auto& argv:cmds)appendCommand(all,argv);
+    append(all);
+}
+
+void Replication::append(const std::string& cmd){
+    {
+        std::lock_guard<std::mutex> lock(backlogMutex);
+        //a switch to replica may have turned the stream off since active()
+        if(!backlogOn.load(std::memory_order_relaxed))return;
+        size_t n=cmd.size();
+        //a command bigger than the ring leaves only its tail behind
+        size_t skip=n>backlogSize?n-backlogSize:0;
+        size_t pos=(masterOffset+skip)%backlogSize;
+        size_t first=std::min(n-skip,backlogSize-pos);
+        std::memcpy(backlog.data()+pos,cmd.data()+skip,first);
+        std::memcpy(backlog.data(),cmd.data()+skip+first,n-skip-first);
+        masterOffset+=n;
+        histlen=std::min<uint64_t>(histlen+n,backlogSize);
+    }
+    wake();
+}
+
+bool Replication::inBacklogLocked(uint64_t offset) const{
+    return backlogOn.load(std::memory_order_relaxed) &&
+           offset>=masterOffset-histlen+1 && offset<=masterOffset+1;
+}
+
+bool Replication::readBacklog(uint64_t offset,std::string& out,size_t max){
+    std::lock_guard<std::mutex> lock(backlogMutex);
+    out.clear();
+    if(!inBacklogLocked(offset))return false;
+    size_t n=std::min<uint64_t>(masterOffset+1-offset,max);
+    size_t pos=(offset-1)%backlogSize;
+    size_t first=std::min(n,backlogSize-pos);
+    out.append(backlog.data()+pos,first);
+    out.append(backlog.data(),n-first);
+    return true;
+}
+
+void Replication::addReplica(int fd,const std::vector<std::string>& argv,int port){
+    auto r=std::make_unique<Replica>(fd);
+    sockaddr_in addr{};
+    socklen_t len=sizeof(addr);
+    char ip[INET_ADDRSTRLEN]="?";
+    if(getpeername(fd,reinterpret_cast<sockaddr*>(&addr),&len)==0)
+        inet_ntop(AF_INET,&addr.sin_addr,ip,sizeof(ip));
+    r->ip=ip;
+    r->port=port?port:ntohs(addr.sin_port);
+    int64_t now=RedisDatabase::nowMs();
+    r->lastAck=r->lastKeepalive=now;
+    if(isReplica()){
+        sendAll(fd,"-ERR a replica does not serve replicas\r\n",POLL_MS);
+        return;
+    }
+    bool psync=equalsIgnoreCase(argv[0],"psync");
+    //no write may run between reading the offset and forking the snapshot
+    //(and a partial sync must not miss one between the check and the add)
+    auto keyLocks=AppendOnlyFile::getInstance().lockAllKeys();
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!sender.joinable()){
+        stopSender=false;
+        sender=std::thread([this](){ senderLoop(); });
+    }
+    bool partial=false;
+    {
+        std::lock_guard<std::mutex> backlogLock(backlogMutex);
+        if(!backlogOn.load(std::memory_order_relaxed)){
+            backlog.assign(backlogSize,0);
+            histlen=0;
+            backlogOn.store(true,std::memory_order_release);
+        }
+        if(psync && argv.size()==3 && argv[1]==replid){
+            char* end=nullptr;
+            uint64_t want=std::strtoull(argv[2].c_str(),&end,10);
+            partial=end && *end=='\0' && inBacklogLocked(want);
+            r->offset=want;
+        }
+    }
+    if(partial){
+        if(!sendAll(fd,"+CONTINUE\r\n",POLL_MS))return;
+        r->state=Replica::State::Online;
+        std::cout<<"Partial resynchronization request from "<<r->ip<<":"<<r->port<<" accepted\n";
+        replicas.push_back(std::move(r));
+        wake();
+        return;
+    }
+    if(!startFullSync()){
+        std::cerr<<"Can't fork the snapshot for replica "<<r->ip<<":"<<r->port<<"\n";
+        return;
+    }
+    r->offset=syncOffset+1;
+    if(psync && !sendAll(fd,"+FULLRESYNC "+replid+" "+std::to_string(syncOffset)+"\r\n",POLL_MS))return;
+    std::cout<<"Full resynchronization of replica "<<r->ip<<":"<<r->port<<" at offset "<<syncOffset<<"\n";
+    replicas.push_back(std::move(r));
+}
+
+bool Replication::startFullSync(){
+    //a replica arriving while a snapshot is being written shares it
+    if(syncChild!=-1)return true;
+    {
+        std::lock_guard<std::mutex> backlogLock(backlogMutex);
+        syncOffset=masterOffset;
+    }
+    syncFile="temp-repl-"+std::to_string(getpid())+".my_rdb";
+    pid_t pid=RedisDatabase::getInstance().forkSnapshot(syncFile);
+    if(pid<0)return false;
+    syncChild=pid;
+    return true;
+}
+
+void Replication::reapSyncChild(){
+    if(syncChild==-1)return;
+    int status=0;
+    pid_t done=waitpid(syncChild,&status,WNOHANG);
+    if(done==0)return;
+    syncChild=-1;
+    int rdb=-1;
+    struct stat st{};
+    if(done>0 && WIFEXITED(status) && WEXITSTATUS(status)==0){
+        rdb=open(syncFile.c_str(),O_RDONLY|O_CLOEXEC);
+        if(rdb>=0 && fstat(rdb,&st)<0){
+            close(rdb);
+            rdb=-1;
+        }
+    }
+    //the open descriptors keep the data; the name is not needed any more
+    unlink(syncFile.c_str());
+    if(rdb<0)std::cerr<<"Replication snapshot failed\n";
+    for(auto& r:replicas){
+        if(r->state!=Replica::State::WaitBgsave)continue;
+        if(rdb<0 || (r->rdbFd=dup(rdb))<0){
+            r->dead=true;
+            continue;
+        }
+        r->rdbSize=st.st_size;
+        r->rdbSent=0;
+        r->header="$"+std::to_string(st.st_size)+"\r\n";
+        r->state=Replica::State::SendRdb;
+    }
+    if(rdb>=0)close(rdb);
+}
+
+void Replication::senderLoop(){
+    std::vector<pollfd> fds;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopSender){
+        uint64_t head;
+        {
+            std::lock_guard<std::mutex> backlogLock(backlogMutex);
+            head=masterOffset;
+        }
+        fds.clear();
+        fds.push_back({wakeFd,POLLIN,0});
+        for(auto& r:replicas){
+            bool output=r->state==Replica::State::SendRdb ||
+                        (r->state==Replica::State::Online && r->offset<=head);
+            fds.push_back({r->fd,static_cast<short>(POLLIN|(output?POLLOUT:0)),0});
+        }
+        lock.unlock();
+        poll(fds.data(),fds.size(),POLL_MS);
+        lock.lock();
+        uint64_t count;
+        while(read(wakeFd,&count,sizeof(count))>0){}
+        //cleared before the backlog is read: a feed after this point wakes us again
+        wakePending.store(false);
+        int64_t now=RedisDatabase::nowMs();
+        reapSyncChild();
+        if(!replicas.empty() && now-lastPing>=REPL_PING_PERIOD){
+            lastPing=now;
+            feed({"PING"});
+        }
+        serveReplicas(now);
+    }
+}
+
+void Replication::serveReplicas(int64_t now){
+    for(auto& r:replicas){
+        if(r->dead)continue;
+        bool ok=readAcks(*r,now);
+        if(ok && r->state==Replica::State::WaitBgsave && now-r->lastKeepalive>=REPL_KEEPALIVE_PERIOD){
+            r->lastKeepalive=now;
+            ok=send(r->fd,"\n",1,MSG_NOSIGNAL)==1 || errno==EAGAIN || errno==EWOULDBLOCK;
+        }
+        if(ok && r->state==Replica::State::SendRdb){
+            ok=sendSnapshot(*r);
+            if(ok && r->state==Replica::State::Online)r->lastAck=now;
+        }
+        if(ok && r->state==Replica::State::Online){
+            ok=sendStream(*r);
+            if(ok && now-r->lastAck>REPL_TIMEOUT){
+                std::cerr<<"Replica "<<r->ip<<":"<<r->port<<" timed out\n";
+                ok=false;
+            }
+        }
+        if(!ok)r->dead=true;
+    }
+    auto gone=std::remove_if(replicas.begin(),replicas.end(),[](const std::unique_ptr<Replica>& r){
+        if(r->dead)std::cout<<"Connection with replica "<<r->ip<<":"<<r->port<<" lost\n";
+        return r->dead;
+    });
+    replicas.erase(gone,replicas.end());
+}
+
+bool Replication::readAcks(Replica& r,int64_t now){
+    char buf[4096];
+    while(true){
+        ssize_t n=recv(r.fd,buf,sizeof(buf),0);
+        if(n>0){
+            r.inbuf.append(buf,n);
+            continue;
+        }
+        if(n==0)return false;
+        if(errno==EINTR)continue;
+        if(errno!=EAGAIN && errno!=EWOULDBLOCK)return false;
+        break;
+    }
+    while(true){
+        RespParser::Status st=r.parser.parse(r.inbuf,r.inpos,r.argv);
+        if(st==RespParser::Status::Incomplete)break;
+        if(st==RespParser::Status::Error)return false;
+        //REPLCONF ACK <offset>; anything else a replica sends is ignored
+        if(r.argv.size()==3 && equalsIgnoreCase(r.argv[0],"replconf") && equalsIgnoreCase(r.argv[1],"ack")){
+            r.ackOffset=std::strtoull(r.argv[2].c_str(),nullptr,10);
+            r.lastAck=now;
+        }
+    }
+    r.inbuf.erase(0,r.inpos);
+    r.inpos=0;
+    return true;
+}
+
+bool Replication::sendSnapshot(Replica& r){
+    while(!r.header.empty()){
+        ssize_t n=send(r.fd,r.header.data(),r.header.size(),MSG_NOSIGNAL);
+        if(n<0)return errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR;
+        r.header.erase(0,n);
+    }
+    while(r.rdbSent<r.rdbSize){
+        size_t chunk=std::min<off_t>(r.rdbSize-r.rdbSent,SEND_CHUNK);
+        ssize_t n=sendfile(r.fd,r.rdbFd,&r.rdbSent,chunk);
+        if(n<0)return errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR;
+        if(n==0)return false;
+    }
+    close(r.rdbFd);
+    r.rdbFd=-1;
+    r.state=Replica::State::Online;
+    std::cout<<"Synchronization with replica "<<r.ip<<":"<<r.port<<" succeeded\n";
+    return true;
+}
+
+bool Replication::sendStream(Replica& r){
+    thread_local std::string chunk;
+    while(true){
+        if(!readBacklog(r.offset,chunk,SEND_CHUNK)){
+            std::cerr<<"Replica "<<r.ip<<":"<<r.port<<" fell out of the backlog, it will resync\n";
+            return false;
+        }
+        if(chunk.empty())return true;
+        ssize_t n=send(r.fd,chunk.data(),chunk.size(),MSG_NOSIGNAL);
+        if(n<0)return errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR;
+        r.offset+=n;
+        if(static_cast<size_t>(n)<chunk.size())return true;
+    }
+}
+
+void Replication::dropReplicas(){
+    std::lock_guard<std::mutex> lock(mutex);
+    replicas.clear();
+    if(syncChild!=-1){
+        kill(syncChild,SIGKILL);
+        waitpid(syncChild,nullptr,0);
+        syncChild=-1;
+        unlink(syncFile.c_str());
+        unlink((syncFile+".tmp-"+std::to_string(getpid())).c_str());
+    }
+}
+
+//-----------------------------
+// replica side
+//-----------------------------
+void Replication::replicaOf(const std::string& host,int port){
+    std::lock_guard<std::mutex> roleLock(roleMutex);
+    stopLinkThread();
+    dropReplicas();
+    std::string ownId;
+    uint64_t ownOffset;
+    {
+        std::lock_guard<std::mutex> backlogLock(backlogMutex);
+        ownId=replid;
+        ownOffset=masterOffset;
+        backlogOn.store(false,std::memory_order_release);
+        histlen=0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        //a former master offers its own history, so it can continue with
+        //a master that used to be its replica
+        if(!isReplica()){
+            masterReplid=ownId;
+            replOffset=ownOffset;
+        }
+        masterHost=host;
+        masterPort=port;
+    }
+    replica.store(true,std::memory_order_release);
+    //from here on keys expire when the master's DEL arrives
+    RedisDatabase::getInstance().setReplica(true);
+    stopLink=false;
+    link=std::thread([this,host,port](){ linkLoop(host,port); });
+    std::cout<<"Connecting to MASTER "<<host<<":"<<port<<"\n";
+}
+
+void Replication::promote(){
+    std::lock_guard<std::mutex> roleLock(roleMutex);
+    if(!isReplica())return;
+    stopLinkThread();
+    {
+        std::lock_guard<std::mutex> backlogLock(backlogMutex);
+        replid=newReplid();
+        masterOffset=replOffset;
+        histlen=0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        masterHost.clear();
+        masterPort=0;
+        masterReplid.clear();
+    }
+    replica.store(false,std::memory_order_release);
+    RedisDatabase::getInstance().setReplica(false);
+    std::cout<<"MASTER MODE enabled\n";
+}
+
+void Replication::stopLinkThread(){
+    stopLink=true;
+    if(link.joinable())link.join();
+    linkUp=false;
+    syncing=false;
+}
+
+void Replication::shutdown(){
+    {
+        std::lock_guard<std::mutex> roleLock(roleMutex);
+        stopLinkThread();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopSender=true;
+    }
+    wake();
+    if(sender.joinable())sender.join();
+    dropReplicas();
+}
+
+void Replication::linkLoop(std::string host,int port){
+    while(!stopLink){
+        syncWithMaster(host,port);
+        linkUp=false;
+        syncing=false;
+        //retry once a second, the way a redis replica does
+        for(int i=0;i<1000/POLL_MS && !stopLink;i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+    }
+}
+
+static int connectTo(const std::string& host,int port){
+    addrinfo hints{},*res=nullptr;
+    hints.ai_family=AF_INET;
+    hints.ai_socktype=SOCK_STREAM;
+    if(getaddrinfo(host.c_str(),std::to_string(port).c_str(),&hints,&res)!=0)return -1;
+    int fd=socket(AF_INET,SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0);
+    if(fd>=0 && connect(fd,res->ai_addr,res->ai_addrlen)<0 && errno!=EINPROGRESS){
+        close(fd);
+        fd=-1;
+    }
+    freeaddrinfo(res);
+    if(fd<0)return -1;
+    pollfd p{fd,POLLOUT,0};
+    int err=0;
+    socklen_t len=sizeof(err);
+    if(poll(&p,1,CONNECT_TIMEOUT_MS)!=1 || getsockopt(fd,SOL_SOCKET,SO_ERROR,&err,&len)<0 || err!=0){
+        close(fd);
+        return -1;
+    }
+    int opt=1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+    return fd;
+}
+
+namespace{
+//the replica's end of the link: a socket plus what was read from it but
+//not consumed yet
+struct MasterLink{
+    int fd;
+    std::string buf;
+    size_t pos=0;
+    std::atomic<bool>& stop;
+    std::atomic<int64_t>& lastIo;
+    MasterLink(int fd,std::atomic<bool>& stop,std::atomic<int64_t>& lastIo):fd(fd),stop(stop),lastIo(lastIo){}
+    ~MasterLink(){ close(fd); }
+
+    //wait up to POLL_MS for more bytes; false when the link is closed or broken
+    bool fill(){
+        pollfd p{fd,POLLIN,0};
+        if(poll(&p,1,POLL_MS)<=0)return true;
+        char chunk[16*1024];
+        ssize_t n=recv(fd,chunk,sizeof(chunk),0);
+        if(n==0)return false;
+        if(n<0)return errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR;
+        buf.append(chunk,n);
+        lastIo=RedisDatabase::nowMs();
+        return true;
+    }
+    //next line without its line ending; false on a broken link, stop or timeout
+    bool readLine(std::string& line){
+        int64_t deadline=RedisDatabase::nowMs()+REPL_TIMEOUT;
+        size_t nl;
+        while((nl=buf.find('\n',pos))==std::string::npos){
+            if(stop || RedisDatabase::nowMs()>deadline || !fill())return false;
+        }
+        line.assign(buf,pos,nl-pos);
+        if(!line.empty() && line.back()=='\r')line.pop_back();
+        pos=nl+1;
+        return true;
+    }
+    bool command(const std::vector<std::string>& argv,std::string& reply){
+        return sendAll(fd,respCommand(argv),REPL_TIMEOUT) && readLine(reply);
+    }
+    void compact(){
+        buf.erase(0,pos);
+        pos=0;
+    }
+};
+}
+
+bool Replication::syncWithMaster(const std::string& host,int port){
+    int fd=connectTo(host,port);
+    if(fd<0){
+        std::cerr<<"Error connecting to MASTER "<<host<<":"<<port<<"\n";
+        return false;
+    }
+    MasterLink conn(fd,stopLink,lastIo);
+    lastIo=RedisDatabase::nowMs();
+    std::string line;
+    if(!conn.command({"PING"},line) || line.empty() || line[0]!='+'){
+        std::cerr<<"MASTER did not answer PING: "<<line<<"\n";
+        return false;
+    }
+    //an old master may not know REPLCONF; its error does not matter
+    if(!conn.command({"REPLCONF","listening-port",std::to_string(listeningPort)},line))return false;
+    std::string id="?",offset="-1";
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!masterReplid.empty()){
+            id=masterReplid;
+            offset=std::to_string(replOffset+1);
+        }
+    }
+    if(!conn.command({"PSYNC",id,offset},line))return false;
+    if(line.rfind("+FULLRESYNC ",0)==0){
+        char newId[41]={0};
+        unsigned long long at=0;
+        if(sscanf(line.c_str()+12,"%40s %llu",newId,&at)!=2){
+            std::cerr<<"Bad FULLRESYNC reply from MASTER: "<<line<<"\n";
+            return false;
+        }
+        syncing=true;
+        //bare newlines keep the link alive while the master writes the snapshot
+        do{
+            if(!conn.readLine(line))return false;
+        }while(line.empty());
+        if(line[0]!='$'){
+            std::cerr<<"Bad snapshot header from MASTER: "<<line<<"\n";
+            return false;
+        }
+        uint64_t size=std::strtoull(line.c_str()+1,nullptr,10);
+        std::string tmp="temp-sync-"+std::to_string(getpid())+".my_rdb";
+        int out=open(tmp.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+        if(out<0)return false;
+        uint64_t got=0;
+        bool ok=true;
+        int64_t deadline=RedisDatabase::nowMs()+REPL_TIMEOUT;
+        while(ok && got<size){
+            size_t n=std::min<uint64_t>(conn.buf.size()-conn.pos,size-got);
+            if(n>0){
+                ok=write(out,conn.buf.data()+conn.pos,n)==static_cast<ssize_t>(n);
+                conn.pos+=n;
+                got+=n;
+                conn.compact();
+                deadline=RedisDatabase::nowMs()+REPL_TIMEOUT;
+                continue;
+            }
+            ok=!stopLink && RedisDatabase::nowMs()<deadline && conn.fill();
+        }
+        ok=close(out)==0 && ok;
+        if(ok)ok=RedisDatabase::getInstance().load(tmp);
+        unlink(tmp.c_str());
+        if(!ok){
+            std::cerr<<"Failed to load the snapshot from MASTER\n";
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            masterReplid=newId;
+            replOffset=at;
+        }
+        std::cout<<"MASTER <-> REPLICA sync: finished with success, "<<size<<" bytes\n";
+        //the aof still holds the dataset from before the sync
+        AppendOnlyFile& aof=AppendOnlyFile::getInstance();
+        if(aof.enabled() && !aof.rewrite())
+            std::cerr<<"Can't rewrite the AOF after the sync; it no longer matches the dataset\n";
+    }else if(line.rfind("+CONTINUE",0)==0){
+        std::cout<<"Successful partial resynchronization with MASTER\n";
+    }else{
+        std::cerr<<"Unexpected reply to PSYNC from MASTER: "<<line<<"\n";
+        return false;
+    }
+    syncing=false;
+    linkUp=true;
+
+    //the stream: apply every command and count its bytes into the offset
+    RedisCommandHandler handler(true);
+    //the master sends an EXEC's writes as MULTI ... EXEC, applied as one batch
+    MultiState multi;
+    uint64_t queuedBytes=0;
+    ReplyBuffer reply;
+    RespParser parser;
+    std::vector<std::string> argv;
+    AppendOnlyFile& aof=AppendOnlyFile::getInstance();
+    int64_t lastAck=0;
+    size_t start=conn.pos;     //where the command being parsed began
+    while(!stopLink){
+        int64_t now=RedisDatabase::nowMs();
+        if(now-lastAck>=REPL_ACK_PERIOD){
+            lastAck=now;
+            if(!sendAll(conn.fd,respCommand({"REPLCONF","ACK",std::to_string(replOffset)}),REPL_TIMEOUT))break;
+        }
+        if(now-lastIo>REPL_TIMEOUT){
+            std::cerr<<"MASTER timed out\n";
+            break;
+        }
+        bool applied=false;
+        while(true){
+            RespParser::Status st=parser.parse(conn.buf,conn.pos,argv);
+            if(st==RespParser::Status::Incomplete)break;
+            if(st==RespParser::Status::Error){
+                std::cerr<<"Protocol error from MASTER: "<<parser.error()<<"\n";
+                return true;
+            }
+            if(!argv.empty()){
+                handler.processCommand(argv,reply,nullptr,&multi);
+                reply.clear();
+                applied=true;
+            }
+            //a transaction counts once its EXEC is applied: a link lost in
+            //the middle resumes from its MULTI
+            queuedBytes+=conn.pos-start;
+            start=conn.pos;
+            if(!multi.active){
+                replOffset+=queuedBytes;
+                queuedBytes=0;
+            }
+        }
+        if(applied)aof.commit();
+        //keep the unfinished command; the parser resumes at pos
+        conn.buf.erase(0,start);
+        conn.pos-=start;
+        start=0;
+        if(!conn.fill())break;
+    }
+    return true;
+}
+
+Replication::Status Replication::status(){
+    Status s;
+    int64_t now=RedisDatabase::nowMs();
+    {
+        std::lock_guard<std::mutex> backlogLock(backlogMutex);
+        s.replid=replid;
+        s.offset=masterOffset;
+        s.backlogActive=backlogOn.load(std::memory_order_relaxed);
+        s.backlogSize=backlogSize;
+        s.backlogFirstByte=masterOffset-histlen+1;
+        s.backlogHistlen=histlen;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    s.replica=isReplica();
+    s.masterHost=masterHost;
+    s.masterPort=masterPort;
+    s.linkUp=linkUp;
+    s.syncInProgress=syncing;
+    s.lastIoSecondsAgo=(now-lastIo)/1000;
+    if(s.replica){
+        s.replid=masterReplid.empty()?s.replid:masterReplid;
+        s.offset=replOffset;
+    }
+    for(const auto& r:replicas)
+        s.replicas.push_back({r->ip,r->port,r->stateName(),r->ackOffset,(now-r->lastAck)/1000});
+    return s;
+}
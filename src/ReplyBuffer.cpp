@@ -0,0 +1,157 @@
+#include "../include/ReplyBuffer.h"
+#include <charconv>
+#include <cerrno>
+#include <sys/uio.h>       // for writev()
+
+//iovecs handed to a single writev call
+static const int MAX_IOV=64;
+//a drained inline chunk up to this size is kept for the next replies
+static const size_t CHUNK_KEEP=64*1024;
+
+std::string& ReplyBuffer::tail(){
+    if(!tailOpen){
+        chunks.emplace_back();
+        chunks.back().own.swap(spare);
+        chunks.back().own.clear();
+        tailOpen=true;
+    }
+    return chunks.back().own;
+}
+
+void ReplyBuffer::closeTail(){
+    if(!tailOpen)return;
+    closedBytes+=chunks.back().own.size();
+    tailOpen=false;
+}
+
+void ReplyBuffer::appendHeader(char type,long long v){
+    char buf[24];
+    buf[0]=type;
+    char* end=std::to_chars(buf+1,buf+sizeof(buf)-2,v).ptr;
+    *end++='\r';
+    *end++='\n';
+    tail().append(buf,end-buf);
+}
+
+void ReplyBuffer::addSimple(std::string_view s){
+    std::string& t=tail();
+    t.push_back('+');
+    t.append(s);
+    t.append("\r\n",2);
+}
+
+void ReplyBuffer::addError(std::string_view msg){
+    std::string& t=tail();
+    t.push_back('-');
+    t.append(msg);
+    t.append("\r\n",2);
+}
+
+void ReplyBuffer::addInteger(long long v){
+    appendHeader(':',v);
+}
+
+void ReplyBuffer::addBulk(std::string_view v){
+    appendHeader('$',static_cast<long long>(v.size()));
+    std::string& t=tail();
+    t.append(v);
+    t.append("\r\n",2);
+}
+
+void ReplyBuffer::addBulk(std::string&& v){
+    if(v.size()<LARGE_VALUE){
+        addBulk(std::string_view(v));
+        return;
+    }
+    appendHeader('$',static_cast<long long>(v.size()));
+    closeTail();
+    closedBytes+=v.size();
+    chunks.emplace_back();
+    chunks.back().own=std::move(v);
+    tail().append("\r\n",2);
+}
+
+void ReplyBuffer::addNull(){
+    tail().append("$-1\r\n",5);
+}
+
+void ReplyBuffer::addNullArray(){
+    tail().append("*-1\r\n",5);
+}
+
+void ReplyBuffer::addArrayHeader(size_t n){
+    appendHeader('*',static_cast<long long>(n));
+}
+
+void ReplyBuffer::addShared(std::shared_ptr<const std::string> msg){
+    closeTail();
+    closedBytes+=msg->size();
+    chunks.emplace_back();
+    chunks.back().shared=std::move(msg);
+}
+
+size_t ReplyBuffer::pending() const{
+    return closedBytes+(tailOpen?chunks.back().own.size():0)-sent;
+}
+
+void ReplyBuffer::clear(){
+    if(tailOpen && chunks.back().own.capacity()<=CHUNK_KEEP){
+        chunks.back().own.clear();
+        spare.swap(chunks.back().own);
+    }
+    chunks.clear();
+    sent=0;
+    closedBytes=0;
+    tailOpen=false;
+}
+
+ReplyBuffer::Mark ReplyBuffer::mark() const{
+    if(tailOpen)return {chunks.size()-1,chunks.back().own.size()};
+    return {chunks.size(),0};
+}
+
+std::string_view ReplyBuffer::peek(const Mark& m,size_t n) const{
+    if(m.chunk>=chunks.size())return {};
+    return chunks[m.chunk].view().substr(m.offset,n);
+}
+
+bool ReplyBuffer::writeTo(int fd){
+    while(!chunks.empty()){
+        iovec iov[MAX_IOV];
+        int cnt=0;
+        for(auto it=chunks.begin();it!=chunks.end() && cnt<MAX_IOV;++it,++cnt){
+            std::string_view v=it->view();
+            size_t off=cnt==0?sent:0;
+            iov[cnt].iov_base=const_cast<char*>(v.data())+off;
+            iov[cnt].iov_len=v.size()-off;
+        }
+        ssize_t n=writev(fd,iov,cnt);
+        if(n<0){
+            if(errno==EINTR)continue;
+            return errno==EAGAIN || errno==EWOULDBLOCK;    //wait for EPOLLOUT
+        }
+        //drop every chunk the kernel took whole, remember the cut in the next
+        size_t left=static_cast<size_t>(n);
+        while(left>0){
+            size_t size=chunks.front().view().size();
+            size_t rest=size-sent;
+            if(left<rest){
+                sent+=left;
+                break;
+            }
+            left-=rest;
+            sent=0;
+            if(chunks.size()==1 && tailOpen){
+                if(chunks.front().own.capacity()<=CHUNK_KEEP){
+                    chunks.front().own.clear();
+                    spare.swap(chunks.front().own);
+                }
+                tailOpen=false;
+            }else{
+                closedBytes-=size;
+            }
+            chunks.pop_front();
+        }
+    }
+    return true;
+}
@@ -0,0 +1,133 @@
+#include "../include/RespParser.h"
+#include <cstring>
+
+//protocol limits, same as the reference server
+static const long MAX_MULTIBULK_LEN=1024*1024;
+static const long MAX_BULK_LEN=512L*1024*1024;
+//a header or inline command without "\r\n" after this many bytes is garbage
+static const size_t MAX_INLINE_LEN=64*1024;
+
+//parse a decimal integer occupying exactly [p,p+len)
+static bool parseLong(const char* p,size_t len,long& out){
+    if(len==0 || len>19)return false;
+    bool neg=false;
+    size_t i=0;
+    if(p[0]=='-'){
+        neg=true;
+        i=1;
+        if(len==1)return false;
+    }
+    long v=0;
+    for(;i<len;i++){
+        if(p[i]<'0' || p[i]>'9')return false;
+        v=v*10+(p[i]-'0');
+    }
+    out=neg?-v:v;
+    return true;
+}
+
+void RespParser::reset(){
+    multibulkLen=0;
+    bulkLen=-1;
+    argc=0;
+}
+
+RespParser::Status RespParser::fail(const std::string& msg){
+    errorMsg=msg;
+    reset();
+    return Status::Error;
+}
+
+//reuse the strings already in argv so their capacity survives between commands
+void RespParser::storeArg(std::vector<std::string>& argv,const char* data,size_t len){
+    if(argc<argv.size())
+        argv[argc].assign(data,len);
+    else
+        argv.emplace_back(data,len);
+    argc++;
+}
+
+RespParser::Status RespParser::parseInline(const std::string& buf,size_t& pos,std::vector<std::string>& argv){
+    const char* start=buf.data()+pos;
+    const char* nl=static_cast<const char*>(std::memchr(start,'\n',buf.size()-pos));
+    if(!nl){
+        if(buf.size()-pos>MAX_INLINE_LEN)return fail("too big inline request");
+        return Status::Incomplete;
+    }
+    const char* end=nl;
+    if(end>start && end[-1]=='\r')end--;
+    argc=0;
+    const char* p=start;
+    while(p<end){
+        while(p<end && (*p==' ' || *p=='\t'))p++;
+        const char* tok=p;
+        while(p<end && *p!=' ' && *p!='\t')p++;
+        if(p>tok)storeArg(argv,tok,p-tok);
+    }
+    argv.resize(argc);
+    argc=0;
+    pos=(nl-buf.data())+1;
+    return Status::Complete;
+}
+
+RespParser::Status RespParser::parse(const std::string& buf,size_t& pos,std::vector<std::string>& argv){
+    if(multibulkLen==0){
+        if(pos>=buf.size())return Status::Incomplete;
+        if(buf[pos]!='*')return parseInline(buf,pos,argv);
+
+        //array header: *<count>\r\n
+        size_t cr=buf.find('\r',pos);
+        if(cr==std::string::npos){
+            if(buf.size()-pos>MAX_INLINE_LEN)return fail("too big mbulk count string");
+            return Status::Incomplete;
+        }
+        if(cr+1>=buf.size())return Status::Incomplete;
+        long n;
+        if(!parseLong(buf.data()+pos+1,cr-pos-1,n) || n>MAX_MULTIBULK_LEN)
+            return fail("invalid multibulk length");
+        pos=cr+2;
+        if(n<=0){
+            argv.clear();
+            return Status::Complete;
+        }
+        multibulkLen=n;
+        argc=0;
+    }
+    while(multibulkLen>0){
+        if(bulkLen==-1){
+            //bulk header: $<len>\r\n
+            if(pos>=buf.size())return Status::Incomplete;
+            if(buf[pos]!='$')
+                return fail(std::string("expected '$', got '")+buf[pos]+"'");
+            size_t cr=buf.find('\r',pos);
+            if(cr==std::string::npos){
+                if(buf.size()-pos>MAX_INLINE_LEN)return fail("too big bulk count string");
+                return Status::Incomplete;
+            }
+            if(cr+1>=buf.size())return Status::Incomplete;
+            long n;
+            if(!parseLong(buf.data()+pos+1,cr-pos-1,n) || n<0 || n>MAX_BULK_LEN)
+                return fail("invalid bulk length");
+            pos=cr+2;
+            bulkLen=n;
+        }
+        //payload plus its trailing \r\n
+        if(buf.size()-pos<static_cast<size_t>(bulkLen)+2)return Status::Incomplete;
+        storeArg(argv,buf.data()+pos,bulkLen);
+        pos+=bulkLen+2;
+        bulkLen=-1;
+        multibulkLen--;
+    }
+    argv.resize(argc);
+    argc=0;
+    return Status::Complete;
+}
+
+std::vector<std::string> ParseRespCommand(const std::string& input){
+    RespParser parser;
+    std::vector<std::string> tokens;
+    size_t pos=0;
+    if(parser.parse(input,pos,tokens)!=RespParser::Status::Complete)
+        tokens.clear();
+    return tokens;
+}
@@ -0,0 +1,88 @@
+#include "../include/ServerStats.h"
+#include <chrono>
+
+ThreadStats::~ThreadStats(){
+    for(auto& p:perCommand)delete p.load();
+}
+
+CommandMetrics& ThreadStats::command(size_t id){
+    CommandMetrics* m=perCommand[id].load(std::memory_order_relaxed);
+    if(!m){
+        m=new CommandMetrics();
+        perCommand[id].store(m,std::memory_order_release);
+    }
+    return *m;
+}
+
+ServerStats& ServerStats::getInstance(){
+    static ServerStats instance;
+    return instance;
+}
+
+ThreadStats& ServerStats::local(){
+    thread_local ThreadStats* mine=&getInstance().registerThread();
+    return *mine;
+}
+
+//blocks live as long as the process: a reader may still be adding up the
+//counters of a thread that has exited
+ThreadStats& ServerStats::registerThread(){
+    std::lock_guard<std::mutex> lock(registryMutex);
+    threads.emplace_back(new ThreadStats());
+    return *threads.back();
+}
+
+void ServerStats::setServerInfo(int port,int ioThreads,size_t maxClients){
+    tcpPort=port;
+    threadCount=ioThreads;
+    clientLimit=maxClients;
+    startMs=std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+ServerStats::Totals ServerStats::totals() const{
+    Totals t;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for(const auto& ts:threads){
+        t.commands+=ts->commands.load(std::memory_order_relaxed);
+        t.connections+=ts->connections.load(std::memory_order_relaxed);
+        t.disconnections+=ts->disconnections.load(std::memory_order_relaxed);
+        t.rejectedConnections+=ts->rejectedConnections.load(std::memory_order_relaxed);
+        t.netInput+=ts->netInput.load(std::memory_order_relaxed);
+        t.netOutput+=ts->netOutput.load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+ServerStats::CommandTotals ServerStats::command(size_t id,std::vector<uint64_t>* latency) const{
+    CommandTotals t;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for(const auto& ts:threads){
+        const CommandMetrics* m=ts->perCommand[id].load(std::memory_order_acquire);
+        if(!m)continue;
+        t.calls+=m->calls.load(std::memory_order_relaxed);
+        t.nsec+=m->nsec.load(std::memory_order_relaxed);
+        t.rejected+=m->rejected.load(std::memory_order_relaxed);
+        t.failed+=m->failed.load(std::memory_order_relaxed);
+        if(latency)m->latency.addTo(*latency);
+    }
+    return t;
+}
+
+void ServerStats::sample(int64_t nowMs){
+    uint64_t commands=totals().commands;
+    std::lock_guard<std::mutex> lock(sampleMutex);
+    if(lastSampleMs>0 && nowMs>lastSampleMs){
+        samples[sampleIdx]=(commands-lastSampleCommands)*1000.0/(nowMs-lastSampleMs);
+        sampleIdx=(sampleIdx+1)%SAMPLES;
+        double sum=0;
+        for(double s:samples)sum+=s;
+        instantaneousOps=sum/SAMPLES;
+    }
+    lastSampleMs=nowMs;
+    lastSampleCommands=commands;
+}
+
+double ServerStats::opsPerSec() const{
+    return instantaneousOps.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,148 @@
+#include "../include/SlabAllocator.h"
+#include "../include/HeapCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <pthread.h>
+
+struct SlabAllocator::Slab{
+    Slab* prev;
+    Slab* next;
+    void* freeList;         //chunks given back, linked through their first word
+    char* unused;           //chunks never handed out start here
+    uint32_t arena;
+    uint32_t cls;
+    uint32_t used;
+    uint32_t capacity;
+};
+//chunks start after the header, on a cache line
+static const size_t SLAB_HEADER=64;
+static_assert(sizeof(void*)*4+sizeof(uint32_t)*4<=SLAB_HEADER,"slab header outgrew its line");
+
+//never destroyed: keyspace entries are still freed by other singletons'
+//destructors at exit
+SlabAllocator& SlabAllocator::getInstance(){
+    static SlabAllocator* instance=new SlabAllocator();
+    return *instance;
+}
+
+SlabAllocator::SlabAllocator(){
+    pthread_atfork(lockAll,unlockAll,unlockAll);
+}
+
+void SlabAllocator::lockAll(){
+    for(auto& arena:getInstance().arenas)arena.mutex.lock();
+}
+void SlabAllocator::unlockAll(){
+    for(auto& arena:getInstance().arenas)arena.mutex.unlock();
+}
+
+//8 byte steps up to 128, then 16 byte steps up to MAX_SIZE
+size_t SlabAllocator::classIndex(size_t size){
+    if(size==0)size=1;
+    return size<=128?(size-1)/8:16+(size-129)/16;
+}
+size_t SlabAllocator::classSize(size_t index){
+    return index<16?(index+1)*8:128+(index-15)*16;
+}
+
+SlabAllocator::Arena& SlabAllocator::localArena(){
+    static std::atomic<size_t> next{0};
+    thread_local size_t arena=next.fetch_add(1,std::memory_order_relaxed)%ARENAS;
+    return arenas[arena];
+}
+
+void SlabAllocator::unlink(SizeClass& sc,Slab* slab){
+    if(slab->prev)slab->prev->next=slab->next;
+    else sc.partial=slab->next;
+    if(slab->next)slab->next->prev=slab->prev;
+    slab->prev=slab->next=nullptr;
+}
+void SlabAllocator::pushFront(SizeClass& sc,Slab* slab){
+    slab->prev=nullptr;
+    slab->next=sc.partial;
+    if(sc.partial)sc.partial->prev=slab;
+    sc.partial=slab;
+}
+
+SlabAllocator::Slab* SlabAllocator::newSlab(size_t arena,size_t cls){
+    void* mem=std::aligned_alloc(SLAB_SIZE,SLAB_SIZE);
+    if(!mem)throw std::bad_alloc();
+    Slab* slab=static_cast<Slab*>(mem);
+    slab->prev=slab->next=nullptr;
+    slab->freeList=nullptr;
+    slab->unused=static_cast<char*>(mem)+SLAB_HEADER;
+    slab->arena=static_cast<uint32_t>(arena);
+    slab->cls=static_cast<uint32_t>(cls);
+    slab->used=0;
+    slab->capacity=static_cast<uint32_t>((SLAB_SIZE-SLAB_HEADER)/classSize(cls));
+    return slab;
+}
+
+void* SlabAllocator::allocate(size_t size){
+    if(size>MAX_SIZE)return ::operator new(size);
+    size_t cls=classIndex(size);
+    Arena& arena=localArena();
+    std::lock_guard<std::mutex> lock(arena.mutex);
+    SizeClass& sc=arena.classes[cls];
+    Slab* slab=sc.partial;
+    if(!slab){
+        slab=newSlab(&arena-arenas,cls);
+        pushFront(sc,slab);
+        sc.slabs++;
+    }
+    void* p;
+    if(slab->freeList){
+        p=slab->freeList;
+        slab->freeList=*static_cast<void**>(p);
+    }else{
+        p=slab->unused;
+        slab->unused+=classSize(cls);
+    }
+    slab->used++;
+    sc.used++;
+    if(slab->used==slab->capacity)unlink(sc,slab);
+    heapAllocated(classSize(cls));
+    return p;
+}
+
+void SlabAllocator::deallocate(void* p,size_t size){
+    if(!p)return;
+    if(size>MAX_SIZE){
+        ::operator delete(p);
+        return;
+    }
+    Slab* slab=reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p)&~(uintptr_t)(SLAB_SIZE-1));
+    Arena& arena=arenas[slab->arena];
+    std::lock_guard<std::mutex> lock(arena.mutex);
+    SizeClass& sc=arena.classes[slab->cls];
+    bool wasFull=slab->used==slab->capacity;
+    *static_cast<void**>(p)=slab->freeList;
+    slab->freeList=p;
+    slab->used--;
+    sc.used--;
+    if(wasFull)pushFront(sc,slab);
+    heapFreed(classSize(slab->cls));
+    //keep one empty slab per class so a class hovering at a slab boundary
+    //does not map and unmap on every other call
+    if(slab->used==0 && (slab->prev || slab->next)){
+        unlink(sc,slab);
+        sc.slabs--;
+        std::free(slab);
+    }
+}
+
+SlabAllocator::Stats SlabAllocator::stats(){
+    Stats s;
+    for(auto& arena:arenas){
+        std::lock_guard<std::mutex> lock(arena.mutex);
+        for(size_t cls=0;cls<CLASSES;cls++){
+            const SizeClass& sc=arena.classes[cls];
+            s.slabs+=sc.slabs;
+            s.chunks+=sc.used;
+            s.usedBytes+=sc.used*classSize(cls);
+        }
+    }
+    s.activeBytes=s.slabs*SLAB_SIZE;
+    return s;
+}
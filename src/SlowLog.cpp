@@ -0,0 +1,53 @@
+#include "../include/SlowLog.h"
+#include <chrono>
+
+SlowLog& SlowLog::getInstance(){
+    static SlowLog instance;
+    return instance;
+}
+
+void SlowLog::setMaxLen(size_t n){
+    std::lock_guard<std::mutex> lock(mutex);
+    maxLen=n;
+    while(entries.size()>maxLen)entries.pop_back();
+}
+
+void SlowLog::record(const std::vector<std::string>& argv,int64_t durationUs){
+    Entry e;
+    e.time=std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    e.durationUs=durationUs;
+    //like redis, the last kept slot says how much was left out
+    size_t argc=argv.size()>MAX_ARGC?MAX_ARGC-1:argv.size();
+    e.argv.reserve(argc+1);
+    for(size_t i=0;i<argc;i++){
+        if(argv[i].size()>MAX_ARG_LEN){
+            e.argv.push_back(argv[i].substr(0,MAX_ARG_LEN)+"... ("+
+                std::to_string(argv[i].size()-MAX_ARG_LEN)+" more bytes)");
+        }else{
+            e.argv.push_back(argv[i]);
+        }
+    }
+    if(argc<argv.size())
+        e.argv.push_back("... ("+std::to_string(argv.size()-argc)+" more arguments)");
+    std::lock_guard<std::mutex> lock(mutex);
+    e.id=nextId++;
+    entries.push_front(std::move(e));
+    while(entries.size()>maxLen)entries.pop_back();
+}
+
+std::vector<SlowLog::Entry> SlowLog::get(size_t count){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(count>entries.size())count=entries.size();
+    return std::vector<Entry>(entries.begin(),entries.begin()+count);
+}
+
+size_t SlowLog::len(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+void SlowLog::reset(){
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
@@ -0,0 +1,198 @@
+#include "../include/SortedSet.h"
+#include "../include/SlabAllocator.h"
+#include <random>
+#include <new>
+
+//chance that a node also appears on the next level (ZSKIPLIST_P in redis)
+static const uint32_t LEVEL_P_PERCENT=25;
+
+//(score, member) order of the list
+static bool lessThan(double s1,std::string_view m1,double s2,std::string_view m2){
+    return s1<s2 || (s1==s2 && m1<m2);
+}
+
+SkipList::SkipList(){
+    header=newNode(MAX_LEVEL,0,std::string_view());
+    for(int i=0;i<MAX_LEVEL;i++){
+        header->level[i].forward=nullptr;
+        header->level[i].span=0;
+    }
+    header->backward=nullptr;
+    nodeBytes=0;
+}
+
+SkipList::~SkipList(){
+    Node* n=header->level[0].forward;
+    while(n){
+        Node* next=n->level[0].forward;
+        freeNode(n);
+        n=next;
+    }
+    freeNode(header);
+}
+
+SkipList::Node* SkipList::newNode(int height,double score,std::string_view member){
+    void* mem=SlabAllocator::getInstance().allocate(allocSize(height));
+    Node* n=static_cast<Node*>(mem);
+    new(&n->member) CompactString(member);
+    n->score=score;
+    n->backward=nullptr;
+    n->height=height;
+    return n;
+}
+
+void SkipList::freeNode(Node* n){
+    size_t size=allocSize(n->height);
+    if(n!=header)nodeBytes-=size;
+    n->member.~CompactString();
+    SlabAllocator::getInstance().deallocate(n,size);
+}
+
+int SkipList::randomLevel(){
+    static thread_local std::minstd_rand rng(std::random_device{}());
+    int level=1;
+    while(level<MAX_LEVEL && rng()%100<LEVEL_P_PERCENT)level++;
+    return level;
+}
+
+SkipList::Node* SkipList::insert(double score,std::string_view member){
+    Node* update[MAX_LEVEL];
+    size_t rank[MAX_LEVEL];
+    Node* x=header;
+    //on each level, the last node before the new one and its rank
+    for(int i=levels-1;i>=0;i--){
+        rank[i]=i==levels-1?0:rank[i+1];
+        while(x->level[i].forward && lessThan(x->level[i].forward->score,x->level[i].forward->member.view(),score,member)){
+            rank[i]+=x->level[i].span;
+            x=x->level[i].forward;
+        }
+        update[i]=x;
+    }
+    int height=randomLevel();
+    if(height>levels){
+        for(int i=levels;i<height;i++){
+            rank[i]=0;
+            update[i]=header;
+            update[i]->level[i].span=length;
+        }
+        levels=height;
+    }
+    x=newNode(height,score,member);
+    nodeBytes+=allocSize(height);
+    for(int i=0;i<height;i++){
+        x->level[i].forward=update[i]->level[i].forward;
+        update[i]->level[i].forward=x;
+        //the predecessor's span is split around the new node
+        x->level[i].span=update[i]->level[i].span-(rank[0]-rank[i]);
+        update[i]->level[i].span=(rank[0]-rank[i])+1;
+    }
+    //links above the new node now jump one more element
+    for(int i=height;i<levels;i++)update[i]->level[i].span++;
+    x->backward=update[0]==header?nullptr:update[0];
+    if(x->level[0].forward)x->level[0].forward->backward=x;
+    else tail=x;
+    length++;
+    return x;
+}
+
+void SkipList::unlink(Node* x,Node** update){
+    for(int i=0;i<levels;i++){
+        if(update[i]->level[i].forward==x){
+            update[i]->level[i].span+=x->level[i].span-1;
+            update[i]->level[i].forward=x->level[i].forward;
+        }else{
+            update[i]->level[i].span--;
+        }
+    }
+    if(x->level[0].forward)x->level[0].forward->backward=x->backward;
+    else tail=x->backward;
+    while(levels>1 && !header->level[levels-1].forward)levels--;
+    length--;
+}
+
+bool SkipList::erase(double score,std::string_view member){
+    Node* update[MAX_LEVEL];
+    Node* x=header;
+    for(int i=levels-1;i>=0;i--){
+        while(x->level[i].forward && lessThan(x->level[i].forward->score,x->level[i].forward->member.view(),score,member))
+            x=x->level[i].forward;
+        update[i]=x;
+    }
+    x=x->level[0].forward;
+    if(!x || x->score!=score || x->member.view()!=member)return false;
+    unlink(x,update);
+    freeNode(x);
+    return true;
+}
+
+SkipList::Node* SkipList::updateScore(double score,std::string_view member,double newScore){
+    Node* update[MAX_LEVEL];
+    Node* x=header;
+    for(int i=levels-1;i>=0;i--){
+        while(x->level[i].forward && lessThan(x->level[i].forward->score,x->level[i].forward->member.view(),score,member))
+            x=x->level[i].forward;
+        update[i]=x;
+    }
+    x=x->level[0].forward;
+    //still between its neighbours: the score changes in place
+    if((!x->backward || lessThan(x->backward->score,x->backward->member.view(),newScore,member)) &&
+       (!x->level[0].forward || lessThan(newScore,member,x->level[0].forward->score,x->level[0].forward->member.view()))){
+        x->score=newScore;
+        return x;
+    }
+    //otherwise take it out and insert it again; x stays allocated until
+    //then, so its member can be reused
+    unlink(x,update);
+    Node* moved=insert(newScore,x->member.view());
+    freeNode(x);
+    return moved;
+}
+
+size_t SkipList::rank(double score,std::string_view member) const{
+    size_t r=0;
+    Node* x=header;
+    for(int i=levels-1;i>=0;i--){
+        while(x->level[i].forward && !lessThan(score,member,x->level[i].forward->score,x->level[i].forward->member.view())){
+            r+=x->level[i].span;
+            x=x->level[i].forward;
+        }
+        if(x!=header && x->score==score && x->member.view()==member)return r;
+    }
+    return 0;
+}
+
+SkipList::Node* SkipList::byRank(size_t rank) const{
+    if(rank==0 || rank>length)return nullptr;
+    size_t traversed=0;
+    Node* x=header;
+    for(int i=levels-1;i>=0;i--){
+        while(x->level[i].forward && traversed+x->level[i].span<=rank){
+            traversed+=x->level[i].span;
+            x=x->level[i].forward;
+        }
+        if(traversed==rank)return x;
+    }
+    return nullptr;
+}
+
+SkipList::Node* SkipList::firstInRange(const ScoreRange& range) const{
+    if(range.empty() || !tail || !range.aboveMin(tail->score))return nullptr;
+    Node* x=header;
+    for(int i=levels-1;i>=0;i--){
+        while(x->level[i].forward && !range.aboveMin(x->level[i].forward->score))
+            x=x->level[i].forward;
+    }
+    x=x->level[0].forward;
+    return x && range.belowMax(x->score)?x:nullptr;
+}
+
+SkipList::Node* SkipList::lastInRange(const ScoreRange& range) const{
+    Node* head=first();
+    if(range.empty() || !head || !range.belowMax(head->score))return nullptr;
+    Node* x=header;
+    for(int i=levels-1;i>=0;i--){
+        while(x->level[i].forward && range.belowMax(x->level[i].forward->score))
+            x=x->level[i].forward;
+    }
+    return x!=header && range.aboveMin(x->score)?x:nullptr;
+}
@@ -0,0 +1,69 @@
+#include "../include/StringMatch.h"
+#include <utility>
+
+//match the single pattern element at pattern[p] (anything but *) against c
+//and move p past it
+static bool matchOne(std::string_view pattern,size_t& p,char c){
+    char pc=pattern[p];
+    if(pc=='?'){
+        p++;
+        return true;
+    }
+    if(pc=='\\' && p+1<pattern.size()){
+        p+=2;
+        return pattern[p-1]==c;
+    }
+    if(pc!='['){
+        p++;
+        return pc==c;
+    }
+    size_t i=p+1;
+    bool negate=i<pattern.size() && pattern[i]=='^';
+    if(negate)i++;
+    bool matched=false;
+    while(i<pattern.size() && pattern[i]!=']'){
+        if(pattern[i]=='\\' && i+1<pattern.size()){
+            if(pattern[i+1]==c)matched=true;
+            i+=2;
+        }else if(i+2<pattern.size() && pattern[i+1]=='-' && pattern[i+2]!=']'){
+            unsigned char lo=pattern[i],hi=pattern[i+2];
+            if(lo>hi)std::swap(lo,hi);
+            unsigned char uc=c;
+            if(uc>=lo && uc<=hi)matched=true;
+            i+=3;
+        }else{
+            if(pattern[i]==c)matched=true;
+            i++;
+        }
+    }
+    p=i<pattern.size()?i+1:i;
+    return matched!=negate;
+}
+
+//iterative with one backtrack point: on a mismatch the last * swallows one
+//more character and matching resumes after it. stars never nest, so this is
+//linear in the common cases and never exponential
+bool stringMatch(std::string_view pattern,std::string_view str){
+    size_t p=0,s=0;
+    size_t starP=std::string_view::npos,starS=0;
+    while(s<str.size()){
+        if(p<pattern.size() && pattern[p]=='*'){
+            while(p<pattern.size() && pattern[p]=='*')p++;
+            if(p==pattern.size())return true;
+            starP=p;
+            starS=s;
+            continue;
+        }
+        size_t next=p;
+        if(p<pattern.size() && matchOne(pattern,next,str[s])){
+            p=next;
+            s++;
+            continue;
+        }
+        if(starP==std::string_view::npos)return false;
+        p=starP;
+        s=++starS;
+    }
+    while(p<pattern.size() && pattern[p]=='*')p++;
+    return p==pattern.size();
+}
@@ -1,36 +1,225 @@
-
 #include "../include/RedisServer.h"
 #include "../include/RedisDatabase.h"
+#include "../include/RedisCommandHandler.h"
+#include "../include/AppendOnlyFile.h"
+#include "../include/SlowLog.h"
+#include "../include/HeapCounter.h"
+#include "../include/Replication.h"
 #include <iostream>
-#include <thread>
-#include  <chrono>
+#include <cstring>
+#include <sstream>
+#include <cctype>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+//a non-negative decimal taking up the whole argument. stoull alone would
+//read "10abc" as 10 and wrap "-1" around to the largest value
+static unsigned long long parseUnsigned(const std::string& arg,size_t& pos){
+    if(arg.empty() || !std::isdigit(static_cast<unsigned char>(arg[0])))
+        throw std::invalid_argument(arg);
+    return std::stoull(arg,&pos);
+}
+
+template<typename T>
+static T parseCount(const std::string& arg){
+    size_t pos=0;
+    unsigned long long n=parseUnsigned(arg,pos);
+    if(pos!=arg.size() || n>std::numeric_limits<T>::max())throw std::invalid_argument(arg);
+    return static_cast<T>(n);
+}
+
+//a signed decimal, all of the argument and within the range of T
+template<typename T>
+static T parseInt(const std::string& arg){
+    if(arg.empty() || !(std::isdigit(static_cast<unsigned char>(arg[0])) || arg[0]=='-'))
+        throw std::invalid_argument(arg);
+    size_t pos=0;
+    long long n=std::stoll(arg,&pos);
+    if(pos!=arg.size() || n<std::numeric_limits<T>::min() || n>std::numeric_limits<T>::max())
+        throw std::invalid_argument(arg);
+    return static_cast<T>(n);
+}
+
+//"100mb", "1gb", "4096": a byte count with an optional k/kb/m/mb/g/gb suffix
+//(1000 based without the b, 1024 based with it, as redis.conf reads them)
+static size_t parseMemory(const std::string& arg){
+    size_t pos=0;
+    unsigned long long n=parseUnsigned(arg,pos);
+    std::string unit=arg.substr(pos);
+    for(char& c:unit)c=static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    unsigned long long mul;
+    if(unit.empty() || unit=="b")mul=1;
+    else if(unit=="k")mul=1000;
+    else if(unit=="kb")mul=1024;
+    else if(unit=="m")mul=1000*1000;
+    else if(unit=="mb")mul=1024*1024;
+    else if(unit=="g")mul=1000*1000*1000;
+    else if(unit=="gb")mul=1024*1024*1024;
+    else throw std::invalid_argument("bad memory unit");
+    size_t bytes;
+    if(__builtin_mul_overflow(n,mul,&bytes))throw std::out_of_range(arg);
+    return bytes;
+}
+
+//a command line the server cannot make sense of: the message goes out with
+//the usage text and the server exits instead of starting half configured
+struct UsageError : std::runtime_error{
+    using std::runtime_error::runtime_error;
+};
+
+static const char* USAGE=
+    "usage: my_redis_server [port] [--backlog N] [--maxclients N] [--io-threads N]\n"
+    "                       [--save \"<seconds> <changes> ...\"]   (--save \"\" disables)\n"
+    "                       [--appendonly yes|no] [--appendfsync always|everysec|no]\n"
+    "                       [--hash-max-listpack-entries N] [--hash-max-listpack-value BYTES]\n"
+    "                       [--list-max-listpack-size BYTES]\n"
+    "                       [--zset-max-listpack-entries N] [--zset-max-listpack-value BYTES]\n"
+    "                       [--set-max-intset-entries N]\n"
+    "                       [--slowlog-log-slower-than USEC] [--slowlog-max-len N]\n"
+    "                       [--maxmemory BYTES] [--maxmemory-samples N]\n"
+    "                       [--maxmemory-policy noeviction|allkeys-lru|allkeys-lfu|volatile-ttl]\n"
+    "                       [--replicaof <host> <port>] [--repl-backlog-size BYTES]\n";
+
+//the port is the one bare argument, and only as a plain number
+static int parsePort(const char* arg){
+    size_t n=std::strlen(arg);
+    if(n==0 || n>5 || !std::all_of(arg,arg+n,[](char c){ return std::isdigit(static_cast<unsigned char>(c)); }))
+        throw UsageError(std::string("unknown option '")+arg+"'");
+    int port=std::stoi(arg);
+    if(port<1 || port>65535)throw UsageError(std::string("port out of range '")+arg+"'");
+    return port;
+}
+
+//yes|no options
+static bool parseYesNo(const char* name,const char* arg){
+    if(std::strcmp(arg,"yes")==0)return true;
+    if(std::strcmp(arg,"no")==0)return false;
+    throw UsageError(std::string("invalid value '")+arg+"' for '"+name+"', expected yes or no");
+}
+
+//"<seconds> <changes> ..." as whole pairs; an empty string is no save points
+static std::vector<SavePoint> parseSavePoints(const char* arg){
+    std::istringstream iss(arg);
+    std::vector<std::string> words;
+    std::string w;
+    while(iss>>w)words.push_back(w);
+    if(words.size()%2!=0)
+        throw UsageError(std::string("invalid value '")+arg+"' for '--save', expected <seconds> <changes> pairs");
+    std::vector<SavePoint> points;
+    for(size_t k=0;k<words.size();k+=2){
+        SavePoint sp;
+        try{
+            sp.seconds=parseCount<int64_t>(words[k]);
+            sp.changes=parseCount<uint64_t>(words[k+1]);
+        }catch(const std::exception&){
+            throw UsageError(std::string("invalid value '")+arg+"' for '--save', expected <seconds> <changes> pairs");
+        }
+        points.push_back(sp);
+    }
+    return points;
+}
 
 int main(int argc,char* argv[]){
     int port =6379;
-    if(argc >=2){
-        port=std::stoi(argv[1]);
+    int backlog=511;
+    size_t maxClients=10000;
+    int ioThreads=1;
+    std::vector<SavePoint> savePoints=RedisServer::defaultSavePoints();
+    bool appendOnly=false;
+    FsyncPolicy fsyncPolicy=FsyncPolicy::EverySec;
+    EncodingLimits limits;
+    MaxmemoryConfig maxmemory;
+    std::string masterHost;
+    int masterPort=0;
+    size_t replBacklogSize=0;
+    //true when argv[i] is the option name; it must be followed by its n values
+    int i=1;
+    auto option=[&](const char* name,int n=1){
+        if(std::strcmp(argv[i],name)!=0)return false;
+        if(i+n>=argc)throw UsageError(std::string("missing value for '")+name+"'");
+        return true;
+    };
+    try{
+        for(;i<argc;i++){
+            if(option("--backlog")){
+                backlog=parseInt<int>(argv[++i]);
+            }else if(option("--maxclients")){
+                maxClients=parseCount<size_t>(argv[++i]);
+            }else if(option("--io-threads")){
+                ioThreads=parseInt<int>(argv[++i]);
+            }else if(option("--save")){
+                savePoints=parseSavePoints(argv[++i]);
+            }else if(option("--appendonly")){
+                appendOnly=parseYesNo("--appendonly",argv[++i]);
+            }else if(option("--appendfsync")){
+                const char* p=argv[++i];
+                if(std::strcmp(p,"always")==0)fsyncPolicy=FsyncPolicy::Always;
+                else if(std::strcmp(p,"no")==0)fsyncPolicy=FsyncPolicy::No;
+                else if(std::strcmp(p,"everysec")==0)fsyncPolicy=FsyncPolicy::EverySec;
+                else throw UsageError(std::string("invalid value '")+p+"' for '--appendfsync', expected always, everysec or no");
+            }else if(option("--hash-max-listpack-entries")){
+                limits.hashMaxListpackEntries=parseCount<size_t>(argv[++i]);
+            }else if(option("--hash-max-listpack-value")){
+                limits.hashMaxListpackValue=parseCount<size_t>(argv[++i]);
+            }else if(option("--list-max-listpack-size")){
+                limits.listMaxListpackBytes=parseCount<size_t>(argv[++i]);
+            }else if(option("--zset-max-listpack-entries")){
+                limits.zsetMaxListpackEntries=parseCount<size_t>(argv[++i]);
+            }else if(option("--zset-max-listpack-value")){
+                limits.zsetMaxListpackValue=parseCount<size_t>(argv[++i]);
+            }else if(option("--set-max-intset-entries")){
+                limits.setMaxIntsetEntries=parseCount<size_t>(argv[++i]);
+            }else if(option("--slowlog-log-slower-than")){
+                SlowLog::getInstance().setThreshold(parseInt<int64_t>(argv[++i]));
+            }else if(option("--slowlog-max-len")){
+                SlowLog::getInstance().setMaxLen(parseCount<size_t>(argv[++i]));
+            }else if(option("--maxmemory")){
+                maxmemory.maxmemory=parseMemory(argv[++i]);
+            }else if(option("--maxmemory-policy")){
+                if(!parseEvictionPolicy(argv[++i],maxmemory.policy))
+                    throw UsageError(std::string("unknown maxmemory policy '")+argv[i]+"'");
+            }else if(option("--maxmemory-samples")){
+                maxmemory.samples=std::max<size_t>(1,parseCount<size_t>(argv[++i]));
+            }else if(option("--replicaof",2)){
+                masterHost=argv[++i];
+                masterPort=parseInt<int>(argv[++i]);
+            }else if(option("--repl-backlog-size")){
+                replBacklogSize=parseMemory(argv[++i]);
+            }else{
+                port=parsePort(argv[i]);
+            }
+        }
+    }catch(const UsageError& e){
+        std::cerr<<e.what()<<"\n"<<USAGE;
+        return 1;
+    }catch(const std::exception&){
+        //a value that is not a number, only partly one or out of range
+        std::cerr<<"invalid value '"<<argv[i]<<"'\n"<<USAGE;
+        return 1;
     }
-    RedisServer server(port);
-    
-    if (RedisDatabase::getInstance().load("dump.my_rdb"))
+    RedisServer server(port,backlog,maxClients,ioThreads,savePoints);
+    RedisDatabase::getInstance().setEncodingLimits(limits);
+    RedisDatabase::getInstance().setMaxmemory(maxmemory);
+    Replication::getInstance().configure(port,replBacklogSize);
+    markStartupMemory();
+
+    if (appendOnly) {
+        //with the aof on it is the source of truth, not the rdb dump
+        RedisCommandHandler loader;
+        if (!AppendOnlyFile::getInstance().open(fsyncPolicy, loader)) {
+            std::cerr << "Error loading the append only file\n";
+            return 1;
+        }
+    } else if (RedisDatabase::getInstance().load(DUMP_FILENAME))
         std::cout << "Database Loaded From dump.my_rdb\n";
-    else 
+    else
         std::cout << "No dump found or load failed; starting with an empty database.\n";
+    //a replica starts from its own data and asks the master to continue it
+    if (!masterHost.empty())
+        Replication::getInstance().replicaOf(masterHost, masterPort);
 
-    //Background persistance:dump the DB evry 300 secs
-    std::thread persistancethread([](){
-        while(true){
-            std::this_thread::sleep_for(std::chrono::seconds(300));
-            
-            if(!RedisDatabase::getInstance().dump("dump.my_rdb")){
-                std::cerr <<"Error Dumping Database\n";
-            }else{
-                std::cout <<"Database Dumped to dump.my_rdb\n";
-            }
-        }
-    });
-    persistancethread.detach();
     server.run();
 
     return 0;
-} 
\ No newline at end of file
+}
\ No newline at end of file